@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <ctype.h>
+#include <stdlib.h>
+
+#include <string>
+
+#ifdef __ANDROID__
+#include <sys/system_properties.h>
+#endif
+
+/**
+ * Runtime switches for the optional HelloVK modes.
+ *
+ * On device these are system properties, set with for example:
+ *   adb shell setprop debug.hellovk.capture png
+ * Elsewhere the property name is turned into an environment variable by
+ * upper casing it and replacing dots with underscores:
+ *   DEBUG_HELLOVK_CAPTURE=png
+ */
+
+namespace vkt {
+
+inline std::string getConfigString(const char *name,
+                                   const std::string &defaultValue = "") {
+#ifdef __ANDROID__
+  char value[PROP_VALUE_MAX] = {};
+  if (__system_property_get(name, value) > 0) {
+    return value;
+  }
+#else
+  std::string variable(name);
+  for (char &c : variable) {
+    c = c == '.' ? '_' : toupper(c);
+  }
+  if (const char *value = getenv(variable.c_str())) {
+    return value;
+  }
+#endif
+  return defaultValue;
+}
+
+inline long getConfigInt(const char *name, long defaultValue) {
+  std::string value = getConfigString(name);
+  if (value.empty()) {
+    return defaultValue;
+  }
+  return strtol(value.c_str(), nullptr, 0);
+}
+
+}  // namespace vkt
@@ -0,0 +1,69 @@
+#[[
+ Copyright (C) 2022 The Android Open Source Project
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+#]]
+
+# Turns a SPIR-V binary into a header holding it as a constexpr uint32_t
+# array, so the shader is linked into the library instead of loaded from the
+# APK at runtime. Run in script mode:
+#   cmake -DINPUT=shader.vert.spv -DOUTPUT=shader.vert.spv.h \
+#         -DVARIABLE=kShaderVertSpv -P embed_spirv.cmake
+
+file(READ "${INPUT}" hex HEX)
+string(LENGTH "${hex}" length)
+math(EXPR remainder "${length} % 8")
+if(length EQUAL 0 OR NOT remainder EQUAL 0)
+  message(FATAL_ERROR "${INPUT} is not a SPIR-V module")
+endif()
+
+# SPIR-V is a stream of little endian words: reorder each group of four
+# bytes into a 32-bit literal.
+string(REGEX MATCHALL "........" bytes "${hex}")
+set(words "")
+set(column 0)
+foreach(word ${bytes})
+  string(SUBSTRING "${word}" 0 2 b0)
+  string(SUBSTRING "${word}" 2 2 b1)
+  string(SUBSTRING "${word}" 4 2 b2)
+  string(SUBSTRING "${word}" 6 2 b3)
+  string(APPEND words "0x${b3}${b2}${b1}${b0},")
+  math(EXPR column "${column} + 1")
+  if(column EQUAL 6)
+    string(APPEND words "\n   ")
+    set(column 0)
+  else()
+    string(APPEND words " ")
+  endif()
+endforeach()
+string(STRIP "${words}" words)
+
+get_filename_component(name "${INPUT}" NAME)
+file(WRITE "${OUTPUT}.tmp"
+"// Generated from ${name} by embed_spirv.cmake, do not edit.
+#pragma once
+
+#include <stdint.h>
+
+namespace vkt {
+
+constexpr uint32_t ${VARIABLE}[] = {
+    ${words}
+};
+
+}  // namespace vkt
+")
+# Only touch the header when the contents changed, to avoid rebuilding.
+execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different
+                "${OUTPUT}.tmp" "${OUTPUT}")
+file(REMOVE "${OUTPUT}.tmp")
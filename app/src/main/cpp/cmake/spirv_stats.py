@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2022 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Size and instruction statistics for SPIR-V modules.
+
+Called by the build for every embedded shader with the module before and
+after spirv-opt:
+
+  spirv_stats.py --output report.txt [--baseline baseline.txt]
+                 [--max-growth 5] --shader NAME BEFORE.spv AFTER.spv ...
+
+The report has one line per shader and variant. When a baseline (a report
+checked in earlier) is given, every row that grew by more than --max-growth
+percent in bytes or instructions is listed and the script exits with status 1,
+so shader bloat shows up as a build failure. A baseline without rows fails as
+well, since nothing could be checked. Generate or refresh the baseline with
+the update_shader_baseline target.
+"""
+
+import argparse
+import struct
+import sys
+
+SPIRV_MAGIC = 0x07230203
+
+# Opcode ranges from the SPIR-V specification, grouped by the cost they model.
+CATEGORIES = [
+    # Arithmetic, relational, logical, bit and conversion instructions, plus
+    # OpExtInst (GLSL.std.450 functions) and derivatives.
+    ("alu", [(12, 12), (109, 124), (126, 152), (154, 205), (207, 215)]),
+    # Loads, stores, copies, access chains and atomics.
+    ("memory", [(60, 70), (227, 242)]),
+    ("image", [(86, 107)]),
+    ("control", [(57, 57), (245, 255)]),
+    # OpSource*, OpName, OpMemberName, OpString, OpLine, OpNoLine and
+    # OpModuleProcessed: removed by --strip-debug.
+    ("debug", [(2, 8), (317, 317), (330, 330)]),
+]
+COLUMNS = ["bytes", "instructions"] + [name for name, _ in CATEGORIES] + [
+    "other"]
+
+
+def categorize(opcode):
+    for name, ranges in CATEGORIES:
+        for low, high in ranges:
+            if low <= opcode <= high:
+                return name
+    return "other"
+
+
+def module_stats(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if len(data) < 20 or len(data) % 4 != 0:
+        raise ValueError("%s: not a SPIR-V module" % path)
+    endian = "<"
+    if struct.unpack("<I", data[:4])[0] != SPIRV_MAGIC:
+        endian = ">"
+        if struct.unpack(">I", data[:4])[0] != SPIRV_MAGIC:
+            raise ValueError("%s: bad SPIR-V magic" % path)
+    words = struct.unpack("%s%dI" % (endian, len(data) // 4), data)
+
+    stats = dict.fromkeys(COLUMNS, 0)
+    stats["bytes"] = len(data)
+    offset = 5  # Header: magic, version, generator, bound, schema.
+    while offset < len(words):
+        count = words[offset] >> 16
+        opcode = words[offset] & 0xFFFF
+        if count == 0:
+            raise ValueError("%s: bad instruction at word %d" % (path, offset))
+        stats["instructions"] += 1
+        stats[categorize(opcode)] += 1
+        offset += count
+    return stats
+
+
+def format_report(rows):
+    header = ["shader", "variant"] + COLUMNS
+    lines = [header] + [[name, variant] + [str(stats[c]) for c in COLUMNS]
+                        for name, variant, stats in rows]
+    widths = [max(len(line[i]) for line in lines) for i in range(len(header))]
+    out = []
+    for i, line in enumerate(lines):
+        text = "  ".join(cell.ljust(widths[j]) if j < 2 else
+                         cell.rjust(widths[j]) for j, cell in enumerate(line))
+        out.append(("# " if i == 0 else "  ") + text.rstrip())
+    return ("# Generated by spirv_stats.py, refresh with the "
+            "update_shader_baseline target.\n" + "\n".join(out) + "\n")
+
+
+def parse_report(path):
+    rows = {}
+    with open(path) as f:
+        for line in f:
+            fields = line.split()
+            if not fields or line.startswith("#"):
+                continue
+            if len(fields) != 2 + len(COLUMNS):
+                continue
+            rows[(fields[0], fields[1])] = dict(
+                zip(COLUMNS, (int(v) for v in fields[2:])))
+    return rows
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--output", required=True)
+    parser.add_argument("--baseline")
+    parser.add_argument("--max-growth", type=float, default=5.0,
+                        help="allowed growth over the baseline, in percent")
+    parser.add_argument("--shader", nargs=3, action="append", required=True,
+                        metavar=("NAME", "BEFORE", "AFTER"), dest="shaders")
+    args = parser.parse_args()
+
+    rows = []
+    for name, before, after in args.shaders:
+        rows.append((name, "unoptimized", module_stats(before)))
+        rows.append((name, "optimized", module_stats(after)))
+
+    report = format_report(rows)
+    with open(args.output, "w") as f:
+        f.write(report)
+    sys.stdout.write(report)
+
+    if not args.baseline:
+        return 0
+    try:
+        baseline = parse_report(args.baseline)
+    except OSError:
+        baseline = {}
+    if not baseline:
+        print("spirv_stats: no baseline rows in %s, run the "
+              "update_shader_baseline target and check the result in"
+              % args.baseline)
+        return 1
+
+    regressions = []
+    for name, variant, stats in rows:
+        old = baseline.get((name, variant))
+        if old is None:
+            print("spirv_stats: %s %s is not in the baseline" % (name, variant))
+            continue
+        for column in ("bytes", "instructions"):
+            limit = old[column] * (1 + args.max_growth / 100.0)
+            if stats[column] > limit:
+                regressions.append("%s %s: %s %d -> %d" % (
+                    name, variant, column, old[column], stats[column]))
+    for regression in regressions:
+        print("spirv_stats: regression: " + regression)
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
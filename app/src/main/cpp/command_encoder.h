@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+#include <array>
+
+/**
+ * A thin wrapper around a command buffer being recorded that drops state
+ * commands setting what is already set.
+ *
+ * Bound pipelines, descriptor sets, vertex buffers, viewport and scissor are
+ * command buffer state and survive render pass boundaries, so passes that
+ * each set up the same state only need it set once. The encoder starts from
+ * unknown state, as a command buffer does when recording begins; construct
+ * one per vkBeginCommandBuffer. Commands the encoder does not track go to
+ * commandBuffer() directly.
+ *
+ * All pipelines are built with dynamic viewport and scissor (see
+ * vkt::createGraphicsPipeline()), so binding one leaves them alone.
+ */
+
+namespace vkt {
+
+enum class StateCommand : uint32_t {
+  Viewport,
+  Scissor,
+  Pipeline,
+  DescriptorSets,
+  VertexBuffers,
+};
+constexpr size_t kStateCommandCount = 5;
+
+inline const char *stateCommandName(StateCommand command) {
+  switch (command) {
+    case StateCommand::Viewport:
+      return "viewport";
+    case StateCommand::Scissor:
+      return "scissor";
+    case StateCommand::Pipeline:
+      return "pipeline";
+    case StateCommand::DescriptorSets:
+      return "descriptor sets";
+    case StateCommand::VertexBuffers:
+      return "vertex buffers";
+  }
+  return "?";
+}
+
+struct CommandStats {
+  // State commands passed on to the command buffer.
+  std::array<uint64_t, kStateCommandCount> recorded{};
+  // State commands dropped as redundant.
+  std::array<uint64_t, kStateCommandCount> filtered{};
+  uint64_t draws = 0;
+
+  uint64_t totalRecorded() const { return sum(recorded); }
+  uint64_t totalFiltered() const { return sum(filtered); }
+  double filterRate() const {
+    uint64_t total = totalRecorded() + totalFiltered();
+    return total > 0 ? double(totalFiltered()) / total : 0.;
+  }
+  CommandStats &operator+=(const CommandStats &other) {
+    for (size_t i = 0; i < kStateCommandCount; i++) {
+      recorded[i] += other.recorded[i];
+      filtered[i] += other.filtered[i];
+    }
+    draws += other.draws;
+    return *this;
+  }
+
+ private:
+  static uint64_t sum(const std::array<uint64_t, kStateCommandCount> &a) {
+    uint64_t total = 0;
+    for (uint64_t n : a) {
+      total += n;
+    }
+    return total;
+  }
+};
+
+class CommandEncoder {
+ public:
+  // Tracked descriptor set slots and vertex buffer bindings; commands
+  // reaching beyond them are recorded and forget what they touch.
+  static constexpr uint32_t kMaxSets = 4;
+  static constexpr uint32_t kMaxVertexBuffers = 4;
+
+  explicit CommandEncoder(VkCommandBuffer commandBuffer)
+      : buffer(commandBuffer) {}
+
+  VkCommandBuffer commandBuffer() const { return buffer; }
+  const CommandStats &stats() const { return counts; }
+
+  void setViewport(const VkViewport &viewport) {
+    if (viewportKnown && sameViewport(boundViewport, viewport)) {
+      filter(StateCommand::Viewport);
+      return;
+    }
+    vkCmdSetViewport(buffer, 0, 1, &viewport);
+    record(StateCommand::Viewport);
+    boundViewport = viewport;
+    viewportKnown = true;
+  }
+
+  void setScissor(const VkRect2D &scissor) {
+    if (scissorKnown && sameRect(boundScissor, scissor)) {
+      filter(StateCommand::Scissor);
+      return;
+    }
+    vkCmdSetScissor(buffer, 0, 1, &scissor);
+    record(StateCommand::Scissor);
+    boundScissor = scissor;
+    scissorKnown = true;
+  }
+
+  void bindPipeline(VkPipeline pipeline) {
+    if (boundPipeline == pipeline) {
+      filter(StateCommand::Pipeline);
+      return;
+    }
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    record(StateCommand::Pipeline);
+    boundPipeline = pipeline;
+  }
+
+  /*
+   * Sets bound through a different layout may disturb the others, so a
+   * layout change forgets every tracked set. Dynamic offsets are not
+   * tracked; binding with them is always recorded.
+   */
+  void bindDescriptorSets(VkPipelineLayout layout, uint32_t firstSet,
+                          uint32_t setCount, const VkDescriptorSet *sets,
+                          uint32_t dynamicOffsetCount = 0,
+                          const uint32_t *dynamicOffsets = nullptr) {
+    bool redundant = layout == boundLayout && dynamicOffsetCount == 0 &&
+                     firstSet + setCount <= kMaxSets;
+    for (uint32_t i = 0; redundant && i < setCount; i++) {
+      redundant = boundSets[firstSet + i] == sets[i];
+    }
+    if (redundant) {
+      filter(StateCommand::DescriptorSets);
+      return;
+    }
+    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            layout, firstSet, setCount, sets,
+                            dynamicOffsetCount, dynamicOffsets);
+    record(StateCommand::DescriptorSets);
+    if (layout != boundLayout) {
+      boundSets.fill(VK_NULL_HANDLE);
+      boundLayout = layout;
+    }
+    for (uint32_t i = 0; i < setCount && firstSet + i < kMaxSets; i++) {
+      boundSets[firstSet + i] =
+          dynamicOffsetCount == 0 ? sets[i] : VK_NULL_HANDLE;
+    }
+  }
+
+  void bindVertexBuffers(uint32_t firstBinding, uint32_t bindingCount,
+                         const VkBuffer *buffers,
+                         const VkDeviceSize *offsets) {
+    bool redundant = firstBinding + bindingCount <= kMaxVertexBuffers;
+    for (uint32_t i = 0; redundant && i < bindingCount; i++) {
+      const VertexBinding &bound = boundVertexBuffers[firstBinding + i];
+      redundant = bound.buffer == buffers[i] && bound.offset == offsets[i];
+    }
+    if (redundant) {
+      filter(StateCommand::VertexBuffers);
+      return;
+    }
+    vkCmdBindVertexBuffers(buffer, firstBinding, bindingCount, buffers,
+                           offsets);
+    record(StateCommand::VertexBuffers);
+    for (uint32_t i = 0; i < bindingCount; i++) {
+      if (firstBinding + i < kMaxVertexBuffers) {
+        boundVertexBuffers[firstBinding + i] = {buffers[i], offsets[i]};
+      }
+    }
+  }
+
+  void draw(uint32_t vertexCount, uint32_t instanceCount,
+            uint32_t firstVertex, uint32_t firstInstance) {
+    assert(boundPipeline != VK_NULL_HANDLE);
+    vkCmdDraw(buffer, vertexCount, instanceCount, firstVertex, firstInstance);
+    counts.draws++;
+  }
+
+ private:
+  struct VertexBinding {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+  };
+
+  static bool sameViewport(const VkViewport &a, const VkViewport &b) {
+    return a.x == b.x && a.y == b.y && a.width == b.width &&
+           a.height == b.height && a.minDepth == b.minDepth &&
+           a.maxDepth == b.maxDepth;
+  }
+  static bool sameRect(const VkRect2D &a, const VkRect2D &b) {
+    return a.offset.x == b.offset.x && a.offset.y == b.offset.y &&
+           a.extent.width == b.extent.width &&
+           a.extent.height == b.extent.height;
+  }
+
+  void record(StateCommand command) {
+    counts.recorded[static_cast<size_t>(command)]++;
+  }
+  void filter(StateCommand command) {
+    counts.filtered[static_cast<size_t>(command)]++;
+  }
+
+  VkCommandBuffer buffer;
+  CommandStats counts;
+  bool viewportKnown = false;
+  VkViewport boundViewport{};
+  bool scissorKnown = false;
+  VkRect2D boundScissor{};
+  VkPipeline boundPipeline = VK_NULL_HANDLE;
+  VkPipelineLayout boundLayout = VK_NULL_HANDLE;
+  std::array<VkDescriptorSet, kMaxSets> boundSets{};
+  std::array<VertexBinding, kMaxVertexBuffers> boundVertexBuffers{};
+};
+
+}  // namespace vkt
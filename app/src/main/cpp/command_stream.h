@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <array>
+#include <string>
+#include <vector>
+
+/**
+ * Capture and replay of the high level per-frame command stream.
+ *
+ * A capture records what the renderer was asked to draw each frame - the final
+ * MVP, the clear colour and the draw list - rather than Vulkan calls, so a
+ * replay produces the exact same workload on any build or driver. Replaying
+ * headless at full speed then gives comparable numbers for A/B runs.
+ *
+ * File layout, native byte order:
+ *   StreamHeader
+ *   per frame: uint32_t flags, then only the fields present in flags:
+ *     kHasTransform   float mvp[16]
+ *     kHasClearColor  float rgba[4]
+ *     kHasDrawList    uint32_t count, DrawCommand[count]
+ * Fields missing from a frame repeat the previous frame's value, which keeps
+ * a static scene at four bytes per frame.
+ */
+
+namespace vkt {
+
+// Parameters of one vkCmdDraw, see HelloVK::setDrawList().
+struct DrawCommand {
+  uint32_t vertexCount;
+  uint32_t instanceCount;
+  uint32_t firstVertex;
+  uint32_t firstInstance;
+
+  bool operator==(const DrawCommand &other) const {
+    return vertexCount == other.vertexCount &&
+           instanceCount == other.instanceCount &&
+           firstVertex == other.firstVertex &&
+           firstInstance == other.firstInstance;
+  }
+};
+
+/*
+ * Limits for draw lists that come from outside the process (render server
+ * clients, captures). The scene's vertex shader indexes a fixed array of
+ * kSceneVertexCount positions, so a draw reaching past it reads out of
+ * bounds, and unbounded instance or command counts let a client keep the GPU
+ * busy for as long as it likes.
+ */
+constexpr uint32_t kSceneVertexCount = 3;
+constexpr uint32_t kMaxDrawInstances = 1024;
+constexpr uint32_t kMaxDrawCommands = 4096;
+
+inline bool isValidDraw(const DrawCommand &draw) {
+  return draw.firstVertex <= kSceneVertexCount &&
+         draw.vertexCount <= kSceneVertexCount - draw.firstVertex &&
+         draw.instanceCount <= kMaxDrawInstances;
+}
+
+inline bool isValidDrawList(const std::vector<DrawCommand> &draws) {
+  return draws.size() <= kMaxDrawCommands &&
+         std::all_of(draws.begin(), draws.end(), isValidDraw);
+}
+
+struct FrameCommands {
+  std::array<float, 16> mvp = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+  std::array<float, 4> clearColor = {0, 0, 0, 1};
+  std::vector<DrawCommand> draws;
+};
+
+struct CommandStream {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::vector<FrameCommands> frames;
+};
+
+constexpr uint32_t kCommandStreamMagic = 0x534b5648;  // "HVKS"
+constexpr uint32_t kCommandStreamVersion = 1;
+// Captures wider or taller than this are refused on load. It is the smallest
+// maxImageDimension2D Vulkan allows, so any device can replay what loads.
+constexpr uint32_t kMaxStreamExtent = 4096;
+
+struct StreamHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t width;
+  uint32_t height;
+  // Written when the capture is closed, 0 for a capture that was cut short.
+  uint32_t frameCount;
+  uint32_t reserved;
+};
+
+enum StreamFrameFlags : uint32_t {
+  kHasTransform = 1 << 0,
+  kHasClearColor = 1 << 1,
+  kHasDrawList = 1 << 2,
+};
+
+class CommandStreamWriter {
+ public:
+  ~CommandStreamWriter() { close(); }
+
+  bool open(const std::string &path, uint32_t width, uint32_t height) {
+    file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+      return false;
+    }
+    StreamHeader header{kCommandStreamMagic, kCommandStreamVersion, width,
+                        height, 0, 0};
+    ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    return ok;
+  }
+
+  // Returns false once a write failed; the capture is unusable from then on.
+  bool writeFrame(const FrameCommands &frame) {
+    if (file == nullptr || !ok) {
+      return false;
+    }
+    uint32_t flags = 0;
+    if (frameCount == 0 || frame.mvp != previous.mvp) {
+      flags |= kHasTransform;
+    }
+    if (frameCount == 0 || frame.clearColor != previous.clearColor) {
+      flags |= kHasClearColor;
+    }
+    if (frameCount == 0 || frame.draws != previous.draws) {
+      flags |= kHasDrawList;
+    }
+
+    ok &= fwrite(&flags, sizeof(flags), 1, file) == 1;
+    if (flags & kHasTransform) {
+      ok &= fwrite(frame.mvp.data(), sizeof(frame.mvp), 1, file) == 1;
+    }
+    if (flags & kHasClearColor) {
+      ok &= fwrite(frame.clearColor.data(), sizeof(frame.clearColor), 1,
+                   file) == 1;
+    }
+    if (flags & kHasDrawList) {
+      uint32_t count = frame.draws.size();
+      ok &= fwrite(&count, sizeof(count), 1, file) == 1;
+      ok &= fwrite(frame.draws.data(), sizeof(DrawCommand), count, file) ==
+            count;
+    }
+    previous.mvp = frame.mvp;
+    previous.clearColor = frame.clearColor;
+    if (flags & kHasDrawList) {
+      previous.draws = frame.draws;
+    }
+    frameCount++;
+    return ok;
+  }
+
+  // Patches the frame count into the header. Returns false if any write
+  // failed.
+  bool close() {
+    if (file == nullptr) {
+      return ok;
+    }
+    if (ok && fseek(file, offsetof(StreamHeader, frameCount), SEEK_SET) == 0) {
+      ok = fwrite(&frameCount, sizeof(frameCount), 1, file) == 1;
+    }
+    ok &= fclose(file) == 0;
+    file = nullptr;
+    return ok;
+  }
+
+  uint32_t frames() const { return frameCount; }
+
+ private:
+  FILE *file = nullptr;
+  bool ok = false;
+  uint32_t frameCount = 0;
+  FrameCommands previous;
+};
+
+/*
+ * Loads a whole capture into memory so a replay does no file I/O. A capture
+ * that was cut short (no frame count in the header) is read up to the last
+ * complete frame. Captures with an empty or oversized extent are refused, and
+ * so are frames whose draw list fails isValidDrawList(), like those from a
+ * render server client.
+ */
+inline bool loadCommandStream(const std::string &path, CommandStream &stream) {
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  StreamHeader header;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      header.magic != kCommandStreamMagic ||
+      header.version != kCommandStreamVersion || header.width == 0 ||
+      header.height == 0 || header.width > kMaxStreamExtent ||
+      header.height > kMaxStreamExtent) {
+    fclose(file);
+    return false;
+  }
+  stream.width = header.width;
+  stream.height = header.height;
+  stream.frames.clear();
+  // frameCount is only a claim until the frames were read; past the cap the
+  // vector grows as they arrive.
+  constexpr uint32_t kMaxReservedFrames = 1u << 16;
+  stream.frames.reserve(std::min(header.frameCount, kMaxReservedFrames));
+
+  FrameCommands frame;
+  uint32_t flags;
+  while (header.frameCount == 0 ||
+         stream.frames.size() < header.frameCount) {
+    if (fread(&flags, sizeof(flags), 1, file) != 1) {
+      break;
+    }
+    bool complete = true;
+    if (flags & kHasTransform) {
+      complete &= fread(frame.mvp.data(), sizeof(frame.mvp), 1, file) == 1;
+    }
+    if (flags & kHasClearColor) {
+      complete &= fread(frame.clearColor.data(), sizeof(frame.clearColor), 1,
+                        file) == 1;
+    }
+    if (flags & kHasDrawList) {
+      uint32_t count = 0;
+      complete &= fread(&count, sizeof(count), 1, file) == 1;
+      // A corrupt count must not turn into a huge allocation.
+      complete &= count <= kMaxDrawCommands;
+      if (complete) {
+        frame.draws.resize(count);
+        complete &= fread(frame.draws.data(), sizeof(DrawCommand), count,
+                          file) == count;
+      }
+      if (complete && !isValidDrawList(frame.draws)) {
+        fclose(file);
+        return false;
+      }
+    }
+    if (!complete) {
+      break;
+    }
+    stream.frames.push_back(frame);
+  }
+  fclose(file);
+  return header.frameCount == 0 || stream.frames.size() == header.frameCount;
+}
+
+}  // namespace vkt
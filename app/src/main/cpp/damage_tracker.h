@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <vector>
+
+/**
+ * Dirty rectangle tracking for swapchains whose images keep their contents
+ * between presents, see HelloVK::setDirtyRegions().
+ *
+ * Each swapchain image was last rendered some frames ago, so bringing it up
+ * to date means redrawing everything damaged since then, not only this
+ * frame's damage. The tracker keeps that area per image as one bounding
+ * rectangle. This frame's own rectangles are kept separately; relative to
+ * the previously presented image only they changed, which is what the
+ * presentation engine is told.
+ *
+ * Rectangles are in swapchain image pixels, as rendered: with pre-rotation
+ * that is the display's native orientation, not the app's. Present regions
+ * are given before the swapchain's preTransform is applied, so they are
+ * rotated back on the way out.
+ */
+
+namespace vkt {
+
+inline bool isEmpty(const VkRect2D &rect) {
+  return rect.extent.width == 0 || rect.extent.height == 0;
+}
+
+// Bounding rectangle of both; an empty rectangle adds nothing.
+inline VkRect2D unite(const VkRect2D &a, const VkRect2D &b) {
+  if (isEmpty(a)) {
+    return b;
+  }
+  if (isEmpty(b)) {
+    return a;
+  }
+  int32_t x0 = std::min(a.offset.x, b.offset.x);
+  int32_t y0 = std::min(a.offset.y, b.offset.y);
+  int64_t x1 = std::max(int64_t(a.offset.x) + a.extent.width,
+                        int64_t(b.offset.x) + b.extent.width);
+  int64_t y1 = std::max(int64_t(a.offset.y) + a.extent.height,
+                        int64_t(b.offset.y) + b.extent.height);
+  return {{x0, y0}, {uint32_t(x1 - x0), uint32_t(y1 - y0)}};
+}
+
+inline VkRect2D clip(const VkRect2D &rect, VkExtent2D extent) {
+  int64_t x0 = std::max<int64_t>(rect.offset.x, 0);
+  int64_t y0 = std::max<int64_t>(rect.offset.y, 0);
+  int64_t x1 = std::min<int64_t>(int64_t(rect.offset.x) + rect.extent.width,
+                                 extent.width);
+  int64_t y1 = std::min<int64_t>(int64_t(rect.offset.y) + rect.extent.height,
+                                 extent.height);
+  if (x1 <= x0 || y1 <= y0) {
+    return {};
+  }
+  return {{int32_t(x0), int32_t(y0)}, {uint32_t(x1 - x0), uint32_t(y1 - y0)}};
+}
+
+// rect grown outwards to multiples of granularity, within extent.
+inline VkRect2D alignTo(const VkRect2D &rect, VkExtent2D granularity,
+                        VkExtent2D extent) {
+  if (isEmpty(rect) || granularity.width == 0 || granularity.height == 0) {
+    return rect;
+  }
+  int64_t x0 = rect.offset.x - rect.offset.x % granularity.width;
+  int64_t y0 = rect.offset.y - rect.offset.y % granularity.height;
+  int64_t x1 = int64_t(rect.offset.x) + rect.extent.width;
+  int64_t y1 = int64_t(rect.offset.y) + rect.extent.height;
+  x1 += (granularity.width - x1 % granularity.width) % granularity.width;
+  y1 += (granularity.height - y1 % granularity.height) % granularity.height;
+  return clip({{int32_t(x0), int32_t(y0)},
+               {uint32_t(x1 - x0), uint32_t(y1 - y0)}},
+              extent);
+}
+
+/*
+ * rect, in the pixels of an image of size extent that was rendered
+ * pre-rotated by transform, in the space before the rotation, as
+ * VkRectLayerKHR wants it (VUID-VkRectLayerKHR-offset-04864). ROTATE_90
+ * turns the content clockwise. Mirroring transforms are not used here and
+ * pass rect through.
+ */
+inline VkRectLayerKHR toPresentRect(const VkRect2D &rect, VkExtent2D extent,
+                                    VkSurfaceTransformFlagBitsKHR transform) {
+  int32_t x0 = rect.offset.x;
+  int32_t y0 = rect.offset.y;
+  int32_t x1 = x0 + int32_t(rect.extent.width);
+  int32_t y1 = y0 + int32_t(rect.extent.height);
+  int32_t width = int32_t(extent.width);
+  int32_t height = int32_t(extent.height);
+  switch (transform) {
+    case VK_SURFACE_TRANSFORM_ROTATE_90_BIT_KHR:
+      return {{y0, width - x1}, {rect.extent.height, rect.extent.width}, 0};
+    case VK_SURFACE_TRANSFORM_ROTATE_180_BIT_KHR:
+      return {{width - x1, height - y1}, rect.extent, 0};
+    case VK_SURFACE_TRANSFORM_ROTATE_270_BIT_KHR:
+      return {{height - y1, x0}, {rect.extent.height, rect.extent.width}, 0};
+    default:
+      return {rect.offset, rect.extent, 0};
+  }
+}
+
+class DamageTracker {
+ public:
+  // More rectangles than this in one frame are merged into their bounds.
+  static constexpr size_t kMaxFrameRects = 8;
+
+  // After a swapchain was (re)created: no image holds anything yet.
+  void reset(uint32_t imageCount, VkExtent2D newExtent,
+             VkSurfaceTransformFlagBitsKHR newTransform =
+                 VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR) {
+    extent = newExtent;
+    transform = newTransform;
+    stale.assign(imageCount, full());
+    frameRects.clear();
+    frameFull = true;
+  }
+
+  void add(const VkRect2D &rect) {
+    VkRect2D clipped = clip(rect, extent);
+    if (isEmpty(clipped) || frameFull) {
+      return;
+    }
+    if (frameRects.size() == kMaxFrameRects) {
+      VkRect2D bounds = {};
+      for (const VkRect2D &r : frameRects) {
+        bounds = unite(bounds, r);
+      }
+      frameRects.assign(1, bounds);
+    }
+    frameRects.push_back(clipped);
+  }
+  void addFull() {
+    frameRects.clear();
+    frameFull = true;
+  }
+  bool hasDamage() const { return frameFull || !frameRects.empty(); }
+
+  /*
+   * The area of imageIndex to redraw this frame: this frame's damage and
+   * whatever changed since the image was last rendered. The other images
+   * pick up this frame's damage, and the frame's damage is moved into
+   * presentRects.
+   */
+  VkRect2D beginFrame(uint32_t imageIndex) {
+    VkRect2D damage = frameFull ? full() : VkRect2D{};
+    for (const VkRect2D &r : frameRects) {
+      damage = unite(damage, r);
+    }
+    VkRect2D area = unite(stale[imageIndex], damage);
+    for (VkRect2D &other : stale) {
+      other = unite(other, damage);
+    }
+    stale[imageIndex] = {};
+
+    presentRects.clear();
+    if (!frameFull) {
+      for (const VkRect2D &r : frameRects) {
+        presentRects.push_back(toPresentRect(r, extent, transform));
+      }
+    }
+    frameRects.clear();
+    frameFull = false;
+    return area;
+  }
+  // This frame's damage for VkPresentRegionKHR; empty when it is the whole
+  // image, which is what a rectangle count of 0 means there.
+  const std::vector<VkRectLayerKHR> &changedRects() const {
+    return presentRects;
+  }
+  bool isFull(const VkRect2D &area) const {
+    return area.offset.x == 0 && area.offset.y == 0 &&
+           area.extent.width == extent.width &&
+           area.extent.height == extent.height;
+  }
+
+ private:
+  VkRect2D full() const { return {{0, 0}, extent}; }
+
+  VkExtent2D extent{};
+  VkSurfaceTransformFlagBitsKHR transform =
+      VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+  // Per swapchain image, everything damaged since it was last rendered.
+  std::vector<VkRect2D> stale;
+  std::vector<VkRect2D> frameRects;
+  bool frameFull = true;
+  std::vector<VkRectLayerKHR> presentRects;
+};
+
+}  // namespace vkt
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Iteration throughput of the renderable store at 10k, 100k and 1M entities:
+ * a plain stream over one component, frustum culling on the calling thread
+ * and on a pool of -t threads, and building the sorted draw list. About a fifth
+ * of the objects are in view; 10% of the entities are destroyed and
+ * recreated before timing so the table has seen swap-removal.
+ *
+ *   adb shell /data/local/tmp/hellovk_entity_bench -i 20 -t 4
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "renderables.h"
+
+using namespace vkt;
+
+// Keeps the compiler from dropping loops whose result is otherwise unused.
+static volatile float gSink;
+
+static double bestMs(long iterations, const std::function<void()> &body) {
+  double best = 1e30;
+  for (long i = 0; i < iterations; i++) {
+    auto start = std::chrono::steady_clock::now();
+    body();
+    best = std::min(best, std::chrono::duration<double, std::milli>(
+                              std::chrono::steady_clock::now() - start)
+                              .count());
+  }
+  return best;
+}
+
+static void print(const char *name, size_t count, double ms) {
+  printf("  %-22s %9.3f ms  %8.1f M entities/s\n", name, ms,
+         count / ms / 1e3);
+}
+
+static void bench(size_t count, long iterations, WorkerPool &pool) {
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> position(-100.f, 100.f);
+  auto makeRenderable = [&](RenderableTable &table, Entity entity) {
+    uint32_t mesh = random() % 32;
+    table.insert(entity,
+                 {mat4::compose({position(random), position(random),
+                                 position(random)},
+                                quat::fromAxisAngle({0.f, 1.f, 0.f},
+                                                    position(random)),
+                                {1.f, 1.f, 1.f})},
+                 {mesh * 36, 36}, {uint32_t(random() % 8)},
+                 {{0.f, 0.f, 0.f}, 1.f}, {});
+  };
+
+  EntityAllocator allocator;
+  RenderableTable table;
+  table.reserve(count);
+  std::vector<Entity> entities;
+  for (size_t i = 0; i < count; i++) {
+    entities.push_back(allocator.create());
+    makeRenderable(table, entities.back());
+  }
+  for (size_t i = 0; i < count / 10; i++) {
+    Entity &entity = entities[random() % count];
+    table.erase(entity);
+    allocator.destroy(entity);
+    entity = allocator.create();
+    makeRenderable(table, entity);
+  }
+
+  // Camera in the middle of the cube looking down -Z with a ~90 degree
+  // frustum: roughly a fifth of the objects are inside.
+  mat4 viewProjection =
+      mat4::perspective(1.6f, 1.f, 0.1f, 200.f) *
+      mat4::lookAt({0.f, 0.f, 0.f}, {0.f, 0.f, -1.f}, {0.f, 1.f, 0.f});
+
+  printf("%zu entities\n", count);
+  print("stream bounds", count, bestMs(iterations, [&] {
+          const Bounds *bounds = table.column<Bounds>();
+          float sum = 0.f;
+          for (size_t i = 0; i < table.size(); i++) {
+            sum += bounds[i].radius;
+          }
+          gSink = sum;
+        }));
+  size_t visible = 0;
+  print("cull, 1 thread", count, bestMs(iterations, [&] {
+          visible = cullRenderables(table, viewProjection, 1);
+        }));
+  char name[32];
+  snprintf(name, sizeof(name), "cull, %u threads", pool.concurrency());
+  print(name, count, bestMs(iterations, [&] {
+          visible = cullRenderables(table, viewProjection, 1, &pool);
+        }));
+  std::vector<DrawCommand> draws;
+  std::vector<uint32_t> rows;
+  print("build draw list", count,
+        bestMs(iterations, [&] { buildDrawList(table, draws, rows); }));
+  printf("  %zu visible, %zu draws\n", visible, draws.size());
+}
+
+int main(int argc, char **argv) {
+  long iterations = 10;
+  unsigned threads = 4;
+  std::vector<size_t> counts = {10000, 100000, 1000000};
+  int option;
+  while ((option = getopt(argc, argv, "i:t:n:h")) != -1) {
+    switch (option) {
+      case 'i':
+        iterations = strtol(optarg, nullptr, 0);
+        break;
+      case 't':
+        threads = strtoul(optarg, nullptr, 0);
+        break;
+      case 'n':
+        counts = {strtoul(optarg, nullptr, 0)};
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-i iterations] [-t threads] [-n count]\n",
+                argv[0]);
+        return 2;
+    }
+  }
+  if (iterations < 1 || threads < 1 || counts[0] == 0) {
+    fprintf(stderr, "usage: %s [-i iterations] [-t threads] [-n count]\n",
+            argv[0]);
+    return 2;
+  }
+
+  WorkerPool pool(threads - 1);
+  for (size_t count : counts) {
+    bench(count, iterations, pool);
+  }
+  return 0;
+}
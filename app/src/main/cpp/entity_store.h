@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "worker_pool.h"
+
+/**
+ * Entities and dense component storage.
+ *
+ * An Entity is a 24 bit index plus an 8 bit generation, so a handle to a
+ * destroyed entity is detected once the index is reused. Components live in
+ * ComponentTables: one table per combination of components (an archetype),
+ * one contiguous array per component type, all arrays in the same row order.
+ * A sparse array maps entity indices to rows. Removing an entity moves the
+ * last row into its place, so the arrays never have holes and every pass
+ * streams over exactly size() elements.
+ */
+
+namespace vkt {
+
+struct Entity {
+  static constexpr uint32_t kIndexBits = 24;
+  static constexpr uint32_t kIndexMask = (1u << kIndexBits) - 1;
+
+  uint32_t id = UINT32_MAX;
+
+  uint32_t index() const { return id & kIndexMask; }
+  uint32_t generation() const { return id >> kIndexBits; }
+  bool operator==(const Entity &other) const { return id == other.id; }
+  bool operator!=(const Entity &other) const { return id != other.id; }
+};
+
+class EntityAllocator {
+ public:
+  Entity create() {
+    uint32_t index;
+    if (!freeIndices.empty()) {
+      index = freeIndices.back();
+      freeIndices.pop_back();
+    } else {
+      index = generations.size();
+      assert(index <= Entity::kIndexMask);
+      generations.push_back(0);
+    }
+    return {index | uint32_t(generations[index]) << Entity::kIndexBits};
+  }
+
+  void destroy(Entity entity) {
+    assert(alive(entity));
+    generations[entity.index()]++;
+    freeIndices.push_back(entity.index());
+  }
+
+  bool alive(Entity entity) const {
+    return entity.index() < generations.size() &&
+           generations[entity.index()] == entity.generation();
+  }
+
+  size_t count() const { return generations.size() - freeIndices.size(); }
+
+ private:
+  std::vector<uint8_t> generations;
+  std::vector<uint32_t> freeIndices;
+};
+
+template <typename... Components>
+class ComponentTable {
+ public:
+  static constexpr uint32_t kNoRow = UINT32_MAX;
+
+  size_t size() const { return entities.size(); }
+
+  void reserve(size_t count) {
+    entities.reserve(count);
+    std::apply([count](auto &...column) { (column.reserve(count), ...); },
+               columns);
+  }
+
+  bool contains(Entity entity) const {
+    return row(entity) != kNoRow;
+  }
+
+  uint32_t row(Entity entity) const {
+    uint32_t index = entity.index();
+    if (index >= sparse.size() || sparse[index] == kNoRow ||
+        entities[sparse[index]] != entity) {
+      return kNoRow;
+    }
+    return sparse[index];
+  }
+
+  // Returns the row of the new entity.
+  uint32_t insert(Entity entity, Components... values) {
+    assert(!contains(entity));
+    uint32_t index = entity.index();
+    if (index >= sparse.size()) {
+      sparse.resize(index + 1, kNoRow);
+    }
+    uint32_t newRow = entities.size();
+    sparse[index] = newRow;
+    entities.push_back(entity);
+    insertValues(std::index_sequence_for<Components...>(),
+                 std::move(values)...);
+    return newRow;
+  }
+
+  // Moves the last row into the erased one.
+  void erase(Entity entity) {
+    uint32_t erased = row(entity);
+    assert(erased != kNoRow);
+    uint32_t last = entities.size() - 1;
+    if (erased != last) {
+      entities[erased] = entities[last];
+      sparse[entities[erased].index()] = erased;
+      std::apply(
+          [erased, last](auto &...column) {
+            ((column[erased] = std::move(column[last])), ...);
+          },
+          columns);
+    }
+    entities.pop_back();
+    std::apply([](auto &...column) { (column.pop_back(), ...); }, columns);
+    sparse[entity.index()] = kNoRow;
+  }
+
+  // Contiguous array of one component, size() elements in row order.
+  template <typename Component>
+  Component *column() {
+    return std::get<std::vector<Component>>(columns).data();
+  }
+  template <typename Component>
+  const Component *column() const {
+    return std::get<std::vector<Component>>(columns).data();
+  }
+  const Entity *entityColumn() const { return entities.data(); }
+
+  template <typename Component>
+  Component &get(Entity entity) {
+    uint32_t r = row(entity);
+    assert(r != kNoRow);
+    return column<Component>()[r];
+  }
+
+  /*
+   * Calls body(begin, end) over row ranges, on pool when one is given. The
+   * body may write components of its own rows but must not insert or erase.
+   */
+  void forEachRange(WorkerPool *pool, size_t grain,
+                    const std::function<void(size_t, size_t)> &body) const {
+    if (pool != nullptr) {
+      pool->parallelFor(size(), grain, body);
+    } else if (size() > 0) {
+      body(0, size());
+    }
+  }
+
+  /*
+   * Rearranges rows so that new row i holds old row order[i], for example to
+   * keep rows sorted by material so recording reads them in draw order.
+   */
+  void reorder(const std::vector<uint32_t> &order) {
+    assert(order.size() == size());
+    auto permute = [&order](auto &values) {
+      std::remove_reference_t<decltype(values)> sorted;
+      sorted.reserve(values.size());
+      for (uint32_t from : order) {
+        sorted.push_back(std::move(values[from]));
+      }
+      values.swap(sorted);
+    };
+    permute(entities);
+    std::apply([&permute](auto &...column) { (permute(column), ...); },
+               columns);
+    for (uint32_t i = 0; i < entities.size(); i++) {
+      sparse[entities[i].index()] = i;
+    }
+  }
+
+ private:
+  template <size_t... I>
+  void insertValues(std::index_sequence<I...>, Components &&...values) {
+    (std::get<I>(columns).push_back(std::move(values)), ...);
+  }
+
+  // Entity index to row, kNoRow when the entity has no row here.
+  std::vector<uint32_t> sparse;
+  std::vector<Entity> entities;
+  std::tuple<std::vector<Components>...> columns;
+};
+
+}  // namespace vkt
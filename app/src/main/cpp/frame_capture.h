@@ -0,0 +1,353 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Encoding and writing of captured frames.
+ *
+ * The renderer copies swapchain images into host visible staging buffers and,
+ * once the frame's fence has signaled, hands the pixels to a FrameWriter. The
+ * writer encodes (raw or PNG) and writes files on its own thread so the render
+ * loop never waits on the disk. When the writer falls behind, new frames are
+ * dropped and counted instead of stalling rendering.
+ */
+
+namespace vkt {
+
+enum class CaptureEncoding { Raw, Png };
+
+struct CapturedFrame {
+  uint64_t index = 0;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  // Pixels are tightly packed, 4 bytes each.
+  bool bgra = false;
+  std::vector<uint8_t> pixels;
+};
+
+struct FrameCaptureConfig {
+  std::string directory;
+  CaptureEncoding encoding = CaptureEncoding::Png;
+  // Capture one frame out of everyNthFrame.
+  uint32_t everyNthFrame = 1;
+  // Frames waiting for the writer beyond this are dropped.
+  size_t maxQueuedFrames = 8;
+  // Runs on the writer thread when it starts.
+  std::function<void()> workerThreadInit;
+};
+
+struct FrameWriterStats {
+  uint64_t written = 0;
+  uint64_t dropped = 0;
+  uint64_t bytesWritten = 0;
+};
+
+/*
+ * Writes an RGBA8 PNG using stored (uncompressed) deflate blocks. Files are
+ * larger than a real deflate encoder would produce but encoding is a memcpy
+ * plus two checksums, which keeps up with capturing every frame.
+ */
+class PngWriter {
+ public:
+  static bool write(FILE *file, const CapturedFrame &frame) {
+    static const uint8_t kSignature[8] = {0x89, 'P',  'N',  'G',
+                                          '\r', '\n', 0x1a, '\n'};
+    std::vector<uint8_t> header;
+    appendBigEndian(header, frame.width);
+    appendBigEndian(header, frame.height);
+    // 8 bits per channel, colour type 6 (RGBA), default compression, filter
+    // and no interlacing.
+    header.insert(header.end(), {8, 6, 0, 0, 0});
+
+    // Every row is prefixed with filter type 0 (none).
+    size_t rowBytes = frame.width * 4;
+    std::vector<uint8_t> raw;
+    raw.reserve((rowBytes + 1) * frame.height);
+    for (uint32_t y = 0; y < frame.height; y++) {
+      raw.push_back(0);
+      const uint8_t *row = frame.pixels.data() + y * rowBytes;
+      if (frame.bgra) {
+        for (size_t x = 0; x < rowBytes; x += 4) {
+          raw.insert(raw.end(), {row[x + 2], row[x + 1], row[x], row[x + 3]});
+        }
+      } else {
+        raw.insert(raw.end(), row, row + rowBytes);
+      }
+    }
+
+    std::vector<uint8_t> zlib = {0x78, 0x01};
+    zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+    size_t offset = 0;
+    do {
+      size_t length = std::min<size_t>(raw.size() - offset, 65535);
+      bool last = offset + length == raw.size();
+      zlib.push_back(last ? 1 : 0);
+      zlib.push_back(length & 0xff);
+      zlib.push_back(length >> 8);
+      zlib.push_back(~length & 0xff);
+      zlib.push_back((~length >> 8) & 0xff);
+      zlib.insert(zlib.end(), raw.begin() + offset,
+                  raw.begin() + offset + length);
+      offset += length;
+    } while (offset < raw.size());
+    appendBigEndian(zlib, adler32(raw));
+
+    return fwrite(kSignature, 1, sizeof(kSignature), file) ==
+               sizeof(kSignature) &&
+           writeChunk(file, "IHDR", header) && writeChunk(file, "IDAT", zlib) &&
+           writeChunk(file, "IEND", {});
+  }
+
+ private:
+  static void appendBigEndian(std::vector<uint8_t> &out, uint32_t value) {
+    out.insert(out.end(), {uint8_t(value >> 24), uint8_t(value >> 16),
+                           uint8_t(value >> 8), uint8_t(value)});
+  }
+
+  static uint32_t adler32(const std::vector<uint8_t> &data) {
+    uint32_t a = 1;
+    uint32_t b = 0;
+    for (uint8_t byte : data) {
+      a = (a + byte) % 65521;
+      b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+  }
+
+  static uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc) {
+    static const std::array<uint32_t, 256> table = [] {
+      std::array<uint32_t, 256> t{};
+      for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+          c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        t[n] = c;
+      }
+      return t;
+    }();
+    for (size_t i = 0; i < size; i++) {
+      crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+  }
+
+  static bool writeChunk(FILE *file, const char type[4],
+                         const std::vector<uint8_t> &data) {
+    std::vector<uint8_t> chunk;
+    appendBigEndian(chunk, data.size());
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    uint32_t crc = crc32(chunk.data() + 4, chunk.size() - 4, 0xffffffffu);
+    appendBigEndian(chunk, crc ^ 0xffffffffu);
+    return fwrite(chunk.data(), 1, chunk.size(), file) == chunk.size();
+  }
+};
+
+class FrameWriter {
+ public:
+  /*
+   * Frames are written to directory as frame_<index>.png, or as
+   * frame_<index>_<width>x<height>.rgba holding tightly packed RGBA8 pixels.
+   * threadInit runs on the writer thread before anything else, for example to
+   * apply a ThreadPlacement.
+   */
+  FrameWriter(std::string directory, CaptureEncoding encoding,
+              size_t maxQueuedFrames, std::function<void()> threadInit = {})
+      : directory(std::move(directory)),
+        encoding(encoding),
+        maxQueuedFrames(maxQueuedFrames),
+        worker([this, threadInit] {
+          if (threadInit) {
+            threadInit();
+          }
+          run();
+        }) {}
+
+  /*
+   * Streaming mode: frames are appended to stream (a file, pipe or stdout) as
+   * tightly packed RGBA8 in submission order. The stream is not closed.
+   */
+  FrameWriter(FILE *stream, size_t maxQueuedFrames,
+              std::function<void()> threadInit = {})
+      : encoding(CaptureEncoding::Raw),
+        stream(stream),
+        maxQueuedFrames(maxQueuedFrames),
+        worker([this, threadInit] {
+          if (threadInit) {
+            threadInit();
+          }
+          run();
+        }) {}
+
+  ~FrameWriter() { finish(); }
+
+  // Writes everything still queued, stops the worker and returns final stats.
+  FrameWriterStats finish() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_one();
+    if (worker.joinable()) {
+      worker.join();
+    }
+    return stats();
+  }
+
+  /*
+   * Returns a pixel buffer to fill, reusing the storage of frames that have
+   * already been written so steady state capture does not allocate.
+   */
+  std::vector<uint8_t> acquireBuffer(size_t size) {
+    std::vector<uint8_t> buffer;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!freeBuffers.empty()) {
+        buffer = std::move(freeBuffers.back());
+        freeBuffers.pop_back();
+      }
+    }
+    buffer.resize(size);
+    return buffer;
+  }
+
+  // Waits for room in the queue instead of dropping the frame.
+  void submitBlocking(CapturedFrame &&frame) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      room.wait(lock, [this] { return queue.size() < maxQueuedFrames; });
+      queue.push_back(std::move(frame));
+    }
+    wake.notify_one();
+  }
+
+  // Never blocks. Returns false when the queue is full and the frame dropped.
+  bool submit(CapturedFrame &&frame) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (queue.size() >= maxQueuedFrames) {
+        writerStats.dropped++;
+        freeBuffers.push_back(std::move(frame.pixels));
+        return false;
+      }
+      queue.push_back(std::move(frame));
+    }
+    wake.notify_one();
+    return true;
+  }
+
+  FrameWriterStats stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return writerStats;
+  }
+
+ private:
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      wake.wait(lock, [this] { return stopping || !queue.empty(); });
+      // Drain what is queued even when stopping so no captured frame is lost.
+      if (queue.empty()) {
+        return;
+      }
+      CapturedFrame frame = std::move(queue.front());
+      queue.pop_front();
+      lock.unlock();
+      room.notify_one();
+
+      size_t bytes = writeFrame(frame);
+
+      lock.lock();
+      if (bytes > 0) {
+        writerStats.written++;
+        writerStats.bytesWritten += bytes;
+      } else {
+        writerStats.dropped++;
+      }
+      freeBuffers.push_back(std::move(frame.pixels));
+    }
+  }
+
+  // Returns the number of bytes written, 0 on failure.
+  size_t writeFrame(const CapturedFrame &frame) {
+    if (stream != nullptr) {
+      return writeRgba(stream, frame) ? frame.pixels.size() : 0;
+    }
+
+    char name[96];
+    if (encoding == CaptureEncoding::Png) {
+      snprintf(name, sizeof(name), "/frame_%06llu.png",
+               (unsigned long long)frame.index);
+    } else {
+      snprintf(name, sizeof(name), "/frame_%06llu_%ux%u.rgba",
+               (unsigned long long)frame.index, frame.width, frame.height);
+    }
+    FILE *file = fopen((directory + name).c_str(), "wb");
+    if (file == nullptr) {
+      return 0;
+    }
+
+    bool ok = encoding == CaptureEncoding::Png ? PngWriter::write(file, frame)
+                                               : writeRgba(file, frame);
+    long size = ftell(file);
+    fclose(file);
+    return ok ? size : 0;
+  }
+
+  static bool writeRgba(FILE *file, const CapturedFrame &frame) {
+    if (!frame.bgra) {
+      return fwrite(frame.pixels.data(), 1, frame.pixels.size(), file) ==
+             frame.pixels.size();
+    }
+    std::vector<uint8_t> rgba(frame.pixels);
+    for (size_t i = 0; i < rgba.size(); i += 4) {
+      std::swap(rgba[i], rgba[i + 2]);
+    }
+    return fwrite(rgba.data(), 1, rgba.size(), file) == rgba.size();
+  }
+
+  std::string directory;
+  CaptureEncoding encoding;
+  FILE *stream = nullptr;
+  size_t maxQueuedFrames;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable room;
+  std::deque<CapturedFrame> queue;
+  std::vector<std::vector<uint8_t>> freeBuffers;
+  FrameWriterStats writerStats;
+  bool stopping = false;
+  // Declared last so every member above is initialised before it starts.
+  std::thread worker;
+};
+
+}  // namespace vkt
@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef __ANDROID__
+#include <android/thermal.h>
+#endif
+
+/**
+ * Thermal and power aware performance governor.
+ *
+ * A ThermalSignalSource reports thermal headroom using the same scale as
+ * AThermal_getThermalHeadroom(): 0.0 means no thermal pressure and 1.0 means
+ * the device has reached THERMAL_STATUS_SEVERE and is throttling hard. The
+ * governor samples the source at a fixed interval and walks a table of
+ * performance levels to keep headroom under a budget, trading frame rate cap,
+ * resolution scale and frames in flight against heat.
+ *
+ * Nothing in here depends on Vulkan so policies can be evaluated offline with
+ * simulateGovernor() and a MockThermalSource.
+ */
+
+namespace vkt {
+
+class ThermalSignalSource {
+ public:
+  virtual ~ThermalSignalSource() = default;
+  // Returns NAN when no fresh sample is available.
+  virtual float headroom() = 0;
+  virtual const char *name() const = 0;
+};
+
+#ifdef __ANDROID__
+/*
+ * Android thermal API (API level 30). The platform rate limits headroom
+ * queries and returns NAN when polled too often, which the governor treats as
+ * "no new sample".
+ */
+class AndroidThermalSource : public ThermalSignalSource {
+ public:
+  AndroidThermalSource() : manager(AThermal_acquireManager()) {}
+  ~AndroidThermalSource() override {
+    if (manager != nullptr) {
+      AThermal_releaseManager(manager);
+    }
+  }
+
+  float headroom() override {
+    if (manager == nullptr) {
+      return NAN;
+    }
+    return AThermal_getThermalHeadroom(manager, kForecastSeconds);
+  }
+  const char *name() const override { return "android-thermal"; }
+
+ private:
+  // Look a little ahead so the governor reacts before throttling starts.
+  static constexpr int kForecastSeconds = 2;
+  AThermalManager *manager;
+};
+#endif
+
+/*
+ * Reads a temperature in millidegrees Celsius from a file, for example
+ * /sys/class/thermal/thermal_zone0/temp on Linux, and maps it linearly onto
+ * headroom: coolMilliC is 0.0 and throttleMilliC is 1.0. A range that is
+ * empty or reversed gives no samples.
+ */
+class FileThermalSource : public ThermalSignalSource {
+ public:
+  FileThermalSource(std::string path, float coolMilliC, float throttleMilliC)
+      : path(std::move(path)),
+        coolMilliC(coolMilliC),
+        throttleMilliC(throttleMilliC) {}
+
+  float headroom() override {
+    FILE *file = fopen(path.c_str(), "r");
+    if (file == nullptr) {
+      return NAN;
+    }
+    float milliC;
+    int read = fscanf(file, "%f", &milliC);
+    fclose(file);
+    if (read != 1 || !(throttleMilliC > coolMilliC)) {
+      return NAN;
+    }
+    return (milliC - coolMilliC) / (throttleMilliC - coolMilliC);
+  }
+  const char *name() const override { return path.c_str(); }
+
+ private:
+  std::string path;
+  float coolMilliC;
+  float throttleMilliC;
+};
+
+// Replays a scripted headroom trace, holding the last value once exhausted.
+class MockThermalSource : public ThermalSignalSource {
+ public:
+  explicit MockThermalSource(std::vector<float> samples)
+      : samples(std::move(samples)) {}
+
+  float headroom() override {
+    if (samples.empty()) {
+      return NAN;
+    }
+    float value = samples[std::min(next, samples.size() - 1)];
+    next++;
+    return value;
+  }
+  const char *name() const override { return "mock"; }
+
+ private:
+  std::vector<float> samples;
+  size_t next = 0;
+};
+
+struct GovernorSettings {
+  // Frames per second, 0 means uncapped (vsync only).
+  uint32_t frameRateCap;
+  // Fraction of the native window size the swapchain is rendered at.
+  float resolutionScale;
+  uint32_t framesInFlight;
+
+  bool operator==(const GovernorSettings &other) const {
+    return frameRateCap == other.frameRateCap &&
+           resolutionScale == other.resolutionScale &&
+           framesInFlight == other.framesInFlight;
+  }
+  bool operator!=(const GovernorSettings &other) const {
+    return !(*this == other);
+  }
+};
+
+struct GovernorPolicy {
+  // Ordered from fastest to most conservative.
+  std::vector<GovernorSettings> levels = {
+      {0, 1.0f, 2}, {60, 1.0f, 2}, {60, 0.75f, 2}, {45, 0.75f, 1},
+      {30, 0.5f, 1},
+  };
+  // Headroom the governor tries to stay under.
+  float headroomBudget = 0.75f;
+  // Headroom has to drop this far below the budget before stepping back up,
+  // so the governor does not oscillate around the budget.
+  float hysteresis = 0.15f;
+  double sampleIntervalSeconds = 1.0;
+  // Minimum time between two level changes.
+  double minDwellSeconds = 5.0;
+};
+
+class PerformanceGovernor {
+ public:
+  PerformanceGovernor(std::unique_ptr<ThermalSignalSource> source,
+                      GovernorPolicy policy = GovernorPolicy())
+      : source(std::move(source)), policy(std::move(policy)) {}
+
+  /*
+   * Samples the signal source if the sample interval elapsed and returns the
+   * settings to apply. Cheap to call every frame.
+   */
+  const GovernorSettings &update(double nowSeconds) {
+    if (nowSeconds - lastSampleSeconds < policy.sampleIntervalSeconds) {
+      return settings();
+    }
+    lastSampleSeconds = nowSeconds;
+
+    float value = source->headroom();
+    if (isnan(value)) {
+      return settings();
+    }
+    lastHeadroom = value;
+    if (nowSeconds - lastChangeSeconds < policy.minDwellSeconds) {
+      return settings();
+    }
+
+    if (value > policy.headroomBudget && level + 1 < policy.levels.size()) {
+      level++;
+      lastChangeSeconds = nowSeconds;
+    } else if (value < policy.headroomBudget - policy.hysteresis && level > 0) {
+      level--;
+      lastChangeSeconds = nowSeconds;
+    }
+    return settings();
+  }
+
+  const GovernorSettings &settings() const { return policy.levels[level]; }
+  size_t currentLevel() const { return level; }
+  float headroom() const { return lastHeadroom; }
+  const char *sourceName() const { return source->name(); }
+
+ private:
+  std::unique_ptr<ThermalSignalSource> source;
+  GovernorPolicy policy;
+  size_t level = 0;
+  float lastHeadroom = NAN;
+  double lastSampleSeconds = -INFINITY;
+  double lastChangeSeconds = -INFINITY;
+};
+
+struct GovernorSimulationStep {
+  double timeSeconds;
+  float headroom;
+  size_t level;
+  GovernorSettings settings;
+};
+
+/*
+ * Simulation mode: runs a policy over a recorded or synthetic headroom trace,
+ * one sample per policy.sampleIntervalSeconds, without touching the renderer.
+ * Use it to check how a policy change reacts to a known thermal profile, see
+ * governor_sim.cpp.
+ */
+inline std::vector<GovernorSimulationStep> simulateGovernor(
+    const GovernorPolicy &policy, const std::vector<float> &headroomTrace) {
+  PerformanceGovernor governor(
+      std::make_unique<MockThermalSource>(headroomTrace), policy);
+  std::vector<GovernorSimulationStep> steps;
+  steps.reserve(headroomTrace.size());
+  for (size_t i = 0; i < headroomTrace.size(); i++) {
+    double now = i * policy.sampleIntervalSeconds;
+    const GovernorSettings &settings = governor.update(now);
+    steps.push_back({now, governor.headroom(), governor.currentLevel(),
+                     settings});
+  }
+  return steps;
+}
+
+}  // namespace vkt
@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Offline simulation of the performance governor in governor.h. Runs the
+ * default policy, adjusted by the options, over a headroom trace and prints
+ * the level the governor picks for every sample:
+ *
+ *   hellovk_governor_sim [-b budget] [-y hysteresis] [-i interval]
+ *                        [-d dwell] trace.txt
+ *
+ * The trace has one headroom value per line on AThermal_getThermalHeadroom()'s
+ * scale; '#' starts a comment and "nan" is a missing sample. Without a file,
+ * or with "-", it is read from stdin.
+ *
+ * With -z the samples come from a temperature file instead, in real time:
+ *
+ *   adb shell /data/local/tmp/hellovk_governor_sim \
+ *       -z /sys/class/thermal/thermal_zone0/temp -c 40000 -t 80000 -n 60
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "governor.h"
+
+static void usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [-b budget] [-y hysteresis] [-i interval] [-d dwell]\n"
+          "          [trace | -z file -c coolMilliC -t throttleMilliC "
+          "-n samples]\n",
+          program);
+}
+
+static bool readTrace(FILE *file, std::vector<float> &trace) {
+  char line[256];
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    char *text = line;
+    while (*text == ' ' || *text == '\t') {
+      text++;
+    }
+    if (*text == '#' || *text == '\n' || *text == '\r' || *text == '\0') {
+      continue;
+    }
+    char *end;
+    float value = strtof(text, &end);
+    if (end == text) {
+      fprintf(stderr, "bad trace line: %s", line);
+      return false;
+    }
+    trace.push_back(value);
+  }
+  return true;
+}
+
+static void printHeader() {
+  printf("%8s  %8s  %5s  %4s  %5s  %6s\n", "time", "headroom", "level", "fps",
+         "scale", "frames");
+}
+
+static void printStep(double seconds, float headroom, size_t level,
+                      const vkt::GovernorSettings &settings) {
+  printf("%8.1f  %8.3f  %5zu  %4u  %5.2f  %6u\n", seconds, headroom, level,
+         settings.frameRateCap, settings.resolutionScale,
+         settings.framesInFlight);
+}
+
+int main(int argc, char **argv) {
+  vkt::GovernorPolicy policy;
+  std::string zone;
+  float coolMilliC = NAN;
+  float throttleMilliC = NAN;
+  long samples = 0;
+  int option;
+  while ((option = getopt(argc, argv, "b:y:i:d:z:c:t:n:h")) != -1) {
+    switch (option) {
+      case 'b':
+        policy.headroomBudget = strtof(optarg, nullptr);
+        break;
+      case 'y':
+        policy.hysteresis = strtof(optarg, nullptr);
+        break;
+      case 'i':
+        policy.sampleIntervalSeconds = strtod(optarg, nullptr);
+        break;
+      case 'd':
+        policy.minDwellSeconds = strtod(optarg, nullptr);
+        break;
+      case 'z':
+        zone = optarg;
+        break;
+      case 'c':
+        coolMilliC = strtof(optarg, nullptr);
+        break;
+      case 't':
+        throttleMilliC = strtof(optarg, nullptr);
+        break;
+      case 'n':
+        samples = strtol(optarg, nullptr, 0);
+        break;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+  if (policy.sampleIntervalSeconds <= 0. || policy.minDwellSeconds < 0.) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if (!zone.empty()) {
+    if (!(throttleMilliC > coolMilliC) || samples < 1 || optind != argc) {
+      usage(argv[0]);
+      return 2;
+    }
+    vkt::PerformanceGovernor governor(
+        std::make_unique<vkt::FileThermalSource>(zone, coolMilliC,
+                                                 throttleMilliC),
+        policy);
+    printHeader();
+    auto start = std::chrono::steady_clock::now();
+    auto interval = std::chrono::duration<double>(policy.sampleIntervalSeconds);
+    for (long i = 0; i < samples; i++) {
+      std::this_thread::sleep_until(
+          start + std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      interval * i));
+      double now = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+      const vkt::GovernorSettings &settings = governor.update(now);
+      printStep(now, governor.headroom(), governor.currentLevel(), settings);
+      fflush(stdout);
+    }
+    return 0;
+  }
+
+  if (argc - optind > 1) {
+    usage(argv[0]);
+    return 2;
+  }
+  std::string path = optind < argc ? argv[optind] : "-";
+  FILE *file = path == "-" ? stdin : fopen(path.c_str(), "r");
+  if (file == nullptr) {
+    perror(path.c_str());
+    return 1;
+  }
+  std::vector<float> trace;
+  bool ok = readTrace(file, trace);
+  if (file != stdin) {
+    fclose(file);
+  }
+  if (!ok) {
+    return 1;
+  }
+
+  std::vector<vkt::GovernorSimulationStep> steps =
+      vkt::simulateGovernor(policy, trace);
+  printHeader();
+  size_t changes = 0;
+  for (size_t i = 0; i < steps.size(); i++) {
+    const vkt::GovernorSimulationStep &step = steps[i];
+    printStep(step.timeSeconds, step.headroom, step.level, step.settings);
+    changes += i > 0 && step.level != steps[i - 1].level;
+  }
+  printf("# %zu samples, %zu level changes\n", steps.size(), changes);
+  return 0;
+}
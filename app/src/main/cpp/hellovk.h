@@ -22,14 +22,42 @@
 #include <vulkan/vulkan.h>
 
 #include <array>
+#include <chrono>
 #include <fstream>
 #include <map>
+#include <mutex>
 #include <optional>
 #include <set>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "command_encoder.h"
+#include "command_stream.h"
+#include "damage_tracker.h"
+#include "frame_capture.h"
+#include "input.h"
+#include "load_store_analysis.h"
+#include "object_cache.h"
+#include "power_profile.h"
+#include "soak_test.h"
+#include "vk_builders.h"
+#include "vk_math.h"
+
+#ifdef HELLOVK_EMBEDDED_SHADERS
+// Generated by the build, see hellovk_embed_shader() in CMakeLists.txt.
+#include "compose.frag.spv.h"
+#include "compose.vert.spv.h"
+#include "layer.frag.spv.h"
+#include "layer.vert.spv.h"
+#include "shader.frag.spv.h"
+#include "shader.vert.spv.h"
+#include "shader_fp16.frag.spv.h"
+#include "shader_fp16.vert.spv.h"
+#include "stereo.vert.spv.h"
+#endif
+
 /**
  * HelloVK contains the core of Vulkan pipeline setup. It includes recording
  * draw commands as well as screen clearing during the render pass.
@@ -54,7 +82,82 @@ namespace vkt {
 const int MAX_FRAMES_IN_FLIGHT = 2;
 
 struct UniformBufferObject {
-  std::array<float, 16> mvp;
+  mat4 mvp;
+};
+
+/*
+ * LateLatchedTransform holds the most recent view transform published by any
+ * thread (input handling, sensors, ...). The render thread samples it at the
+ * last possible moment - right before vkQueueSubmit - and writes the result
+ * into the persistently mapped uniform buffer of the frame being submitted, so
+ * the MVP read by the GPU is at most one submit old instead of one frame old.
+ *
+ * Writing into the slot after submission would race with the GPU read, which
+ * Vulkan does not allow without extra synchronisation, so the submit is the
+ * latch point.
+ */
+class LateLatchedTransform {
+ public:
+  void publish(const mat4 &transform) {
+    std::lock_guard<std::mutex> lock(mutex);
+    latest = transform;
+  }
+
+  void latch(mat4 &transform) {
+    std::lock_guard<std::mutex> lock(mutex);
+    transform = latest;
+  }
+
+ private:
+  std::mutex mutex;
+  mat4 latest;
+};
+
+/*
+ * Offscreen batch rendering, see HelloVK::renderOffscreenBatch().
+ */
+struct BatchConfig {
+  uint32_t frameCount = 120;
+  VkExtent2D extent = {1280, 720};
+  // Frames rendered and read back concurrently.
+  uint32_t pipelineDepth = 3;
+  // 0 renders as fast as possible.
+  uint32_t maxFramesPerSecond = 0;
+  // Colour targets, staging buffers and queued output together stay below
+  // this; the pipeline depth is reduced until they fit, and a batch whose
+  // single frame does not fit is refused.
+  uint64_t memoryBudgetBytes = 256ull << 20;
+  FILE *output = stdout;
+  std::function<void()> workerThreadInit;
+};
+
+struct BatchReport {
+  uint32_t frames;
+  double seconds;
+  double framesPerSecond;
+  uint32_t pipelineDepth;
+  uint64_t memoryBytes;
+  uint64_t bytesWritten;
+};
+
+struct ReplayReport {
+  uint32_t frames;
+  double seconds;
+  double framesPerSecond;
+};
+
+// Per static layer, see HelloVK::addStaticLayer().
+struct LayerCacheStats {
+  // Frames that composited the cached image as it was.
+  uint64_t hits = 0;
+  // Frames that rendered the layer again, after a change to any layer or a
+  // rebuild.
+  uint64_t renders = 0;
+
+  double hitRate() const {
+    uint64_t frames = hits + renders;
+    return frames > 0 ? double(hits) / frames : 0.;
+  }
 };
 
 struct QueueFamilyIndices {
@@ -176,10 +279,179 @@ static void DestroyDebugUtilsMessengerEXT(
 class HelloVK {
  public:
   void initVulkan();
+  // Sets up everything but the surface and swapchain, for offscreen work.
+  void initVulkanHeadless(AAssetManager *newManager);
+  BatchReport renderOffscreenBatch(const BatchConfig &config);
   void render();
   void cleanup();
   void cleanupSwapChain();
   void reset(ANativeWindow *newWindow, AAssetManager *newManager);
+  // Thread safe. The transform is applied after the pre-rotation matrix and
+  // latched just before the frame is submitted.
+  void setViewTransform(const mat4 &transform);
+  // Records that input generated at eventTimestampNs (CLOCK_MONOTONIC) has been
+  // applied to the scene and will be visible in the next presented frame.
+  void onInputApplied(int64_t eventTimestampNs);
+  // Knobs driven by the performance governor. A frame rate cap of 0 disables
+  // pacing, the resolution scale is relative to the native window size.
+  void setFrameRateCap(uint32_t framesPerSecond);
+  void setResolutionScale(float scale);
+  void setFramesInFlight(uint32_t count);
+  /*
+   * Power profile, standard by default; see power_profile.h. Takes effect on
+   * the next render(). A different surface format rebuilds the swapchain
+   * together with the render passes and pipelines drawing into it, which
+   * stalls that one frame. Usage is counted per profile, and a switch logs
+   * the finished period next to the one before it.
+   */
+  void setPowerProfile(const PowerProfile &profile);
+  const PowerProfile &powerProfile() const { return power; }
+  PowerUsage powerUsage() const;
+  void logPowerUsage() const;
+  // Copies presented frames into staging buffers which a worker thread
+  // encodes and writes to disk, see frame_capture.h. Requires initVulkan().
+  bool startCapture(const FrameCaptureConfig &config);
+  void stopCapture();
+  // Scene overrides. Without a clear colour the background keeps cycling
+  // through greys, an empty draw list draws the single triangle.
+  void setClearColor(const std::array<float, 4> &rgba);
+  void setDrawList(std::vector<DrawCommand> draws);
+  // For a draw list whose change stays within changed, in swapchain image
+  // pixels as for addDamage(); only matters with dirty regions.
+  void setDrawList(std::vector<DrawCommand> draws, const VkRect2D &changed);
+  // Single frame offscreen rendering after initVulkanHeadless(), used by the
+  // render server. renderOffscreenFrame() returns once the GPU is done.
+  void startOffscreenRendering(VkExtent2D extent);
+  void renderOffscreenFrame();
+  void stopOffscreenRendering();
+  // Records the MVP, clear colour and draw list of every submitted frame to
+  // path, see command_stream.h.
+  bool startCommandCapture(const std::string &path);
+  void stopCommandCapture();
+  // Re-executes a capture loops times at full speed into an offscreen target
+  // of the captured size. Requires initVulkanHeadless().
+  ReplayReport replayCommandStream(const CommandStream &stream,
+                                   uint32_t loops);
+  /*
+   * Additional render targets on the same device: another window, or an
+   * offscreen image of a fixed size. They share the render pass, pipeline,
+   * command pool and shaders with the main window and only own their
+   * swapchain or image, frame slots and view transform.
+   *
+   * A target renders at most framesPerSecond times per second, 0 meaning on
+   * every render() call. It is skipped rather than waited for while its
+   * frame slot is busy or its swapchain has no image available, so a slow
+   * window does not hold back the others. Swapchain images rendered in one
+   * render() call are presented together with the main window's by a single
+   * vkQueuePresentKHR.
+   *
+   * addWindowTarget() takes over the caller's reference to the window, like
+   * reset(), and returns kNoTarget if the window cannot be presented from
+   * the present queue in the scene format.
+   */
+  using TargetId = uint32_t;
+  static constexpr TargetId kNoTarget = UINT32_MAX;
+  TargetId addWindowTarget(ANativeWindow *newWindow,
+                           uint32_t framesPerSecond = 0);
+  TargetId addOffscreenTarget(VkExtent2D extent, uint32_t framesPerSecond = 0);
+  void removeTarget(TargetId id);
+  // Thread safe, like setViewTransform().
+  void setTargetViewTransform(TargetId id, const mat4 &transform);
+  uint64_t targetFrameCount(TargetId id);
+  // Renders the targets that are due without touching the main window, for
+  // use after initVulkanHeadless().
+  void renderTargets();
+  /*
+   * Static layers of the main window, composited under the draw list. The
+   * layers' draws are rendered, each with its own transform and in the order
+   * the layers were added, into one cached image of the swapchain size. It
+   * is only rendered again after a layer was added, updated or removed or the
+   * swapchain was rebuilt; every other frame just blends it in with one
+   * draw. Unlike the draw list, a layer without draws stays transparent.
+   * Stereo rendering and the additional targets show no layers. Requires
+   * initVulkan().
+   */
+  using LayerId = uint32_t;
+  LayerId addStaticLayer(std::vector<DrawCommand> draws,
+                         const mat4 &transform = mat4{});
+  void updateStaticLayer(LayerId id, std::vector<DrawCommand> draws,
+                         const mat4 &transform = mat4{});
+  void removeStaticLayer(LayerId id);
+  LayerCacheStats staticLayerStats(LayerId id) const;
+  /*
+   * Two eye views for head mounted displays. Must be called before
+   * initVulkan(); without multiview support (Vulkan 1.1) the request is
+   * logged and rendering stays mono. The scene is recorded once: a multiview
+   * render pass draws it into both layers of an eye target, which is then
+   * composed side by side into the swapchain. Additional targets and the
+   * offscreen paths stay mono.
+   */
+  void setStereo(bool enabled);
+  // Thread safe, like setViewTransform(). Each eye's transform is applied
+  // after the view transform; pre-rotation happens in the compose pass.
+  void setEyeTransforms(const mat4 &left, const mat4 &right);
+  bool stereoEnabled() const { return stereo; }
+  /*
+   * Half precision scene shaders, on by default. Must be called before
+   * initVulkan(). When allowed and the device supports shaderFloat16, the
+   * feature is enabled and the scene pipelines are built from the float16
+   * shader variants; otherwise the full precision shaders are used.
+   */
+  void setHalfPrecision(bool allowed);
+  bool halfPrecisionEnabled() const { return halfPrecision; }
+  /*
+   * Imageless framebuffers, on by default. Must be called before
+   * initVulkan(). When allowed and VK_KHR_imageless_framebuffer is supported,
+   * one framebuffer serves all images of a swapchain and survives swapchain
+   * rebuilds that keep the size; see FramebufferCache.
+   */
+  void setImagelessFramebuffers(bool allowed);
+  bool imagelessFramebuffersEnabled() const {
+    return framebufferCache.imageless();
+  }
+  /*
+   * Dirty rectangle rendering, off by default. Must be called before
+   * initVulkan(); stereo and headless rendering ignore it. Swapchain images
+   * keep their contents, so a frame only clears and draws the area that
+   * changed since the acquired image was last rendered, and render() skips
+   * frames in which nothing changed. Where VK_KHR_incremental_present is
+   * supported the changed rectangles are passed on with the present.
+   *
+   * A changed view transform or draw list damages the area the scene
+   * covered before and after the change. A changed clear colour damages the
+   * whole image, as does the cycling background without a clear colour. The
+   * view transform is latched before recording rather than after, so the
+   * damage is known when the frame is recorded.
+   */
+  void setDirtyRegions(bool allowed);
+  bool dirtyRegionsEnabled() const { return dirtyRegions; }
+  // Marks a rectangle of the swapchain image as changed. It is in the
+  // image's pixels as rendered, after pre-rotation: x runs along the
+  // display's native width whatever the app's orientation.
+  void addDamage(const VkRect2D &rect);
+  /*
+   * Swapchain churn soak test on the current window, see soak_test.h. Each
+   * cycle runs the recreation that follows a resize (a resolution scale
+   * change), a rotation and a surface loss (the window hidden and shown
+   * again), each followed by config.framesPerStep rendered frames. Blocks
+   * until done. Requires initVulkan().
+   */
+  SoakReport runSwapchainSoak(const SoakConfig &config);
+  VulkanObjectCounts liveObjects() const;
+
+  // Reuse of samplers and image views, see object_cache.h.
+  const ObjectCacheStats &samplerCacheStats() const {
+    return samplerCache.stats();
+  }
+  const ObjectCacheStats &imageViewCacheStats() const {
+    return imageViewCache.stats();
+  }
+  const ObjectCacheStats &framebufferCacheStats() const {
+    return framebufferCache.stats();
+  }
+  // State commands of the main window's last frame, those recorded and those
+  // dropped as redundant, see command_encoder.h.
+  const CommandStats &frameCommandStats() const { return frameCommands; }
   bool initialized = false;
 
  private:
@@ -206,7 +478,35 @@ class HelloVK {
   SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device);
   VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR &capabilities);
   VkShaderModule createShaderModule(const std::vector<uint8_t> &code);
+  VkShaderModule createShaderModule(const uint32_t *code, size_t size);
+  VkShaderModule createSceneShaderModule(VkShaderStageFlagBits stage);
   void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+  void recordRenderPass(CommandEncoder &encoder, VkFramebuffer framebuffer,
+                        VkImageView attachment, VkExtent2D extent,
+                        VkRenderPass pass, VkPipeline pipeline,
+                        VkDescriptorSet descriptorSet,
+                        const VkClearValue &clearColor,
+                        const VkRect2D *dirtyArea = nullptr,
+                        bool composeLayers = false);
+  void beginRenderPass(VkCommandBuffer commandBuffer,
+                       VkRenderPassBeginInfo &beginInfo,
+                       VkImageView attachment);
+  void advanceClearColor();
+  VkFramebuffer acquireFramebuffer(VkRenderPass pass,
+                                   const RenderPassDesc &desc,
+                                   VkImageView view, VkImageUsageFlags usage,
+                                   VkExtent2D extent, uint32_t layerCount = 1);
+  void releaseFramebuffer(VkFramebuffer framebuffer, VkImageView view);
+  void collectCaches();
+  VkDeviceSize createImage(VkExtent2D extent, uint32_t layers, VkFormat format,
+                           VkImageUsageFlags usage, VkImage &image,
+                           VkDeviceMemory &imageMemory);
+  VkMemoryPropertyFlags readbackMemoryProperties();
+  struct OffscreenTarget;
+  VkDeviceSize createOffscreenTarget(VkExtent2D extent,
+                                     OffscreenTarget &target);
+  void destroyOffscreenTarget(OffscreenTarget &target);
+  VkFence submitOffscreenFrame();
   void recreateSwapChain();
   void onOrientationChange();
   uint32_t findMemoryType(uint32_t typeFilter,
@@ -216,9 +516,54 @@ class HelloVK {
                     VkDeviceMemory &bufferMemory);
   void createUniformBuffers();
   void updateUniformBuffer(uint32_t currentImage);
+  VkRect2D sceneBounds(const std::array<float, 16> &mvp,
+                       const std::vector<DrawCommand> &draws) const;
+  void damageScene(const std::array<float, 16> &oldMvp,
+                   const std::vector<DrawCommand> &oldDraws);
   void createDescriptorPool();
   void createDescriptorSets();
   void establishDisplaySizeIdentity();
+  void recordInputLatency();
+  void paceFrame();
+  void applyResolutionScale();
+  uint32_t effectiveFrameRateCap() const;
+  float effectiveResolutionScale() const;
+  void applyPowerProfile();
+  VkSurfaceFormatKHR chooseSwapSurfaceFormat(
+      const std::vector<VkSurfaceFormatKHR> &availableFormats);
+  void rebuildForSurfaceFormat();
+  void createCaptureResources();
+  void destroyCaptureResources();
+  void recordCapture(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+  void collectCapture(uint32_t frame);
+  struct RenderTarget;
+  RenderTarget *findTarget(TargetId id);
+  RenderTarget &createTarget(uint32_t framesPerSecond);
+  bool createTargetSwapChain(RenderTarget &target);
+  void destroyTargetSwapChain(RenderTarget &target);
+  void destroyTarget(RenderTarget &target);
+  VkRenderPass targetRenderPass(bool present);
+  void submitDueTargets();
+  VkResult presentBatch();
+  bool multiviewSupported();
+  bool float16Supported();
+  bool imagelessFramebufferSupported();
+  bool deviceExtensionSupported(const char *name);
+  void createStereoPipelines();
+  void destroyStereoPipelines();
+  void createStereoTarget();
+  void destroyStereoTarget();
+  VkDeviceSize uniformSlotStride();
+  struct StaticLayer;
+  StaticLayer *findStaticLayer(LayerId id);
+  void createLayerPipelines();
+  void createLayerCompositePipeline();
+  void destroyLayerPipelines();
+  void createLayerImage();
+  void destroyStaticLayer(StaticLayer &layer);
+  void renderStaleLayers(CommandEncoder &encoder);
+  void composeStaticLayers(CommandEncoder &encoder);
+  void recordStereoFrame(CommandEncoder &encoder, uint32_t imageIndex);
 
   /*
    * In order to enable validation layer toggle this to true and
@@ -240,17 +585,19 @@ class HelloVK {
   VkInstance instance;
   VkDebugUtilsMessengerEXT debugMessenger;
 
-  VkSurfaceKHR surface;
+  VkSurfaceKHR surface = VK_NULL_HANDLE;
 
   VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
   VkDevice device;
 
-  VkSwapchainKHR swapChain;
+  VkSwapchainKHR swapChain = VK_NULL_HANDLE;
   std::vector<VkImage> swapChainImages;
   VkFormat swapChainImageFormat;
   VkExtent2D swapChainExtent;
   VkExtent2D displaySizeIdentity;
+  VkImageUsageFlags swapChainImageUsage = 0;
   std::vector<VkImageView> swapChainImageViews;
+  // With imageless framebuffers every entry is the same framebuffer.
   std::vector<VkFramebuffer> swapChainFramebuffers;
   VkCommandPool commandPool;
   std::vector<VkCommandBuffer> commandBuffers;
@@ -258,13 +605,17 @@ class HelloVK {
   VkQueue graphicsQueue;
   VkQueue presentQueue;
 
-  VkRenderPass renderPass;
+  VkRenderPass renderPass = VK_NULL_HANDLE;
+  // What renderPass was created from, for framebuffers compatible with it.
+  RenderPassDesc renderPassDesc;
   VkDescriptorSetLayout descriptorSetLayout;
   VkPipelineLayout pipelineLayout;
   VkPipeline graphicsPipeline;
 
   std::vector<VkBuffer> uniformBuffers;
   std::vector<VkDeviceMemory> uniformBuffersMemory;
+  std::vector<void *> uniformBuffersMapped;
+  LateLatchedTransform viewTransform;
 
   std::vector<VkSemaphore> imageAvailableSemaphores;
   std::vector<VkSemaphore> renderFinishedSemaphores;
@@ -272,9 +623,251 @@ class HelloVK {
   VkDescriptorPool descriptorPool;
   std::vector<VkDescriptorSet> descriptorSets;
 
+  // Oldest input applied since the last present, 0 when there is none.
+  int64_t oldestPendingInputNs = 0;
+  struct InputLatencyStats {
+    int64_t totalNs = 0;
+    int64_t maxNs = 0;
+    uint32_t samples = 0;
+  } inputLatency;
+
+  uint32_t frameRateCap = 0;
+  std::chrono::steady_clock::time_point nextFrameTime;
+  float resolutionScale = 1.f;
+  bool resolutionChanged = false;
+  int32_t nativeWindowWidth = 0;
+  int32_t nativeWindowHeight = 0;
+  uint32_t framesInFlight = MAX_FRAMES_IN_FLIGHT;
+
+  // The governor's frame rate cap and resolution scale above are limited by
+  // the profile.
+  PowerProfile power;
+  bool powerProfileChanged = false;
+  // Since power was set. seconds is filled in by powerUsage().
+  PowerUsage usage;
+  std::chrono::steady_clock::time_point usageStart =
+      std::chrono::steady_clock::now();
+  // The period before, for comparison; no frames when there was none.
+  PowerProfile previousPower;
+  PowerUsage previousUsage;
+
+  /*
+   * One host visible staging buffer per frame in flight. A slot is pending
+   * from the moment its copy is recorded until the frame's fence has signaled
+   * and the pixels were handed to the frame writer.
+   */
+  struct CaptureSlot {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    void *mapped = nullptr;
+    bool pending = false;
+    uint64_t frameIndex = 0;
+    VkExtent2D extent{};
+  };
+  bool captureEnabled = false;
+  FrameCaptureConfig captureConfig;
+  std::unique_ptr<FrameWriter> frameWriter;
+  std::vector<CaptureSlot> captureSlots;
+  uint64_t renderedFrames = 0;
+
+  std::optional<std::array<float, 4>> clearColorOverride;
+  // Resolved once per frame by advanceClearColor(), so the main window and
+  // every target rendered with it show the same background.
+  VkClearValue frameClearColor{};
+  float backgroundGrey = 0.f;
+  std::vector<DrawCommand> drawList;
+  // Filled while recording and submitting a frame when a command capture is
+  // running.
+  std::unique_ptr<CommandStreamWriter> commandCapture;
+  FrameCommands capturedCommands;
+
+  // Colour target rendered to without a swapchain.
+  struct OffscreenTarget {
+    VkExtent2D extent{};
+    VkImage image = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+    VkFramebuffer framebuffer = VK_NULL_HANDLE;
+  };
+  OffscreenTarget offscreenTarget;
+
+  struct RenderTarget {
+    TargetId id = kNoTarget;
+    // Window targets.
+    std::unique_ptr<ANativeWindow, ANativeWindowDeleter> window;
+    VkSurfaceKHR surface = VK_NULL_HANDLE;
+    VkSwapchainKHR swapChain = VK_NULL_HANDLE;
+    std::vector<VkImage> images;
+    std::vector<VkImageView> imageViews;
+    std::vector<VkFramebuffer> framebuffers;
+    VkSurfaceTransformFlagBitsKHR pretransform =
+        VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+    bool outOfDate = false;
+    // The surface refused a swapchain (format or presentation unsupported).
+    // Not retried until the swapchain format changes again.
+    bool swapChainFailed = false;
+    // Offscreen targets.
+    OffscreenTarget offscreen;
+
+    VkExtent2D extent{};
+    std::chrono::nanoseconds interval{0};
+    std::chrono::steady_clock::time_point nextFrameTime;
+    LateLatchedTransform viewTransform;
+
+    // The uniforms of all frame slots share one buffer.
+    struct Frame {
+      VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+      VkFence inFlight = VK_NULL_HANDLE;
+      VkSemaphore imageAvailable = VK_NULL_HANDLE;
+      VkSemaphore renderFinished = VK_NULL_HANDLE;
+      VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+      void *uniformMapped = nullptr;
+    };
+    std::array<Frame, MAX_FRAMES_IN_FLIGHT> frames;
+    VkBuffer uniformBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory uniformMemory = VK_NULL_HANDLE;
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    uint32_t currentFrame = 0;
+    uint64_t frameCount = 0;
+  };
+  std::vector<std::unique_ptr<RenderTarget>> targets;
+  TargetId nextTargetId = 0;
+  // renderPass with the other final layout, for offscreen targets next to a
+  // window or window targets after headless init. Created on first use.
+  VkRenderPass alternateRenderPass = VK_NULL_HANDLE;
+
+  struct StaticLayer {
+    LayerId id = 0;
+    std::vector<DrawCommand> draws;
+    mat4 transform;
+    // A uniform slot and set per frame in flight, as for RenderTarget.
+    VkBuffer uniformBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory uniformMemory = VK_NULL_HANDLE;
+    std::array<void *, MAX_FRAMES_IN_FLIGHT> uniformMapped{};
+    std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> uniformSets{};
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    LayerCacheStats stats;
+  };
+  std::vector<std::unique_ptr<StaticLayer>> staticLayers;
+  LayerId nextLayerId = 0;
+  // Every layer flattened into one image, which shows their current draws
+  // while layersValid is set. Exists while there are layers.
+  OffscreenTarget layerImage;
+  bool layersValid = false;
+  // Samples layerImage in the composite pass.
+  VkDescriptorPool layerCompositePool = VK_NULL_HANDLE;
+  VkDescriptorSet layerCompositeSet = VK_NULL_HANDLE;
+  // Created with the first layer.
+  VkRenderPass layerRenderPass = VK_NULL_HANDLE;
+  RenderPassDesc layerRenderPassDesc;
+  VkPipeline layerPipeline = VK_NULL_HANDLE;
+  VkSampler layerSampler = VK_NULL_HANDLE;
+  VkDescriptorSetLayout layerSetLayout = VK_NULL_HANDLE;
+  VkPipelineLayout layerCompositeLayout = VK_NULL_HANDLE;
+  VkPipeline layerCompositePipeline = VK_NULL_HANDLE;
+
+  /*
+   * Stereo rendering, see setStereo(). stereoTarget holds one layer per eye
+   * at half the visible width and is recreated with the swapchain.
+   */
+  bool stereoRequested = false;
+  bool stereo = false;
+  // MVPs in each frame's uniform buffer, one per eye in stereo.
+  uint32_t viewCount = 1;
+  std::array<LateLatchedTransform, 2> eyeTransforms;
+  OffscreenTarget stereoTarget;
+  VkRenderPass stereoRenderPass = VK_NULL_HANDLE;
+  VkRenderPass composeRenderPass = VK_NULL_HANDLE;
+  VkPipeline stereoPipeline = VK_NULL_HANDLE;
+  VkSampler composeSampler = VK_NULL_HANDLE;
+  VkDescriptorSetLayout composeSetLayout = VK_NULL_HANDLE;
+  VkDescriptorPool composeDescriptorPool = VK_NULL_HANDLE;
+  VkDescriptorSet composeDescriptorSet = VK_NULL_HANDLE;
+  VkPipelineLayout composePipelineLayout = VK_NULL_HANDLE;
+  VkPipeline composePipeline = VK_NULL_HANDLE;
+
+  // See setHalfPrecision().
+  bool halfPrecisionAllowed = true;
+  bool halfPrecision = false;
+
+  // See setImagelessFramebuffers().
+  bool imagelessAllowed = true;
+
+  // See setDirtyRegions(). updateRenderPass is renderPass loading the
+  // retained image instead of clearing it, used for partial redraws.
+  bool dirtyRegionsAllowed = false;
+  bool dirtyRegions = false;
+  bool incrementalPresent = false;
+  DamageTracker damage;
+  VkRenderPass updateRenderPass = VK_NULL_HANDLE;
+  VkExtent2D renderAreaGranularity = {1, 1};
+  // How long render() sleeps on a frame without damage and no frame rate cap,
+  // about one refresh.
+  static constexpr std::chrono::milliseconds kIdleFrameInterval{16};
+  // The MVP the swapchain images were last rendered with.
+  std::optional<std::array<float, 16>> damagedMvp;
+  // What the last recorded main window frame redrew.
+  VkRect2D lastRenderArea{};
+  struct DirtyRegionStats {
+    uint64_t frames = 0;
+    uint64_t skipped = 0;
+    uint64_t partial = 0;
+    uint64_t pixelsRedrawn = 0;
+    uint64_t pixelsTotal = 0;
+  } dirtyStats;
+
+  // See frameCommandStats(); commandTotals adds up every command buffer
+  // recorded, for all targets.
+  CommandStats frameCommands;
+  CommandStats commandTotals;
+  uint64_t encodedCommandBuffers = 0;
+
+  /*
+   * Swapchain images waiting for the present of the current render() call.
+   * target is null for the main window.
+   */
+  struct PendingPresents {
+    std::vector<VkSwapchainKHR> swapChains;
+    std::vector<uint32_t> imageIndices;
+    std::vector<VkSemaphore> waitSemaphores;
+    std::vector<RenderTarget *> targets;
+    std::vector<VkResult> results;
+    // No rectangles means the whole image changed.
+    std::vector<VkPresentRegionKHR> regions;
+
+    void add(VkSwapchainKHR swapChain, uint32_t imageIndex,
+             VkSemaphore waitSemaphore, RenderTarget *target,
+             const std::vector<VkRectLayerKHR> *changed = nullptr) {
+      swapChains.push_back(swapChain);
+      imageIndices.push_back(imageIndex);
+      waitSemaphores.push_back(waitSemaphore);
+      targets.push_back(target);
+      VkPresentRegionKHR region{};
+      if (changed != nullptr) {
+        region.rectangleCount = changed->size();
+        region.pRectangles = changed->data();
+      }
+      regions.push_back(region);
+    }
+    void clear() {
+      swapChains.clear();
+      imageIndices.clear();
+      waitSemaphores.clear();
+      targets.clear();
+      regions.clear();
+    }
+  } pendingPresents;
+
   uint32_t currentFrame = 0;
   bool orientationChanged = false;
   VkSurfaceTransformFlagBitsKHR pretransformFlag;
+  VulkanObjectCounts objectCounts;
+
+  // Released objects outlive the frames in flight that may still use them.
+  SamplerCache samplerCache{MAX_FRAMES_IN_FLIGHT};
+  ImageViewCache imageViewCache{MAX_FRAMES_IN_FLIGHT};
+  RenderPassCache renderPassCache{MAX_FRAMES_IN_FLIGHT};
+  FramebufferCache framebufferCache{MAX_FRAMES_IN_FLIGHT};
 };
 
 void HelloVK::initVulkan() {
@@ -293,6 +886,34 @@ void HelloVK::initVulkan() {
   createDescriptorSets();
   createGraphicsPipeline();
   createFramebuffers();
+  if (stereo) {
+    createStereoPipelines();
+    createStereoTarget();
+  }
+  createCommandPool();
+  createCommandBuffer();
+  createSyncObjects();
+  initialized = true;
+}
+
+/*
+ * Headless setup: no surface and no swapchain. Rendering goes to offscreen
+ * targets in swapChainImageFormat, which is RGBA8 here since every Vulkan
+ * implementation supports it as colour attachment and transfer source.
+ */
+void HelloVK::initVulkanHeadless(AAssetManager *newManager) {
+  assetManager = newManager;
+  swapChainImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+  createInstance();
+  pickPhysicalDevice();
+  createLogicalDeviceAndQueue();
+  setupDebugMessenger();
+  createRenderPass();
+  createDescriptorSetLayout();
+  createUniformBuffers();
+  createDescriptorPool();
+  createDescriptorSets();
+  createGraphicsPipeline();
   createCommandPool();
   createCommandBuffer();
   createSyncObjects();
@@ -352,16 +973,21 @@ uint32_t HelloVK::findMemoryType(uint32_t typeFilter,
 }
 
 void HelloVK::createUniformBuffers() {
-  VkDeviceSize bufferSize = sizeof(UniformBufferObject);
+  VkDeviceSize bufferSize = sizeof(UniformBufferObject) * viewCount;
 
   uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
   uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+  uniformBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
 
+  // The buffers stay mapped for their whole lifetime so the MVP can be written
+  // right before submission without a map/unmap round trip.
   for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
     createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
                  uniformBuffers[i], uniformBuffersMemory[i]);
+    VK_CHECK(vkMapMemory(device, uniformBuffersMemory[i], 0, bufferSize, 0,
+                         &uniformBuffersMapped[i]));
   }
 }
 
@@ -385,7 +1011,20 @@ void HelloVK::createDescriptorSetLayout() {
 void HelloVK::reset(ANativeWindow *newWindow, AAssetManager *newManager) {
   window.reset(newWindow);
   assetManager = newManager;
+
+  // Revert any scaled buffer geometry so the native window size can be read.
+  ANativeWindow_setBuffersGeometry(window.get(), 0, 0, 0);
+  nativeWindowWidth = ANativeWindow_getWidth(window.get());
+  nativeWindowHeight = ANativeWindow_getHeight(window.get());
+  resolutionChanged = effectiveResolutionScale() != 1.f;
+
   if (initialized) {
+    // The swapchain was created for the old surface, and both go before the
+    // new surface is created.
+    vkDeviceWaitIdle(device);
+    cleanupSwapChain();
+    vkDestroySurfaceKHR(instance, surface, nullptr);
+    objectCounts.surfaces--;
     createSurface();
     recreateSwapChain();
   }
@@ -393,19 +1032,115 @@ void HelloVK::reset(ANativeWindow *newWindow, AAssetManager *newManager) {
 
 void HelloVK::recreateSwapChain() {
   vkDeviceWaitIdle(device);
+  VkFormat oldFormat = swapChainImageFormat;
   cleanupSwapChain();
   createSwapChain();
+  if (swapChainImageFormat != oldFormat) {
+    rebuildForSurfaceFormat();
+  }
   createImageViews();
   createFramebuffers();
+  if (stereo) {
+    createStereoTarget();
+  }
+  if (captureEnabled) {
+    createCaptureResources();
+  }
+  if (!staticLayers.empty()) {
+    createLayerImage();
+  }
+}
+
+/*
+ * The swapchain came back in another format, after a power profile change.
+ * The render passes, the pipelines built against them and the images of the
+ * additional targets were made for the old one. Window targets get their
+ * swapchains back on their next frame. The device is idle.
+ */
+void HelloVK::rebuildForSurfaceFormat() {
+  LOGI("Swapchain format is now %d, rebuilding render passes and pipelines",
+       swapChainImageFormat);
+  for (auto &target : targets) {
+    if (target->surface != VK_NULL_HANDLE) {
+      destroyTargetSwapChain(*target);
+      target->outOfDate = true;
+      target->swapChainFailed = false;
+    } else {
+      destroyOffscreenTarget(target->offscreen);
+    }
+  }
+  if (alternateRenderPass != VK_NULL_HANDLE) {
+    renderPassCache.release(alternateRenderPass);
+    alternateRenderPass = VK_NULL_HANDLE;
+  }
+  destroyStereoPipelines();
+  vkDestroyPipeline(device, graphicsPipeline, nullptr);
+  vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+  renderPassCache.release(renderPass);
+  if (updateRenderPass != VK_NULL_HANDLE) {
+    renderPassCache.release(updateRenderPass);
+  }
+
+  createRenderPass();
+  createGraphicsPipeline();
+  if (stereo) {
+    createStereoPipelines();
+  }
+  // The layers keep their format, only compositing targets renderPass.
+  if (layerCompositePipeline != VK_NULL_HANDLE) {
+    vkDestroyPipeline(device, layerCompositePipeline, nullptr);
+    createLayerCompositePipeline();
+  }
+  for (auto &target : targets) {
+    if (target->surface == VK_NULL_HANDLE) {
+      createOffscreenTarget(target->extent, target->offscreen);
+    }
+  }
 }
 
 void HelloVK::render() {
+  if (powerProfileChanged) {
+    applyPowerProfile();
+  }
+  paceFrame();
+  double cpuStart = threadCpuSeconds();
+  if (resolutionChanged) {
+    applyResolutionScale();
+  }
   if (orientationChanged) {
     onOrientationChange();
   }
 
   vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE,
                   UINT64_MAX);
+  if (captureEnabled) {
+    collectCapture(currentFrame);
+  }
+  collectCaches();
+  advanceClearColor();
+  if (dirtyRegions) {
+    // Latched early so a new transform is part of this frame's damage.
+    updateUniformBuffer(currentFrame);
+    if (!clearColorOverride) {
+      damage.addFull();
+    }
+    dirtyStats.frames++;
+    if (!damage.hasDamage()) {
+      // Every image already shows the current frame, so only the main
+      // window's frame is skipped; the additional targets keep their own
+      // schedule. Without a frame rate cap nothing else paces the loop.
+      dirtyStats.skipped++;
+      dirtyStats.pixelsTotal +=
+          uint64_t(swapChainExtent.width) * swapChainExtent.height;
+      pendingPresents.clear();
+      submitDueTargets();
+      presentBatch();
+      if (effectiveFrameRateCap() == 0) {
+        std::this_thread::sleep_for(kIdleFrameInterval);
+      }
+      return;
+    }
+  }
   uint32_t imageIndex;
   VkResult result = vkAcquireNextImageKHR(
       device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame],
@@ -416,13 +1151,21 @@ void HelloVK::render() {
   }
   assert(result == VK_SUCCESS ||
          result == VK_SUBOPTIMAL_KHR);  // failed to acquire swap chain image
-  updateUniformBuffer(currentFrame);
 
   vkResetFences(device, 1, &inFlightFences[currentFrame]);
   vkResetCommandBuffer(commandBuffers[currentFrame], 0);
 
   recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
 
+  // Late latch: the uniform buffer is only read once the command buffer
+  // executes, so the freshest view transform is written after recording.
+  if (!dirtyRegions) {
+    updateUniformBuffer(currentFrame);
+  }
+  if (commandCapture) {
+    commandCapture->writeFrame(capturedCommands);
+  }
+
   VkSubmitInfo submitInfo{};
   submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
@@ -441,19 +1184,13 @@ void HelloVK::render() {
   VK_CHECK(vkQueueSubmit(graphicsQueue, 1, &submitInfo,
                          inFlightFences[currentFrame]));
 
-  VkPresentInfoKHR presentInfo{};
-  presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-
-  presentInfo.waitSemaphoreCount = 1;
-  presentInfo.pWaitSemaphores = signalSemaphores;
-
-  VkSwapchainKHR swapChains[] = {swapChain};
-  presentInfo.swapchainCount = 1;
-  presentInfo.pSwapchains = swapChains;
-  presentInfo.pImageIndices = &imageIndex;
-  presentInfo.pResults = nullptr;
-
-  result = vkQueuePresentKHR(presentQueue, &presentInfo);
+  // Additional targets due this frame go out with the same present.
+  pendingPresents.clear();
+  pendingPresents.add(swapChain, imageIndex, signalSemaphores[0], nullptr,
+                      dirtyRegions ? &damage.changedRects() : nullptr);
+  submitDueTargets();
+  result = presentBatch();
+  recordInputLatency();
   if (result == VK_SUBOPTIMAL_KHR) {
     orientationChanged = true;
   } else if (result == VK_ERROR_OUT_OF_DATE_KHR) {
@@ -461,368 +1198,1473 @@ void HelloVK::render() {
   } else {
     assert(result == VK_SUCCESS);  // failed to present swap chain image!
   }
-  currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+  usage.frames++;
+  usage.cpuSeconds += threadCpuSeconds() - cpuStart;
+  usage.attachmentBytes += uint64_t(lastRenderArea.extent.width) *
+                           lastRenderArea.extent.height *
+                           colorFormatSize(swapChainImageFormat);
+  currentFrame = (currentFrame + 1) % framesInFlight;
 }
 
-/*
- * getPrerotationMatrix handles screen rotation with 3 hardcoded rotation
- * matrices (detailed below). We skip the 180 degrees rotation.
- */
-void getPrerotationMatrix(const VkSurfaceCapabilitiesKHR &capabilities,
-                          const VkSurfaceTransformFlagBitsKHR &pretransformFlag,
-                          std::array<float, 16> &mat) {
-  // mat is initialized to the identity matrix
-  mat = {1., 0., 0., 0., 0., 1., 0., 0., 0., 0., 1., 0., 0., 0., 0., 1.};
-  if (pretransformFlag & VK_SURFACE_TRANSFORM_ROTATE_90_BIT_KHR) {
-    // mat is set to a 90 deg rotation matrix
-    mat = {0., 1., 0., 0., -1., 0, 0., 0., 0., 0., 1., 0., 0., 0., 0., 1.};
-  }
+void HelloVK::setFrameRateCap(uint32_t framesPerSecond) {
+  frameRateCap = framesPerSecond;
+}
 
-  else if (pretransformFlag & VK_SURFACE_TRANSFORM_ROTATE_270_BIT_KHR) {
-    // mat is set to 270 deg rotation matrix
-    mat = {0., -1., 0., 0., 1., 0, 0., 0., 0., 0., 1., 0., 0., 0., 0., 1.};
+void HelloVK::setResolutionScale(float scale) {
+  float effective = effectiveResolutionScale();
+  resolutionScale = std::clamp(scale, 0.25f, 1.f);
+  if (effectiveResolutionScale() != effective) {
+    resolutionChanged = true;
   }
 }
 
-void HelloVK::createDescriptorPool() {
-  VkDescriptorPoolSize poolSize{};
-  poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-  poolSize.descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+/*
+ * Fewer frames in flight trade throughput for lower latency and less queued
+ * GPU work. Slots above the new count are simply left idle; their fences stay
+ * signaled once their last submission retires.
+ */
+void HelloVK::setFramesInFlight(uint32_t count) {
+  framesInFlight = std::clamp(count, 1u, (uint32_t)MAX_FRAMES_IN_FLIGHT);
+  currentFrame %= framesInFlight;
+}
 
-  VkDescriptorPoolCreateInfo poolInfo{};
-  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-  poolInfo.poolSizeCount = 1;
-  poolInfo.pPoolSizes = &poolSize;
-  poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+// Sleeps so that frames start no faster than the frame rate cap allows.
+void HelloVK::paceFrame() {
+  uint32_t cap = effectiveFrameRateCap();
+  if (cap == 0) {
+    return;
+  }
+  auto interval = std::chrono::nanoseconds(1000000000 / cap);
+  auto now = std::chrono::steady_clock::now();
+  if (nextFrameTime > now) {
+    std::this_thread::sleep_until(nextFrameTime);
+  }
+  nextFrameTime = std::max(now, nextFrameTime) + interval;
+}
 
-  VK_CHECK(vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool));
+uint32_t HelloVK::effectiveFrameRateCap() const {
+  if (power.maxFrameRate == 0) {
+    return frameRateCap;
+  }
+  return frameRateCap == 0 ? power.maxFrameRate
+                           : std::min(frameRateCap, power.maxFrameRate);
 }
 
-void HelloVK::createDescriptorSets() {
-  std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT,
-                                             descriptorSetLayout);
-  VkDescriptorSetAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-  allocInfo.descriptorPool = descriptorPool;
-  allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-  allocInfo.pSetLayouts = layouts.data();
+float HelloVK::effectiveResolutionScale() const {
+  return std::min(resolutionScale, power.maxResolutionScale);
+}
 
-  descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
-  VK_CHECK(vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()));
+void HelloVK::setPowerProfile(const PowerProfile &profile) {
+  float scale = effectiveResolutionScale();
+  logPowerUsage();
+  previousPower = power;
+  previousUsage = powerUsage();
+  power = profile;
+  usage = {};
+  usageStart = std::chrono::steady_clock::now();
+  if (effectiveResolutionScale() != scale) {
+    resolutionChanged = true;
+  }
+  powerProfileChanged = true;
+}
 
-  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-    VkDescriptorBufferInfo bufferInfo{};
-    bufferInfo.buffer = uniformBuffers[i];
-    bufferInfo.offset = 0;
-    bufferInfo.range = sizeof(UniformBufferObject);
+/*
+ * The frame rate and resolution limits need nothing here: paceFrame() reads
+ * the cap and render() applies the resolution change setPowerProfile()
+ * flagged. Capture readbacks are an optional pass and assume 4 byte pixels,
+ * so they stop before the swapchain can change format. The format itself is
+ * picked by createSwapChain(), so a rebuild applies it.
+ */
+void HelloVK::applyPowerProfile() {
+  powerProfileChanged = false;
+  LOGI("Power profile: %s", power.name);
+  if (captureEnabled && (!power.optionalPasses || power.lowBitDepth)) {
+    LOGI("Frame capture is not available in the %s profile", power.name);
+    stopCapture();
+  }
+  SwapChainSupportDetails swapChainSupport =
+      querySwapChainSupport(physicalDevice);
+  if (chooseSwapSurfaceFormat(swapChainSupport.formats).format !=
+      swapChainImageFormat) {
+    // Done together with a resolution change when there is one.
+    resolutionChanged = true;
+  }
+}
 
-    VkWriteDescriptorSet descriptorWrite{};
-    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWrite.dstSet = descriptorSets[i];
-    descriptorWrite.dstBinding = 0;
-    descriptorWrite.dstArrayElement = 0;
-    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    descriptorWrite.descriptorCount = 1;
-    descriptorWrite.pBufferInfo = &bufferInfo;
+PowerUsage HelloVK::powerUsage() const {
+  PowerUsage result = usage;
+  result.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - usageStart)
+                       .count();
+  return result;
+}
 
-    vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+void HelloVK::logPowerUsage() const {
+  PowerUsage current = powerUsage();
+  LOGI("%s profile: %llu frames in %.1f s (%.1f fps), %.2f ms CPU per "
+       "frame, %.1f MB/s colour writes",
+       power.name, (unsigned long long)current.frames, current.seconds,
+       current.framesPerSecond(), current.cpuMsPerFrame(),
+       current.megabytesPerSecond());
+  if (previousUsage.frames == 0 || current.frames == 0) {
+    return;
   }
+  // Rates rather than totals, so periods of different length compare.
+  auto saving = [](double before, double after) {
+    return before > 0. ? (1. - after / before) * 100. : 0.;
+  };
+  LOGI("%s vs %s profile: %.0f%% less bandwidth, %.0f%% less CPU time",
+       power.name, previousPower.name,
+       saving(previousUsage.megabytesPerSecond(),
+              current.megabytesPerSecond()),
+       saving(previousUsage.cpuLoad(), current.cpuLoad()));
 }
 
-void HelloVK::updateUniformBuffer(uint32_t currentImage) {
+bool HelloVK::startCapture(const FrameCaptureConfig &config) {
+  assert(initialized);
+  if (!power.optionalPasses) {
+    LOGE("Frame capture is disabled by the %s profile", power.name);
+    return false;
+  }
+  bool fourBytesPerPixel = swapChainImageFormat == VK_FORMAT_B8G8R8A8_SRGB ||
+                           swapChainImageFormat == VK_FORMAT_B8G8R8A8_UNORM ||
+                           swapChainImageFormat == VK_FORMAT_R8G8B8A8_SRGB ||
+                           swapChainImageFormat == VK_FORMAT_R8G8B8A8_UNORM;
   SwapChainSupportDetails swapChainSupport =
       querySwapChainSupport(physicalDevice);
-  UniformBufferObject ubo{};
-  getPrerotationMatrix(swapChainSupport.capabilities, pretransformFlag,
-                       ubo.mvp);
-  void *data;
-  vkMapMemory(device, uniformBuffersMemory[currentImage], 0, sizeof(ubo), 0,
-              &data);
-  memcpy(data, &ubo, sizeof(ubo));
-  vkUnmapMemory(device, uniformBuffersMemory[currentImage]);
-}
+  if (!fourBytesPerPixel ||
+      !(swapChainSupport.capabilities.supportedUsageFlags &
+        VK_IMAGE_USAGE_TRANSFER_SRC_BIT)) {
+    LOGE("Frame capture is not supported for swapchain format %d",
+         swapChainImageFormat);
+    return false;
+  }
 
-void HelloVK::onOrientationChange() {
+  captureConfig = config;
+  captureConfig.everyNthFrame = std::max(1u, config.everyNthFrame);
+  frameWriter = std::make_unique<FrameWriter>(
+      config.directory, config.encoding, config.maxQueuedFrames,
+      config.workerThreadInit);
+  captureEnabled = true;
   recreateSwapChain();
-  orientationChanged = false;
+  LOGI("Capturing every %u frame(s) to %s", captureConfig.everyNthFrame,
+       config.directory.c_str());
+  return true;
 }
 
-void HelloVK::recordCommandBuffer(VkCommandBuffer commandBuffer,
-                                  uint32_t imageIndex) {
-  VkCommandBufferBeginInfo beginInfo{};
-  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-  beginInfo.flags = 0;
-  beginInfo.pInheritanceInfo = nullptr;
+void HelloVK::stopCapture() {
+  if (!captureEnabled) {
+    return;
+  }
+  captureEnabled = false;
+  // Collects the frames still in flight before the transfer usage is dropped.
+  recreateSwapChain();
 
-  VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+  FrameWriterStats stats = frameWriter->finish();
+  frameWriter.reset();
+  LOGI("Capture stopped: %llu frames written (%llu bytes), %llu dropped",
+       (unsigned long long)stats.written,
+       (unsigned long long)stats.bytesWritten,
+       (unsigned long long)stats.dropped);
+}
 
-  VkRenderPassBeginInfo renderPassInfo{};
-  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-  renderPassInfo.renderPass = renderPass;
-  renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
-  renderPassInfo.renderArea.offset = {0, 0};
-  renderPassInfo.renderArea.extent = swapChainExtent;
+void HelloVK::createCaptureResources() {
+  VkMemoryPropertyFlags properties = readbackMemoryProperties();
+  VkDeviceSize size =
+      (VkDeviceSize)swapChainExtent.width * swapChainExtent.height * 4;
+  captureSlots.resize(MAX_FRAMES_IN_FLIGHT);
+  for (CaptureSlot &slot : captureSlots) {
+    createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, properties,
+                 slot.buffer, slot.memory);
+    VK_CHECK(vkMapMemory(device, slot.memory, 0, size, 0, &slot.mapped));
+    slot.pending = false;
+    slot.extent = swapChainExtent;
+  }
+}
 
-  VkViewport viewport{};
-  viewport.width = (float)swapChainExtent.width;
-  viewport.height = (float)swapChainExtent.height;
-  viewport.minDepth = 0.0f;
-  viewport.maxDepth = 1.0f;
-  vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+// Callers make sure the device is idle, so pending copies are complete.
+void HelloVK::destroyCaptureResources() {
+  for (uint32_t i = 0; i < captureSlots.size(); i++) {
+    collectCapture(i);
+    vkUnmapMemory(device, captureSlots[i].memory);
+    vkDestroyBuffer(device, captureSlots[i].buffer, nullptr);
+    vkFreeMemory(device, captureSlots[i].memory, nullptr);
+  }
+  captureSlots.clear();
+}
 
-  VkRect2D scissor{};
-  scissor.extent = swapChainExtent;
-  vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+/*
+ * Copies the rendered swapchain image into the staging buffer of the current
+ * frame. The image leaves the render pass in PRESENT_SRC layout, goes through
+ * TRANSFER_SRC for the copy and is returned to PRESENT_SRC for presentation.
+ */
+void HelloVK::recordCapture(VkCommandBuffer commandBuffer,
+                            uint32_t imageIndex) {
+  CaptureSlot &slot = captureSlots[currentFrame];
+
+  VkImageMemoryBarrier toTransfer{};
+  toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  toTransfer.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  toTransfer.oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toTransfer.image = swapChainImages[imageIndex];
+  toTransfer.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  vkCmdPipelineBarrier(commandBuffer,
+                       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &toTransfer);
+
+  VkBufferImageCopy region{};
+  region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  region.imageExtent = {slot.extent.width, slot.extent.height, 1};
+  vkCmdCopyImageToBuffer(commandBuffer, swapChainImages[imageIndex],
+                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot.buffer, 1,
+                         &region);
+
+  VkImageMemoryBarrier toPresent = toTransfer;
+  toPresent.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  toPresent.dstAccessMask = 0;
+  toPresent.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  toPresent.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+  VkBufferMemoryBarrier toHost{};
+  toHost.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  toHost.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  toHost.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toHost.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toHost.buffer = slot.buffer;
+  toHost.offset = 0;
+  toHost.size = VK_WHOLE_SIZE;
+  vkCmdPipelineBarrier(
+      commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0,
+      nullptr, 1, &toHost, 1, &toPresent);
+
+  slot.pending = true;
+  slot.frameIndex = renderedFrames;
+}
 
-  static float grey;
-  grey += 0.005f;
-  if (grey > 1.0f) {
-    grey = 0.0f;
+/*
+ * Called once the fence of frame has signaled. Only a memcpy happens on the
+ * render thread; encoding and file I/O are left to the frame writer.
+ */
+void HelloVK::collectCapture(uint32_t frame) {
+  if (frame >= captureSlots.size() || !captureSlots[frame].pending) {
+    return;
   }
-  VkClearValue clearColor = {{{grey, grey, grey, 1.0f}}};
+  CaptureSlot &slot = captureSlots[frame];
+  slot.pending = false;
+
+  CapturedFrame captured;
+  captured.index = slot.frameIndex;
+  captured.width = slot.extent.width;
+  captured.height = slot.extent.height;
+  captured.bgra = swapChainImageFormat == VK_FORMAT_B8G8R8A8_SRGB ||
+                  swapChainImageFormat == VK_FORMAT_B8G8R8A8_UNORM;
+  captured.pixels =
+      frameWriter->acquireBuffer((size_t)captured.width * captured.height * 4);
+  memcpy(captured.pixels.data(), slot.mapped, captured.pixels.size());
+  frameWriter->submit(std::move(captured));
+}
 
-  renderPassInfo.clearValueCount = 1;
-  renderPassInfo.pClearValues = &clearColor;
-  vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
-                       VK_SUBPASS_CONTENTS_INLINE);
-  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                    graphicsPipeline);
-  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                          pipelineLayout, 0, 1, &descriptorSets[currentFrame],
-                          0, nullptr);
-
-  vkCmdDraw(commandBuffer, 3, 1, 0, 0);
-  vkCmdEndRenderPass(commandBuffer);
-  VK_CHECK(vkEndCommandBuffer(commandBuffer));
+/*
+ * Creates a single sampled 2D image (or layered image when layers > 1) backed
+ * by device local memory. Returns the size of the allocation.
+ */
+VkDeviceSize HelloVK::createImage(VkExtent2D extent, uint32_t layers,
+                                  VkFormat format, VkImageUsageFlags usage,
+                                  VkImage &image, VkDeviceMemory &imageMemory) {
+  VkImageCreateInfo imageInfo{};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.format = format;
+  imageInfo.extent = {extent.width, extent.height, 1};
+  imageInfo.mipLevels = 1;
+  imageInfo.arrayLayers = layers;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.usage = usage;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  VK_CHECK(vkCreateImage(device, &imageInfo, nullptr, &image));
+
+  VkMemoryRequirements memRequirements;
+  vkGetImageMemoryRequirements(device, image, &memRequirements);
+
+  VkMemoryAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = memRequirements.size;
+  allocInfo.memoryTypeIndex = findMemoryType(
+      memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  VK_CHECK(vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory));
+  vkBindImageMemory(device, image, imageMemory, 0);
+  return memRequirements.size;
 }
 
-void HelloVK::cleanupSwapChain() {
-  for (size_t i = 0; i < swapChainFramebuffers.size(); i++) {
-    vkDestroyFramebuffer(device, swapChainFramebuffers[i], nullptr);
+/*
+ * Readback memory prefers HOST_CACHED: the CPU reads every byte back and
+ * uncached (write combined) reads are very slow on mobile GPUs.
+ */
+VkMemoryPropertyFlags HelloVK::readbackMemoryProperties() {
+  VkPhysicalDeviceMemoryProperties memProperties;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+  VkMemoryPropertyFlags coherent = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  VkMemoryPropertyFlags cached = coherent | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+  for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+    if ((memProperties.memoryTypes[i].propertyFlags & cached) == cached) {
+      return cached;
+    }
   }
+  return coherent;
+}
 
-  for (size_t i = 0; i < swapChainImageViews.size(); i++) {
-    vkDestroyImageView(device, swapChainImageViews[i], nullptr);
+// Colour attachment views; the format is the swapchain's.
+constexpr ImageViewDesc kColorView = ImageViewDesc{};
+static_assert(kColorView.valid(), "invalid colour view");
+
+// Every sampler HelloVK creates, hashed at compile time. samplerCache looks
+// them up by entry.
+enum SamplerEntry : size_t {
+  kComposeSampler,
+  // Layer texels map 1:1 onto swapchain pixels.
+  kLayerSampler,
+};
+constexpr auto kSamplers = makeDescTable(
+    SamplerDesc{},
+    SamplerDesc{}.withFilter(VK_FILTER_NEAREST,
+                             VK_SAMPLER_MIPMAP_MODE_NEAREST));
+static_assert(kSamplers.valid(), "invalid sampler");
+static_assert(kSamplers.unique(), "samplers share a hash");
+
+/*
+ * Creates a colour image in swapChainImageFormat that can be read back, with
+ * its view and framebuffer. Returns the size of the image allocation.
+ */
+VkDeviceSize HelloVK::createOffscreenTarget(VkExtent2D extent,
+                                            OffscreenTarget &target) {
+  target.extent = extent;
+  VkDeviceSize size = createImage(
+      extent, 1, swapChainImageFormat,
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+      target.image, target.memory);
+
+  VK_CHECK(imageViewCache.acquire(
+      target.image, kColorView.withFormat(swapChainImageFormat),
+      &target.view));
+
+  target.framebuffer = acquireFramebuffer(
+      renderPass, renderPassDesc, target.view,
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+      extent);
+  return size;
+}
+
+void HelloVK::destroyOffscreenTarget(OffscreenTarget &target) {
+  if (target.image == VK_NULL_HANDLE) {
+    return;
   }
+  releaseFramebuffer(target.framebuffer, target.view);
+  imageViewCache.release(target.view);
+  imageViewCache.releaseImage(target.image);
+  vkDestroyImage(device, target.image, nullptr);
+  vkFreeMemory(device, target.memory, nullptr);
+  target = {};
+}
 
-  vkDestroySwapchainKHR(device, swapChain, nullptr);
+void HelloVK::startOffscreenRendering(VkExtent2D extent) {
+  assert(initialized && surface == VK_NULL_HANDLE);  // needs headless init
+  destroyOffscreenTarget(offscreenTarget);
+  createOffscreenTarget(extent, offscreenTarget);
 }
 
-void HelloVK::cleanup() {
+void HelloVK::stopOffscreenRendering() {
+  if (offscreenTarget.image == VK_NULL_HANDLE) {
+    return;
+  }
   vkDeviceWaitIdle(device);
-  cleanupSwapChain();
-  vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+  destroyOffscreenTarget(offscreenTarget);
+}
 
-  vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+void HelloVK::renderOffscreenFrame() {
+  VkFence fence = submitOffscreenFrame();
+  VK_CHECK(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
+}
 
-  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-    vkDestroyBuffer(device, uniformBuffers[i], nullptr);
-    vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
-  }
+/*
+ * Submits the current scene for rendering into the offscreen target and
+ * returns the frame's fence. The transform is latched right before
+ * submission, like on the swapchain path but without pre-rotation.
+ */
+VkFence HelloVK::submitOffscreenFrame() {
+  assert(offscreenTarget.framebuffer != VK_NULL_HANDLE);
+  VkFence fence = inFlightFences[currentFrame];
+  VK_CHECK(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
+  VK_CHECK(vkResetFences(device, 1, &fence));
+  collectCaches();
+  advanceClearColor();
+
+  VkCommandBuffer commandBuffer = commandBuffers[currentFrame];
+  VK_CHECK(vkResetCommandBuffer(commandBuffer, 0));
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+  CommandEncoder encoder(commandBuffer);
+  recordRenderPass(encoder, offscreenTarget.framebuffer, offscreenTarget.view,
+                   offscreenTarget.extent, renderPass, graphicsPipeline,
+                   descriptorSets[currentFrame], frameClearColor);
+  VK_CHECK(vkEndCommandBuffer(commandBuffer));
+  commandTotals += encoder.stats();
+  encodedCommandBuffers++;
 
-  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-    vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
-    vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
-    vkDestroyFence(device, inFlightFences[i], nullptr);
+  UniformBufferObject ubo{};
+  viewTransform.latch(ubo.mvp);
+  memcpy(uniformBuffersMapped[currentFrame], &ubo, sizeof(ubo));
+  if (commandCapture) {
+    capturedCommands.mvp = ubo.mvp.toArray();
+    commandCapture->writeFrame(capturedCommands);
   }
-  vkDestroyCommandPool(device, commandPool, nullptr);
-  vkDestroyPipeline(device, graphicsPipeline, nullptr);
-  vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-  vkDestroyRenderPass(device, renderPass, nullptr);
-  vkDestroyDevice(device, nullptr);
-  if (enableValidationLayers) {
-    DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+
+  VkSubmitInfo submitInfo{};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &commandBuffer;
+  VK_CHECK(vkQueueSubmit(graphicsQueue, 1, &submitInfo, fence));
+  renderedFrames++;
+  currentFrame = (currentFrame + 1) % framesInFlight;
+  return fence;
+}
+
+bool HelloVK::startCommandCapture(const std::string &path) {
+  assert(initialized);
+  VkExtent2D extent =
+      surface != VK_NULL_HANDLE ? swapChainExtent : offscreenTarget.extent;
+  auto writer = std::make_unique<CommandStreamWriter>();
+  if (!writer->open(path, extent.width, extent.height)) {
+    LOGE("Cannot open command capture %s", path.c_str());
+    return false;
   }
-  vkDestroySurfaceKHR(instance, surface, nullptr);
-  vkDestroyInstance(instance, nullptr);
-  initialized = false;
+  commandCapture = std::move(writer);
+  LOGI("Capturing commands to %s", path.c_str());
+  return true;
 }
 
-void HelloVK::setupDebugMessenger() {
-  if (!enableValidationLayers) {
+void HelloVK::stopCommandCapture() {
+  if (!commandCapture) {
     return;
   }
-
-  VkDebugUtilsMessengerCreateInfoEXT createInfo{};
-  populateDebugMessengerCreateInfo(createInfo);
-
-  VK_CHECK(CreateDebugUtilsMessengerEXT(instance, &createInfo, nullptr,
-                                        &debugMessenger));
+  uint32_t frames = commandCapture->frames();
+  if (commandCapture->close()) {
+    LOGI("Command capture stopped: %u frames", frames);
+  } else {
+    LOGE("Command capture failed to write, the file is incomplete");
+  }
+  commandCapture.reset();
 }
 
-bool HelloVK::checkValidationLayerSupport() {
-  uint32_t layerCount;
-  vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
-
-  std::vector<VkLayerProperties> availableLayers(layerCount);
-  vkEnumerateInstanceLayerProperties(&layerCount, availableLayers.data());
-
-  for (const char *layerName : validationLayers) {
-    bool layerFound = false;
-    for (const auto &layerProperties : availableLayers) {
-      if (strcmp(layerName, layerProperties.layerName) == 0) {
-        layerFound = true;
-        break;
-      }
-    }
-
-    if (!layerFound) {
-      return false;
+/*
+ * Frames are submitted back to back with framesInFlight frames queued, so the
+ * replay measures throughput rather than latency. The scene overrides are
+ * cleared again afterwards.
+ */
+ReplayReport HelloVK::replayCommandStream(const CommandStream &stream,
+                                          uint32_t loops) {
+  assert(initialized && surface == VK_NULL_HANDLE);  // needs headless init
+  startOffscreenRendering({stream.width, stream.height});
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t loop = 0; loop < loops; loop++) {
+    for (const FrameCommands &frame : stream.frames) {
+      viewTransform.publish(mat4::fromArray(frame.mvp));
+      clearColorOverride = frame.clearColor;
+      drawList.assign(frame.draws.begin(), frame.draws.end());
+      submitOffscreenFrame();
     }
   }
-  return true;
+  vkDeviceWaitIdle(device);
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  stopOffscreenRendering();
+  clearColorOverride.reset();
+  drawList.clear();
+
+  ReplayReport report{};
+  report.frames = stream.frames.size() * loops;
+  report.seconds = seconds;
+  report.framesPerSecond = seconds > 0 ? report.frames / seconds : 0;
+  LOGI("Replay: %u frames of %ux%u in %.3f s (%.1f fps)", report.frames,
+       stream.width, stream.height, report.seconds, report.framesPerSecond);
+  return report;
 }
 
-std::vector<const char *> HelloVK::getRequiredExtensions(
-    bool enableValidationLayers) {
-  std::vector<const char *> extensions;
-  extensions.push_back("VK_KHR_surface");
-  extensions.push_back("VK_KHR_android_surface");
-  if (enableValidationLayers) {
-    extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+/*
+ * Renders config.frameCount frames into offscreen images and streams them to
+ * config.output as tightly packed RGBA8, one frame after the other.
+ *
+ * Each of the pipelineDepth slots owns a colour target, a staging buffer, a
+ * command buffer and a fence. While slot N renders, older slots are being
+ * read back and the frame writer thread writes even older frames, so GPU
+ * work, readback and output overlap. Output is strictly in frame order and
+ * never dropped: the writer applies back pressure instead.
+ */
+BatchReport HelloVK::renderOffscreenBatch(const BatchConfig &config) {
+  assert(initialized && surface == VK_NULL_HANDLE);  // needs headless init
+  const VkExtent2D extent = config.extent;
+  const VkDeviceSize frameBytes =
+      (VkDeviceSize)extent.width * extent.height * 4;
+
+  // Every slot holds a colour image and a staging buffer, and the writer may
+  // queue one more frame per slot: shrink the pipeline to fit the budget.
+  uint32_t depth = std::max(1u, config.pipelineDepth);
+  while (depth > 1 && depth * frameBytes * 3 > config.memoryBudgetBytes) {
+    depth--;
+  }
+  if (depth * frameBytes * 3 > config.memoryBudgetBytes) {
+    LOGE("Batch of %ux%u needs %llu bytes per frame, over the %llu byte budget",
+         extent.width, extent.height, (unsigned long long)(frameBytes * 3),
+         (unsigned long long)config.memoryBudgetBytes);
+    return BatchReport{};
   }
-  return extensions;
-}
 
-void HelloVK::createInstance() {
-  assert(!enableValidationLayers ||
-         checkValidationLayerSupport());  // validation layers requested, but
-                                          // not available!
-  auto requiredExtensions = getRequiredExtensions(enableValidationLayers);
+  struct BatchSlot {
+    OffscreenTarget target;
+    VkBuffer staging;
+    VkDeviceMemory stagingMemory;
+    void *mapped;
+    VkCommandBuffer commandBuffer;
+    VkFence fence;
+    bool busy;
+  };
+  std::vector<BatchSlot> slots(depth);
+  std::vector<VkCommandBuffer> batchCommandBuffers(depth);
 
-  VkApplicationInfo appInfo{};
-  appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-  appInfo.pApplicationName = "Hello Triangle";
-  appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
-  appInfo.pEngineName = "No Engine";
-  appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-  appInfo.apiVersion = VK_API_VERSION_1_0;
+  VkCommandBufferAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.commandPool = commandPool;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandBufferCount = depth;
+  VK_CHECK(vkAllocateCommandBuffers(device, &allocInfo,
+                                    batchCommandBuffers.data()));
+
+  uint64_t memoryHeld = 0;
+  VkMemoryPropertyFlags readbackProperties = readbackMemoryProperties();
+  for (uint32_t i = 0; i < depth; i++) {
+    BatchSlot &slot = slots[i];
+    memoryHeld += createOffscreenTarget(extent, slot.target);
+
+    createBuffer(frameBytes, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 readbackProperties, slot.staging, slot.stagingMemory);
+    VK_CHECK(vkMapMemory(device, slot.stagingMemory, 0, frameBytes, 0,
+                         &slot.mapped));
+    memoryHeld += frameBytes;
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VK_CHECK(vkCreateFence(device, &fenceInfo, nullptr, &slot.fence));
+    slot.commandBuffer = batchCommandBuffers[i];
+    slot.busy = false;
+  }
+  // Frames queued in the writer.
+  memoryHeld += depth * frameBytes;
 
-  VkInstanceCreateInfo createInfo{};
-  createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-  createInfo.pApplicationInfo = &appInfo;
-  createInfo.enabledExtensionCount = (uint32_t)requiredExtensions.size();
-  createInfo.ppEnabledExtensionNames = requiredExtensions.data();
-  createInfo.pApplicationInfo = &appInfo;
+  // The transform does not change during a batch, so all slots share the
+  // first uniform buffer and it is written once up front. There is no
+  // pre-rotation offscreen.
+  currentFrame = 0;
+  UniformBufferObject ubo{};
+  viewTransform.latch(ubo.mvp);
+  memcpy(uniformBuffersMapped[0], &ubo, sizeof(ubo));
+
+  FrameWriter writer(config.output, depth, config.workerThreadInit);
+  auto retire = [&](BatchSlot &slot, uint64_t frame) {
+    VK_CHECK(vkWaitForFences(device, 1, &slot.fence, VK_TRUE, UINT64_MAX));
+    VK_CHECK(vkResetFences(device, 1, &slot.fence));
+    CapturedFrame captured;
+    captured.index = frame;
+    captured.width = extent.width;
+    captured.height = extent.height;
+    captured.bgra = swapChainImageFormat == VK_FORMAT_B8G8R8A8_UNORM ||
+                    swapChainImageFormat == VK_FORMAT_B8G8R8A8_SRGB;
+    captured.pixels = writer.acquireBuffer(frameBytes);
+    memcpy(captured.pixels.data(), slot.mapped, frameBytes);
+    writer.submitBlocking(std::move(captured));
+    slot.busy = false;
+  };
+
+  auto interval = config.maxFramesPerSecond > 0
+                      ? std::chrono::nanoseconds(1000000000 /
+                                                 config.maxFramesPerSecond)
+                      : std::chrono::nanoseconds(0);
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t frame = 0; frame < config.frameCount; frame++) {
+    BatchSlot &slot = slots[frame % depth];
+    if (slot.busy) {
+      retire(slot, frame - depth);
+    }
+    if (interval.count() > 0) {
+      std::this_thread::sleep_until(start + interval * frame);
+    }
 
-  if (enableValidationLayers) {
-    VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo{};
-    createInfo.enabledLayerCount =
-        static_cast<uint32_t>(validationLayers.size());
-    createInfo.ppEnabledLayerNames = validationLayers.data();
-    populateDebugMessengerCreateInfo(debugCreateInfo);
-    createInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT *)&debugCreateInfo;
-  } else {
-    createInfo.enabledLayerCount = 0;
-    createInfo.pNext = nullptr;
+    advanceClearColor();
+    VkCommandBuffer commandBuffer = slot.commandBuffer;
+    VK_CHECK(vkResetCommandBuffer(commandBuffer, 0));
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+    CommandEncoder encoder(commandBuffer);
+    recordRenderPass(encoder, slot.target.framebuffer, slot.target.view,
+                     extent, renderPass, graphicsPipeline,
+                     descriptorSets[currentFrame], frameClearColor);
+    commandTotals += encoder.stats();
+    encodedCommandBuffers++;
+
+    // The render pass leaves the image in TRANSFER_SRC layout; make the
+    // colour writes visible to the copy.
+    VkImageMemoryBarrier toTransfer{};
+    toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    toTransfer.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    toTransfer.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toTransfer.image = slot.target.image;
+    toTransfer.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                         nullptr, 1, &toTransfer);
+
+    VkBufferImageCopy region{};
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageExtent = {extent.width, extent.height, 1};
+    vkCmdCopyImageToBuffer(commandBuffer, slot.target.image,
+                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot.staging,
+                           1, &region);
+
+    VkBufferMemoryBarrier toHost{};
+    toHost.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    toHost.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    toHost.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toHost.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toHost.buffer = slot.staging;
+    toHost.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &toHost,
+                         0, nullptr);
+    VK_CHECK(vkEndCommandBuffer(commandBuffer));
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    VK_CHECK(vkQueueSubmit(graphicsQueue, 1, &submitInfo, slot.fence));
+    slot.busy = true;
   }
-  VK_CHECK(vkCreateInstance(&createInfo, nullptr, &instance));
 
-  uint32_t extensionCount = 0;
-  vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
-  std::vector<VkExtensionProperties> extensions(extensionCount);
-  vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount,
-                                         extensions.data());
-  LOGI("available extensions");
-  for (const auto &extension : extensions) {
-    LOGI("\t %s", extension.extensionName);
+  // Drain the pipeline oldest first to keep the output in order.
+  uint32_t firstPending =
+      config.frameCount > depth ? config.frameCount - depth : 0;
+  for (uint32_t frame = firstPending; frame < config.frameCount; frame++) {
+    if (slots[frame % depth].busy) {
+      retire(slots[frame % depth], frame);
+    }
   }
+  FrameWriterStats stats = writer.finish();
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  for (BatchSlot &slot : slots) {
+    vkDestroyFence(device, slot.fence, nullptr);
+    vkUnmapMemory(device, slot.stagingMemory);
+    vkDestroyBuffer(device, slot.staging, nullptr);
+    vkFreeMemory(device, slot.stagingMemory, nullptr);
+    destroyOffscreenTarget(slot.target);
+  }
+  vkFreeCommandBuffers(device, commandPool, depth, batchCommandBuffers.data());
+
+  BatchReport report{};
+  report.frames = (uint32_t)stats.written;
+  report.seconds = seconds;
+  report.framesPerSecond = seconds > 0 ? stats.written / seconds : 0;
+  report.pipelineDepth = depth;
+  report.memoryBytes = memoryHeld;
+  report.bytesWritten = stats.bytesWritten;
+  LOGI("Batch: %u frames of %ux%u in %.2f s (%.1f fps), depth %u, "
+       "%.1f MiB held, %llu bytes written",
+       report.frames, extent.width, extent.height, report.seconds,
+       report.framesPerSecond, report.pipelineDepth,
+       report.memoryBytes / (1024.0 * 1024.0),
+       (unsigned long long)report.bytesWritten);
+  return report;
 }
 
 /*
- * createSurface can only be called after the android ecosystem has had the
- * chance to provide a native window. This happens after the APP_CMD_START event
- * has had a chance to be called.
- *
- * Notice the window.get() call which is only valid after window has been set to
- * a non null value
+ * Resolution scaling is done by shrinking the window buffers: the swapchain is
+ * created at the smaller size and the compositor upscales it for free on the
+ * display hardware.
  */
-void HelloVK::createSurface() {
-  assert(window != nullptr);  // window not initialized
-  const VkAndroidSurfaceCreateInfoKHR create_info{
-      .sType = VK_STRUCTURE_TYPE_ANDROID_SURFACE_CREATE_INFO_KHR,
-      .pNext = nullptr,
-      .flags = 0,
-      .window = window.get()};
+void HelloVK::applyResolutionScale() {
+  float scale = effectiveResolutionScale();
+  int32_t width = std::max(1, (int32_t)(nativeWindowWidth * scale));
+  int32_t height = std::max(1, (int32_t)(nativeWindowHeight * scale));
+  ANativeWindow_setBuffersGeometry(window.get(), width, height, 0);
+  resolutionChanged = false;
 
-  VK_CHECK(vkCreateAndroidSurfaceKHR(instance, &create_info,
-                                     nullptr /* pAllocator */, &surface));
+  vkDeviceWaitIdle(device);
+  establishDisplaySizeIdentity();
+  recreateSwapChain();
 }
 
-// BEGIN DEVICE SUITABILITY
-// Functions to find a suitable physical device to execute Vulkan commands.
+/*
+ * getPrerotationMatrix handles screen rotation with 3 hardcoded rotation
+ * matrices (detailed below). We skip the 180 degrees rotation.
+ */
+mat4 getPrerotationMatrix(
+    const VkSurfaceTransformFlagBitsKHR &pretransformFlag) {
+  // mat is initialized to the identity matrix
+  mat4 mat;
+  if (pretransformFlag & VK_SURFACE_TRANSFORM_ROTATE_90_BIT_KHR) {
+    // mat is set to a 90 deg rotation matrix
+    mat.col[0] = {0., 1., 0., 0.};
+    mat.col[1] = {-1., 0., 0., 0.};
+  }
 
-QueueFamilyIndices HelloVK::findQueueFamilies(VkPhysicalDevice device) {
-  QueueFamilyIndices indices;
+  else if (pretransformFlag & VK_SURFACE_TRANSFORM_ROTATE_270_BIT_KHR) {
+    // mat is set to 270 deg rotation matrix
+    mat.col[0] = {0., -1., 0., 0.};
+    mat.col[1] = {1., 0., 0., 0.};
+  }
+  return mat;
+}
 
-  uint32_t queueFamilyCount = 0;
-  vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+void HelloVK::createDescriptorPool() {
+  VkDescriptorPoolSize poolSize{};
+  poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  poolSize.descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
 
-  std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-  vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount,
-                                           queueFamilies.data());
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
 
-  int i = 0;
-  for (const auto &queueFamily : queueFamilies) {
-    if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-      indices.graphicsFamily = i;
-    }
+  VK_CHECK(vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool));
+}
 
-    VkBool32 presentSupport = false;
-    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-    if (presentSupport) {
-      indices.presentFamily = i;
-    }
+void HelloVK::createDescriptorSets() {
+  std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT,
+                                             descriptorSetLayout);
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+  allocInfo.pSetLayouts = layouts.data();
 
-    if (indices.isComplete()) {
-      break;
-    }
+  descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+  VK_CHECK(vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()));
 
-    i++;
-  }
-  return indices;
-}
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    VkDescriptorBufferInfo bufferInfo{};
+    bufferInfo.buffer = uniformBuffers[i];
+    bufferInfo.offset = 0;
+    bufferInfo.range = sizeof(UniformBufferObject) * viewCount;
 
-bool HelloVK::checkDeviceExtensionSupport(VkPhysicalDevice device) {
-  uint32_t extensionCount;
-  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
-                                       nullptr);
+    VkWriteDescriptorSet descriptorWrite{};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = descriptorSets[i];
+    descriptorWrite.dstBinding = 0;
+    descriptorWrite.dstArrayElement = 0;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.pBufferInfo = &bufferInfo;
 
-  std::vector<VkExtensionProperties> availableExtensions(extensionCount);
-  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
-                                       availableExtensions.data());
+    vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+  }
+}
 
-  std::set<std::string> requiredExtensions(deviceExtensions.begin(),
-                                           deviceExtensions.end());
+void HelloVK::setViewTransform(const mat4 &transform) {
+  viewTransform.publish(transform);
+}
 
-  for (const auto &extension : availableExtensions) {
-    requiredExtensions.erase(extension.extensionName);
-  }
+void HelloVK::setStereo(bool enabled) {
+  assert(!initialized);  // device features are fixed at creation
+  stereoRequested = enabled;
+}
 
-  return requiredExtensions.empty();
+void HelloVK::setHalfPrecision(bool allowed) {
+  assert(!initialized);  // device features are fixed at creation
+  halfPrecisionAllowed = allowed;
 }
 
-SwapChainSupportDetails HelloVK::querySwapChainSupport(
-    VkPhysicalDevice device) {
-  SwapChainSupportDetails details;
+void HelloVK::setImagelessFramebuffers(bool allowed) {
+  assert(!initialized);  // device features are fixed at creation
+  imagelessAllowed = allowed;
+}
 
-  vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface,
-                                            &details.capabilities);
+void HelloVK::setEyeTransforms(const mat4 &left, const mat4 &right) {
+  eyeTransforms[0].publish(left);
+  eyeTransforms[1].publish(right);
+}
 
-  uint32_t formatCount;
-  vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, nullptr);
+void HelloVK::setClearColor(const std::array<float, 4> &rgba) {
+  if (clearColorOverride != rgba) {
+    damage.addFull();
+  }
+  clearColorOverride = rgba;
+}
 
-  if (formatCount != 0) {
-    details.formats.resize(formatCount);
-    vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount,
-                                         details.formats.data());
+void HelloVK::setDrawList(std::vector<DrawCommand> draws) {
+  std::vector<DrawCommand> oldDraws = std::move(drawList);
+  drawList = std::move(draws);
+  if (damagedMvp) {
+    damageScene(*damagedMvp, oldDraws);
+  } else {
+    damage.addFull();
   }
+}
 
-  uint32_t presentModeCount;
-  vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount,
-                                            nullptr);
+// The triangle of shader.vert.
+constexpr std::array<vec3, kSceneVertexCount> kSceneVertices = {
+    vec3{0.f, -0.5f, 0.f}, vec3{0.5f, 0.5f, 0.f}, vec3{-0.5f, 0.5f, 0.f}};
 
-  if (presentModeCount != 0) {
+/*
+ * Swapchain image pixels that draws cover with mvp, rounded outwards. An
+ * empty list draws the triangle. Vertices behind the eye make it the whole
+ * image.
+ */
+VkRect2D HelloVK::sceneBounds(const std::array<float, 16> &mvp,
+                              const std::vector<DrawCommand> &draws) const {
+  static const std::vector<DrawCommand> kTriangle = {{3, 1, 0, 0}};
+  mat4 transform = mat4::fromArray(mvp);
+  float x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+  for (const DrawCommand &draw : draws.empty() ? kTriangle : draws) {
+    // A triangle list draws nothing with fewer than three vertices.
+    if (draw.instanceCount == 0 || draw.vertexCount < 3) {
+      continue;
+    }
+    uint32_t end = std::min(draw.firstVertex + draw.vertexCount,
+                            kSceneVertexCount);
+    for (uint32_t i = draw.firstVertex; i < end; i++) {
+      const vec3 &p = kSceneVertices[i];
+      vec4 position = transform * vec4{p.x, p.y, p.z, 1.f};
+      if (position.w <= 0.f) {
+        return {{0, 0}, swapChainExtent};
+      }
+      // Clamped so far off screen vertices stay representable.
+      float width = swapChainExtent.width;
+      float height = swapChainExtent.height;
+      float x = std::clamp((position.x / position.w * 0.5f + 0.5f) * width,
+                           -1.f, width + 1.f);
+      float y = std::clamp((position.y / position.w * 0.5f + 0.5f) * height,
+                           -1.f, height + 1.f);
+      x0 = std::min(x0, x);
+      y0 = std::min(y0, y);
+      x1 = std::max(x1, x);
+      y1 = std::max(y1, y);
+    }
+  }
+  if (x0 > x1) {
+    return {};
+  }
+  // One pixel more on each side for rasterisation rounding.
+  VkRect2D bounds;
+  bounds.offset = {int32_t(floorf(x0)) - 1, int32_t(floorf(y0)) - 1};
+  bounds.extent = {uint32_t(ceilf(x1) - floorf(x0)) + 2,
+                   uint32_t(ceilf(y1) - floorf(y0)) + 2};
+  return clip(bounds, swapChainExtent);
+}
+
+// The scene moved from what oldMvp and oldDraws drew to the current state.
+void HelloVK::damageScene(const std::array<float, 16> &oldMvp,
+                          const std::vector<DrawCommand> &oldDraws) {
+  damage.add(sceneBounds(oldMvp, oldDraws));
+  damage.add(sceneBounds(capturedCommands.mvp, drawList));
+}
+
+void HelloVK::setDrawList(std::vector<DrawCommand> draws,
+                          const VkRect2D &changed) {
+  drawList = std::move(draws);
+  damage.add(changed);
+}
+
+void HelloVK::setDirtyRegions(bool allowed) {
+  assert(!initialized);  // the render passes are created for it
+  dirtyRegionsAllowed = allowed;
+}
+
+void HelloVK::addDamage(const VkRect2D &rect) { damage.add(rect); }
+
+void HelloVK::onInputApplied(int64_t eventTimestampNs) {
+  if (oldestPendingInputNs == 0 || eventTimestampNs < oldestPendingInputNs) {
+    oldestPendingInputNs = eventTimestampNs;
+  }
+}
+
+/*
+ * Input-to-present latency is measured from the time the oldest input applied
+ * to a frame was generated until that frame was handed to the presentation
+ * engine. Averages are logged every 120 frames that carried input.
+ */
+void HelloVK::recordInputLatency() {
+  if (oldestPendingInputNs == 0) {
+    return;
+  }
+  int64_t latencyNs = monotonicNowNs() - oldestPendingInputNs;
+  oldestPendingInputNs = 0;
+
+  inputLatency.totalNs += latencyNs;
+  inputLatency.maxNs = std::max(inputLatency.maxNs, latencyNs);
+  if (++inputLatency.samples == 120) {
+    LOGI("Input to present latency: avg %.2f ms, max %.2f ms",
+         inputLatency.totalNs / 1e6 / inputLatency.samples,
+         inputLatency.maxNs / 1e6);
+    inputLatency = {};
+  }
+}
+
+void HelloVK::updateUniformBuffer(uint32_t currentImage) {
+  mat4 view;
+  viewTransform.latch(view);
+
+  if (stereo) {
+    // The eye images are rendered upright; the compose pass pre-rotates.
+    std::array<UniformBufferObject, 2> eyes{};
+    for (size_t i = 0; i < eyes.size(); i++) {
+      mat4 eye;
+      eyeTransforms[i].latch(eye);
+      eyes[i].mvp = eye * view;
+    }
+    memcpy(uniformBuffersMapped[currentImage], eyes.data(), sizeof(eyes));
+    capturedCommands.mvp = eyes[0].mvp.toArray();
+    return;
+  }
+
+  UniformBufferObject ubo{};
+  ubo.mvp = getPrerotationMatrix(pretransformFlag) * view;
+  memcpy(uniformBuffersMapped[currentImage], &ubo, sizeof(ubo));
+  capturedCommands.mvp = ubo.mvp.toArray();
+  if (dirtyRegions && damagedMvp != capturedCommands.mvp) {
+    if (damagedMvp) {
+      damageScene(*damagedMvp, drawList);
+    } else {
+      damage.addFull();
+    }
+    damagedMvp = capturedCommands.mvp;
+  }
+}
+
+void HelloVK::onOrientationChange() {
+  recreateSwapChain();
+  orientationChanged = false;
+}
+
+void HelloVK::recordCommandBuffer(VkCommandBuffer commandBuffer,
+                                  uint32_t imageIndex) {
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = 0;
+  beginInfo.pInheritanceInfo = nullptr;
+
+  VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+  CommandEncoder encoder(commandBuffer);
+
+  lastRenderArea = {{0, 0}, swapChainExtent};
+  if (!stereo) {
+    renderStaleLayers(encoder);
+  }
+  if (stereo) {
+    recordStereoFrame(encoder, imageIndex);
+  } else if (dirtyRegions) {
+    lastRenderArea = alignTo(damage.beginFrame(imageIndex),
+                             renderAreaGranularity, swapChainExtent);
+    bool partial = !damage.isFull(lastRenderArea);
+    dirtyStats.partial += partial;
+    dirtyStats.pixelsRedrawn +=
+        uint64_t(lastRenderArea.extent.width) * lastRenderArea.extent.height;
+    dirtyStats.pixelsTotal +=
+        uint64_t(swapChainExtent.width) * swapChainExtent.height;
+    recordRenderPass(encoder, swapChainFramebuffers[imageIndex],
+                     swapChainImageViews[imageIndex], swapChainExtent,
+                     partial ? updateRenderPass : renderPass,
+                     graphicsPipeline, descriptorSets[currentFrame],
+                     frameClearColor, partial ? &lastRenderArea : nullptr,
+                     true);
+  } else {
+    recordRenderPass(encoder, swapChainFramebuffers[imageIndex],
+                     swapChainImageViews[imageIndex], swapChainExtent,
+                     renderPass, graphicsPipeline,
+                     descriptorSets[currentFrame], frameClearColor, nullptr,
+                     true);
+  }
+  if (captureEnabled && renderedFrames % captureConfig.everyNthFrame == 0) {
+    recordCapture(commandBuffer, imageIndex);
+  }
+  renderedFrames++;
+  VK_CHECK(vkEndCommandBuffer(commandBuffer));
+  frameCommands = encoder.stats();
+  commandTotals += frameCommands;
+  encodedCommandBuffers++;
+}
+
+/*
+ * Records the scene's render pass into framebuffer, whose colour attachment
+ * is attachment. Shared by the swapchain path, offscreen rendering,
+ * additional targets and the stereo eye target; pipeline must be compatible
+ * with pass, descriptorSet holds the MVP of the frame and clearColor its
+ * background, the same for every pass of that frame. State an earlier
+ * pass left in encoder is not set again.
+ *
+ * With a dirtyArea, pass loads the attachment and only that area is cleared
+ * and drawn; the rest keeps what the image held. composeLayers blends the
+ * static layers in before the draw list.
+ */
+void HelloVK::recordRenderPass(CommandEncoder &encoder,
+                               VkFramebuffer framebuffer,
+                               VkImageView attachment, VkExtent2D extent,
+                               VkRenderPass pass, VkPipeline pipeline,
+                               VkDescriptorSet descriptorSet,
+                               const VkClearValue &clearColor,
+                               const VkRect2D *dirtyArea,
+                               bool composeLayers) {
+  VkCommandBuffer commandBuffer = encoder.commandBuffer();
+  VkRenderPassBeginInfo renderPassInfo{};
+  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+  renderPassInfo.renderPass = pass;
+  renderPassInfo.framebuffer = framebuffer;
+  renderPassInfo.renderArea.offset = {0, 0};
+  renderPassInfo.renderArea.extent = extent;
+  if (dirtyArea != nullptr) {
+    renderPassInfo.renderArea = *dirtyArea;
+  }
+
+  VkViewport viewport{};
+  viewport.width = (float)extent.width;
+  viewport.height = (float)extent.height;
+  viewport.minDepth = 0.0f;
+  viewport.maxDepth = 1.0f;
+  encoder.setViewport(viewport);
+  encoder.setScissor(renderPassInfo.renderArea);
+
+  if (commandCapture) {
+    memcpy(capturedCommands.clearColor.data(), clearColor.color.float32,
+           sizeof(capturedCommands.clearColor));
+    if (drawList.empty()) {
+      capturedCommands.draws.assign(1, {3, 1, 0, 0});
+    } else {
+      capturedCommands.draws = drawList;
+    }
+  }
+
+  renderPassInfo.clearValueCount = 1;
+  renderPassInfo.pClearValues = &clearColor;
+  beginRenderPass(commandBuffer, renderPassInfo, attachment);
+  if (dirtyArea != nullptr) {
+    VkClearAttachment clear{VK_IMAGE_ASPECT_COLOR_BIT, 0, clearColor};
+    VkClearRect rect{*dirtyArea, 0, 1};
+    vkCmdClearAttachments(commandBuffer, 1, &clear, 1, &rect);
+  }
+  if (composeLayers) {
+    composeStaticLayers(encoder);
+  }
+  encoder.bindPipeline(pipeline);
+  encoder.bindDescriptorSets(pipelineLayout, 0, 1, &descriptorSet);
+
+  if (drawList.empty()) {
+    encoder.draw(3, 1, 0, 0);
+  }
+  for (const DrawCommand &draw : drawList) {
+    encoder.draw(draw.vertexCount, draw.instanceCount, draw.firstVertex,
+                 draw.firstInstance);
+  }
+  vkCmdEndRenderPass(commandBuffer);
+}
+
+// Without an override the background steps through greys, once per frame.
+void HelloVK::advanceClearColor() {
+  if (clearColorOverride) {
+    memcpy(frameClearColor.color.float32, clearColorOverride->data(),
+           sizeof(frameClearColor.color.float32));
+    return;
+  }
+  backgroundGrey += 0.005f;
+  if (backgroundGrey > 1.0f) {
+    backgroundGrey = 0.0f;
+  }
+  frameClearColor = {{{backgroundGrey, backgroundGrey, backgroundGrey, 1.0f}}};
+}
+
+// Imageless framebuffers get their attachment when the pass begins.
+void HelloVK::beginRenderPass(VkCommandBuffer commandBuffer,
+                              VkRenderPassBeginInfo &beginInfo,
+                              VkImageView attachment) {
+  VkRenderPassAttachmentBeginInfoKHR attachmentInfo;
+  framebufferCache.chainAttachments(beginInfo, attachmentInfo, &attachment,
+                                    1);
+  vkCmdBeginRenderPass(commandBuffer, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
+}
+
+/*
+ * A framebuffer from framebufferCache with view, an image of usage and
+ * layerCount layers, as its single colour attachment. desc is what pass was
+ * created from.
+ */
+VkFramebuffer HelloVK::acquireFramebuffer(VkRenderPass pass,
+                                          const RenderPassDesc &desc,
+                                          VkImageView view,
+                                          VkImageUsageFlags usage,
+                                          VkExtent2D extent,
+                                          uint32_t layerCount) {
+  assert(desc.colorCount == 1 && !desc.hasDepth);
+  FramebufferAttachment attachment{view, desc.colors[0].format, usage,
+                                   layerCount};
+  VkFramebuffer framebuffer;
+  VK_CHECK(framebufferCache.acquire(pass, desc, extent, &attachment,
+                                    &framebuffer));
+  return framebuffer;
+}
+
+// Call before view is released.
+void HelloVK::releaseFramebuffer(VkFramebuffer framebuffer,
+                                 VkImageView view) {
+  framebufferCache.release(framebuffer);
+  framebufferCache.releaseView(view);
+}
+
+// Once per frame, after waiting for the frame slot about to be reused.
+void HelloVK::collectCaches() {
+  samplerCache.collect(renderedFrames);
+  imageViewCache.collect(renderedFrames);
+  framebufferCache.collect(renderedFrames);
+  renderPassCache.collect(renderedFrames);
+}
+
+void HelloVK::cleanupSwapChain() {
+  destroyCaptureResources();
+  destroyStereoTarget();
+  destroyOffscreenTarget(layerImage);
+
+  for (size_t i = 0; i < swapChainFramebuffers.size(); i++) {
+    releaseFramebuffer(swapChainFramebuffers[i], swapChainImageViews[i]);
+  }
+  swapChainFramebuffers.clear();
+
+  for (size_t i = 0; i < swapChainImageViews.size(); i++) {
+    imageViewCache.release(swapChainImageViews[i]);
+    imageViewCache.releaseImage(swapChainImages[i]);
+  }
+  swapChainImageViews.clear();
+
+  // Safe to call twice, as reset() followed by recreateSwapChain() does.
+  if (swapChain != VK_NULL_HANDLE) {
+    vkDestroySwapchainKHR(device, swapChain, nullptr);
+    objectCounts.swapchains--;
+    swapChain = VK_NULL_HANDLE;
+  }
+}
+
+void HelloVK::cleanup() {
+  if (!initialized) {
+    return;
+  }
+  vkDeviceWaitIdle(device);
+  cleanupSwapChain();
+  destroyOffscreenTarget(offscreenTarget);
+  for (auto &target : targets) {
+    destroyTarget(*target);
+  }
+  targets.clear();
+  if (alternateRenderPass != VK_NULL_HANDLE) {
+    renderPassCache.release(alternateRenderPass);
+  }
+  alternateRenderPass = VK_NULL_HANDLE;
+  // Their stats are reported through staticLayerStats().
+  for (auto &layer : staticLayers) {
+    destroyStaticLayer(*layer);
+  }
+  staticLayers.clear();
+  destroyLayerPipelines();
+  destroyStereoPipelines();
+  stopCommandCapture();
+  captureEnabled = false;
+  frameWriter.reset();
+  vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+
+  vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    vkUnmapMemory(device, uniformBuffersMemory[i]);
+    vkDestroyBuffer(device, uniformBuffers[i], nullptr);
+    vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
+  }
+
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
+    vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
+    vkDestroyFence(device, inFlightFences[i], nullptr);
+  }
+  vkDestroyCommandPool(device, commandPool, nullptr);
+  vkDestroyPipeline(device, graphicsPipeline, nullptr);
+  vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+  renderPassCache.release(renderPass);
+  renderPass = VK_NULL_HANDLE;
+  if (updateRenderPass != VK_NULL_HANDLE) {
+    renderPassCache.release(updateRenderPass);
+    updateRenderPass = VK_NULL_HANDLE;
+  }
+  if (dirtyStats.pixelsTotal > 0) {
+    LOGI("Dirty regions: %llu frames, %llu skipped, %llu partial, %.0f%% of "
+         "the pixels redrawn",
+         (unsigned long long)dirtyStats.frames,
+         (unsigned long long)dirtyStats.skipped,
+         (unsigned long long)dirtyStats.partial,
+         dirtyStats.pixelsRedrawn * 100. / dirtyStats.pixelsTotal);
+  }
+  if (encodedCommandBuffers > 0) {
+    std::string filtered;
+    for (size_t i = 0; i < kStateCommandCount; i++) {
+      char entry[64];
+      snprintf(entry, sizeof(entry), "%s%s %.1f", i > 0 ? ", " : "",
+               stateCommandName(StateCommand(i)),
+               double(commandTotals.filtered[i]) / encodedCommandBuffers);
+      filtered += entry;
+    }
+    LOGI("Command encoder: %.1f state commands and %.1f draws per command "
+         "buffer, %.0f%% filtered (%s)",
+         double(commandTotals.totalRecorded()) / encodedCommandBuffers,
+         double(commandTotals.draws) / encodedCommandBuffers,
+         commandTotals.filterRate() * 100., filtered.c_str());
+  }
+  auto logReuse = [](const char *name, const ObjectCacheStats &stats) {
+    LOGI("%s cache: %llu requests, %.0f%% reused, %llu created", name,
+         (unsigned long long)stats.requests, stats.reuseRate() * 100.,
+         (unsigned long long)stats.created);
+  };
+  logReuse("Sampler", samplerCache.stats());
+  logReuse("Image view", imageViewCache.stats());
+  logReuse("Framebuffer", framebufferCache.stats());
+  logReuse("Render pass", renderPassCache.stats());
+  framebufferCache.clear();
+  renderPassCache.clear();
+  samplerCache.clear();
+  imageViewCache.clear();
+  vkDestroyDevice(device, nullptr);
+  if (enableValidationLayers) {
+    DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+  }
+  if (surface != VK_NULL_HANDLE) {
+    vkDestroySurfaceKHR(instance, surface, nullptr);
+    objectCounts.surfaces--;
+  }
+  vkDestroyInstance(instance, nullptr);
+  surface = VK_NULL_HANDLE;
+  swapChain = VK_NULL_HANDLE;
+  initialized = false;
+}
+
+void HelloVK::setupDebugMessenger() {
+  if (!enableValidationLayers) {
+    return;
+  }
+
+  VkDebugUtilsMessengerCreateInfoEXT createInfo{};
+  populateDebugMessengerCreateInfo(createInfo);
+
+  VK_CHECK(CreateDebugUtilsMessengerEXT(instance, &createInfo, nullptr,
+                                        &debugMessenger));
+}
+
+bool HelloVK::checkValidationLayerSupport() {
+  uint32_t layerCount;
+  vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+
+  std::vector<VkLayerProperties> availableLayers(layerCount);
+  vkEnumerateInstanceLayerProperties(&layerCount, availableLayers.data());
+
+  for (const char *layerName : validationLayers) {
+    bool layerFound = false;
+    for (const auto &layerProperties : availableLayers) {
+      if (strcmp(layerName, layerProperties.layerName) == 0) {
+        layerFound = true;
+        break;
+      }
+    }
+
+    if (!layerFound) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::vector<const char *> HelloVK::getRequiredExtensions(
+    bool enableValidationLayers) {
+  std::vector<const char *> extensions;
+  extensions.push_back("VK_KHR_surface");
+  extensions.push_back("VK_KHR_android_surface");
+  if (enableValidationLayers) {
+    extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+  }
+  return extensions;
+}
+
+void HelloVK::createInstance() {
+  assert(!enableValidationLayers ||
+         checkValidationLayerSupport());  // validation layers requested, but
+                                          // not available!
+  auto requiredExtensions = getRequiredExtensions(enableValidationLayers);
+
+  VkApplicationInfo appInfo{};
+  appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+  appInfo.pApplicationName = "Hello Triangle";
+  appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+  appInfo.pEngineName = "No Engine";
+  appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+  // Multiview for stereo and vkGetPhysicalDeviceFeatures2() are core in
+  // Vulkan 1.1, which every Android 11 (minSdk 30) loader supports.
+  appInfo.apiVersion = VK_API_VERSION_1_1;
+
+  VkInstanceCreateInfo createInfo{};
+  createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+  createInfo.pApplicationInfo = &appInfo;
+  createInfo.enabledExtensionCount = (uint32_t)requiredExtensions.size();
+  createInfo.ppEnabledExtensionNames = requiredExtensions.data();
+  createInfo.pApplicationInfo = &appInfo;
+
+  if (enableValidationLayers) {
+    VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo{};
+    createInfo.enabledLayerCount =
+        static_cast<uint32_t>(validationLayers.size());
+    createInfo.ppEnabledLayerNames = validationLayers.data();
+    populateDebugMessengerCreateInfo(debugCreateInfo);
+    createInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT *)&debugCreateInfo;
+  } else {
+    createInfo.enabledLayerCount = 0;
+    createInfo.pNext = nullptr;
+  }
+  VK_CHECK(vkCreateInstance(&createInfo, nullptr, &instance));
+
+  uint32_t extensionCount = 0;
+  vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+  std::vector<VkExtensionProperties> extensions(extensionCount);
+  vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount,
+                                         extensions.data());
+  LOGI("available extensions");
+  for (const auto &extension : extensions) {
+    LOGI("\t %s", extension.extensionName);
+  }
+}
+
+/*
+ * createSurface can only be called after the android ecosystem has had the
+ * chance to provide a native window. This happens after the APP_CMD_START event
+ * has had a chance to be called.
+ *
+ * Notice the window.get() call which is only valid after window has been set to
+ * a non null value
+ */
+void HelloVK::createSurface() {
+  assert(window != nullptr);  // window not initialized
+  const VkAndroidSurfaceCreateInfoKHR create_info{
+      .sType = VK_STRUCTURE_TYPE_ANDROID_SURFACE_CREATE_INFO_KHR,
+      .pNext = nullptr,
+      .flags = 0,
+      .window = window.get()};
+
+  VK_CHECK(vkCreateAndroidSurfaceKHR(instance, &create_info,
+                                     nullptr /* pAllocator */, &surface));
+  objectCounts.surfaces++;
+}
+
+// BEGIN DEVICE SUITABILITY
+// Functions to find a suitable physical device to execute Vulkan commands.
+
+QueueFamilyIndices HelloVK::findQueueFamilies(VkPhysicalDevice device) {
+  QueueFamilyIndices indices;
+
+  uint32_t queueFamilyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+
+  std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount,
+                                           queueFamilies.data());
+
+  int i = 0;
+  for (const auto &queueFamily : queueFamilies) {
+    if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+      indices.graphicsFamily = i;
+    }
+
+    VkBool32 presentSupport = false;
+    if (surface != VK_NULL_HANDLE) {
+      vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
+                                           &presentSupport);
+    } else {
+      // Headless: nothing is presented, the graphics queue stands in.
+      presentSupport = queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT;
+    }
+    if (presentSupport) {
+      indices.presentFamily = i;
+    }
+
+    if (indices.isComplete()) {
+      break;
+    }
+
+    i++;
+  }
+  return indices;
+}
+
+bool HelloVK::checkDeviceExtensionSupport(VkPhysicalDevice device) {
+  uint32_t extensionCount;
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
+                                       nullptr);
+
+  std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
+                                       availableExtensions.data());
+
+  std::set<std::string> requiredExtensions(deviceExtensions.begin(),
+                                           deviceExtensions.end());
+
+  for (const auto &extension : availableExtensions) {
+    requiredExtensions.erase(extension.extensionName);
+  }
+
+  return requiredExtensions.empty();
+}
+
+SwapChainSupportDetails HelloVK::querySwapChainSupport(
+    VkPhysicalDevice device) {
+  SwapChainSupportDetails details;
+
+  vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface,
+                                            &details.capabilities);
+
+  uint32_t formatCount;
+  vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, nullptr);
+
+  if (formatCount != 0) {
+    details.formats.resize(formatCount);
+    vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount,
+                                         details.formats.data());
+  }
+
+  uint32_t presentModeCount;
+  vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount,
+                                            nullptr);
+
+  if (presentModeCount != 0) {
     details.presentModes.resize(presentModeCount);
     vkGetPhysicalDeviceSurfacePresentModesKHR(
         device, surface, &presentModeCount, details.presentModes.data());
@@ -833,8 +2675,8 @@ SwapChainSupportDetails HelloVK::querySwapChainSupport(
 bool HelloVK::isDeviceSuitable(VkPhysicalDevice device) {
   QueueFamilyIndices indices = findQueueFamilies(device);
   bool extensionsSupported = checkDeviceExtensionSupport(device);
-  bool swapChainAdequate = false;
-  if (extensionsSupported) {
+  bool swapChainAdequate = surface == VK_NULL_HANDLE;
+  if (extensionsSupported && !swapChainAdequate) {
     SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
     swapChainAdequate = !swapChainSupport.formats.empty() &&
                         !swapChainSupport.presentModes.empty();
@@ -879,15 +2721,74 @@ void HelloVK::createLogicalDeviceAndQueue() {
 
   VkPhysicalDeviceFeatures deviceFeatures{};
 
+  // Stereo only applies to the swapchain, headless rendering stays mono.
+  stereo = false;
+  if (stereoRequested && surface != VK_NULL_HANDLE) {
+    stereo = multiviewSupported();
+    if (!stereo) {
+      LOGE("Multiview is not supported, rendering mono");
+    }
+  }
+  viewCount = stereo ? 2 : 1;
+  halfPrecision = halfPrecisionAllowed && float16Supported();
+  LOGI("Half precision shaders: %s", halfPrecision ? "on" : "off");
+
+  // Optional features are chained in front of each other.
+  void *features = nullptr;
+  std::vector<const char *> extensions = deviceExtensions;
+  VkPhysicalDeviceMultiviewFeatures multiviewFeatures{};
+  multiviewFeatures.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES;
+  multiviewFeatures.multiview = VK_TRUE;
+  if (stereo) {
+    multiviewFeatures.pNext = features;
+    features = &multiviewFeatures;
+  }
+  VkPhysicalDeviceShaderFloat16Int8FeaturesKHR float16Features{};
+  float16Features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_FLOAT16_INT8_FEATURES_KHR;
+  float16Features.shaderFloat16 = VK_TRUE;
+  if (halfPrecision) {
+    float16Features.pNext = features;
+    features = &float16Features;
+    extensions.push_back(VK_KHR_SHADER_FLOAT16_INT8_EXTENSION_NAME);
+  }
+  // Presenting only the changed rectangles is optional, dirty rectangle
+  // rendering works without it.
+  dirtyRegions = dirtyRegionsAllowed && surface != VK_NULL_HANDLE && !stereo;
+  incrementalPresent =
+      dirtyRegions &&
+      deviceExtensionSupported(VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME);
+  if (dirtyRegions) {
+    LOGI("Dirty regions: on, incremental present %s",
+         incrementalPresent ? "on" : "off");
+  }
+  if (incrementalPresent) {
+    extensions.push_back(VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME);
+  }
+  bool imageless = imagelessAllowed && imagelessFramebufferSupported();
+  LOGI("Imageless framebuffers: %s", imageless ? "on" : "off");
+  VkPhysicalDeviceImagelessFramebufferFeaturesKHR imagelessFeatures{};
+  imagelessFeatures.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGELESS_FRAMEBUFFER_FEATURES_KHR;
+  imagelessFeatures.imagelessFramebuffer = VK_TRUE;
+  if (imageless) {
+    imagelessFeatures.pNext = features;
+    features = &imagelessFeatures;
+    // Only enabled because the imageless extension depends on it.
+    extensions.push_back(VK_KHR_IMAGE_FORMAT_LIST_EXTENSION_NAME);
+    extensions.push_back(VK_KHR_IMAGELESS_FRAMEBUFFER_EXTENSION_NAME);
+  }
+
   VkDeviceCreateInfo createInfo{};
+  createInfo.pNext = features;
   createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
   createInfo.queueCreateInfoCount =
       static_cast<uint32_t>(queueCreateInfos.size());
   createInfo.pQueueCreateInfos = queueCreateInfos.data();
   createInfo.pEnabledFeatures = &deviceFeatures;
-  createInfo.enabledExtensionCount =
-      static_cast<uint32_t>(deviceExtensions.size());
-  createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+  createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+  createInfo.ppEnabledExtensionNames = extensions.data();
   if (enableValidationLayers) {
     createInfo.enabledLayerCount =
         static_cast<uint32_t>(validationLayers.size());
@@ -900,6 +2801,15 @@ void HelloVK::createLogicalDeviceAndQueue() {
 
   vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
   vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  samplerCache.init(device);
+  samplerCache.setLimit(properties.limits.maxSamplerAllocationCount);
+  imageViewCache.init(device);
+  renderPassCache.init(device);
+  framebufferCache.init(device);
+  framebufferCache.setImageless(imageless);
 }
 
 VkExtent2D HelloVK::chooseSwapExtent(
@@ -940,21 +2850,38 @@ void HelloVK::establishDisplaySizeIdentity() {
   displaySizeIdentity = capabilities.currentExtent;
 }
 
+/*
+ * B8G8R8A8_SRGB where offered. The low-power profile prefers a 16-bit format
+ * instead, which not every surface offers; it then falls back to the same
+ * choice as the standard profile.
+ */
+VkSurfaceFormatKHR HelloVK::chooseSwapSurfaceFormat(
+    const std::vector<VkSurfaceFormatKHR> &availableFormats) {
+  auto find = [&](VkFormat format) {
+    return std::find_if(availableFormats.begin(), availableFormats.end(),
+                        [format](const VkSurfaceFormatKHR &f) {
+                          return f.format == format &&
+                                 f.colorSpace ==
+                                     VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+                        });
+  };
+  if (power.lowBitDepth) {
+    for (VkFormat format : {VK_FORMAT_R5G6B5_UNORM_PACK16,
+                            VK_FORMAT_B5G6R5_UNORM_PACK16}) {
+      auto it = find(format);
+      if (it != availableFormats.end()) {
+        return *it;
+      }
+    }
+  }
+  auto it = find(VK_FORMAT_B8G8R8A8_SRGB);
+  return it != availableFormats.end() ? *it : availableFormats[0];
+}
+
 void HelloVK::createSwapChain() {
   SwapChainSupportDetails swapChainSupport =
       querySwapChainSupport(physicalDevice);
 
-  auto chooseSwapSurfaceFormat =
-      [](const std::vector<VkSurfaceFormatKHR> &availableFormats) {
-        for (const auto &availableFormat : availableFormats) {
-          if (availableFormat.format == VK_FORMAT_B8G8R8A8_SRGB &&
-              availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
-            return availableFormat;
-          }
-        }
-        return availableFormats[0];
-      };
-
   VkSurfaceFormatKHR surfaceFormat =
       chooseSwapSurfaceFormat(swapChainSupport.formats);
 
@@ -982,6 +2909,12 @@ void HelloVK::createSwapChain() {
   createInfo.imageExtent = displaySizeIdentity;
   createInfo.imageArrayLayers = 1;
   createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+  if (captureEnabled) {
+    // Only requested while capturing: transfer usage can disable framebuffer
+    // compression on some GPUs.
+    createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  }
+  swapChainImageUsage = createInfo.imageUsage;
   createInfo.preTransform = pretransformFlag;
 
   QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
@@ -1003,307 +2936,1465 @@ void HelloVK::createSwapChain() {
   createInfo.oldSwapchain = VK_NULL_HANDLE;
 
   VK_CHECK(vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain));
+  objectCounts.swapchains++;
 
   vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
   swapChainImages.resize(imageCount);
   vkGetSwapchainImagesKHR(device, swapChain, &imageCount,
                           swapChainImages.data());
 
-  swapChainImageFormat = surfaceFormat.format;
-  swapChainExtent = displaySizeIdentity;
+  swapChainImageFormat = surfaceFormat.format;
+  swapChainExtent = displaySizeIdentity;
+  damage.reset(imageCount, swapChainExtent, pretransformFlag);
+}
+
+void HelloVK::createImageViews() {
+  swapChainImageViews.resize(swapChainImages.size());
+  for (size_t i = 0; i < swapChainImages.size(); i++) {
+    VK_CHECK(imageViewCache.acquire(
+        swapChainImages[i], kColorView.withFormat(swapChainImageFormat),
+        &swapChainImageViews[i]));
+  }
+}
+
+// The swapchain format and the final layout are only known at runtime and
+// filled in by createRenderPass().
+constexpr RenderPassDesc kSceneRenderPass = RenderPassDesc{}.addColor(
+    VK_FORMAT_UNDEFINED, VK_ATTACHMENT_LOAD_OP_CLEAR,
+    VK_ATTACHMENT_STORE_OP_STORE, VK_IMAGE_LAYOUT_UNDEFINED,
+    VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+static_assert(kSceneRenderPass.valid(), "invalid scene render pass");
+
+// The scene drawn over a presented swapchain image, see setDirtyRegions().
+constexpr RenderPassDesc kSceneUpdateRenderPass = RenderPassDesc{}.addColor(
+    VK_FORMAT_UNDEFINED, VK_ATTACHMENT_LOAD_OP_LOAD,
+    VK_ATTACHMENT_STORE_OP_STORE, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+    VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+static_assert(kSceneUpdateRenderPass.valid(), "invalid scene update pass");
+
+// Passes declared with load or store ops that cost bandwidth or lose
+// contents; the passes are created with the ops the analysis chose instead.
+static void logLoadStoreFindings(const LoadStoreAnalyzer &frame) {
+  for (const LoadStoreFinding &finding : frame.findings()) {
+    if (finding.costsBandwidth()) {
+      LOGI("Load/store: %s", finding.message().c_str());
+    } else {
+      LOGE("Load/store: %s", finding.message().c_str());
+    }
+  }
+}
+
+void HelloVK::createRenderPass() {
+  // Offscreen targets are read back after the pass.
+  bool present = surface != VK_NULL_HANDLE;
+  RenderPassDesc desc =
+      kSceneRenderPass.withFormat(0, swapChainImageFormat)
+          .withFinalLayout(0, present ? VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+                                      : VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+  LoadStoreAnalyzer frame;
+  uint32_t target = frame.addResource(
+      present ? "swapchain image" : "offscreen image",
+      ResourceLifetime::Exported);
+  uint32_t scene =
+      frame.addPass("scene", desc, {{target, AttachmentWrite::Clear}});
+  frame.analyze();
+  logLoadStoreFindings(frame);
+  renderPassDesc = frame.optimized(scene);
+  VK_CHECK(renderPassCache.acquire(renderPassDesc, &renderPass));
+
+  if (dirtyRegions) {
+    // Partial redraws build on what the image held when it was presented.
+    LoadStoreAnalyzer update;
+    uint32_t retained = update.addResource("retained swapchain image",
+                                           ResourceLifetime::Persistent);
+    uint32_t pass = update.addPass(
+        "scene update",
+        kSceneUpdateRenderPass.withFormat(0, swapChainImageFormat),
+        {{retained, AttachmentWrite::Accumulate}});
+    update.analyze();
+    logLoadStoreFindings(update);
+    VK_CHECK(renderPassCache.acquire(update.optimized(pass),
+                                     &updateRenderPass));
+    vkGetRenderAreaGranularity(device, updateRenderPass,
+                               &renderAreaGranularity);
+  }
+}
+
+/*
+ * Creates a graphics pipeline loading a simple vertex and fragment shader, both
+ * with 'main' set as entrypoint A list of standard parameters are provided:
+ * 	- The vertex input coming from the application is set to empty - we are
+ * hardcoding the triangle in the vertex shader.
+ * 	- The input assembly is configured to draw triangle lists
+ *  - We intend to draw onto the whole screen, so the scissoring extent is
+ * specified as being the whole swapchain extent.
+ * 	- The rasterizer is set to discard fragmets beyond the near and far
+ * planes (depthClampEnable=false) as well as sending geometry to the frame
+ * buffer and generate fragments for the whole area of the geometry. We consider
+ * geometry in terms of the clockwise order of their respective vertex input.
+ *  - Multisampling is disabled
+ *  - Depth and stencil testing are disabled
+ * 	- ColorBlending is set to opaque mode, meaning any new fragments will
+ * overwrite the ones already existing in the framebuffer
+ *  - We utilise Vulkan's concept of dynamic state for viewport and scissoring.
+ * 		The other option is to hardcode the viewport/scissor options,
+ * however this means needing to recreate the whole graphics pipeline object
+ * when the screen is rotated.
+ *  - The pipeline layout sends 1 uniform buffer object to the shader containing
+ * a 4x4 rotation matrix specified by the descriptorSetLayout. This is required
+ * in order to render a rotated scene when the device has been rotated.
+ */
+constexpr GraphicsPipelineDesc kScenePipeline =
+    GraphicsPipelineDesc{}.withCullMode(VK_CULL_MODE_BACK_BIT,
+                                        VK_FRONT_FACE_CLOCKWISE);
+static_assert(kScenePipeline.valid(), "invalid scene pipeline");
+
+void HelloVK::createGraphicsPipeline() {
+  VkShaderModule vertShaderModule =
+      createSceneShaderModule(VK_SHADER_STAGE_VERTEX_BIT);
+  VkShaderModule fragShaderModule =
+      createSceneShaderModule(VK_SHADER_STAGE_FRAGMENT_BIT);
+
+  VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
+  vertShaderStageInfo.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+  vertShaderStageInfo.module = vertShaderModule;
+  vertShaderStageInfo.pName = "main";
+
+  VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
+  fragShaderStageInfo.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+  fragShaderStageInfo.module = fragShaderModule;
+  fragShaderStageInfo.pName = "main";
+
+  VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo,
+                                                    fragShaderStageInfo};
+
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount = 1;
+  pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+  pipelineLayoutInfo.pushConstantRangeCount = 0;
+  pipelineLayoutInfo.pPushConstantRanges = nullptr;
+
+  VK_CHECK(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr,
+                                  &pipelineLayout));
+  VK_CHECK(vkt::createGraphicsPipeline(device, kScenePipeline, shaderStages, 2,
+                                       pipelineLayout, renderPass,
+                                       &graphicsPipeline));
+  vkDestroyShaderModule(device, fragShaderModule, nullptr);
+  vkDestroyShaderModule(device, vertShaderModule, nullptr);
+}
+
+/*
+ * The scene shaders in the precision picked at device creation. The float16
+ * variants keep colours in half precision and interpolate them at mediump.
+ */
+VkShaderModule HelloVK::createSceneShaderModule(VkShaderStageFlagBits stage) {
+  bool vertex = stage == VK_SHADER_STAGE_VERTEX_BIT;
+#ifdef HELLOVK_EMBEDDED_SHADERS
+  if (halfPrecision) {
+    return vertex ? createShaderModule(kShaderFp16VertSpv,
+                                       sizeof(kShaderFp16VertSpv))
+                  : createShaderModule(kShaderFp16FragSpv,
+                                       sizeof(kShaderFp16FragSpv));
+  }
+  return vertex ? createShaderModule(kShaderVertSpv, sizeof(kShaderVertSpv))
+                : createShaderModule(kShaderFragSpv, sizeof(kShaderFragSpv));
+#else
+  const char *path;
+  if (halfPrecision) {
+    path = vertex ? "shaders/shader_fp16.vert.spv"
+                  : "shaders/shader_fp16.frag.spv";
+  } else {
+    path = vertex ? "shaders/shader.vert.spv" : "shaders/shader.frag.spv";
+  }
+  return createShaderModule(LoadBinaryFileToVector(path, assetManager));
+#endif
+}
+
+VkShaderModule HelloVK::createShaderModule(const std::vector<uint8_t> &code) {
+  // Satisifies alignment requirements since the allocator
+  // in vector ensures worst case requirements
+  return createShaderModule(reinterpret_cast<const uint32_t *>(code.data()),
+                            code.size());
+}
+
+// size is in bytes, as in VkShaderModuleCreateInfo::codeSize.
+VkShaderModule HelloVK::createShaderModule(const uint32_t *code, size_t size) {
+  VkShaderModuleCreateInfo createInfo{};
+  createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  createInfo.codeSize = size;
+  createInfo.pCode = code;
+  VkShaderModule shaderModule;
+  VK_CHECK(vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule));
+
+  return shaderModule;
+}
+
+void HelloVK::createFramebuffers() {
+  swapChainFramebuffers.resize(swapChainImageViews.size());
+  for (size_t i = 0; i < swapChainImageViews.size(); i++) {
+    swapChainFramebuffers[i] =
+        acquireFramebuffer(renderPass, renderPassDesc, swapChainImageViews[i],
+                           swapChainImageUsage, swapChainExtent);
+  }
+}
+
+void HelloVK::createCommandPool() {
+  QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+  VkCommandPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+  VK_CHECK(vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool));
+}
+
+void HelloVK::createCommandBuffer() {
+  commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  VkCommandBufferAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.commandPool = commandPool;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandBufferCount = commandBuffers.size();
+
+  VK_CHECK(vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()));
+}
+
+void HelloVK::createSyncObjects() {
+  imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+  renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+  inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+
+  VkSemaphoreCreateInfo semaphoreInfo{};
+  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+  VkFenceCreateInfo fenceInfo{};
+  fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    VK_CHECK(vkCreateSemaphore(device, &semaphoreInfo, nullptr,
+                               &imageAvailableSemaphores[i]));
+
+    VK_CHECK(vkCreateSemaphore(device, &semaphoreInfo, nullptr,
+                               &renderFinishedSemaphores[i]));
+
+    VK_CHECK(vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]));
+  }
+}
+
+HelloVK::RenderTarget *HelloVK::findTarget(TargetId id) {
+  for (auto &target : targets) {
+    if (target->id == id) {
+      return target.get();
+    }
+  }
+  return nullptr;
+}
+
+// One UniformBufferObject per frame slot, aligned for dynamic offsets into a
+// shared buffer.
+VkDeviceSize HelloVK::uniformSlotStride() {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  VkDeviceSize alignment =
+      std::max<VkDeviceSize>(1,
+                             properties.limits.minUniformBufferOffsetAlignment);
+  return (sizeof(UniformBufferObject) + alignment - 1) / alignment * alignment;
+}
+
+/*
+ * Frame slots of a new target: command buffers from the shared pool, sync
+ * objects, and one uniform buffer holding every slot's MVP.
+ */
+HelloVK::RenderTarget &HelloVK::createTarget(uint32_t framesPerSecond) {
+  auto target = std::make_unique<RenderTarget>();
+  target->id = nextTargetId++;
+  if (framesPerSecond > 0) {
+    target->interval = std::chrono::nanoseconds(1000000000 / framesPerSecond);
+  }
+
+  std::array<VkCommandBuffer, MAX_FRAMES_IN_FLIGHT> commandBuffers;
+  VkCommandBufferAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.commandPool = commandPool;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandBufferCount = MAX_FRAMES_IN_FLIGHT;
+  VK_CHECK(vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()));
+
+  VkDeviceSize stride = uniformSlotStride();
+  createBuffer(stride * MAX_FRAMES_IN_FLIGHT,
+               VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+               target->uniformBuffer, target->uniformMemory);
+  void *mapped;
+  VK_CHECK(vkMapMemory(device, target->uniformMemory, 0, VK_WHOLE_SIZE, 0,
+                       &mapped));
+
+  VkDescriptorPoolSize poolSize{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                                MAX_FRAMES_IN_FLIGHT};
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  poolInfo.maxSets = MAX_FRAMES_IN_FLIGHT;
+  VK_CHECK(vkCreateDescriptorPool(device, &poolInfo, nullptr,
+                                  &target->descriptorPool));
+
+  VkSemaphoreCreateInfo semaphoreInfo{};
+  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  VkFenceCreateInfo fenceInfo{};
+  fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    RenderTarget::Frame &frame = target->frames[i];
+    frame.commandBuffer = commandBuffers[i];
+    frame.uniformMapped = static_cast<char *>(mapped) + stride * i;
+    VK_CHECK(vkCreateSemaphore(device, &semaphoreInfo, nullptr,
+                               &frame.imageAvailable));
+    VK_CHECK(vkCreateSemaphore(device, &semaphoreInfo, nullptr,
+                               &frame.renderFinished));
+    VK_CHECK(vkCreateFence(device, &fenceInfo, nullptr, &frame.inFlight));
+
+    VkDescriptorSetAllocateInfo setInfo{};
+    setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    setInfo.descriptorPool = target->descriptorPool;
+    setInfo.descriptorSetCount = 1;
+    setInfo.pSetLayouts = &descriptorSetLayout;
+    VK_CHECK(vkAllocateDescriptorSets(device, &setInfo, &frame.descriptorSet));
+
+    VkDescriptorBufferInfo bufferInfo{target->uniformBuffer, stride * i,
+                                      sizeof(UniformBufferObject)};
+    VkWriteDescriptorSet descriptorWrite{};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = frame.descriptorSet;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.pBufferInfo = &bufferInfo;
+    vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+  }
+
+  targets.push_back(std::move(target));
+  return *targets.back();
+}
+
+HelloVK::TargetId HelloVK::addWindowTarget(ANativeWindow *newWindow,
+                                           uint32_t framesPerSecond) {
+  assert(initialized && newWindow != nullptr);
+  RenderTarget &target = createTarget(framesPerSecond);
+  target.window.reset(newWindow);
+  const VkAndroidSurfaceCreateInfoKHR createInfo{
+      .sType = VK_STRUCTURE_TYPE_ANDROID_SURFACE_CREATE_INFO_KHR,
+      .pNext = nullptr,
+      .flags = 0,
+      .window = newWindow};
+  VK_CHECK(vkCreateAndroidSurfaceKHR(instance, &createInfo, nullptr,
+                                     &target.surface));
+  if (!createTargetSwapChain(target)) {
+    TargetId id = target.id;
+    removeTarget(id);
+    return kNoTarget;
+  }
+  return target.id;
+}
+
+HelloVK::TargetId HelloVK::addOffscreenTarget(VkExtent2D extent,
+                                              uint32_t framesPerSecond) {
+  assert(initialized);
+  RenderTarget &target = createTarget(framesPerSecond);
+  // Framebuffers only need a compatible render pass, so renderPass does for
+  // either final layout.
+  createOffscreenTarget(extent, target.offscreen);
+  target.extent = extent;
+  return target.id;
+}
+
+/*
+ * Creates or recreates the swapchain of a window target. The window has to
+ * accept the format the scene's render pass and pipeline were built for;
+ * size and pre-rotation are handled as for the main window.
+ */
+bool HelloVK::createTargetSwapChain(RenderTarget &target) {
+  uint32_t presentFamily =
+      findQueueFamilies(physicalDevice).presentFamily.value();
+  VkBool32 presentSupport = false;
+  vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, presentFamily,
+                                       target.surface, &presentSupport);
+  if (!presentSupport) {
+    LOGE("Render target %u cannot be presented from queue family %u",
+         target.id, presentFamily);
+    return false;
+  }
+
+  VkSurfaceCapabilitiesKHR capabilities;
+  vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, target.surface,
+                                            &capabilities);
+  uint32_t formatCount = 0;
+  vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, target.surface,
+                                       &formatCount, nullptr);
+  std::vector<VkSurfaceFormatKHR> formats(formatCount);
+  vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, target.surface,
+                                       &formatCount, formats.data());
+  auto format = std::find_if(formats.begin(), formats.end(),
+                             [this](const VkSurfaceFormatKHR &f) {
+                               return f.format == swapChainImageFormat;
+                             });
+  if (format == formats.end()) {
+    LOGE("Render target %u does not support format %d", target.id,
+         swapChainImageFormat);
+    return false;
+  }
+
+  VkExtent2D extent = capabilities.currentExtent;
+  if (capabilities.currentTransform & VK_SURFACE_TRANSFORM_ROTATE_90_BIT_KHR ||
+      capabilities.currentTransform & VK_SURFACE_TRANSFORM_ROTATE_270_BIT_KHR) {
+    std::swap(extent.width, extent.height);
+  }
+  if (extent.width == 0 || extent.height == 0) {
+    // Minimised; tried again on the target's next frame.
+    target.outOfDate = true;
+    return true;
+  }
+  uint32_t imageCount = capabilities.minImageCount + 1;
+  if (capabilities.maxImageCount > 0 &&
+      imageCount > capabilities.maxImageCount) {
+    imageCount = capabilities.maxImageCount;
+  }
+
+  VkSwapchainCreateInfoKHR createInfo{};
+  createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+  createInfo.surface = target.surface;
+  createInfo.minImageCount = imageCount;
+  createInfo.imageFormat = format->format;
+  createInfo.imageColorSpace = format->colorSpace;
+  createInfo.imageExtent = extent;
+  createInfo.imageArrayLayers = 1;
+  createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+  createInfo.preTransform = capabilities.currentTransform;
+  QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+  uint32_t queueFamilyIndices[] = {indices.graphicsFamily.value(),
+                                   indices.presentFamily.value()};
+  if (indices.graphicsFamily != indices.presentFamily) {
+    createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+    createInfo.queueFamilyIndexCount = 2;
+    createInfo.pQueueFamilyIndices = queueFamilyIndices;
+  } else {
+    createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  }
+  createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_INHERIT_BIT_KHR;
+  createInfo.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+  createInfo.clipped = VK_TRUE;
+  createInfo.oldSwapchain = target.swapChain;
+
+  VkSwapchainKHR newSwapChain;
+  VK_CHECK(vkCreateSwapchainKHR(device, &createInfo, nullptr, &newSwapChain));
+  if (target.swapChain != VK_NULL_HANDLE) {
+    // Presents of the old swapchain may still be pending.
+    vkDeviceWaitIdle(device);
+  }
+  destroyTargetSwapChain(target);
+  target.swapChain = newSwapChain;
+  target.extent = extent;
+  target.pretransform = capabilities.currentTransform;
+  target.outOfDate = false;
+
+  vkGetSwapchainImagesKHR(device, target.swapChain, &imageCount, nullptr);
+  target.images.resize(imageCount);
+  vkGetSwapchainImagesKHR(device, target.swapChain, &imageCount,
+                          target.images.data());
+  target.imageViews.resize(imageCount);
+  target.framebuffers.resize(imageCount);
+  for (uint32_t i = 0; i < imageCount; i++) {
+    VK_CHECK(imageViewCache.acquire(
+        target.images[i], kColorView.withFormat(swapChainImageFormat),
+        &target.imageViews[i]));
+
+    target.framebuffers[i] = acquireFramebuffer(
+        renderPass, renderPassDesc, target.imageViews[i],
+        createInfo.imageUsage, extent);
+  }
+  return true;
 }
 
-void HelloVK::createImageViews() {
-  swapChainImageViews.resize(swapChainImages.size());
-  for (size_t i = 0; i < swapChainImages.size(); i++) {
-    VkImageViewCreateInfo createInfo{};
-    createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-    createInfo.image = swapChainImages[i];
-    createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    createInfo.format = swapChainImageFormat;
-    createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-    createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-    createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-    createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-    createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    createInfo.subresourceRange.baseMipLevel = 0;
-    createInfo.subresourceRange.levelCount = 1;
-    createInfo.subresourceRange.baseArrayLayer = 0;
-    createInfo.subresourceRange.layerCount = 1;
-    VK_CHECK(vkCreateImageView(device, &createInfo, nullptr,
-                               &swapChainImageViews[i]));
+// The caller makes sure the GPU no longer uses the swapchain.
+void HelloVK::destroyTargetSwapChain(RenderTarget &target) {
+  for (size_t i = 0; i < target.imageViews.size(); i++) {
+    releaseFramebuffer(target.framebuffers[i], target.imageViews[i]);
+    imageViewCache.release(target.imageViews[i]);
+    imageViewCache.releaseImage(target.images[i]);
   }
+  target.framebuffers.clear();
+  target.images.clear();
+  target.imageViews.clear();
+  vkDestroySwapchainKHR(device, target.swapChain, nullptr);
+  target.swapChain = VK_NULL_HANDLE;
 }
 
-void HelloVK::createRenderPass() {
-  VkAttachmentDescription colorAttachment{};
-  colorAttachment.format = swapChainImageFormat;
-  colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+void HelloVK::destroyTarget(RenderTarget &target) {
+  destroyTargetSwapChain(target);
+  vkDestroySurfaceKHR(instance, target.surface, nullptr);
+  destroyOffscreenTarget(target.offscreen);
+  for (RenderTarget::Frame &frame : target.frames) {
+    vkDestroySemaphore(device, frame.imageAvailable, nullptr);
+    vkDestroySemaphore(device, frame.renderFinished, nullptr);
+    vkDestroyFence(device, frame.inFlight, nullptr);
+    vkFreeCommandBuffers(device, commandPool, 1, &frame.commandBuffer);
+  }
+  vkDestroyDescriptorPool(device, target.descriptorPool, nullptr);
+  vkUnmapMemory(device, target.uniformMemory);
+  vkDestroyBuffer(device, target.uniformBuffer, nullptr);
+  vkFreeMemory(device, target.uniformMemory, nullptr);
+}
 
-  colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-  colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+void HelloVK::removeTarget(TargetId id) {
+  auto it = std::find_if(targets.begin(), targets.end(),
+                         [id](const auto &target) { return target->id == id; });
+  if (it == targets.end()) {
+    return;
+  }
+  // A present may still wait on the target's semaphores after its fences
+  // signaled.
+  vkDeviceWaitIdle(device);
+  destroyTarget(**it);
+  targets.erase(it);
+}
 
-  colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-  colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+void HelloVK::setTargetViewTransform(TargetId id, const mat4 &transform) {
+  RenderTarget *target = findTarget(id);
+  assert(target != nullptr);
+  target->viewTransform.publish(transform);
+}
 
-  colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+uint64_t HelloVK::targetFrameCount(TargetId id) {
+  RenderTarget *target = findTarget(id);
+  return target != nullptr ? target->frameCount : 0;
+}
 
-  VkAttachmentReference colorAttachmentRef{};
-  colorAttachmentRef.attachment = 0;
-  colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+VkRenderPass HelloVK::targetRenderPass(bool present) {
+  if (present == (surface != VK_NULL_HANDLE)) {
+    return renderPass;
+  }
+  if (alternateRenderPass == VK_NULL_HANDLE) {
+    RenderPassDesc desc =
+        kSceneRenderPass.withFormat(0, swapChainImageFormat)
+            .withFinalLayout(0, present ? VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+                                        : VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    VK_CHECK(renderPassCache.acquire(desc, &alternateRenderPass));
+  }
+  return alternateRenderPass;
+}
 
-  VkSubpassDescription subpass{};
-  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-  subpass.colorAttachmentCount = 1;
-  subpass.pColorAttachments = &colorAttachmentRef;
+/*
+ * Records and submits a frame for every target that is due, has a free frame
+ * slot and, for windows, an image available right now. Swapchain images are
+ * queued in pendingPresents.
+ */
+void HelloVK::submitDueTargets() {
+  auto now = std::chrono::steady_clock::now();
+  for (auto &targetPointer : targets) {
+    RenderTarget &target = *targetPointer;
+    if (target.interval.count() > 0 && now < target.nextFrameTime) {
+      continue;
+    }
+    // Offscreen targets next to a window are an optional pass.
+    if (!power.optionalPasses && surface != VK_NULL_HANDLE &&
+        target.surface == VK_NULL_HANDLE) {
+      continue;
+    }
+    RenderTarget::Frame &frame = target.frames[target.currentFrame];
+    if (vkGetFenceStatus(device, frame.inFlight) != VK_SUCCESS) {
+      continue;
+    }
 
-  VkSubpassDependency dependency{};
-  dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-  dependency.dstSubpass = 0;
-  dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependency.srcAccessMask = 0;
-  dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    bool present = target.surface != VK_NULL_HANDLE;
+    VkFramebuffer framebuffer = target.offscreen.framebuffer;
+    VkImageView attachment = target.offscreen.view;
+    uint32_t imageIndex = 0;
+    if (present) {
+      if (target.swapChainFailed) {
+        continue;
+      }
+      if (target.outOfDate) {
+        if (!createTargetSwapChain(target)) {
+          LOGE("Render target %u stops presenting until the format changes",
+               target.id);
+          target.swapChainFailed = true;
+        }
+        if (target.swapChainFailed || target.outOfDate) {
+          continue;
+        }
+      }
+      VkResult result =
+          vkAcquireNextImageKHR(device, target.swapChain, 0,
+                                frame.imageAvailable, VK_NULL_HANDLE,
+                                &imageIndex);
+      if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+        target.outOfDate = true;
+        continue;
+      }
+      if (result == VK_NOT_READY || result == VK_TIMEOUT) {
+        continue;
+      }
+      assert(result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR);
+      framebuffer = target.framebuffers[imageIndex];
+      attachment = target.imageViews[imageIndex];
+    }
 
-  VkRenderPassCreateInfo renderPassInfo{};
-  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-  renderPassInfo.attachmentCount = 1;
-  renderPassInfo.pAttachments = &colorAttachment;
-  renderPassInfo.subpassCount = 1;
-  renderPassInfo.pSubpasses = &subpass;
-  renderPassInfo.dependencyCount = 1;
-  renderPassInfo.pDependencies = &dependency;
+    VK_CHECK(vkResetFences(device, 1, &frame.inFlight));
+    VK_CHECK(vkResetCommandBuffer(frame.commandBuffer, 0));
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_CHECK(vkBeginCommandBuffer(frame.commandBuffer, &beginInfo));
+    CommandEncoder encoder(frame.commandBuffer);
+    recordRenderPass(encoder, framebuffer, attachment, target.extent,
+                     targetRenderPass(present), graphicsPipeline,
+                     frame.descriptorSet, frameClearColor);
+    VK_CHECK(vkEndCommandBuffer(frame.commandBuffer));
+    commandTotals += encoder.stats();
+    encodedCommandBuffers++;
+
+    mat4 view;
+    target.viewTransform.latch(view);
+    UniformBufferObject ubo{};
+    ubo.mvp = getPrerotationMatrix(target.pretransform) * view;
+    memcpy(frame.uniformMapped, &ubo, sizeof(ubo));
+
+    VkPipelineStageFlags waitStage =
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &frame.commandBuffer;
+    if (present) {
+      submitInfo.waitSemaphoreCount = 1;
+      submitInfo.pWaitSemaphores = &frame.imageAvailable;
+      submitInfo.pWaitDstStageMask = &waitStage;
+      submitInfo.signalSemaphoreCount = 1;
+      submitInfo.pSignalSemaphores = &frame.renderFinished;
+    }
+    VK_CHECK(vkQueueSubmit(graphicsQueue, 1, &submitInfo, frame.inFlight));
+    if (present) {
+      pendingPresents.add(target.swapChain, imageIndex, frame.renderFinished,
+                          &target);
+    }
 
-  VK_CHECK(vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass));
+    target.frameCount++;
+    target.currentFrame = (target.currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+    target.nextFrameTime =
+        std::max(now, target.nextFrameTime) + target.interval;
+  }
 }
 
 /*
- * Creates a graphics pipeline loading a simple vertex and fragment shader, both
- * with 'main' set as entrypoint A list of standard parameters are provided:
- * 	- The vertex input coming from the application is set to empty - we are
- * hardcoding the triangle in the vertex shader.
- * 	- The input assembly is configured to draw triangle lists
- *  - We intend to draw onto the whole screen, so the scissoring extent is
- * specified as being the whole swapchain extent.
- * 	- The rasterizer is set to discard fragmets beyond the near and far
- * planes (depthClampEnable=false) as well as sending geometry to the frame
- * buffer and generate fragments for the whole area of the geometry. We consider
- * geometry in terms of the clockwise order of their respective vertex input.
- *  - Multisampling is disabled
- *  - Depth and stencil testing are disabled
- * 	- ColorBlending is set to opaque mode, meaning any new fragments will
- * overwrite the ones already existing in the framebuffer
- *  - We utilise Vulkan's concept of dynamic state for viewport and scissoring.
- * 		The other option is to hardcode the viewport/scissor options,
- * however this means needing to recreate the whole graphics pipeline object
- * when the screen is rotated.
- *  - The pipeline layout sends 1 uniform buffer object to the shader containing
- * a 4x4 rotation matrix specified by the descriptorSetLayout. This is required
- * in order to render a rotated scene when the device has been rotated.
+ * Presents everything in pendingPresents with one vkQueuePresentKHR and
+ * returns the main window's result, VK_SUCCESS if it has none. The wait
+ * semaphores are consumed even when a swapchain reports out of date, so the
+ * other swapchains are unaffected; such targets are recreated before their
+ * next frame.
  */
-void HelloVK::createGraphicsPipeline() {
-  auto vertShaderCode =
-      LoadBinaryFileToVector("shaders/shader.vert.spv", assetManager);
-  auto fragShaderCode =
-      LoadBinaryFileToVector("shaders/shader.frag.spv", assetManager);
+VkResult HelloVK::presentBatch() {
+  uint32_t count = pendingPresents.swapChains.size();
+  if (count == 0) {
+    return VK_SUCCESS;
+  }
+  pendingPresents.results.assign(count, VK_SUCCESS);
+  VkPresentInfoKHR presentInfo{};
+  presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+  presentInfo.waitSemaphoreCount = count;
+  presentInfo.pWaitSemaphores = pendingPresents.waitSemaphores.data();
+  presentInfo.swapchainCount = count;
+  presentInfo.pSwapchains = pendingPresents.swapChains.data();
+  presentInfo.pImageIndices = pendingPresents.imageIndices.data();
+  presentInfo.pResults = pendingPresents.results.data();
+  VkPresentRegionsKHR regions{};
+  if (incrementalPresent) {
+    regions.sType = VK_STRUCTURE_TYPE_PRESENT_REGIONS_KHR;
+    regions.swapchainCount = count;
+    regions.pRegions = pendingPresents.regions.data();
+    presentInfo.pNext = &regions;
+  }
+  // The per swapchain results below carry the outcome.
+  vkQueuePresentKHR(presentQueue, &presentInfo);
+
+  VkResult mainResult = VK_SUCCESS;
+  for (uint32_t i = 0; i < count; i++) {
+    VkResult result = pendingPresents.results[i];
+    RenderTarget *target = pendingPresents.targets[i];
+    if (target == nullptr) {
+      mainResult = result;
+    } else if (result == VK_SUBOPTIMAL_KHR ||
+               result == VK_ERROR_OUT_OF_DATE_KHR) {
+      target->outOfDate = true;
+    } else {
+      assert(result == VK_SUCCESS);  // failed to present swap chain image!
+    }
+  }
+  return mainResult;
+}
 
-  VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-  VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+void HelloVK::renderTargets() {
+  advanceClearColor();
+  pendingPresents.clear();
+  submitDueTargets();
+  presentBatch();
+}
 
-  VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
-  vertShaderStageInfo.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-  vertShaderStageInfo.module = vertShaderModule;
-  vertShaderStageInfo.pName = "main";
+bool HelloVK::multiviewSupported() {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  if (properties.apiVersion < VK_API_VERSION_1_1) {
+    return false;
+  }
+  VkPhysicalDeviceMultiviewFeatures multiview{};
+  multiview.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES;
+  VkPhysicalDeviceFeatures2 features{};
+  features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  features.pNext = &multiview;
+  vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+  return multiview.multiview == VK_TRUE;
+}
 
-  VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
-  fragShaderStageInfo.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-  fragShaderStageInfo.module = fragShaderModule;
-  fragShaderStageInfo.pName = "main";
+/*
+ * shaderFloat16 comes from VK_KHR_shader_float16_int8, which is core in
+ * Vulkan 1.2 but still needs enabling as an extension on a 1.1 instance.
+ */
+bool HelloVK::float16Supported() {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  if (properties.apiVersion < VK_API_VERSION_1_1) {
+    return false;
+  }
+  uint32_t extensionCount;
+  vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr,
+                                       &extensionCount, nullptr);
+  std::vector<VkExtensionProperties> available(extensionCount);
+  vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr,
+                                       &extensionCount, available.data());
+  auto isFloat16 = [](const VkExtensionProperties &extension) {
+    return strcmp(extension.extensionName,
+                  VK_KHR_SHADER_FLOAT16_INT8_EXTENSION_NAME) == 0;
+  };
+  if (std::none_of(available.begin(), available.end(), isFloat16)) {
+    return false;
+  }
+  VkPhysicalDeviceShaderFloat16Int8FeaturesKHR float16{};
+  float16.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_FLOAT16_INT8_FEATURES_KHR;
+  VkPhysicalDeviceFeatures2 features{};
+  features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  features.pNext = &float16;
+  vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+  return float16.shaderFloat16 == VK_TRUE;
+}
 
-  VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo,
-                                                    fragShaderStageInfo};
+bool HelloVK::deviceExtensionSupported(const char *name) {
+  uint32_t extensionCount;
+  vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr,
+                                       &extensionCount, nullptr);
+  std::vector<VkExtensionProperties> available(extensionCount);
+  vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr,
+                                       &extensionCount, available.data());
+  return std::any_of(available.begin(), available.end(),
+                     [name](const VkExtensionProperties &extension) {
+                       return strcmp(extension.extensionName, name) == 0;
+                     });
+}
+
+/*
+ * VK_KHR_imageless_framebuffer is core in Vulkan 1.2. On 1.1 it is an
+ * extension, and needs VK_KHR_image_format_list enabled with it.
+ */
+bool HelloVK::imagelessFramebufferSupported() {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  if (properties.apiVersion < VK_API_VERSION_1_1) {
+    return false;
+  }
+  if (!deviceExtensionSupported(VK_KHR_IMAGELESS_FRAMEBUFFER_EXTENSION_NAME) ||
+      !deviceExtensionSupported(VK_KHR_IMAGE_FORMAT_LIST_EXTENSION_NAME)) {
+    return false;
+  }
+  VkPhysicalDeviceImagelessFramebufferFeaturesKHR imageless{};
+  imageless.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGELESS_FRAMEBUFFER_FEATURES_KHR;
+  VkPhysicalDeviceFeatures2 features{};
+  features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  features.pNext = &imageless;
+  vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+  return imageless.imagelessFramebuffer == VK_TRUE;
+}
 
-  VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
-  vertexInputInfo.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-  vertexInputInfo.vertexBindingDescriptionCount = 0;
-  vertexInputInfo.pVertexBindingDescriptions = nullptr;
-  vertexInputInfo.vertexAttributeDescriptionCount = 0;
-  vertexInputInfo.pVertexAttributeDescriptions = nullptr;
-
-  VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
-  inputAssembly.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-  inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-  inputAssembly.primitiveRestartEnable = VK_FALSE;
-
-  VkPipelineViewportStateCreateInfo viewportState{};
-  viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-  viewportState.viewportCount = 1;
-  viewportState.scissorCount = 1;
-
-  VkPipelineRasterizationStateCreateInfo rasterizer{};
-  rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-  rasterizer.depthClampEnable = VK_FALSE;
-  rasterizer.rasterizerDiscardEnable = VK_FALSE;
-  rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-  rasterizer.lineWidth = 1.0f;
-
-  rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-  rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-
-  rasterizer.depthBiasEnable = VK_FALSE;
-  rasterizer.depthBiasConstantFactor = 0.0f;
-  rasterizer.depthBiasClamp = 0.0f;
-  rasterizer.depthBiasSlopeFactor = 0.0f;
-
-  VkPipelineMultisampleStateCreateInfo multisampling{};
-  multisampling.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-  multisampling.sampleShadingEnable = VK_FALSE;
-  multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-  multisampling.minSampleShading = 1.0f;
-  multisampling.pSampleMask = nullptr;
-  multisampling.alphaToCoverageEnable = VK_FALSE;
-  multisampling.alphaToOneEnable = VK_FALSE;
-
-  VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-  colorBlendAttachment.colorWriteMask =
-      VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-      VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-  colorBlendAttachment.blendEnable = VK_FALSE;
-
-  VkPipelineColorBlendStateCreateInfo colorBlending{};
-  colorBlending.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-  colorBlending.logicOpEnable = VK_FALSE;
-  colorBlending.logicOp = VK_LOGIC_OP_COPY;
-  colorBlending.attachmentCount = 1;
-  colorBlending.pAttachments = &colorBlendAttachment;
-  colorBlending.blendConstants[0] = 0.0f;
-  colorBlending.blendConstants[1] = 0.0f;
-  colorBlending.blendConstants[2] = 0.0f;
-  colorBlending.blendConstants[3] = 0.0f;
+// Both eyes in one pass: the view mask broadcasts every draw to layers 0 and
+// 1. The eye target is left ready for sampling by the compose pass.
+constexpr RenderPassDesc kStereoRenderPass =
+    RenderPassDesc{}
+        .addColor(VK_FORMAT_UNDEFINED, VK_ATTACHMENT_LOAD_OP_CLEAR,
+                  VK_ATTACHMENT_STORE_OP_STORE, VK_IMAGE_LAYOUT_UNDEFINED,
+                  VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+        .withViewMask(0b11);
+static_assert(kStereoRenderPass.valid(), "invalid stereo render pass");
+
+// Every swapchain pixel is covered by the compose triangle, so nothing is
+// cleared.
+constexpr RenderPassDesc kComposeRenderPass = RenderPassDesc{}.addColor(
+    VK_FORMAT_UNDEFINED, VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+    VK_ATTACHMENT_STORE_OP_STORE, VK_IMAGE_LAYOUT_UNDEFINED,
+    VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+static_assert(kComposeRenderPass.valid(), "invalid compose render pass");
+
+// A full screen triangle; pre-rotation changes its winding, so no culling.
+constexpr GraphicsPipelineDesc kComposePipeline = GraphicsPipelineDesc{};
+static_assert(kComposePipeline.valid(), "invalid compose pipeline");
+
+// Both eyes of the stereo target, one layer each.
+constexpr ImageViewDesc kEyesView =
+    kColorView.withLayers(VK_IMAGE_VIEW_TYPE_2D_ARRAY, 0, 2);
+static_assert(kEyesView.valid(), "invalid eye target view");
+
+/*
+ * The stereo pipeline is the scene pipeline with the multiview vertex shader,
+ * sharing its layout. The compose pipeline draws into the swapchain images
+ * and reads the eye target through composeDescriptorSet, which
+ * createStereoTarget() points at the current image.
+ */
+void HelloVK::createStereoPipelines() {
+  // The eye target only lives until the compose pass has sampled it.
+  LoadStoreAnalyzer frame;
+  uint32_t eyes =
+      frame.addResource("eye target", ResourceLifetime::Transient);
+  uint32_t swapchain =
+      frame.addResource("swapchain image", ResourceLifetime::Exported);
+  uint32_t stereoPass = frame.addPass(
+      "stereo", kStereoRenderPass.withFormat(0, swapChainImageFormat),
+      {{eyes, AttachmentWrite::Clear}});
+  frame.addRead(eyes);
+  uint32_t composePass = frame.addPass(
+      "compose", kComposeRenderPass.withFormat(0, swapChainImageFormat),
+      {{swapchain, AttachmentWrite::Overwrite}});
+  frame.analyze();
+  logLoadStoreFindings(frame);
+  VK_CHECK(renderPassCache.acquire(frame.optimized(stereoPass),
+                                   &stereoRenderPass));
+  VK_CHECK(renderPassCache.acquire(frame.optimized(composePass),
+                                   &composeRenderPass));
+
+  VkShaderModule sceneFrag =
+      createSceneShaderModule(VK_SHADER_STAGE_FRAGMENT_BIT);
+#ifdef HELLOVK_EMBEDDED_SHADERS
+  VkShaderModule stereoVert =
+      createShaderModule(kStereoVertSpv, sizeof(kStereoVertSpv));
+  VkShaderModule composeVert =
+      createShaderModule(kComposeVertSpv, sizeof(kComposeVertSpv));
+  VkShaderModule composeFrag =
+      createShaderModule(kComposeFragSpv, sizeof(kComposeFragSpv));
+#else
+  VkShaderModule stereoVert = createShaderModule(
+      LoadBinaryFileToVector("shaders/stereo.vert.spv", assetManager));
+  VkShaderModule composeVert = createShaderModule(
+      LoadBinaryFileToVector("shaders/compose.vert.spv", assetManager));
+  VkShaderModule composeFrag = createShaderModule(
+      LoadBinaryFileToVector("shaders/compose.frag.spv", assetManager));
+#endif
+  auto stage = [](VkShaderStageFlagBits stage, VkShaderModule module) {
+    VkPipelineShaderStageCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    info.stage = stage;
+    info.module = module;
+    info.pName = "main";
+    return info;
+  };
+
+  VkPipelineShaderStageCreateInfo stereoStages[] = {
+      stage(VK_SHADER_STAGE_VERTEX_BIT, stereoVert),
+      stage(VK_SHADER_STAGE_FRAGMENT_BIT, sceneFrag)};
+  VK_CHECK(vkt::createGraphicsPipeline(device, kScenePipeline, stereoStages,
+                                       2, pipelineLayout, stereoRenderPass,
+                                       &stereoPipeline));
+
+  VK_CHECK(samplerCache.acquire(kSamplers, kComposeSampler, &composeSampler));
+
+  VkDescriptorSetLayoutBinding eyesBinding{};
+  eyesBinding.binding = 0;
+  eyesBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  eyesBinding.descriptorCount = 1;
+  eyesBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  VkDescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = 1;
+  layoutInfo.pBindings = &eyesBinding;
+  VK_CHECK(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr,
+                                       &composeSetLayout));
 
+  VkDescriptorPoolSize poolSize = {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                                   1};
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  poolInfo.maxSets = 1;
+  VK_CHECK(vkCreateDescriptorPool(device, &poolInfo, nullptr,
+                                  &composeDescriptorPool));
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = composeDescriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &composeSetLayout;
+  VK_CHECK(
+      vkAllocateDescriptorSets(device, &allocInfo, &composeDescriptorSet));
+
+  VkPushConstantRange prerotation = {VK_SHADER_STAGE_VERTEX_BIT, 0,
+                                     sizeof(mat4)};
   VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
   pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
   pipelineLayoutInfo.setLayoutCount = 1;
-  pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
-  pipelineLayoutInfo.pushConstantRangeCount = 0;
-  pipelineLayoutInfo.pPushConstantRanges = nullptr;
-
+  pipelineLayoutInfo.pSetLayouts = &composeSetLayout;
+  pipelineLayoutInfo.pushConstantRangeCount = 1;
+  pipelineLayoutInfo.pPushConstantRanges = &prerotation;
   VK_CHECK(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr,
-                                  &pipelineLayout));
-  std::vector<VkDynamicState> dynamicStateEnables = {VK_DYNAMIC_STATE_VIEWPORT,
-                                                     VK_DYNAMIC_STATE_SCISSOR};
-  VkPipelineDynamicStateCreateInfo dynamicStateCI{};
-  dynamicStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-  dynamicStateCI.pDynamicStates = dynamicStateEnables.data();
-  dynamicStateCI.dynamicStateCount =
-      static_cast<uint32_t>(dynamicStateEnables.size());
-
-  VkGraphicsPipelineCreateInfo pipelineInfo{};
-  pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-  pipelineInfo.stageCount = 2;
-  pipelineInfo.pStages = shaderStages;
-  pipelineInfo.pVertexInputState = &vertexInputInfo;
-  pipelineInfo.pInputAssemblyState = &inputAssembly;
-  pipelineInfo.pViewportState = &viewportState;
-  pipelineInfo.pRasterizationState = &rasterizer;
-  pipelineInfo.pMultisampleState = &multisampling;
-  pipelineInfo.pDepthStencilState = nullptr;
-  pipelineInfo.pColorBlendState = &colorBlending;
-  pipelineInfo.pDynamicState = &dynamicStateCI;
-  pipelineInfo.layout = pipelineLayout;
-  pipelineInfo.renderPass = renderPass;
-  pipelineInfo.subpass = 0;
-  pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
-  pipelineInfo.basePipelineIndex = -1;
-
-  VK_CHECK(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
-                                     nullptr, &graphicsPipeline));
-  vkDestroyShaderModule(device, fragShaderModule, nullptr);
-  vkDestroyShaderModule(device, vertShaderModule, nullptr);
+                                  &composePipelineLayout));
+  VkPipelineShaderStageCreateInfo composeStages[] = {
+      stage(VK_SHADER_STAGE_VERTEX_BIT, composeVert),
+      stage(VK_SHADER_STAGE_FRAGMENT_BIT, composeFrag)};
+  VK_CHECK(vkt::createGraphicsPipeline(device, kComposePipeline,
+                                       composeStages, 2, composePipelineLayout,
+                                       composeRenderPass, &composePipeline));
+
+  vkDestroyShaderModule(device, composeFrag, nullptr);
+  vkDestroyShaderModule(device, composeVert, nullptr);
+  vkDestroyShaderModule(device, sceneFrag, nullptr);
+  vkDestroyShaderModule(device, stereoVert, nullptr);
 }
 
-VkShaderModule HelloVK::createShaderModule(const std::vector<uint8_t> &code) {
-  VkShaderModuleCreateInfo createInfo{};
-  createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-  createInfo.codeSize = code.size();
+/*
+ * Each eye gets half of the screen as the user sees it, which is the
+ * swapchain extent with width and height swapped when pre-rotating by 90 or
+ * 270 degrees.
+ */
+void HelloVK::createStereoTarget() {
+  VkExtent2D visible = swapChainExtent;
+  if (pretransformFlag & (VK_SURFACE_TRANSFORM_ROTATE_90_BIT_KHR |
+                          VK_SURFACE_TRANSFORM_ROTATE_270_BIT_KHR)) {
+    std::swap(visible.width, visible.height);
+  }
+  stereoTarget.extent = {std::max(1u, visible.width / 2), visible.height};
+  createImage(stereoTarget.extent, 2, swapChainImageFormat,
+              VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+              stereoTarget.image, stereoTarget.memory);
+
+  VK_CHECK(imageViewCache.acquire(stereoTarget.image,
+                                  kEyesView.withFormat(swapChainImageFormat),
+                                  &stereoTarget.view));
+
+  stereoTarget.framebuffer = acquireFramebuffer(
+      stereoRenderPass, kStereoRenderPass.withFormat(0, swapChainImageFormat),
+      stereoTarget.view,
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+      stereoTarget.extent, 2);
+
+  VkDescriptorImageInfo imageInfo{};
+  imageInfo.sampler = composeSampler;
+  imageInfo.imageView = stereoTarget.view;
+  imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  VkWriteDescriptorSet descriptorWrite{};
+  descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrite.dstSet = composeDescriptorSet;
+  descriptorWrite.dstBinding = 0;
+  descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  descriptorWrite.descriptorCount = 1;
+  descriptorWrite.pImageInfo = &imageInfo;
+  vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+}
 
-  // Satisifies alignment requirements since the allocator
-  // in vector ensures worst case requirements
-  createInfo.pCode = reinterpret_cast<const uint32_t *>(code.data());
-  VkShaderModule shaderModule;
-  VK_CHECK(vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule));
+void HelloVK::destroyStereoPipelines() {
+  vkDestroyPipeline(device, composePipeline, nullptr);
+  vkDestroyPipelineLayout(device, composePipelineLayout, nullptr);
+  vkDestroyDescriptorPool(device, composeDescriptorPool, nullptr);
+  vkDestroyDescriptorSetLayout(device, composeSetLayout, nullptr);
+  if (composeSampler != VK_NULL_HANDLE) {
+    samplerCache.release(composeSampler);
+  }
+  vkDestroyPipeline(device, stereoPipeline, nullptr);
+  if (stereoRenderPass != VK_NULL_HANDLE) {
+    renderPassCache.release(stereoRenderPass);
+    renderPassCache.release(composeRenderPass);
+  }
+  composePipeline = VK_NULL_HANDLE;
+  composePipelineLayout = VK_NULL_HANDLE;
+  composeDescriptorPool = VK_NULL_HANDLE;
+  composeSetLayout = VK_NULL_HANDLE;
+  composeSampler = VK_NULL_HANDLE;
+  stereoPipeline = VK_NULL_HANDLE;
+  stereoRenderPass = VK_NULL_HANDLE;
+  composeRenderPass = VK_NULL_HANDLE;
+}
 
-  return shaderModule;
+void HelloVK::destroyStereoTarget() {
+  // Same resources as an offscreen target.
+  destroyOffscreenTarget(stereoTarget);
 }
 
-void HelloVK::createFramebuffers() {
-  swapChainFramebuffers.resize(swapChainImageViews.size());
-  for (size_t i = 0; i < swapChainImageViews.size(); i++) {
-    VkImageView attachments[] = {swapChainImageViews[i]};
+/*
+ * The scene is recorded once into the eye target, then a full screen
+ * triangle samples both eyes into the swapchain image. The external
+ * dependency of stereoRenderPass makes the eye images visible to the compose
+ * pass's fragment shader.
+ */
+void HelloVK::recordStereoFrame(CommandEncoder &encoder,
+                                uint32_t imageIndex) {
+  VkCommandBuffer commandBuffer = encoder.commandBuffer();
+  recordRenderPass(encoder, stereoTarget.framebuffer, stereoTarget.view,
+                   stereoTarget.extent, stereoRenderPass, stereoPipeline,
+                   descriptorSets[currentFrame], frameClearColor);
+
+  // The swapchain framebuffers were created for renderPass, which is
+  // compatible with composeRenderPass.
+  VkRenderPassBeginInfo renderPassInfo{};
+  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+  renderPassInfo.renderPass = composeRenderPass;
+  renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
+  renderPassInfo.renderArea.extent = swapChainExtent;
+  beginRenderPass(commandBuffer, renderPassInfo,
+                  swapChainImageViews[imageIndex]);
 
-    VkFramebufferCreateInfo framebufferInfo{};
-    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-    framebufferInfo.renderPass = renderPass;
-    framebufferInfo.attachmentCount = 1;
-    framebufferInfo.pAttachments = attachments;
-    framebufferInfo.width = swapChainExtent.width;
-    framebufferInfo.height = swapChainExtent.height;
-    framebufferInfo.layers = 1;
+  VkViewport viewport{};
+  viewport.width = (float)swapChainExtent.width;
+  viewport.height = (float)swapChainExtent.height;
+  viewport.maxDepth = 1.0f;
+  encoder.setViewport(viewport);
+  VkRect2D scissor{};
+  scissor.extent = swapChainExtent;
+  encoder.setScissor(scissor);
+
+  encoder.bindPipeline(composePipeline);
+  encoder.bindDescriptorSets(composePipelineLayout, 0, 1,
+                             &composeDescriptorSet);
+  std::array<float, 16> prerotation =
+      getPrerotationMatrix(pretransformFlag).toArray();
+  vkCmdPushConstants(commandBuffer, composePipelineLayout,
+                     VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(prerotation),
+                     prerotation.data());
+  encoder.draw(3, 1, 0, 0);
+  vkCmdEndRenderPass(commandBuffer);
+}
+
+// Layers keep an alpha channel whatever the swapchain format. sRGB encodes
+// on write and decodes on sampling, so compositing gives the colours the
+// scene shader would have written directly.
+constexpr VkFormat kLayerFormat = VK_FORMAT_R8G8B8A8_SRGB;
+
+// Cleared to transparent, left ready for sampling by the composite pass.
+constexpr RenderPassDesc kLayerRenderPass = RenderPassDesc{}.addColor(
+    kLayerFormat, VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_STORE,
+    VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+static_assert(kLayerRenderPass.valid(), "invalid static layer render pass");
+
+// The layers hold premultiplied colour: cleared to zero, drawn opaque.
+constexpr GraphicsPipelineDesc kLayerCompositePipeline =
+    kComposePipeline.withBlend(ColorBlendDesc::premultipliedAlpha());
+static_assert(kLayerCompositePipeline.valid(), "invalid composite pipeline");
+
+HelloVK::StaticLayer *HelloVK::findStaticLayer(LayerId id) {
+  auto it = std::find_if(staticLayers.begin(), staticLayers.end(),
+                         [id](const auto &layer) { return layer->id == id; });
+  return it != staticLayers.end() ? it->get() : nullptr;
+}
+
+HelloVK::LayerId HelloVK::addStaticLayer(std::vector<DrawCommand> draws,
+                                         const mat4 &transform) {
+  assert(initialized && surface != VK_NULL_HANDLE);
+  if (layerRenderPass == VK_NULL_HANDLE) {
+    createLayerPipelines();
+  }
+  auto layer = std::make_unique<StaticLayer>();
+  layer->id = nextLayerId++;
+  layer->draws = std::move(draws);
+  layer->transform = transform;
+
+  VkDeviceSize stride = uniformSlotStride();
+  createBuffer(stride * MAX_FRAMES_IN_FLIGHT,
+               VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+               layer->uniformBuffer, layer->uniformMemory);
+  void *mapped;
+  VK_CHECK(vkMapMemory(device, layer->uniformMemory, 0,
+                       stride * MAX_FRAMES_IN_FLIGHT, 0, &mapped));
+
+  VkDescriptorPoolSize poolSize{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                                MAX_FRAMES_IN_FLIGHT};
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  poolInfo.maxSets = MAX_FRAMES_IN_FLIGHT;
+  VK_CHECK(vkCreateDescriptorPool(device, &poolInfo, nullptr,
+                                  &layer->descriptorPool));
+
+  VkDescriptorSetAllocateInfo setInfo{};
+  setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  setInfo.descriptorPool = layer->descriptorPool;
+  setInfo.descriptorSetCount = 1;
+  setInfo.pSetLayouts = &descriptorSetLayout;
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    layer->uniformMapped[i] = static_cast<char *>(mapped) + stride * i;
+    VK_CHECK(vkAllocateDescriptorSets(device, &setInfo,
+                                      &layer->uniformSets[i]));
+    VkDescriptorBufferInfo bufferInfo{layer->uniformBuffer, stride * i,
+                                      sizeof(UniformBufferObject)};
+    VkWriteDescriptorSet descriptorWrite{};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = layer->uniformSets[i];
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.pBufferInfo = &bufferInfo;
+    vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+  }
 
-    VK_CHECK(vkCreateFramebuffer(device, &framebufferInfo, nullptr,
-                                 &swapChainFramebuffers[i]));
+  if (layerImage.image == VK_NULL_HANDLE) {
+    createLayerImage();
   }
+  staticLayers.push_back(std::move(layer));
+  layersValid = false;
+  damage.addFull();
+  return staticLayers.back()->id;
 }
 
-void HelloVK::createCommandPool() {
-  QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
-  VkCommandPoolCreateInfo poolInfo{};
-  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-  poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-  poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
-  VK_CHECK(vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool));
+void HelloVK::updateStaticLayer(LayerId id, std::vector<DrawCommand> draws,
+                                const mat4 &transform) {
+  StaticLayer *layer = findStaticLayer(id);
+  assert(layer != nullptr);
+  layer->draws = std::move(draws);
+  layer->transform = transform;
+  layersValid = false;
+  damage.addFull();
 }
 
-void HelloVK::createCommandBuffer() {
-  commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-  VkCommandBufferAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  allocInfo.commandPool = commandPool;
-  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  allocInfo.commandBufferCount = commandBuffers.size();
+void HelloVK::removeStaticLayer(LayerId id) {
+  auto it = std::find_if(staticLayers.begin(), staticLayers.end(),
+                         [id](const auto &layer) { return layer->id == id; });
+  if (it == staticLayers.end()) {
+    return;
+  }
+  // Frames in flight may still render the layer or composite the image.
+  vkDeviceWaitIdle(device);
+  destroyStaticLayer(**it);
+  staticLayers.erase(it);
+  if (staticLayers.empty()) {
+    destroyOffscreenTarget(layerImage);
+  }
+  layersValid = false;
+  damage.addFull();
+}
 
-  VK_CHECK(vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()));
+LayerCacheStats HelloVK::staticLayerStats(LayerId id) const {
+  for (const auto &layer : staticLayers) {
+    if (layer->id == id) {
+      return layer->stats;
+    }
+  }
+  return {};
 }
 
-void HelloVK::createSyncObjects() {
-  imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-  renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-  inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+/*
+ * The layers are drawn with the scene shaders and pipeline layout into one
+ * kLayerFormat image, then blended into the swapchain image by a single full
+ * screen triangle. The scene draws are opaque, so drawing the layers in
+ * order gives what blending them one by one would.
+ */
+void HelloVK::createLayerPipelines() {
+  LoadStoreAnalyzer frame;
+  uint32_t image =
+      frame.addResource("static layer", ResourceLifetime::Persistent);
+  uint32_t pass = frame.addPass("static layer", kLayerRenderPass,
+                                {{image, AttachmentWrite::Clear}});
+  frame.analyze();
+  logLoadStoreFindings(frame);
+  layerRenderPassDesc = frame.optimized(pass);
+  VK_CHECK(renderPassCache.acquire(layerRenderPassDesc, &layerRenderPass));
+
+  VkShaderModule sceneVert =
+      createSceneShaderModule(VK_SHADER_STAGE_VERTEX_BIT);
+  VkShaderModule sceneFrag =
+      createSceneShaderModule(VK_SHADER_STAGE_FRAGMENT_BIT);
+  VkPipelineShaderStageCreateInfo stages[2] = {};
+  for (VkPipelineShaderStageCreateInfo &stage : stages) {
+    stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stage.pName = "main";
+  }
+  stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+  stages[0].module = sceneVert;
+  stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+  stages[1].module = sceneFrag;
+  VK_CHECK(vkt::createGraphicsPipeline(device, kScenePipeline, stages, 2,
+                                       pipelineLayout, layerRenderPass,
+                                       &layerPipeline));
+  vkDestroyShaderModule(device, sceneFrag, nullptr);
+  vkDestroyShaderModule(device, sceneVert, nullptr);
+
+  VK_CHECK(samplerCache.acquire(kSamplers, kLayerSampler, &layerSampler));
+  VkDescriptorSetLayoutBinding layerBinding{};
+  layerBinding.binding = 0;
+  layerBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  layerBinding.descriptorCount = 1;
+  layerBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  VkDescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = 1;
+  layoutInfo.pBindings = &layerBinding;
+  VK_CHECK(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr,
+                                       &layerSetLayout));
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount = 1;
+  pipelineLayoutInfo.pSetLayouts = &layerSetLayout;
+  VK_CHECK(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr,
+                                  &layerCompositeLayout));
+  createLayerCompositePipeline();
 
-  VkSemaphoreCreateInfo semaphoreInfo{};
-  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  VkDescriptorPoolSize poolSize{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1};
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  poolInfo.maxSets = 1;
+  VK_CHECK(vkCreateDescriptorPool(device, &poolInfo, nullptr,
+                                  &layerCompositePool));
+  VkDescriptorSetAllocateInfo setInfo{};
+  setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  setInfo.descriptorPool = layerCompositePool;
+  setInfo.descriptorSetCount = 1;
+  setInfo.pSetLayouts = &layerSetLayout;
+  VK_CHECK(vkAllocateDescriptorSets(device, &setInfo, &layerCompositeSet));
+}
 
-  VkFenceCreateInfo fenceInfo{};
-  fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-  fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-    VK_CHECK(vkCreateSemaphore(device, &semaphoreInfo, nullptr,
-                               &imageAvailableSemaphores[i]));
+// Built for renderPass, so a change of swapchain format rebuilds it.
+void HelloVK::createLayerCompositePipeline() {
+#ifdef HELLOVK_EMBEDDED_SHADERS
+  VkShaderModule vert =
+      createShaderModule(kLayerVertSpv, sizeof(kLayerVertSpv));
+  VkShaderModule frag =
+      createShaderModule(kLayerFragSpv, sizeof(kLayerFragSpv));
+#else
+  VkShaderModule vert = createShaderModule(
+      LoadBinaryFileToVector("shaders/layer.vert.spv", assetManager));
+  VkShaderModule frag = createShaderModule(
+      LoadBinaryFileToVector("shaders/layer.frag.spv", assetManager));
+#endif
+  VkPipelineShaderStageCreateInfo stages[2] = {};
+  for (VkPipelineShaderStageCreateInfo &stage : stages) {
+    stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stage.pName = "main";
+  }
+  stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+  stages[0].module = vert;
+  stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+  stages[1].module = frag;
+  VK_CHECK(vkt::createGraphicsPipeline(
+      device, kLayerCompositePipeline, stages, 2, layerCompositeLayout,
+      renderPass, &layerCompositePipeline));
+  vkDestroyShaderModule(device, frag, nullptr);
+  vkDestroyShaderModule(device, vert, nullptr);
+}
 
-    VK_CHECK(vkCreateSemaphore(device, &semaphoreInfo, nullptr,
-                               &renderFinishedSemaphores[i]));
+void HelloVK::destroyLayerPipelines() {
+  if (layerRenderPass == VK_NULL_HANDLE) {
+    return;
+  }
+  vkDestroyDescriptorPool(device, layerCompositePool, nullptr);
+  vkDestroyPipeline(device, layerCompositePipeline, nullptr);
+  vkDestroyPipelineLayout(device, layerCompositeLayout, nullptr);
+  vkDestroyDescriptorSetLayout(device, layerSetLayout, nullptr);
+  samplerCache.release(layerSampler);
+  vkDestroyPipeline(device, layerPipeline, nullptr);
+  renderPassCache.release(layerRenderPass);
+  layerCompositePool = VK_NULL_HANDLE;
+  layerCompositeSet = VK_NULL_HANDLE;
+  layerCompositePipeline = VK_NULL_HANDLE;
+  layerCompositeLayout = VK_NULL_HANDLE;
+  layerSetLayout = VK_NULL_HANDLE;
+  layerSampler = VK_NULL_HANDLE;
+  layerPipeline = VK_NULL_HANDLE;
+  layerRenderPass = VK_NULL_HANDLE;
+}
 
-    VK_CHECK(vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]));
+// At the swapchain size and orientation; invalid until rendered.
+void HelloVK::createLayerImage() {
+  VkImageUsageFlags usage =
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+  layerImage.extent = swapChainExtent;
+  createImage(swapChainExtent, 1, kLayerFormat, usage, layerImage.image,
+              layerImage.memory);
+  VK_CHECK(imageViewCache.acquire(layerImage.image,
+                                  kColorView.withFormat(kLayerFormat),
+                                  &layerImage.view));
+  layerImage.framebuffer =
+      acquireFramebuffer(layerRenderPass, layerRenderPassDesc,
+                         layerImage.view, usage, swapChainExtent);
+  layersValid = false;
+
+  VkDescriptorImageInfo imageInfo{};
+  imageInfo.sampler = layerSampler;
+  imageInfo.imageView = layerImage.view;
+  imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  VkWriteDescriptorSet descriptorWrite{};
+  descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrite.dstSet = layerCompositeSet;
+  descriptorWrite.dstBinding = 0;
+  descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  descriptorWrite.descriptorCount = 1;
+  descriptorWrite.pImageInfo = &imageInfo;
+  vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+}
+
+// The caller makes sure the GPU no longer uses the layer.
+void HelloVK::destroyStaticLayer(StaticLayer &layer) {
+  vkDestroyDescriptorPool(device, layer.descriptorPool, nullptr);
+  vkUnmapMemory(device, layer.uniformMemory);
+  vkDestroyBuffer(device, layer.uniformBuffer, nullptr);
+  vkFreeMemory(device, layer.uniformMemory, nullptr);
+}
+
+/*
+ * Renders every layer into the layer image again if any of them changed,
+ * before the main render pass. Earlier frames may still be compositing the
+ * old contents, so clearing waits for their fragment shaders.
+ */
+void HelloVK::renderStaleLayers(CommandEncoder &encoder) {
+  if (layersValid || staticLayers.empty()) {
+    for (auto &layer : staticLayers) {
+      layer->stats.hits++;
+    }
+    return;
+  }
+  VkCommandBuffer commandBuffer = encoder.commandBuffer();
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0,
+                       nullptr, 0, nullptr, 0, nullptr);
+
+  VkViewport viewport{};
+  viewport.width = (float)layerImage.extent.width;
+  viewport.height = (float)layerImage.extent.height;
+  viewport.maxDepth = 1.0f;
+  encoder.setViewport(viewport);
+  VkRect2D area = {{0, 0}, layerImage.extent};
+  encoder.setScissor(area);
+
+  VkClearValue transparent = {{{0.f, 0.f, 0.f, 0.f}}};
+  VkRenderPassBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+  beginInfo.renderPass = layerRenderPass;
+  beginInfo.framebuffer = layerImage.framebuffer;
+  beginInfo.renderArea = area;
+  beginInfo.clearValueCount = 1;
+  beginInfo.pClearValues = &transparent;
+  beginRenderPass(commandBuffer, beginInfo, layerImage.view);
+  encoder.bindPipeline(layerPipeline);
+  for (auto &layerPointer : staticLayers) {
+    StaticLayer &layer = *layerPointer;
+    layer.stats.renders++;
+    UniformBufferObject ubo{};
+    ubo.mvp = getPrerotationMatrix(pretransformFlag) * layer.transform;
+    memcpy(layer.uniformMapped[currentFrame], &ubo, sizeof(ubo));
+    encoder.bindDescriptorSets(pipelineLayout, 0, 1,
+                               &layer.uniformSets[currentFrame]);
+    for (const DrawCommand &draw : layer.draws) {
+      encoder.draw(draw.vertexCount, draw.instanceCount, draw.firstVertex,
+                   draw.firstInstance);
+    }
+  }
+  vkCmdEndRenderPass(commandBuffer);
+  layersValid = true;
+}
+
+// Inside the main render pass, before the draw list.
+void HelloVK::composeStaticLayers(CommandEncoder &encoder) {
+  if (staticLayers.empty()) {
+    return;
+  }
+  encoder.bindPipeline(layerCompositePipeline);
+  encoder.bindDescriptorSets(layerCompositeLayout, 0, 1, &layerCompositeSet);
+  encoder.draw(3, 1, 0, 0);
+}
+
+/*
+ * Image views and framebuffers come from their caches. Objects released in
+ * the last frames are not counted: they are destroyed once those frames
+ * retire.
+ */
+VulkanObjectCounts HelloVK::liveObjects() const {
+  VulkanObjectCounts counts = objectCounts;
+  const ObjectCacheStats &views = imageViewCache.stats();
+  counts.imageViews = int64_t(views.live - views.unreferenced);
+  const ObjectCacheStats &framebuffers = framebufferCache.stats();
+  counts.framebuffers = int64_t(framebuffers.live - framebuffers.unreferenced);
+  return counts;
+}
+
+SoakReport HelloVK::runSwapchainSoak(const SoakConfig &config) {
+  assert(initialized && surface != VK_NULL_HANDLE);
+  SoakReport report;
+  float scale = resolutionScale;
+  auto timed = [](LatencyRecorder *recorder,
+                  const std::function<void()> &step) {
+    auto start = std::chrono::steady_clock::now();
+    step();
+    if (recorder != nullptr) {
+      recorder->add(std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start)
+                        .count());
+    }
+  };
+  auto renderFrames = [&] {
+    for (uint32_t i = 0; i < config.framesPerStep; i++) {
+      render();
+    }
+  };
+
+  uint32_t total = config.warmupCycles + config.cycles;
+  for (uint32_t cycle = 0; cycle < total; cycle++) {
+    if (cycle == config.warmupCycles) {
+      vkDeviceWaitIdle(device);
+      report.objectsBefore = liveObjects();
+      report.memoryBefore = HostMemorySample::take(0);
+    }
+    bool measured = cycle >= config.warmupCycles;
+
+    // Resize: alternate between half and full resolution.
+    resolutionScale = cycle % 2 == 0 ? 0.5f : 1.f;
+    timed(measured ? &report.resize : nullptr,
+          [this] { applyResolutionScale(); });
+    renderFrames();
+
+    // Rotate: the recreation a suboptimal present after rotating triggers.
+    timed(measured ? &report.rotate : nullptr,
+          [this] { onOrientationChange(); });
+    renderFrames();
+
+    // Surface loss: the window goes away and comes back, as on an app
+    // switch. reset() takes over a window reference.
+    timed(measured ? &report.surfaceLoss : nullptr, [this] {
+      ANativeWindow_acquire(window.get());
+      reset(window.get(), assetManager);
+    });
+    renderFrames();
+
+    uint32_t done = cycle + 1 - config.warmupCycles;
+    if (measured && config.sampleEvery > 0 && done % config.sampleEvery == 0) {
+      report.memoryTrend.push_back(HostMemorySample::take(done));
+    }
   }
+
+  resolutionScale = scale;
+  applyResolutionScale();
+  vkDeviceWaitIdle(device);
+  report.cycles = config.cycles;
+  report.objectsAfter = liveObjects();
+  report.memoryAfter = HostMemorySample::take(config.cycles);
+  return report;
 }
 
-}  // namespace vkt
\ No newline at end of file
+}  // namespace vkt
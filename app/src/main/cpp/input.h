@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <game-activity/native_app_glue/android_native_app_glue.h>
+#include <stdint.h>
+
+#include <array>
+#include <chrono>
+
+/**
+ * Input handling for HelloVK.
+ *
+ * GameActivity double buffers key and motion events. Once per frame the render
+ * loop drains both buffers into a compact ring of timestamped events, merging
+ * consecutive moves of the same pointer so a fast swipe costs one slot per
+ * frame instead of one per sample. The scene consumes the ring afterwards.
+ */
+
+namespace vkt {
+
+enum class InputEventType : uint8_t { Key, Touch };
+
+struct InputEvent {
+  // Time the oldest sample folded into this event was generated and the time
+  // of the newest one, both in nanoseconds on CLOCK_MONOTONIC (the clock
+  // GameActivity uses for eventTime).
+  int64_t firstTimestampNs;
+  int64_t timestampNs;
+  InputEventType type;
+  // AKEY_EVENT_ACTION_* for keys, masked AMOTION_EVENT_ACTION_* for touches.
+  int32_t action;
+  // Key code for keys, pointer id for touches.
+  int32_t id;
+  float x;
+  float y;
+  // Number of move samples merged into this event.
+  uint16_t coalesced;
+};
+
+/*
+ * Fixed capacity FIFO. When the consumer falls behind the oldest events are
+ * overwritten: stale input is worth less than fresh input.
+ */
+template <size_t Capacity>
+class InputEventRing {
+ public:
+  void push(const InputEvent &event) {
+    if (count == Capacity) {
+      head = (head + 1) % Capacity;
+      count--;
+      dropped++;
+    }
+    events[(head + count) % Capacity] = event;
+    count++;
+  }
+
+  bool pop(InputEvent &event) {
+    if (count == 0) {
+      return false;
+    }
+    event = events[head];
+    head = (head + 1) % Capacity;
+    count--;
+    return true;
+  }
+
+  // Newest first: fromBack(0) is the most recently pushed event.
+  InputEvent &fromBack(size_t i) {
+    return events[(head + count - 1 - i) % Capacity];
+  }
+
+  size_t size() const { return count; }
+  uint64_t droppedCount() const { return dropped; }
+
+ private:
+  std::array<InputEvent, Capacity> events{};
+  size_t head = 0;
+  size_t count = 0;
+  uint64_t dropped = 0;
+};
+
+struct InputStats {
+  uint64_t keyEvents = 0;
+  uint64_t touchSamples = 0;
+  uint64_t coalescedSamples = 0;
+};
+
+class InputQueue {
+ public:
+  /*
+   * Moves every buffered key and motion event into the ring, in timestamp
+   * order, and clears both GameActivity buffers so the glue code can reuse
+   * them.
+   */
+  void drain(android_input_buffer *inputBuffer) {
+    uint64_t k = 0;
+    uint64_t m = 0;
+    while (k < inputBuffer->keyEventsCount ||
+           m < inputBuffer->motionEventsCount) {
+      bool takeKey = m == inputBuffer->motionEventsCount ||
+                     (k < inputBuffer->keyEventsCount &&
+                      inputBuffer->keyEvents[k].eventTime <=
+                          inputBuffer->motionEvents[m].eventTime);
+      if (takeKey) {
+        pushKey(inputBuffer->keyEvents[k++]);
+      } else {
+        pushMotion(inputBuffer->motionEvents[m++]);
+      }
+    }
+    android_app_clear_key_events(inputBuffer);
+    android_app_clear_motion_events(inputBuffer);
+  }
+
+  // Events leave the ring once popped, so only events the scene has not seen
+  // yet are ever coalesced.
+  bool pop(InputEvent &event) { return ring.pop(event); }
+
+  const InputStats &stats() const { return inputStats; }
+  uint64_t droppedCount() const { return ring.droppedCount(); }
+
+ private:
+  static constexpr size_t kCapacity = 64;
+
+  void pushKey(const GameActivityKeyEvent &key) {
+    InputEvent event{};
+    event.firstTimestampNs = key.eventTime;
+    event.timestampNs = key.eventTime;
+    event.type = InputEventType::Key;
+    event.action = key.action;
+    event.id = key.keyCode;
+    push(event);
+    inputStats.keyEvents++;
+  }
+
+  void pushMotion(const GameActivityMotionEvent &motion) {
+    int32_t action = motion.action & AMOTION_EVENT_ACTION_MASK;
+    int32_t actionIndex =
+        (motion.action & AMOTION_EVENT_ACTION_POINTER_INDEX_MASK) >>
+        AMOTION_EVENT_ACTION_POINTER_INDEX_SHIFT;
+
+    for (uint32_t i = 0; i < motion.pointerCount; i++) {
+      const GameActivityPointerAxes &pointer = motion.pointers[i];
+      int32_t pointerAction = action;
+      if (action == AMOTION_EVENT_ACTION_POINTER_DOWN ||
+          action == AMOTION_EVENT_ACTION_POINTER_UP) {
+        // Only the indexed pointer changed state, the others just report
+        // their current position.
+        if ((int32_t)i != actionIndex) {
+          pointerAction = AMOTION_EVENT_ACTION_MOVE;
+        }
+      }
+
+      InputEvent event{};
+      event.firstTimestampNs = motion.eventTime;
+      event.timestampNs = motion.eventTime;
+      event.type = InputEventType::Touch;
+      event.action = pointerAction;
+      event.id = pointer.id;
+      event.x = GameActivityPointerAxes_getX(&pointer);
+      event.y = GameActivityPointerAxes_getY(&pointer);
+      inputStats.touchSamples++;
+
+      if (pointerAction == AMOTION_EVENT_ACTION_MOVE && coalesce(event)) {
+        inputStats.coalescedSamples++;
+        continue;
+      }
+      push(event);
+    }
+  }
+
+  /*
+   * Folds a move into the latest queued event of the same pointer when that
+   * event is itself a move. A down or up in between ends the run so gestures
+   * keep their shape, and so does a key event so ordering is preserved.
+   */
+  bool coalesce(const InputEvent &move) {
+    for (size_t i = 0; i < ring.size(); i++) {
+      InputEvent &previous = ring.fromBack(i);
+      if (previous.type != InputEventType::Touch) {
+        return false;
+      }
+      if (previous.id != move.id) {
+        continue;
+      }
+      if (previous.action != AMOTION_EVENT_ACTION_MOVE) {
+        return false;
+      }
+      previous.timestampNs = move.timestampNs;
+      previous.x = move.x;
+      previous.y = move.y;
+      previous.coalesced++;
+      return true;
+    }
+    return false;
+  }
+
+  void push(const InputEvent &event) { ring.push(event); }
+
+  InputEventRing<kCapacity> ring;
+  InputStats inputStats;
+};
+
+// Same clock as GameActivity event timestamps.
+inline int64_t monotonicNowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace vkt
@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <initializer_list>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "vk_builders.h"
+
+/**
+ * Load and store ops derived from how a frame uses its attachments.
+ *
+ * A frame is described in submission order: render passes, naming the frame
+ * resource behind each attachment and what the pass does with it, and reads
+ * outside render passes (sampling, copies). analyze() then
+ *
+ *   - loads an attachment only when the pass draws on top of contents an
+ *     earlier pass, or an earlier frame, left in it; otherwise it clears,
+ *     or leaves the contents undefined when every pixel is overwritten;
+ *   - stores an attachment only when something after the pass reads it:
+ *     a later read or pass in the frame, present, readback or the next frame.
+ *
+ * On a tiler each needless load or store moves a whole attachment through
+ * memory every frame. The ops a pass was declared with are compared against
+ * the chosen ones and every difference becomes a finding; optimized() returns
+ * the description with the chosen ops.
+ */
+
+namespace vkt {
+
+enum class AttachmentWrite {
+  Clear,       // starts from the clear value
+  Accumulate,  // draws on top of the existing contents
+  Overwrite,   // writes every pixel, e.g. a full screen pass
+};
+
+enum class ResourceLifetime {
+  Transient,  // produced and consumed within the frame
+  Exported,   // read after the frame: presented or read back
+  Persistent  // exported, and the next frame builds on the contents
+};
+
+struct LoadStoreFinding {
+  enum class Kind {
+    // Bandwidth.
+    UnusedStore,       // stored although nothing reads it afterwards
+    UnneededLoad,      // loaded although it is cleared or overwritten
+    UnneededClear,     // cleared although every pixel is overwritten
+    MultisampleStore,  // multisampled contents are written to memory
+    // Correctness.
+    MissingStore,      // read afterwards but not stored
+    MissingLoad,       // accumulates onto contents it does not load
+    UndefinedContents  // accumulates onto contents nothing wrote
+  };
+  Kind kind;
+  std::string pass;
+  std::string resource;
+
+  bool costsBandwidth() const {
+    return kind == Kind::UnusedStore || kind == Kind::UnneededLoad ||
+           kind == Kind::UnneededClear || kind == Kind::MultisampleStore;
+  }
+
+  std::string message() const {
+    const char *what = "";
+    switch (kind) {
+      case Kind::UnusedStore:
+        what = "is stored but nothing reads it afterwards";
+        break;
+      case Kind::UnneededLoad:
+        what = "is loaded but the pass clears or overwrites it";
+        break;
+      case Kind::UnneededClear:
+        what = "is cleared but the pass overwrites every pixel";
+        break;
+      case Kind::MultisampleStore:
+        what = "is multisampled and stored, resolve it instead";
+        break;
+      case Kind::MissingStore:
+        what = "is read afterwards but not stored";
+        break;
+      case Kind::MissingLoad:
+        what = "is drawn on top of but not loaded";
+        break;
+      case Kind::UndefinedContents:
+        what = "is drawn on top of but nothing wrote it, clearing";
+        break;
+    }
+    return pass + ": " + resource + " " + what;
+  }
+};
+
+class LoadStoreAnalyzer {
+ public:
+  static constexpr uint32_t kNoResource = UINT32_MAX;
+
+  struct PassAttachment {
+    uint32_t resource;
+    AttachmentWrite write;
+  };
+
+  uint32_t addResource(std::string name, ResourceLifetime lifetime) {
+    resources.push_back({std::move(name), lifetime});
+    return resources.size() - 1;
+  }
+
+  /*
+   * Colour attachment i of desc renders to colors[i]; depth, when desc has
+   * one, to depth. Returns the index for optimized().
+   */
+  uint32_t addPass(std::string name, const RenderPassDesc &desc,
+                   std::initializer_list<PassAttachment> colors,
+                   PassAttachment depth = {kNoResource,
+                                           AttachmentWrite::Clear}) {
+    assert(colors.size() == desc.colorCount);
+    uint32_t pass = passes.size();
+    passes.push_back({std::move(name), desc, desc});
+    uint32_t slot = 0;
+    for (const PassAttachment &color : colors) {
+      events.push_back({pass, slot++, color.resource, color.write});
+    }
+    if (desc.hasDepth) {
+      events.push_back({pass, kDepthSlot, depth.resource, depth.write});
+    }
+    return pass;
+  }
+
+  // resource is sampled or copied between the passes added before and after.
+  void addRead(uint32_t resource) {
+    events.push_back({kNoPass, 0, resource, AttachmentWrite::Accumulate});
+  }
+
+  void analyze() {
+    results.clear();
+    for (size_t i = 0; i < events.size(); i++) {
+      const Event &event = events[i];
+      if (event.pass == kNoPass) {
+        continue;
+      }
+      assert(event.resource < resources.size());
+      Pass &pass = passes[event.pass];
+      const Resource &resource = resources[event.resource];
+      const AttachmentDesc &declared = attachment(pass.declared, event.slot);
+      AttachmentDesc &chosen = attachment(pass.optimized, event.slot);
+      auto report = [&](LoadStoreFinding::Kind kind) {
+        results.push_back({kind, pass.name, resource.name});
+      };
+
+      // Contents before the pass: the last earlier pass on the resource, or
+      // the previous frame.
+      const AttachmentDesc *previous = nullptr;
+      for (size_t j = i; j-- > 0;) {
+        if (events[j].resource == event.resource &&
+            events[j].pass != kNoPass) {
+          previous = &attachment(passes[events[j].pass].optimized,
+                                 events[j].slot);
+          break;
+        }
+      }
+      bool hasContents =
+          previous != nullptr ||
+          resource.lifetime == ResourceLifetime::Persistent;
+
+      switch (event.write) {
+        case AttachmentWrite::Overwrite:
+          chosen.load = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+          break;
+        case AttachmentWrite::Clear:
+          chosen.load = VK_ATTACHMENT_LOAD_OP_CLEAR;
+          break;
+        case AttachmentWrite::Accumulate:
+          if (hasContents) {
+            chosen.load = VK_ATTACHMENT_LOAD_OP_LOAD;
+          } else {
+            report(LoadStoreFinding::Kind::UndefinedContents);
+            chosen.load = VK_ATTACHMENT_LOAD_OP_CLEAR;
+          }
+          break;
+      }
+      if (chosen.load == VK_ATTACHMENT_LOAD_OP_LOAD) {
+        // The layout the contents were left in; a persistent resource is
+        // assumed to end the previous frame the way this pass leaves it.
+        chosen.initialLayout =
+            previous != nullptr ? previous->finalLayout : declared.finalLayout;
+      } else {
+        // Nothing is read, so the old contents may be discarded.
+        chosen.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+      }
+      if (declared.load == VK_ATTACHMENT_LOAD_OP_LOAD &&
+          chosen.load != VK_ATTACHMENT_LOAD_OP_LOAD) {
+        report(LoadStoreFinding::Kind::UnneededLoad);
+      } else if (declared.load != VK_ATTACHMENT_LOAD_OP_LOAD &&
+                 chosen.load == VK_ATTACHMENT_LOAD_OP_LOAD) {
+        report(LoadStoreFinding::Kind::MissingLoad);
+      } else if (declared.load == VK_ATTACHMENT_LOAD_OP_CLEAR &&
+                 chosen.load == VK_ATTACHMENT_LOAD_OP_DONT_CARE) {
+        report(LoadStoreFinding::Kind::UnneededClear);
+      }
+
+      bool consumed = resource.lifetime != ResourceLifetime::Transient;
+      for (size_t j = i + 1; j < events.size(); j++) {
+        const Event &later = events[j];
+        if (later.resource == event.resource) {
+          consumed = later.pass == kNoPass ||
+                     later.write == AttachmentWrite::Accumulate;
+          break;
+        }
+      }
+      chosen.store = consumed ? VK_ATTACHMENT_STORE_OP_STORE
+                              : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+      if (declared.store == VK_ATTACHMENT_STORE_OP_STORE && !consumed) {
+        report(LoadStoreFinding::Kind::UnusedStore);
+      } else if (declared.store != VK_ATTACHMENT_STORE_OP_STORE && consumed) {
+        report(LoadStoreFinding::Kind::MissingStore);
+      }
+      if (consumed && chosen.samples != VK_SAMPLE_COUNT_1_BIT) {
+        report(LoadStoreFinding::Kind::MultisampleStore);
+      }
+    }
+  }
+
+  const RenderPassDesc &optimized(uint32_t pass) const {
+    return passes[pass].optimized;
+  }
+  const std::vector<LoadStoreFinding> &findings() const { return results; }
+
+ private:
+  static constexpr uint32_t kNoPass = UINT32_MAX;
+  static constexpr uint32_t kDepthSlot = UINT32_MAX;
+
+  struct Resource {
+    std::string name;
+    ResourceLifetime lifetime;
+  };
+  struct Pass {
+    std::string name;
+    RenderPassDesc declared;
+    RenderPassDesc optimized;
+  };
+  // A pass attachment, or a read outside passes when pass is kNoPass.
+  struct Event {
+    uint32_t pass;
+    uint32_t slot;
+    uint32_t resource;
+    AttachmentWrite write;
+  };
+
+  static AttachmentDesc &attachment(RenderPassDesc &desc, uint32_t slot) {
+    return slot == kDepthSlot ? desc.depth : desc.colors[slot];
+  }
+  static const AttachmentDesc &attachment(const RenderPassDesc &desc,
+                                          uint32_t slot) {
+    return slot == kDepthSlot ? desc.depth : desc.colors[slot];
+  }
+
+  std::vector<Resource> resources;
+  std::vector<Pass> passes;
+  std::vector<Event> events;
+  std::vector<LoadStoreFinding> results;
+};
+
+}  // namespace vkt
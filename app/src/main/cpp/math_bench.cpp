@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Microbenchmarks for the batch routines in vk_math.h. Each routine runs over
+ * the same inputs with the scalar reference and the SIMD path, checks that
+ * the outputs agree and prints the time per element. The last section times
+ * TransformHierarchy::update() over n nodes with everything, 10% and none of
+ * the nodes animated, on the calling thread and on a pool of -t threads.
+ *
+ *   adb shell /data/local/tmp/hellovk_math_bench -n 100000 -i 50 -t 4
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "transform_hierarchy.h"
+#include "vk_math.h"
+
+using vkt::mat4;
+using vkt::quat;
+using vkt::vec3;
+using vkt::vec4;
+
+// Best of iterations, in nanoseconds per element.
+static double timeBest(long iterations, size_t count,
+                       const std::function<void()> &body) {
+  double best = 1e30;
+  for (long i = 0; i < iterations; i++) {
+    auto start = std::chrono::steady_clock::now();
+    body();
+    double ns = std::chrono::duration<double, std::nano>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    best = std::min(best, ns / count);
+  }
+  return best;
+}
+
+static float maxDifference(const float *a, const float *b, size_t floats) {
+  float worst = 0.f;
+  for (size_t i = 0; i < floats; i++) {
+    worst = std::max(worst, fabsf(a[i] - b[i]) / std::max(1.f, fabsf(a[i])));
+  }
+  return worst;
+}
+
+static bool report(const char *name, double scalarNs, double simdNs,
+                   float difference) {
+  bool ok = difference < 1e-5f;
+  printf("%-18s scalar %7.2f ns  %-6s %7.2f ns  x%.2f%s\n", name, scalarNs,
+         vkt::mathBackendName(), simdNs, scalarNs / simdNs,
+         ok ? "" : "  MISMATCH");
+  return ok;
+}
+
+static void usage(const char *program) {
+  fprintf(stderr, "usage: %s [-n elements] [-i iterations] [-t threads]\n",
+          program);
+}
+
+/*
+ * A forest of count nodes where each node hangs off one of the previous 64,
+ * which gives wide, fairly deep trees and breaks level order often enough to
+ * exercise the re-sort.
+ */
+static void benchHierarchy(size_t count, long iterations, unsigned threads,
+                           std::mt19937 &random) {
+  std::uniform_real_distribution<float> value(-1.f, 1.f);
+  vkt::TransformHierarchy hierarchy(2);
+  hierarchy.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    vkt::TransformHierarchy::Handle parent = vkt::TransformHierarchy::kNoParent;
+    if (i % 1000 != 0) {
+      parent = i - 1 - random() % std::min<size_t>(i, 64);
+    }
+    hierarchy.add(parent, {value(random), value(random), value(random)},
+                  quat::fromAxisAngle({0.f, 0.f, 1.f}, value(random)));
+  }
+  std::vector<mat4> upload(count);
+  hierarchy.update(upload.data());
+
+  vkt::WorkerPool pool(threads - 1);
+  float angle = 0.f;
+  for (int percent : {100, 10, 0}) {
+    size_t animated = count * percent / 100;
+    for (vkt::WorkerPool *usePool : {(vkt::WorkerPool *)nullptr, &pool}) {
+      vkt::TransformUpdateStats stats;
+      double ns = timeBest(iterations, 1, [&] {
+        angle += 0.01f;
+        quat rotation = quat::fromAxisAngle({0.f, 0.f, 1.f}, angle);
+        // The most recently added nodes, mostly leaves and short subtrees.
+        for (size_t i = count - animated; i < count; i++) {
+          hierarchy.setRotation(i, rotation);
+        }
+        stats = hierarchy.update(upload.data(), usePool);
+      });
+      printf("hierarchy %3d%% animated, %u thread%s  %8.3f ms  "
+             "(%zu recomputed, %zu uploaded)\n",
+             percent, usePool ? pool.concurrency() : 1,
+             usePool && pool.concurrency() > 1 ? "s" : " ", ns / 1e6,
+             stats.recomputed, stats.uploaded);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  size_t count = 100000;
+  long iterations = 20;
+  unsigned threads = 4;
+  int option;
+  while ((option = getopt(argc, argv, "n:i:t:h")) != -1) {
+    switch (option) {
+      case 'n':
+        count = strtoul(optarg, nullptr, 0);
+        break;
+      case 'i':
+        iterations = strtol(optarg, nullptr, 0);
+        break;
+      case 't':
+        threads = strtoul(optarg, nullptr, 0);
+        break;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+  if (count == 0 || iterations < 1 || threads < 1) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> value(-10.f, 10.f);
+  std::vector<vec3> translations(count), scales(count), points(count);
+  std::vector<quat> rotations(count);
+  std::vector<vec4> vectors(count);
+  for (size_t i = 0; i < count; i++) {
+    translations[i] = {value(random), value(random), value(random)};
+    scales[i] = {1.f + value(random) * 0.05f, 1.f, 1.f - value(random) * 0.05f};
+    rotations[i] = quat::fromAxisAngle(
+        vkt::normalize(vec3{value(random), value(random), 1.f}),
+        value(random));
+    points[i] = {value(random), value(random), value(random)};
+    vectors[i] = {value(random), value(random), value(random), 1.f};
+  }
+  mat4 viewProjection =
+      mat4::perspective(1.f, 16.f / 9.f, 0.1f, 100.f) *
+      mat4::lookAt({0.f, 2.f, 5.f}, {0.f, 0.f, 0.f}, {0.f, 1.f, 0.f});
+
+  std::vector<mat4> locals(count), matricesA(count), matricesB(count);
+  std::vector<vec4> vectorsA(count), vectorsB(count);
+  std::vector<vec3> pointsA(count), pointsB(count);
+  vkt::scalar::composeTransforms(translations.data(), rotations.data(),
+                                 scales.data(), locals.data(), count);
+
+  printf("%zu elements, best of %ld\n", count, iterations);
+  bool ok = true;
+
+  double scalarNs = timeBest(iterations, count, [&] {
+    vkt::scalar::composeTransforms(translations.data(), rotations.data(),
+                                   scales.data(), matricesA.data(), count);
+  });
+  double simdNs = timeBest(iterations, count, [&] {
+    vkt::composeTransforms(translations.data(), rotations.data(),
+                           scales.data(), matricesB.data(), count);
+  });
+  ok &= report("composeTransforms", scalarNs, simdNs,
+               maxDifference(&matricesA[0].col[0].x, &matricesB[0].col[0].x,
+                             count * 16));
+
+  scalarNs = timeBest(iterations, count, [&] {
+    vkt::scalar::multiplyMat4(viewProjection, locals.data(), matricesA.data(),
+                              count);
+  });
+  simdNs = timeBest(iterations, count, [&] {
+    vkt::multiplyMat4(viewProjection, locals.data(), matricesB.data(), count);
+  });
+  ok &= report("multiplyMat4", scalarNs, simdNs,
+               maxDifference(&matricesA[0].col[0].x, &matricesB[0].col[0].x,
+                             count * 16));
+
+  scalarNs = timeBest(iterations, count, [&] {
+    vkt::scalar::transformVec4(viewProjection, vectors.data(), vectorsA.data(),
+                               count);
+  });
+  simdNs = timeBest(iterations, count, [&] {
+    vkt::transformVec4(viewProjection, vectors.data(), vectorsB.data(), count);
+  });
+  ok &= report("transformVec4", scalarNs, simdNs,
+               maxDifference(&vectorsA[0].x, &vectorsB[0].x, count * 4));
+
+  scalarNs = timeBest(iterations, count, [&] {
+    vkt::scalar::transformPoints(viewProjection, points.data(), pointsA.data(),
+                                 count);
+  });
+  simdNs = timeBest(iterations, count, [&] {
+    vkt::transformPoints(viewProjection, points.data(), pointsB.data(), count);
+  });
+  ok &= report("transformPoints", scalarNs, simdNs,
+               maxDifference(&pointsA[0].x, &pointsB[0].x, count * 3));
+
+  benchHierarchy(count, iterations, threads, random);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,475 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <array>
+#include <type_traits>
+#include <unordered_map>
+
+#include "vk_builders.h"
+
+/**
+ * Content-hashed, reference counted caches of samplers, image views, render
+ * passes and framebuffers.
+ *
+ * acquire() returns the object matching a description and takes a reference,
+ * creating the object only when no existing one matches. release() drops the
+ * reference. An object nobody references is kept for retainFrames frames
+ * before collect() destroys it: frames still in flight may use it, and a
+ * request for the same description in the meantime revives it instead of
+ * creating it again. With retainFrames at least the number of frames in
+ * flight and collect() called after waiting for the oldest frame, nothing the
+ * GPU uses is destroyed.
+ *
+ * Objects are found by the hash of their key and then compared with the full
+ * key, so a hash collision costs a second object, not the wrong one.
+ *
+ * Image views are keyed by their image as well. The driver may hand out the
+ * handle of a destroyed image again, so releaseImage() must be called before
+ * an image, or the swapchain owning it, is destroyed; it destroys the image's
+ * unreferenced views right away.
+ */
+
+namespace vkt {
+
+struct ObjectCacheStats {
+  uint64_t requests = 0;
+  uint64_t hits = 0;     // served by a referenced object
+  uint64_t revived = 0;  // served by an object waiting to be destroyed
+  uint64_t created = 0;
+  uint64_t destroyed = 0;
+  size_t live = 0;  // objects that exist, referenced or not
+  size_t unreferenced = 0;
+
+  double reuseRate() const {
+    return requests > 0 ? double(hits + revived) / requests : 0.;
+  }
+};
+
+// Integer value of a handle, which is a pointer on 64-bit platforms only.
+template <typename Handle>
+uint64_t handleBits(Handle handle) {
+  if constexpr (std::is_pointer_v<Handle>) {
+    return reinterpret_cast<uintptr_t>(handle);
+  } else {
+    return uint64_t(handle);
+  }
+}
+
+template <typename Handle, typename Key>
+class ObjectCache {
+ public:
+  using DestroyFunction = void (*)(VkDevice, Handle,
+                                   const VkAllocationCallbacks *);
+
+  ObjectCache(DestroyFunction destroyFunction, uint64_t retainFrames)
+      : destroyFunction(destroyFunction), retainFrames(retainFrames) {}
+  ~ObjectCache() { assert(entries.empty()); }  // clear() before the device
+
+  void init(VkDevice cacheDevice) { device = cacheDevice; }
+
+  void release(Handle handle) {
+    Entry &entry = find(handle)->second;
+    assert(entry.refs > 0);
+    if (--entry.refs == 0) {
+      entry.releasedFrame = frame;
+      cacheStats.unreferenced++;
+    }
+  }
+
+  /*
+   * Advances to frame, the count of frames submitted so far, and destroys
+   * objects unreferenced for retainFrames frames.
+   */
+  void collect(uint64_t currentFrame) {
+    frame = currentFrame;
+    for (auto it = entries.begin(); it != entries.end();) {
+      const Entry &entry = it->second;
+      if (entry.refs == 0 && frame - entry.releasedFrame >= retainFrames) {
+        it = destroy(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  // Destroys every object; the device must be idle.
+  void clear() {
+    for (auto it = entries.begin(); it != entries.end();) {
+      it = destroy(it);
+    }
+  }
+
+  const ObjectCacheStats &stats() const { return cacheStats; }
+
+ protected:
+  /*
+   * The object for key, whose hash is hash, created with
+   * create(VkDevice, Handle *) -> VkResult when there is none. owner groups
+   * objects for releaseOwner().
+   */
+  template <typename Create>
+  VkResult acquire(uint64_t hash, const Key &key, uint64_t owner,
+                   Create &&create, Handle *handle) {
+    cacheStats.requests++;
+    auto range = entries.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      Entry &entry = it->second;
+      if (!(entry.key == key)) {
+        continue;
+      }
+      if (entry.refs++ == 0) {
+        cacheStats.revived++;
+        cacheStats.unreferenced--;
+      } else {
+        cacheStats.hits++;
+      }
+      *handle = entry.handle;
+      return VK_SUCCESS;
+    }
+    VkResult result = create(device, handle);
+    if (result != VK_SUCCESS) {
+      return result;
+    }
+    entries.emplace(hash, Entry{*handle, key, owner, 1, 0});
+    hashes.emplace(*handle, hash);
+    cacheStats.created++;
+    cacheStats.live++;
+    return VK_SUCCESS;
+  }
+
+  // Destroys the unreferenced objects of owner without waiting.
+  void releaseOwner(uint64_t owner) {
+    for (auto it = entries.begin(); it != entries.end();) {
+      if (it->second.owner != owner) {
+        ++it;
+        continue;
+      }
+      assert(it->second.refs == 0);  // still in use
+      it = destroy(it);
+    }
+  }
+
+ private:
+  struct Entry {
+    Handle handle;
+    Key key;
+    uint64_t owner;
+    uint32_t refs;
+    uint64_t releasedFrame;
+  };
+  // Keyed by hash; colliding keys share a bucket.
+  using EntryMap = std::unordered_multimap<uint64_t, Entry>;
+
+  typename EntryMap::iterator find(Handle handle) {
+    auto hash = hashes.find(handle);
+    assert(hash != hashes.end());
+    auto range = entries.equal_range(hash->second);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second.handle == handle) {
+        return it;
+      }
+    }
+    assert(false);  // hashes and entries disagree
+    return entries.end();
+  }
+
+  typename EntryMap::iterator destroy(typename EntryMap::iterator it) {
+    if (it->second.refs == 0) {
+      cacheStats.unreferenced--;
+    }
+    destroyFunction(device, it->second.handle, nullptr);
+    hashes.erase(it->second.handle);
+    cacheStats.destroyed++;
+    cacheStats.live--;
+    return entries.erase(it);
+  }
+
+  DestroyFunction destroyFunction;
+  uint64_t retainFrames;
+  VkDevice device = VK_NULL_HANDLE;
+  uint64_t frame = 0;
+  EntryMap entries;
+  std::unordered_map<Handle, uint64_t> hashes;
+  ObjectCacheStats cacheStats;
+};
+
+/*
+ * Samplers count against maxSamplerAllocationCount, which can be as low as
+ * 4000; acquire() fails with VK_ERROR_TOO_MANY_OBJECTS instead of going over.
+ */
+class SamplerCache : public ObjectCache<VkSampler, SamplerDesc> {
+ public:
+  explicit SamplerCache(uint64_t retainFrames)
+      : ObjectCache(vkDestroySampler, retainFrames) {}
+
+  void setLimit(uint32_t maxSamplers) { limit = maxSamplers; }
+
+  VkResult acquire(const SamplerDesc &desc, VkSampler *sampler) {
+    return acquire(desc.hash(), desc, sampler);
+  }
+  // An entry of a constexpr table, whose hash was computed at compile time.
+  template <size_t N>
+  VkResult acquire(const DescTable<SamplerDesc, N> &table, size_t entry,
+                   VkSampler *sampler) {
+    assert(entry < N);
+    return acquire(table.hashes[entry], table.descs[entry], sampler);
+  }
+
+ private:
+  VkResult acquire(uint64_t hash, const SamplerDesc &desc,
+                   VkSampler *sampler) {
+    assert(desc.valid());
+    return ObjectCache::acquire(
+        hash, desc, 0,
+        [&](VkDevice device, VkSampler *created) {
+          if (stats().live >= limit) {
+            return VK_ERROR_TOO_MANY_OBJECTS;
+          }
+          VkSamplerCreateInfo createInfo = desc.createInfo();
+          return vkCreateSampler(device, &createInfo, nullptr, created);
+        },
+        sampler);
+  }
+
+  uint32_t limit = UINT32_MAX;
+};
+
+struct ImageViewKey {
+  VkImage image;
+  ImageViewDesc desc;
+
+  bool operator==(const ImageViewKey &other) const {
+    return image == other.image && desc == other.desc;
+  }
+};
+
+class ImageViewCache : public ObjectCache<VkImageView, ImageViewKey> {
+ public:
+  explicit ImageViewCache(uint64_t retainFrames)
+      : ObjectCache(vkDestroyImageView, retainFrames) {}
+
+  VkResult acquire(VkImage image, const ImageViewDesc &desc,
+                   VkImageView *view) {
+    assert(desc.valid() && desc.format != VK_FORMAT_UNDEFINED);
+    uint64_t owner = handleBits(image);
+    return ObjectCache::acquire(
+        DescHasher().add(owner).add(desc.hash()).value(), {image, desc}, owner,
+        [&](VkDevice device, VkImageView *created) {
+          VkImageViewCreateInfo createInfo = desc.createInfo(image);
+          return vkCreateImageView(device, &createInfo, nullptr, created);
+        },
+        view);
+  }
+
+  // Call before image is destroyed, with all its views released.
+  void releaseImage(VkImage image) { releaseOwner(handleBits(image)); }
+};
+
+class RenderPassCache : public ObjectCache<VkRenderPass, RenderPassDesc> {
+ public:
+  explicit RenderPassCache(uint64_t retainFrames)
+      : ObjectCache(vkDestroyRenderPass, retainFrames) {}
+
+  VkResult acquire(const RenderPassDesc &desc, VkRenderPass *renderPass) {
+    assert(desc.valid() && desc.complete());
+    return ObjectCache::acquire(
+        desc.hash(), desc, 0,
+        [&](VkDevice device, VkRenderPass *created) {
+          return createRenderPass(device, desc, created);
+        },
+        renderPass);
+  }
+};
+
+// A framebuffer attachment: the view, and the properties of its image that
+// an imageless framebuffer is created from instead.
+struct FramebufferAttachment {
+  VkImageView view = VK_NULL_HANDLE;
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  VkImageUsageFlags usage = 0;
+  uint32_t layerCount = 1;
+};
+
+// What a cached framebuffer was created for. Imageless framebuffers match on
+// the attachment properties, the others on the views.
+struct FramebufferKey {
+  static constexpr uint32_t kMaxAttachments =
+      RenderPassDesc::kMaxColorAttachments + 1;
+
+  RenderPassDesc desc;
+  VkExtent2D extent;
+  uint32_t count;
+  bool imageless;
+  std::array<FramebufferAttachment, kMaxAttachments> attachments;
+
+  bool operator==(const FramebufferKey &other) const {
+    if (!desc.compatibleWith(other.desc) ||
+        extent.width != other.extent.width ||
+        extent.height != other.extent.height || count != other.count ||
+        imageless != other.imageless) {
+      return false;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+      const FramebufferAttachment &a = attachments[i];
+      const FramebufferAttachment &b = other.attachments[i];
+      bool same = imageless ? a.format == b.format && a.usage == b.usage &&
+                                  a.layerCount == b.layerCount
+                            : a.view == b.view;
+      if (!same) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+/*
+ * Framebuffers keyed by render pass compatibility and extent.
+ *
+ * With VK_KHR_imageless_framebuffer a framebuffer records the format, usage
+ * and layer count of its attachments rather than views, and the views are
+ * supplied with chainAttachments() when the render pass begins. One
+ * framebuffer then serves every swapchain image, and a swapchain rebuilt at
+ * the same size finds it still cached.
+ *
+ * Otherwise the views are part of the key, and a framebuffer belongs to its
+ * first attachment: releaseView() must be called before that view is
+ * destroyed.
+ */
+class FramebufferCache : public ObjectCache<VkFramebuffer, FramebufferKey> {
+ public:
+  static constexpr uint32_t kMaxAttachments = FramebufferKey::kMaxAttachments;
+
+  explicit FramebufferCache(uint64_t retainFrames)
+      : ObjectCache(vkDestroyFramebuffer, retainFrames) {}
+
+  // Needs the imagelessFramebuffer feature; set before the first acquire().
+  void setImageless(bool enabled) {
+    assert(stats().live == 0);
+    imagelessEnabled = enabled;
+  }
+  bool imageless() const { return imagelessEnabled; }
+
+  /*
+   * A framebuffer for render passes compatible with desc, created with
+   * renderPass. attachments follow desc: colours, then depth. Their images
+   * must be exactly extent in size.
+   */
+  VkResult acquire(VkRenderPass renderPass, const RenderPassDesc &desc,
+                   VkExtent2D extent, const FramebufferAttachment *attachments,
+                   VkFramebuffer *framebuffer) {
+    uint32_t count = desc.colorCount + (desc.hasDepth ? 1 : 0);
+    assert(count > 0 && count <= kMaxAttachments);
+    DescHasher hash;
+    hash.add(desc.compatibilityHash())
+        .add(uint64_t(extent.width))
+        .add(uint64_t(extent.height));
+    for (uint32_t i = 0; i < count; i++) {
+      if (imagelessEnabled) {
+        hash.add(uint64_t(attachments[i].format))
+            .add(uint64_t(attachments[i].usage))
+            .add(uint64_t(attachments[i].layerCount));
+      } else {
+        hash.add(handleBits(attachments[i].view));
+      }
+    }
+    uint64_t owner = imagelessEnabled ? 0 : handleBits(attachments[0].view);
+    FramebufferKey key{desc, extent, count, imagelessEnabled, {}};
+    std::copy(attachments, attachments + count, key.attachments.begin());
+
+    return ObjectCache::acquire(
+        hash.value(), key, owner,
+        [&](VkDevice device, VkFramebuffer *created) {
+          std::array<VkImageView, kMaxAttachments> views{};
+          std::array<VkFramebufferAttachmentImageInfoKHR, kMaxAttachments>
+              images{};
+          for (uint32_t i = 0; i < count; i++) {
+            views[i] = attachments[i].view;
+            images[i].sType =
+                VK_STRUCTURE_TYPE_FRAMEBUFFER_ATTACHMENT_IMAGE_INFO_KHR;
+            images[i].usage = attachments[i].usage;
+            images[i].width = extent.width;
+            images[i].height = extent.height;
+            images[i].layerCount = attachments[i].layerCount;
+            // Must match the VkImageFormatListCreateInfo the image was
+            // created with, and no image or swapchain here has one.
+            images[i].viewFormatCount = 0;
+            images[i].pViewFormats = nullptr;
+          }
+          VkFramebufferAttachmentsCreateInfoKHR imagesInfo{};
+          imagesInfo.sType =
+              VK_STRUCTURE_TYPE_FRAMEBUFFER_ATTACHMENTS_CREATE_INFO_KHR;
+          imagesInfo.attachmentImageInfoCount = count;
+          imagesInfo.pAttachmentImageInfos = images.data();
+
+          VkFramebufferCreateInfo createInfo{};
+          createInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+          createInfo.renderPass = renderPass;
+          createInfo.attachmentCount = count;
+          createInfo.width = extent.width;
+          createInfo.height = extent.height;
+          // Multiview passes select layers with the view mask.
+          createInfo.layers = 1;
+          if (imagelessEnabled) {
+            createInfo.pNext = &imagesInfo;
+            createInfo.flags = VK_FRAMEBUFFER_CREATE_IMAGELESS_BIT_KHR;
+          } else {
+            createInfo.pAttachments = views.data();
+          }
+          return vkCreateFramebuffer(device, &createInfo, nullptr, created);
+        },
+        framebuffer);
+  }
+
+  /*
+   * Hands views to an imageless framebuffer: chains attachmentInfo, which
+   * must live until vkCmdBeginRenderPass(), to beginInfo. Does nothing for
+   * framebuffers created with their views.
+   */
+  void chainAttachments(VkRenderPassBeginInfo &beginInfo,
+                        VkRenderPassAttachmentBeginInfoKHR &attachmentInfo,
+                        const VkImageView *views, uint32_t count) const {
+    if (!imagelessEnabled) {
+      return;
+    }
+    attachmentInfo = {};
+    attachmentInfo.sType =
+        VK_STRUCTURE_TYPE_RENDER_PASS_ATTACHMENT_BEGIN_INFO_KHR;
+    attachmentInfo.pNext = beginInfo.pNext;
+    attachmentInfo.attachmentCount = count;
+    attachmentInfo.pAttachments = views;
+    beginInfo.pNext = &attachmentInfo;
+  }
+
+  // Call before view is destroyed, with its framebuffers released.
+  void releaseView(VkImageView view) {
+    if (!imagelessEnabled) {
+      releaseOwner(handleBits(view));
+    }
+  }
+
+ private:
+  bool imagelessEnabled = false;
+};
+
+}  // namespace vkt
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * Power profiles, see HelloVK::setPowerProfile().
+ *
+ * A profile is a ceiling on what the governor asks for: the effective frame
+ * rate cap and resolution scale are the lower of the two, so thermal
+ * throttling keeps working underneath a low-power profile.
+ */
+
+namespace vkt {
+
+struct PowerProfile {
+  const char *name = "standard";
+  // Prefer a 16-bit surface format (R5G6B5), which halves the bytes written
+  // per pixel, scanned out and composed. Such formats have no sRGB variant,
+  // so colours are written without sRGB encoding.
+  bool lowBitDepth = false;
+  float maxResolutionScale = 1.f;
+  // 0 leaves the frame rate to the governor.
+  uint32_t maxFrameRate = 0;
+  // Offscreen render targets and frame capture readbacks.
+  bool optionalPasses = true;
+
+  static PowerProfile standard() { return {}; }
+  static PowerProfile lowPower() {
+    return {"low-power", true, 0.75f, 30, false};
+  }
+};
+
+// What rendering cost while a profile was active.
+struct PowerUsage {
+  uint64_t frames = 0;
+  double seconds = 0.;
+  // Render thread CPU time spent in render(), pacing sleeps excluded.
+  double cpuSeconds = 0.;
+  // Colour attachment bytes written by the main window's frames, an estimate
+  // of the memory bandwidth that scales with format and resolution.
+  uint64_t attachmentBytes = 0;
+
+  double framesPerSecond() const {
+    return seconds > 0. ? frames / seconds : 0.;
+  }
+  double cpuMsPerFrame() const {
+    return frames > 0 ? cpuSeconds * 1000. / frames : 0.;
+  }
+  double megabytesPerSecond() const {
+    return seconds > 0. ? attachmentBytes / (1024. * 1024.) / seconds : 0.;
+  }
+  // CPU seconds per second, which includes the frame rate.
+  double cpuLoad() const { return seconds > 0. ? cpuSeconds / seconds : 0.; }
+};
+
+inline double threadCpuSeconds() {
+  timespec now{};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+}  // namespace vkt
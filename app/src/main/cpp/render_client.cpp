@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Command line client for the HelloVK render server. Streams scene updates
+ * and frame requests and reports the achieved update and frame rates.
+ *
+ *   adb shell setprop debug.hellovk.server hellovk
+ *   adb shell am start -n com.android.hellovk/.VulkanActivity
+ *   adb shell /data/local/tmp/hellovk_render_client -n hellovk -f 600 -u 16
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "command_stream.h"
+#include "render_client.h"
+
+static void usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [-n socket] [-f frames] [-u updates-per-frame] "
+          "[-d draws] [-s]\n"
+          "  -s  ask the server to shut down when done\n",
+          program);
+}
+
+int main(int argc, char **argv) {
+  std::string name = "hellovk";
+  long frames = 300;
+  long updatesPerFrame = 8;
+  long draws = 4;
+  bool shutdown = false;
+  int option;
+  while ((option = getopt(argc, argv, "n:f:u:d:sh")) != -1) {
+    switch (option) {
+      case 'n':
+        name = optarg;
+        break;
+      case 'f':
+        frames = strtol(optarg, nullptr, 0);
+        break;
+      case 'u':
+        updatesPerFrame = strtol(optarg, nullptr, 0);
+        break;
+      case 'd':
+        draws = strtol(optarg, nullptr, 0);
+        break;
+      case 's':
+        shutdown = true;
+        break;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+  if (frames < 1 || updatesPerFrame < 0 || draws < 0 ||
+      draws > vkt::kMaxDrawCommands) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  // Two draw lists, written alternately so the one the server may still be
+  // reading is never overwritten.
+  uint32_t listBytes = draws * sizeof(vkt::WireDrawCommand);
+  vkt::RenderClient client;
+  if (!client.connect(name, std::max(1u, listBytes * 2))) {
+    fprintf(stderr, "cannot connect to %s: %s\n", name.c_str(),
+            strerror(errno));
+    return 1;
+  }
+  printf("connected to %s, %ux%u\n", name.c_str(), client.welcome().width,
+         client.welcome().height);
+
+  uint64_t updates = 0;
+  double roundTripTotal = 0;
+  double roundTripMax = 0;
+  double renderTotal = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (long frame = 0; frame < frames; frame++) {
+    uint32_t listOffset = (frame % 2) * listBytes;
+    auto *list = reinterpret_cast<vkt::WireDrawCommand *>(
+        client.sharedMemory() + listOffset);
+    for (long i = 0; i < draws; i++) {
+      list[i] = {3, 1, 0, (uint32_t)i};
+    }
+
+    bool ok = true;
+    for (long update = 0; update < updatesPerFrame && ok; update++) {
+      float angle = (frame * updatesPerFrame + update) * 0.01f;
+      float c = cosf(angle);
+      float s = sinf(angle);
+      switch (update % 3) {
+        case 0:
+          ok = client.setTransform(
+              {c, s, 0, 0, -s, c, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1});
+          break;
+        case 1:
+          ok = client.setClearColor({0.5f + 0.5f * c, 0.5f + 0.5f * s, 0, 1});
+          break;
+        case 2:
+          ok = client.setDrawList(listOffset, draws);
+          break;
+      }
+      updates++;
+    }
+
+    auto requested = std::chrono::steady_clock::now();
+    vkt::FrameCompletePayload complete;
+    if (!ok || !client.renderFrame(frame) ||
+        !client.waitFrameComplete(complete) ||
+        complete.frameId != (uint64_t)frame) {
+      fprintf(stderr, "server went away at frame %ld\n", frame);
+      return 1;
+    }
+    double roundTrip = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - requested)
+                           .count();
+    roundTripTotal += roundTrip;
+    roundTripMax = std::max(roundTripMax, roundTrip);
+    renderTotal += complete.renderNs / 1e9;
+  }
+  double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+
+  printf("%ld frames, %llu updates in %.3f s\n", frames,
+         (unsigned long long)updates, seconds);
+  printf("%.1f frames/s, %.1f updates/s\n", frames / seconds,
+         updates / seconds);
+  printf("frame round trip avg %.3f ms, max %.3f ms, server render avg %.3f ms\n",
+         roundTripTotal * 1e3 / frames, roundTripMax * 1e3,
+         renderTotal * 1e3 / frames);
+
+  if (shutdown) {
+    client.shutdown();
+  }
+  return 0;
+}
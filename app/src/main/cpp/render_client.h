@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <array>
+#include <string>
+
+#include "render_protocol.h"
+
+/**
+ * Minimal client for the render server, used by render_client.cpp and usable
+ * from tests. Calls block; the only reply the server sends after Welcome is
+ * FrameComplete, one per RenderFrame.
+ */
+
+namespace vkt {
+
+class RenderClient {
+ public:
+  ~RenderClient() { disconnect(); }
+
+  /*
+   * Connects to the server socket name and shares sharedMemorySize bytes of
+   * memory with it for draw lists. Returns false with errno set on failure.
+   */
+  bool connect(const std::string &name, uint32_t sharedMemorySize) {
+    sockaddr_un address;
+    socklen_t length;
+    if (!makeAbstractAddress(name, address, length)) {
+      errno = ENAMETOOLONG;
+      return false;
+    }
+    socketFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (socketFd < 0 ||
+        ::connect(socketFd, (sockaddr *)&address, length) != 0) {
+      return fail();
+    }
+
+    // The server only maps memory whose size is sealed.
+    int memoryFd = memfd_create("hellovk-draw-lists",
+                                MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memoryFd < 0 || ftruncate(memoryFd, sharedMemorySize) != 0 ||
+        fcntl(memoryFd, F_ADD_SEALS,
+              F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+      return fail(memoryFd);
+    }
+    void *memory = mmap(nullptr, sharedMemorySize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, memoryFd, 0);
+    if (memory == MAP_FAILED) {
+      return fail(memoryFd);
+    }
+    shared = static_cast<uint8_t *>(memory);
+    sharedSize = sharedMemorySize;
+
+    bool sent = sendMessage(
+        socketFd, MessageType::Hello,
+        HelloPayload{kRenderProtocolVersion, sharedMemorySize}, memoryFd);
+    close(memoryFd);
+    if (!sent || !receive(MessageType::Welcome, welcomePayload)) {
+      return fail();
+    }
+    return true;
+  }
+
+  void disconnect() {
+    if (shared != nullptr) {
+      munmap(shared, sharedSize);
+      shared = nullptr;
+      sharedSize = 0;
+    }
+    if (socketFd >= 0) {
+      close(socketFd);
+      socketFd = -1;
+    }
+  }
+
+  uint8_t *sharedMemory() { return shared; }
+  uint32_t sharedMemorySize() const { return sharedSize; }
+  const WelcomePayload &welcome() const { return welcomePayload; }
+
+  bool setTransform(const std::array<float, 16> &mvp) {
+    SetTransformPayload payload;
+    memcpy(payload.mvp, mvp.data(), sizeof(payload.mvp));
+    return sendMessage(socketFd, MessageType::SetTransform, payload);
+  }
+
+  bool setClearColor(const std::array<float, 4> &rgba) {
+    SetClearColorPayload payload;
+    memcpy(payload.rgba, rgba.data(), sizeof(payload.rgba));
+    return sendMessage(socketFd, MessageType::SetClearColor, payload);
+  }
+
+  /*
+   * Refers to count WireDrawCommands already written to sharedMemory() at
+   * offset. The server copies them when it processes the message; do not
+   * overwrite the range before the next FrameComplete.
+   */
+  bool setDrawList(uint32_t offset, uint32_t count) {
+    return sendMessage(socketFd, MessageType::SetDrawList,
+                       SetDrawListPayload{offset, count});
+  }
+
+  bool renderFrame(uint64_t frameId) {
+    return sendMessage(socketFd, MessageType::RenderFrame,
+                       RenderFramePayload{frameId});
+  }
+
+  bool waitFrameComplete(FrameCompletePayload &complete) {
+    return receive(MessageType::FrameComplete, complete);
+  }
+
+  bool shutdown() {
+    return sendMessage(socketFd, MessageType::Shutdown, uint8_t(0));
+  }
+
+ private:
+  template <typename Payload>
+  bool receive(MessageType type, Payload &out) {
+    MessageHeader header;
+    uint8_t payload[kMaxMessageSize];
+    int fd;
+    ssize_t result = receiveMessage(socketFd, header, payload, fd);
+    if (fd >= 0) {
+      close(fd);
+    }
+    if (result <= 0 || header.type != type ||
+        header.payloadSize != sizeof(Payload)) {
+      return false;
+    }
+    memcpy(&out, payload, sizeof(Payload));
+    return true;
+  }
+
+  bool fail(int fd = -1) {
+    int error = errno;
+    if (fd >= 0) {
+      close(fd);
+    }
+    disconnect();
+    errno = error;
+    return false;
+  }
+
+  int socketFd = -1;
+  uint8_t *shared = nullptr;
+  uint32_t sharedSize = 0;
+  WelcomePayload welcomePayload{};
+};
+
+}  // namespace vkt
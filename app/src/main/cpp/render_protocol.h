@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <string>
+
+/**
+ * Wire protocol between HelloVK in render server mode and its clients.
+ *
+ * Both ends live on the same machine, so messages use native byte order and
+ * are sent over an AF_UNIX SOCK_SEQPACKET socket, which keeps message
+ * boundaries: one message is exactly one packet, a MessageHeader followed by
+ * a fixed size payload. Bulk data (draw lists) is not copied through the
+ * socket: the client shares a memfd with the server in its Hello message and
+ * later messages refer to ranges inside it. The memfd must be sealed against
+ * shrinking and growing (F_SEAL_SHRINK | F_SEAL_GROW) or the Hello is refused;
+ * draw lists are limited as described in command_stream.h.
+ *
+ * Sockets live in the abstract namespace so no filesystem path (and thus no
+ * write permission) is needed on Android.
+ */
+
+namespace vkt {
+
+constexpr uint32_t kRenderProtocolMagic = 0x4b564c48;  // "HLVK"
+constexpr uint32_t kRenderProtocolVersion = 2;
+
+enum class MessageType : uint16_t {
+  // Client to server. The shared memory fd travels as SCM_RIGHTS ancillary
+  // data.
+  Hello = 1,
+  SetTransform = 2,
+  SetClearColor = 3,
+  SetDrawList = 4,
+  RenderFrame = 5,
+  Shutdown = 6,
+  // Server to client.
+  Welcome = 100,
+  FrameComplete = 101,
+};
+
+struct MessageHeader {
+  uint32_t magic;
+  MessageType type;
+  uint16_t reserved;
+  uint32_t payloadSize;
+};
+
+struct HelloPayload {
+  uint32_t version;
+  uint32_t sharedMemorySize;
+};
+
+struct WelcomePayload {
+  uint32_t version;
+  uint32_t width;
+  uint32_t height;
+};
+
+struct SetTransformPayload {
+  float mvp[16];
+};
+
+struct SetClearColorPayload {
+  float rgba[4];
+};
+
+struct WireDrawCommand {
+  uint32_t vertexCount;
+  uint32_t instanceCount;
+  uint32_t firstVertex;
+  uint32_t firstInstance;
+};
+
+// commandCount WireDrawCommands starting at byte offset of the shared memory.
+struct SetDrawListPayload {
+  uint32_t offset;
+  uint32_t commandCount;
+};
+
+struct RenderFramePayload {
+  uint64_t frameId;
+};
+
+struct FrameCompletePayload {
+  uint64_t frameId;
+  // Scene updates applied since the previous frame.
+  uint32_t updatesApplied;
+  uint32_t reserved;
+  // Server side time from the RenderFrame request to GPU completion.
+  uint64_t renderNs;
+};
+
+constexpr size_t kMaxMessageSize = sizeof(MessageHeader) + 64;
+
+inline bool makeAbstractAddress(const std::string &name, sockaddr_un &address,
+                                socklen_t &length) {
+  if (name.size() + 1 > sizeof(address.sun_path)) {
+    return false;
+  }
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  // Leading NUL selects the abstract namespace.
+  memcpy(address.sun_path + 1, name.data(), name.size());
+  length = offsetof(sockaddr_un, sun_path) + 1 + name.size();
+  return true;
+}
+
+/*
+ * Sends one message, optionally passing a file descriptor along with it.
+ * Returns false if the peer is gone.
+ */
+template <typename Payload>
+bool sendMessage(int socket, MessageType type, const Payload &payload,
+                 int fd = -1) {
+  uint8_t buffer[sizeof(MessageHeader) + sizeof(Payload)];
+  MessageHeader header{kRenderProtocolMagic, type, 0, sizeof(Payload)};
+  memcpy(buffer, &header, sizeof(header));
+  memcpy(buffer + sizeof(header), &payload, sizeof(payload));
+
+  iovec iov{buffer, sizeof(buffer)};
+  msghdr message{};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+  if (fd >= 0) {
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+  return sendmsg(socket, &message, MSG_NOSIGNAL) == (ssize_t)sizeof(buffer);
+}
+
+/*
+ * Receives one message. Returns a positive value on success, 0 when the peer
+ * closed the connection and -1 with errno set on error; a malformed message
+ * is reported as EBADMSG. A file descriptor passed along is stored in fd,
+ * otherwise fd is set to -1. flags are passed to recvmsg(), for example
+ * MSG_DONTWAIT.
+ */
+inline ssize_t receiveMessage(int socket, MessageHeader &header,
+                              uint8_t (&payload)[kMaxMessageSize], int &fd,
+                              int flags = 0) {
+  uint8_t buffer[kMaxMessageSize];
+  iovec iov{buffer, sizeof(buffer)};
+  msghdr message{};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  fd = -1;
+  ssize_t received = recvmsg(socket, &message, flags | MSG_CMSG_CLOEXEC);
+  if (received <= 0) {
+    return received == 0 ? 0 : -1;
+  }
+  for (cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(&message, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+  }
+
+  if ((size_t)received < sizeof(MessageHeader) ||
+      (message.msg_flags & MSG_TRUNC)) {
+    errno = EBADMSG;
+    return -1;
+  }
+  memcpy(&header, buffer, sizeof(header));
+  if (header.magic != kRenderProtocolMagic ||
+      header.payloadSize != received - sizeof(MessageHeader)) {
+    errno = EBADMSG;
+    return -1;
+  }
+  memcpy(payload, buffer + sizeof(header), header.payloadSize);
+  return received;
+}
+
+}  // namespace vkt
@@ -0,0 +1,317 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <array>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "command_stream.h"
+#include "render_protocol.h"
+
+/**
+ * Render server mode: a local process drives the renderer over a Unix domain
+ * socket instead of touch input, see render_protocol.h for the wire format.
+ *
+ * The server is single threaded and serves one client at a time. Scene
+ * updates (transform, clear colour, draw list) are applied to the handler as
+ * they arrive and only take effect in the next rendered frame, so a client can
+ * stream many updates per frame. Nothing in here depends on Vulkan; vk_main.cpp
+ * connects a RenderServerHandler to HelloVK's offscreen path.
+ */
+
+namespace vkt {
+
+class RenderServerHandler {
+ public:
+  virtual ~RenderServerHandler() = default;
+  virtual void setTransform(const std::array<float, 16> &mvp) = 0;
+  virtual void setClearColor(const std::array<float, 4> &rgba) = 0;
+  // draws was copied out of the client's shared memory and passed
+  // isValidDrawList().
+  virtual void setDrawList(std::vector<DrawCommand> draws) = 0;
+  // Renders one frame with the current scene and returns once the GPU is done.
+  virtual void renderFrame() = 0;
+};
+
+struct RenderServerStats {
+  uint64_t clients = 0;
+  uint64_t updates = 0;
+  uint64_t frames = 0;
+  uint64_t rejectedMessages = 0;
+};
+
+class RenderServer {
+ public:
+  // width and height are reported to clients in the Welcome message.
+  RenderServer(std::string name, uint32_t width, uint32_t height,
+               RenderServerHandler &handler)
+      : name(std::move(name)), width(width), height(height), handler(handler) {}
+
+  ~RenderServer() {
+    disconnect();
+    if (listenSocket >= 0) {
+      close(listenSocket);
+    }
+  }
+
+  // Returns false with errno set if the socket cannot be bound.
+  bool listen() {
+    sockaddr_un address;
+    socklen_t length;
+    if (!makeAbstractAddress(name, address, length)) {
+      errno = ENAMETOOLONG;
+      return false;
+    }
+    listenSocket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (listenSocket < 0) {
+      return false;
+    }
+    if (bind(listenSocket, (sockaddr *)&address, length) != 0 ||
+        ::listen(listenSocket, 1) != 0) {
+      int error = errno;
+      close(listenSocket);
+      listenSocket = -1;
+      errno = error;
+      return false;
+    }
+    return true;
+  }
+
+  /*
+   * Waits up to timeoutMs for a connection or messages and handles everything
+   * that is available. Returns false once a client requested shutdown.
+   */
+  bool poll(int timeoutMs) {
+    pollfd fds[2] = {{listenSocket, POLLIN, 0}, {clientSocket, POLLIN, 0}};
+    int count = clientSocket >= 0 ? 2 : 1;
+    if (::poll(fds, count, timeoutMs) <= 0) {
+      return !shutdownRequested;
+    }
+
+    if (fds[0].revents & POLLIN) {
+      int socket = accept4(listenSocket, nullptr, nullptr, SOCK_CLOEXEC);
+      if (socket >= 0 && clientSocket >= 0) {
+        // Busy, one client at a time.
+        close(socket);
+      } else if (socket >= 0) {
+        clientSocket = socket;
+        serverStats.clients++;
+      }
+    }
+
+    if (clientSocket >= 0 && count == 2 &&
+        (fds[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+      processMessages();
+    }
+    return !shutdownRequested;
+  }
+
+  const RenderServerStats &stats() const { return serverStats; }
+
+ private:
+  void processMessages() {
+    while (clientSocket >= 0 && !shutdownRequested) {
+      MessageHeader header;
+      uint8_t payload[kMaxMessageSize];
+      int fd;
+      ssize_t result =
+          receiveMessage(clientSocket, header, payload, fd, MSG_DONTWAIT);
+      if (result > 0) {
+        handleMessage(header, payload, fd);
+      } else if (result < 0 && errno == EBADMSG) {
+        serverStats.rejectedMessages++;
+      } else if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+      } else {
+        disconnect();
+      }
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+  }
+
+  template <typename Payload>
+  static bool decode(const MessageHeader &header, const uint8_t *payload,
+                     Payload &out) {
+    if (header.payloadSize != sizeof(Payload)) {
+      return false;
+    }
+    memcpy(&out, payload, sizeof(Payload));
+    return true;
+  }
+
+  void handleMessage(const MessageHeader &header, const uint8_t *payload,
+                     int fd) {
+    bool ok = false;
+    switch (header.type) {
+      case MessageType::Hello: {
+        HelloPayload hello;
+        ok = decode(header, payload, hello) &&
+             hello.version == kRenderProtocolVersion && mapShared(fd, hello);
+        if (ok) {
+          sendMessage(clientSocket, MessageType::Welcome,
+                      WelcomePayload{kRenderProtocolVersion, width, height});
+        }
+        break;
+      }
+      case MessageType::SetTransform: {
+        SetTransformPayload transform;
+        if ((ok = decode(header, payload, transform))) {
+          std::array<float, 16> mvp;
+          memcpy(mvp.data(), transform.mvp, sizeof(transform.mvp));
+          handler.setTransform(mvp);
+        }
+        break;
+      }
+      case MessageType::SetClearColor: {
+        SetClearColorPayload color;
+        if ((ok = decode(header, payload, color))) {
+          handler.setClearColor(
+              {color.rgba[0], color.rgba[1], color.rgba[2], color.rgba[3]});
+        }
+        break;
+      }
+      case MessageType::SetDrawList: {
+        SetDrawListPayload list;
+        ok = decode(header, payload, list) && sharedMemory != nullptr &&
+             list.offset % alignof(WireDrawCommand) == 0 &&
+             list.offset <= sharedMemorySize &&
+             list.commandCount <= kMaxDrawCommands &&
+             list.commandCount <= (sharedMemorySize - list.offset) /
+                                      sizeof(WireDrawCommand);
+        if (ok) {
+          // Copied before checking, the client may rewrite the memory at any
+          // time.
+          const auto *commands = reinterpret_cast<const WireDrawCommand *>(
+              sharedMemory + list.offset);
+          std::vector<DrawCommand> draws(list.commandCount);
+          for (uint32_t i = 0; i < list.commandCount; i++) {
+            draws[i] = {commands[i].vertexCount, commands[i].instanceCount,
+                        commands[i].firstVertex, commands[i].firstInstance};
+          }
+          if ((ok = isValidDrawList(draws))) {
+            handler.setDrawList(std::move(draws));
+          }
+        }
+        break;
+      }
+      case MessageType::RenderFrame: {
+        RenderFramePayload frame;
+        if ((ok = decode(header, payload, frame))) {
+          auto start = std::chrono::steady_clock::now();
+          handler.renderFrame();
+          FrameCompletePayload complete{};
+          complete.frameId = frame.frameId;
+          complete.updatesApplied = updatesSinceFrame;
+          complete.renderNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                  std::chrono::steady_clock::now() - start)
+                                  .count();
+          serverStats.frames++;
+          updatesSinceFrame = 0;
+          if (!sendMessage(clientSocket, MessageType::FrameComplete,
+                           complete)) {
+            disconnect();
+            return;
+          }
+        }
+        break;
+      }
+      case MessageType::Shutdown:
+        shutdownRequested = ok = true;
+        break;
+      default:
+        break;
+    }
+
+    if (!ok) {
+      serverStats.rejectedMessages++;
+    } else if (header.type == MessageType::SetTransform ||
+               header.type == MessageType::SetClearColor ||
+               header.type == MessageType::SetDrawList) {
+      serverStats.updates++;
+      updatesSinceFrame++;
+    }
+  }
+
+  bool mapShared(int fd, const HelloPayload &hello) {
+    unmapShared();
+    if (fd < 0 || hello.sharedMemorySize == 0) {
+      // Shared memory is optional, without it draw lists are rejected.
+      return fd < 0;
+    }
+    // Reading past the end of the file would raise SIGBUS, so the client
+    // must have sealed its size before the check below means anything.
+    constexpr int kRequiredSeals = F_SEAL_SHRINK | F_SEAL_GROW;
+    int seals = fcntl(fd, F_GET_SEALS);
+    struct stat info;
+    if (seals < 0 || (seals & kRequiredSeals) != kRequiredSeals ||
+        fstat(fd, &info) != 0 || info.st_size < hello.sharedMemorySize) {
+      return false;
+    }
+    void *memory = mmap(nullptr, hello.sharedMemorySize, PROT_READ, MAP_SHARED,
+                        fd, 0);
+    if (memory == MAP_FAILED) {
+      return false;
+    }
+    sharedMemory = static_cast<const uint8_t *>(memory);
+    sharedMemorySize = hello.sharedMemorySize;
+    return true;
+  }
+
+  void unmapShared() {
+    if (sharedMemory != nullptr) {
+      munmap(const_cast<uint8_t *>(sharedMemory), sharedMemorySize);
+      sharedMemory = nullptr;
+      sharedMemorySize = 0;
+    }
+  }
+
+  void disconnect() {
+    unmapShared();
+    if (clientSocket >= 0) {
+      close(clientSocket);
+      clientSocket = -1;
+    }
+    updatesSinceFrame = 0;
+  }
+
+  std::string name;
+  uint32_t width;
+  uint32_t height;
+  RenderServerHandler &handler;
+
+  int listenSocket = -1;
+  int clientSocket = -1;
+  const uint8_t *sharedMemory = nullptr;
+  size_t sharedMemorySize = 0;
+  uint32_t updatesSinceFrame = 0;
+  bool shutdownRequested = false;
+  RenderServerStats serverStats;
+};
+
+}  // namespace vkt
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "command_stream.h"
+#include "entity_store.h"
+#include "vk_math.h"
+
+/**
+ * Renderable objects on top of entity_store.h, and the per-frame passes over
+ * them. Each pass streams over the component arrays it needs:
+ *
+ *   cullRenderables()  transforms, bounds, visibility  -> visibility
+ *   buildDrawList()    visibility, materials, meshes   -> sorted draws
+ *
+ * buildDrawList() also returns the rows it drew in draw order, so per-object
+ * data (world matrices) can be uploaded in the order firstInstance indexes.
+ */
+
+namespace vkt {
+
+struct RenderTransform {
+  mat4 world;
+};
+
+// Vertex range of the mesh in the shared vertex buffer.
+struct MeshRef {
+  uint32_t firstVertex = 0;
+  uint32_t vertexCount = 0;
+};
+
+struct MaterialRef {
+  uint32_t id = 0;
+};
+
+// Bounding sphere in object space.
+struct Bounds {
+  vec3 center;
+  float radius = 0.f;
+};
+
+struct Visibility {
+  // Culling only considers objects whose layers intersect the camera's.
+  uint32_t layers = 1;
+  uint8_t visible = 0;
+};
+
+using RenderableTable =
+    ComponentTable<RenderTransform, MeshRef, MaterialRef, Bounds, Visibility>;
+
+// Six normalised planes (xyz normal pointing inside, w distance).
+struct Frustum {
+  vec4 planes[6];
+
+  /*
+   * Extracts the planes from a view projection matrix with Vulkan's [0, 1]
+   * depth range (Gribb and Hartmann).
+   */
+  static Frustum fromMatrix(const mat4 &m) {
+    mat4 rows = m.transposed();
+    const vec4 &r0 = rows.col[0];
+    const vec4 &r1 = rows.col[1];
+    const vec4 &r2 = rows.col[2];
+    const vec4 &r3 = rows.col[3];
+    Frustum frustum;
+    frustum.planes[0] = r3 + r0;  // left
+    frustum.planes[1] = r3 - r0;  // right
+    frustum.planes[2] = r3 + r1;  // top, clip space Y points down
+    frustum.planes[3] = r3 - r1;  // bottom
+    frustum.planes[4] = r2;       // near
+    frustum.planes[5] = r3 - r2;  // far
+    for (vec4 &plane : frustum.planes) {
+      plane = plane * (1.f / length(vec3{plane.x, plane.y, plane.z}));
+    }
+    return frustum;
+  }
+
+  bool intersectsSphere(const vec3 &center, float radius) const {
+    for (const vec4 &plane : planes) {
+      if (plane.x * center.x + plane.y * center.y + plane.z * center.z +
+              plane.w <
+          -radius) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+/*
+ * Marks renderables on any of layers that intersect the frustum of
+ * viewProjection visible and all others invisible. Returns the number of
+ * visible objects.
+ */
+inline size_t cullRenderables(RenderableTable &table,
+                              const mat4 &viewProjection, uint32_t layers,
+                              WorkerPool *pool = nullptr) {
+  Frustum frustum = Frustum::fromMatrix(viewProjection);
+  const RenderTransform *transforms = table.column<RenderTransform>();
+  const Bounds *bounds = table.column<Bounds>();
+  Visibility *visibility = table.column<Visibility>();
+  std::atomic<size_t> visible{0};
+  table.forEachRange(pool, 4096, [&](size_t begin, size_t end) {
+    size_t rangeVisible = 0;
+    for (size_t i = begin; i < end; i++) {
+      const mat4 &world = transforms[i].world;
+      bool inside = false;
+      if (visibility[i].layers & layers) {
+        // Conservative world radius: the largest axis scale.
+        float scale = std::max({dot(world.col[0], world.col[0]),
+                                dot(world.col[1], world.col[1]),
+                                dot(world.col[2], world.col[2])});
+        inside = frustum.intersectsSphere(
+            world.transformPoint(bounds[i].center),
+            bounds[i].radius * sqrtf(scale));
+      }
+      visibility[i].visible = inside;
+      rangeVisible += inside;
+    }
+    visible += rangeVisible;
+  });
+  return visible;
+}
+
+/*
+ * Emits one draw per run of visible objects sharing material and mesh, sorted
+ * by material then mesh so pipeline and vertex state change as rarely as
+ * possible. Object k of the sorted visible set is instance k: rows[k] is its
+ * table row, and draws use firstInstance to index per-object data uploaded in
+ * that order. The material of a draw is that of rows[draw.firstInstance].
+ */
+inline void buildDrawList(const RenderableTable &table,
+                          std::vector<DrawCommand> &draws,
+                          std::vector<uint32_t> &rows) {
+  const Visibility *visibility = table.column<Visibility>();
+  const MaterialRef *materials = table.column<MaterialRef>();
+  const MeshRef *meshes = table.column<MeshRef>();
+
+  // Sort (material, first vertex) keys paired with rows rather than the rows
+  // themselves, so the sort never touches the component arrays.
+  std::vector<std::pair<uint64_t, uint32_t>> keys;
+  keys.reserve(table.size());
+  for (uint32_t i = 0; i < table.size(); i++) {
+    if (visibility[i].visible) {
+      keys.push_back({uint64_t(materials[i].id) << 32 | meshes[i].firstVertex,
+                      i});
+    }
+  }
+  std::sort(keys.begin(), keys.end());
+
+  draws.clear();
+  rows.clear();
+  rows.reserve(keys.size());
+  for (const auto &[key, row] : keys) {
+    const MeshRef &mesh = meshes[row];
+    uint32_t instance = rows.size();
+    rows.push_back(row);
+    if (!draws.empty()) {
+      DrawCommand &last = draws.back();
+      if (last.firstVertex == mesh.firstVertex &&
+          last.vertexCount == mesh.vertexCount &&
+          materials[rows[last.firstInstance]].id == materials[row].id) {
+        last.instanceCount++;
+        continue;
+      }
+    }
+    draws.push_back({mesh.vertexCount, 1, mesh.firstVertex, instance});
+  }
+}
+
+}  // namespace vkt
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+/**
+ * Swapchain churn soak test, see HelloVK::runSwapchainSoak().
+ *
+ * Every cycle resizes, rotates and loses the surface once. Leaks show up as
+ * live object counts that differ after the run, or as resident memory that
+ * keeps growing between samples; a one-off step after the warm-up is driver
+ * pools settling, steady growth per cycle is a leak.
+ */
+
+namespace vkt {
+
+struct SoakConfig {
+  uint32_t cycles = 1000;
+  // Cycles run before the baseline is taken, so allocations made only once
+  // (driver pools, pipeline caches) do not count as growth.
+  uint32_t warmupCycles = 20;
+  // Frames rendered after every step, so each new swapchain is acquired from
+  // and presented to as well.
+  uint32_t framesPerStep = 2;
+  // Memory is sampled every sampleEvery cycles.
+  uint32_t sampleEvery = 100;
+};
+
+// Objects recreated along with the swapchain, counted by HelloVK as they are
+// created and destroyed.
+struct VulkanObjectCounts {
+  int64_t surfaces = 0;
+  int64_t swapchains = 0;
+  int64_t imageViews = 0;
+  int64_t framebuffers = 0;
+
+  bool operator==(const VulkanObjectCounts &other) const {
+    return surfaces == other.surfaces && swapchains == other.swapchains &&
+           imageViews == other.imageViews &&
+           framebuffers == other.framebuffers;
+  }
+  bool operator!=(const VulkanObjectCounts &other) const {
+    return !(*this == other);
+  }
+};
+
+struct HostMemorySample {
+  uint32_t cycle = 0;
+  // Resident set of the process, which includes the driver's allocations.
+  int64_t residentBytes = 0;
+  // Allocated through malloc and not freed yet.
+  int64_t heapBytes = 0;
+
+  static HostMemorySample take(uint32_t cycle) {
+    HostMemorySample sample;
+    sample.cycle = cycle;
+    if (FILE *statm = fopen("/proc/self/statm", "r")) {
+      long size = 0;
+      long resident = 0;
+      if (fscanf(statm, "%ld %ld", &size, &resident) == 2) {
+        sample.residentBytes = int64_t(resident) * sysconf(_SC_PAGESIZE);
+      }
+      fclose(statm);
+    }
+    sample.heapBytes = mallinfo().uordblks;
+    return sample;
+  }
+};
+
+// Durations in milliseconds, with nearest rank percentiles.
+class LatencyRecorder {
+ public:
+  void add(double ms) {
+    samples.push_back(ms);
+    sorted = false;
+  }
+  size_t count() const { return samples.size(); }
+  // p in [0, 100]; 0 without samples.
+  double percentile(double p) {
+    if (samples.empty()) {
+      return 0.;
+    }
+    if (!sorted) {
+      std::sort(samples.begin(), samples.end());
+      sorted = true;
+    }
+    size_t rank = size_t(p / 100. * (samples.size() - 1) + 0.5);
+    return samples[std::min(rank, samples.size() - 1)];
+  }
+
+ private:
+  std::vector<double> samples;
+  bool sorted = true;
+};
+
+struct SoakReport {
+  uint32_t cycles = 0;
+  LatencyRecorder resize;
+  LatencyRecorder rotate;
+  LatencyRecorder surfaceLoss;
+  // After the warm-up and after the last cycle, with the device idle.
+  VulkanObjectCounts objectsBefore;
+  VulkanObjectCounts objectsAfter;
+  HostMemorySample memoryBefore;
+  HostMemorySample memoryAfter;
+  std::vector<HostMemorySample> memoryTrend;
+};
+
+}  // namespace vkt
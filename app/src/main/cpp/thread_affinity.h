@@ -0,0 +1,349 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Thread placement for the render and worker threads.
+ *
+ * On big.LITTLE SoCs the scheduler happily migrates the render thread between
+ * clusters, which shows up as frame time jitter. The CPU topology is read from
+ * /sys/devices/system/cpu: cores with the highest cpu_capacity (or, on kernels
+ * without it, the highest cpuinfo_max_freq) form the performance set.
+ *
+ * - The render thread is pinned to the performance set and given a higher
+ *   priority. SCHED_FIFO is attempted only when the policy asks for it; apps
+ *   normally lack the permission and fall back to a nice value.
+ * - Workers are kept off the render cores so they never preempt rendering.
+ * - When every core has the same capacity there is no performance set, and
+ *   affinity is left to the scheduler; only the priorities are applied.
+ * - On NUMA machines (/sys/devices/system/node lists more than one node) both
+ *   sets are kept on the render core's node, so the threads sharing frame data
+ *   do not pay for remote memory. Workers spill onto other nodes only when the
+ *   render node has no core to spare. With homogeneous cores both roles share
+ *   the first node.
+ *
+ * Every placed thread is registered so migrations can be reported, using the
+ * kernel's own counter when it is exposed and sched_getcpu() sampling
+ * otherwise.
+ */
+
+namespace vkt {
+
+struct CpuTopology {
+  // Relative compute capacity per logical CPU, indexed by CPU number.
+  std::vector<uint32_t> capacity;
+  // NUMA node per logical CPU, all 0 when the kernel reports no nodes.
+  std::vector<uint32_t> node;
+
+  bool isMultiNode() const {
+    return std::any_of(node.begin(), node.end(),
+                       [this](uint32_t n) { return n != node.front(); });
+  }
+
+  bool isHeterogeneous() const {
+    if (capacity.empty()) {
+      return false;
+    }
+    auto [lo, hi] = std::minmax_element(capacity.begin(), capacity.end());
+    return *lo != *hi;
+  }
+};
+
+static bool readSysfsUint(const char *path, uint32_t &value) {
+  FILE *file = fopen(path, "r");
+  if (file == nullptr) {
+    return false;
+  }
+  bool ok = fscanf(file, "%u", &value) == 1;
+  fclose(file);
+  return ok;
+}
+
+/*
+ * Marks the CPUs in a sysfs cpulist ("0-3,8,10-11") as belonging to nodeIndex.
+ * CPUs beyond the end of node are ignored.
+ */
+static void readNodeCpuList(const char *path, uint32_t nodeIndex,
+                            std::vector<uint32_t> &node) {
+  FILE *file = fopen(path, "r");
+  if (file == nullptr) {
+    return;
+  }
+  unsigned first;
+  while (fscanf(file, "%u", &first) == 1) {
+    unsigned last = first;
+    int separator = fgetc(file);
+    if (separator == '-') {
+      if (fscanf(file, "%u", &last) != 1) {
+        break;
+      }
+      separator = fgetc(file);
+    }
+    for (unsigned cpu = first; cpu <= last && cpu < node.size(); cpu++) {
+      node[cpu] = nodeIndex;
+    }
+    if (separator != ',') {
+      break;
+    }
+  }
+  fclose(file);
+}
+
+CpuTopology discoverCpuTopology() {
+  CpuTopology topology;
+  long cpuCount = sysconf(_SC_NPROCESSORS_CONF);
+  for (long cpu = 0; cpu < cpuCount; cpu++) {
+    char path[128];
+    uint32_t capacity = 0;
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%ld/cpu_capacity",
+             cpu);
+    if (!readSysfsUint(path, capacity)) {
+      snprintf(path, sizeof(path),
+               "/sys/devices/system/cpu/cpu%ld/cpufreq/cpuinfo_max_freq", cpu);
+      if (!readSysfsUint(path, capacity)) {
+        // No information, treat every core the same.
+        capacity = 1024;
+      }
+    }
+    topology.capacity.push_back(capacity);
+  }
+
+  // Nodes are numbered densely on every kernel we run on, so stop at the first
+  // missing one.
+  topology.node.assign(topology.capacity.size(), 0);
+  for (uint32_t nodeIndex = 0;; nodeIndex++) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist",
+             nodeIndex);
+    if (access(path, R_OK) != 0) {
+      break;
+    }
+    readNodeCpuList(path, nodeIndex, topology.node);
+  }
+  return topology;
+}
+
+enum class ThreadRole { Render, Worker };
+
+struct ThreadPlacementPolicy {
+  bool pinRenderThread = true;
+  bool keepWorkersOffRenderCores = true;
+  // Nice values, lower is more important. -8 is
+  // ANDROID_PRIORITY_URGENT_DISPLAY, what SurfaceFlinger's composition runs
+  // at; ANDROID_PRIORITY_DISPLAY, used by the UI render thread, is -4.
+  int renderNice = -8;
+  int workerNice = 0;
+  // Try SCHED_FIFO for the render thread first. Needs CAP_SYS_NICE or an
+  // RLIMIT_RTPRIO allowance, which regular apps do not have.
+  bool renderRealtime = false;
+  int renderRealtimePriority = 2;
+};
+
+struct ThreadMigrationReport {
+  std::string name;
+  pid_t tid;
+  // se.nr_migrations from /proc/self/task/<tid>/sched, -1 when the kernel
+  // does not expose it.
+  long long kernelMigrations;
+  // CPU changes observed between calls to sampleCurrentThread().
+  unsigned long long sampledMigrations;
+};
+
+class ThreadPlacement {
+ public:
+  explicit ThreadPlacement(CpuTopology topology,
+                           ThreadPlacementPolicy policy = {})
+      : topology(std::move(topology)), policy(policy) {
+    size_t cpuCount = this->topology.capacity.size();
+    if (cpuCount == 0) {
+      return;
+    }
+    if (this->topology.isHeterogeneous()) {
+      uint32_t maxCapacity = *std::max_element(
+          this->topology.capacity.begin(), this->topology.capacity.end());
+      for (size_t cpu = 0; cpu < cpuCount; cpu++) {
+        if (this->topology.capacity[cpu] == maxCapacity) {
+          renderCores.push_back(cpu);
+        } else {
+          workerCores.push_back(cpu);
+        }
+      }
+    }
+    if (this->topology.node.size() == cpuCount &&
+        this->topology.isMultiNode()) {
+      if (renderCores.empty()) {
+        // Homogeneous CPUs: no core is better than another, only the node
+        // matters.
+        for (size_t cpu = 0; cpu < cpuCount; cpu++) {
+          if (this->topology.node[cpu] == this->topology.node.front()) {
+            renderCores.push_back(cpu);
+          }
+        }
+      } else {
+        keepOnNode(this->topology.node[renderCores.front()]);
+      }
+    }
+    if (workerCores.empty()) {
+      workerCores = renderCores;
+    }
+  }
+
+  /*
+   * Applies the policy for role to the calling thread and registers it for
+   * migration reporting. Returns 0, or the errno of the first step the OS
+   * refused; the thread keeps running with whatever could be applied. Roles
+   * without cores (homogeneous CPUs on one node) keep their affinity.
+   */
+  int placeCurrentThread(ThreadRole role, const char *name) {
+    int error = 0;
+    auto check = [&error](int result) {
+      if (result != 0 && error == 0) {
+        error = errno;
+      }
+    };
+    const std::vector<size_t> &cores =
+        role == ThreadRole::Render ? renderCores : workerCores;
+    bool pin = role == ThreadRole::Render ? policy.pinRenderThread
+                                          : policy.keepWorkersOffRenderCores;
+    if (pin && !cores.empty()) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      for (size_t cpu : cores) {
+        CPU_SET(cpu, &set);
+      }
+      check(sched_setaffinity(0, sizeof(set), &set));
+    }
+
+    bool realtime = false;
+    if (role == ThreadRole::Render && policy.renderRealtime) {
+      sched_param param{};
+      param.sched_priority = policy.renderRealtimePriority;
+      realtime = sched_setscheduler(0, SCHED_FIFO, &param) == 0;
+    }
+    if (!realtime) {
+      int nice =
+          role == ThreadRole::Render ? policy.renderNice : policy.workerNice;
+      check(setpriority(PRIO_PROCESS, gettid(), nice));
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    threads.push_back({name, gettid(), sched_getcpu(), 0});
+    return error;
+  }
+
+  /*
+   * Call periodically from a registered thread (for example once per frame)
+   * to count migrations on kernels that do not export nr_migrations.
+   */
+  void sampleCurrentThread() {
+    pid_t tid = gettid();
+    int cpu = sched_getcpu();
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &thread : threads) {
+      if (thread.tid == tid) {
+        if (cpu != thread.lastCpu) {
+          thread.sampledMigrations++;
+          thread.lastCpu = cpu;
+        }
+        return;
+      }
+    }
+  }
+
+  std::vector<ThreadMigrationReport> migrationReport() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<ThreadMigrationReport> reports;
+    for (const auto &thread : threads) {
+      reports.push_back({thread.name, thread.tid,
+                         readKernelMigrations(thread.tid),
+                         thread.sampledMigrations});
+    }
+    return reports;
+  }
+
+  const std::vector<size_t> &coresFor(ThreadRole role) const {
+    return role == ThreadRole::Render ? renderCores : workerCores;
+  }
+
+ private:
+  struct RegisteredThread {
+    std::string name;
+    pid_t tid;
+    int lastCpu;
+    unsigned long long sampledMigrations;
+  };
+
+  static long long readKernelMigrations(pid_t tid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/task/%d/sched", (int)tid);
+    FILE *file = fopen(path, "r");
+    if (file == nullptr) {
+      return -1;
+    }
+    long long migrations = -1;
+    char line[256];
+    while (fgets(line, sizeof(line), file) != nullptr) {
+      if (strncmp(line, "se.nr_migrations", 16) == 0) {
+        const char *colon = strchr(line, ':');
+        if (colon != nullptr) {
+          migrations = atoll(colon + 1);
+        }
+        break;
+      }
+    }
+    fclose(file);
+    return migrations;
+  }
+
+  /*
+   * Drops the cores outside renderNode. The render set always keeps at least
+   * its first core; the worker set is left alone if none of it is on the node.
+   */
+  void keepOnNode(uint32_t renderNode) {
+    auto offNode = [&](size_t cpu) { return topology.node[cpu] != renderNode; };
+    renderCores.erase(
+        std::remove_if(renderCores.begin(), renderCores.end(), offNode),
+        renderCores.end());
+    if (!std::all_of(workerCores.begin(), workerCores.end(), offNode)) {
+      workerCores.erase(
+          std::remove_if(workerCores.begin(), workerCores.end(), offNode),
+          workerCores.end());
+    }
+  }
+
+  CpuTopology topology;
+  ThreadPlacementPolicy policy;
+  std::vector<size_t> renderCores;
+  std::vector<size_t> workerCores;
+  std::mutex mutex;
+  std::vector<RegisteredThread> threads;
+};
+
+}  // namespace vkt
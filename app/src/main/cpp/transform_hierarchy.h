@@ -0,0 +1,345 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <type_traits>
+#include <vector>
+
+#include "vk_math.h"
+#include "worker_pool.h"
+
+/**
+ * Transform hierarchy stored as structure of arrays.
+ *
+ * Every per-node property lives in its own contiguous array, and the arrays
+ * are kept in level order: all roots, then all nodes at depth 1, and so on.
+ * Parents therefore always precede their children, and all nodes of one level
+ * depend only on the level before. update() runs two linear passes:
+ *
+ *   1. local matrices of dirty nodes, composed from translation, rotation
+ *      and scale with the batch routines of vk_math.h;
+ *   2. world matrices, level by level, for nodes that are dirty or whose
+ *      parent's world matrix changed this update.
+ *
+ * Both passes split into independent chunks and run on a WorkerPool when one
+ * is given. Untouched subtrees cost one byte test per node.
+ *
+ * Handles returned by add() are stable; the storage index of a node changes
+ * when adding a node breaks level order, which re-sorts the arrays on the
+ * next update().
+ */
+
+namespace vkt {
+
+struct TransformUpdateStats {
+  size_t recomputed = 0;
+  size_t uploaded = 0;
+};
+
+class TransformHierarchy {
+ public:
+  using Handle = uint32_t;
+  static constexpr Handle kNoParent = UINT32_MAX;
+
+  /*
+   * uploadRingSize is the number of per-frame upload buffers update() writes
+   * to in turn, usually the number of frames in flight. A changed world matrix
+   * is written into each of them once.
+   */
+  explicit TransformHierarchy(uint32_t uploadRingSize = 1)
+      : ringSize(std::max(1u, uploadRingSize)) {}
+
+  void reserve(size_t count) {
+    handles.reserve(count);
+    indexOfHandle.reserve(count);
+    parents.reserve(count);
+    depths.reserve(count);
+    translations.reserve(count);
+    rotations.reserve(count);
+    scales.reserve(count);
+    locals.reserve(count);
+    worlds.reserve(count);
+    dirty.reserve(count);
+    changed.reserve(count);
+    pendingUploads.reserve(count);
+  }
+
+  Handle add(Handle parent, const vec3 &translation = {},
+             const quat &rotation = {}, const vec3 &scale = {1.f, 1.f, 1.f}) {
+    uint32_t parentIndex = kNoParent;
+    uint32_t depth = 0;
+    if (parent != kNoParent) {
+      assert(parent < indexOfHandle.size());
+      parentIndex = indexOfHandle[parent];
+      depth = depths[parentIndex] + 1;
+    }
+    // Appending keeps level order unless the new node is shallower than the
+    // last one; only a node one level deeper than that can start a new level.
+    if (!depths.empty() && depth < depths.back()) {
+      layoutDirty = true;
+    } else if (!layoutDirty) {
+      if (depth + 2 == levelStart.size()) {
+        levelStart.back()++;
+      } else {
+        levelStart.push_back(levelStart.back() + 1);
+      }
+    }
+    Handle handle = indexOfHandle.size();
+    indexOfHandle.push_back(handles.size());
+    handles.push_back(handle);
+    parents.push_back(parentIndex);
+    depths.push_back(depth);
+    translations.push_back(translation);
+    rotations.push_back(rotation);
+    scales.push_back(scale);
+    locals.emplace_back();
+    worlds.emplace_back();
+    dirty.push_back(1);
+    changed.push_back(0);
+    pendingUploads.push_back(0);
+    dirtyCount++;
+    return handle;
+  }
+
+  void clear() { *this = TransformHierarchy(ringSize); }
+
+  size_t size() const { return handles.size(); }
+
+  void setTranslation(Handle node, const vec3 &value) {
+    uint32_t i = indexOfHandle[node];
+    translations[i] = value;
+    markDirty(i);
+  }
+  void setRotation(Handle node, const quat &value) {
+    uint32_t i = indexOfHandle[node];
+    rotations[i] = value;
+    markDirty(i);
+  }
+  void setScale(Handle node, const vec3 &value) {
+    uint32_t i = indexOfHandle[node];
+    scales[i] = value;
+    markDirty(i);
+  }
+  void setLocal(Handle node, const vec3 &translation, const quat &rotation,
+                const vec3 &scale) {
+    uint32_t i = indexOfHandle[node];
+    translations[i] = translation;
+    rotations[i] = rotation;
+    scales[i] = scale;
+    markDirty(i);
+  }
+
+  // Valid after update().
+  const mat4 &world(Handle node) const { return worlds[indexOfHandle[node]]; }
+
+  /*
+   * Storage index of a node: the position of its world matrix in
+   * worldMatrices() and in the upload buffers. Changes when the arrays are
+   * re-sorted, after which every matrix is uploaded again.
+   */
+  uint32_t indexOf(Handle node) const { return indexOfHandle[node]; }
+  const mat4 *worldMatrices() const { return worlds.data(); }
+
+  /*
+   * Recomputes dirty subtrees. With upload set (a persistently mapped buffer
+   * of at least size() matrices, the slot of the frame being recorded) every
+   * world matrix that slot has not seen yet is copied to upload[indexOf()].
+   * World matrices are computed in cached memory first because children read
+   * their parent's result, and mapped memory is often uncached.
+   */
+  TransformUpdateStats update(mat4 *upload = nullptr,
+                              WorkerPool *pool = nullptr) {
+    TransformUpdateStats stats;
+    if (layoutDirty) {
+      sortByLevel();
+    }
+    if (dirtyCount == 0 && pendingFrames == 0) {
+      return stats;
+    }
+    size_t count = size();
+    auto parallelFor = [pool](size_t items,
+                              const std::function<void(size_t, size_t)> &body) {
+      if (pool != nullptr) {
+        pool->parallelFor(items, kGrain, body);
+      } else if (items > 0) {
+        body(0, items);
+      }
+    };
+
+    if (dirtyCount > 0) {
+      parallelFor(count, [this](size_t begin, size_t end) {
+        composeDirty(begin, end);
+      });
+    }
+
+    std::atomic<size_t> recomputed{0};
+    std::atomic<size_t> uploaded{0};
+    for (size_t level = 0; level + 1 < levelStart.size(); level++) {
+      size_t first = levelStart[level];
+      parallelFor(levelStart[level + 1] - first, [&](size_t begin, size_t end) {
+        size_t levelRecomputed = 0;
+        size_t levelUploaded = 0;
+        for (size_t i = first + begin; i < first + end; i++) {
+          uint32_t parent = parents[i];
+          bool recompute =
+              dirty[i] || (parent != kNoParent && changed[parent]);
+          changed[i] = recompute;
+          if (recompute) {
+            dirty[i] = 0;
+            if (parent == kNoParent) {
+              worlds[i] = locals[i];
+            } else {
+              worlds[i] = worlds[parent] * locals[i];
+            }
+            pendingUploads[i] = ringSize;
+            levelRecomputed++;
+          }
+          if (upload != nullptr && pendingUploads[i] > 0) {
+            upload[i] = worlds[i];
+            pendingUploads[i]--;
+            levelUploaded++;
+          }
+        }
+        recomputed += levelRecomputed;
+        uploaded += levelUploaded;
+      });
+    }
+    stats.recomputed = recomputed;
+    stats.uploaded = uploaded;
+    dirtyCount = 0;
+    // A matrix recomputed now still has to reach the other ring slots.
+    if (stats.recomputed > 0) {
+      pendingFrames = upload != nullptr ? ringSize - 1 : ringSize;
+    } else if (upload != nullptr && pendingFrames > 0) {
+      pendingFrames--;
+    }
+    return stats;
+  }
+
+ private:
+  static constexpr size_t kGrain = 2048;
+
+  void markDirty(uint32_t index) {
+    if (!dirty[index]) {
+      dirty[index] = 1;
+      dirtyCount++;
+    }
+  }
+
+  // Composes local matrices for runs of consecutive dirty nodes.
+  void composeDirty(size_t begin, size_t end) {
+    size_t i = begin;
+    while (i < end) {
+      if (!dirty[i]) {
+        i++;
+        continue;
+      }
+      size_t run = i;
+      while (run < end && dirty[run]) {
+        run++;
+      }
+      composeTransforms(&translations[i], &rotations[i], &scales[i],
+                        &locals[i], run - i);
+      i = run;
+    }
+  }
+
+  /*
+   * Stable counting sort of all nodes by depth, then every array is permuted
+   * to the new order. Every node is marked dirty so all upload slots are
+   * rewritten at the new indices.
+   */
+  void sortByLevel() {
+    size_t count = size();
+    uint32_t maxDepth = 0;
+    for (uint32_t depth : depths) {
+      maxDepth = std::max(maxDepth, depth);
+    }
+    levelStart.assign(maxDepth + 2, 0);
+    for (uint32_t depth : depths) {
+      levelStart[depth + 1]++;
+    }
+    for (size_t level = 1; level < levelStart.size(); level++) {
+      levelStart[level] += levelStart[level - 1];
+    }
+    std::vector<uint32_t> newIndex(count);
+    std::vector<uint32_t> cursor(levelStart.begin(), levelStart.end() - 1);
+    for (size_t i = 0; i < count; i++) {
+      newIndex[i] = cursor[depths[i]]++;
+    }
+
+    auto permute = [&](auto &values) {
+      std::remove_reference_t<decltype(values)> sorted(values.size());
+      for (size_t i = 0; i < count; i++) {
+        sorted[newIndex[i]] = values[i];
+      }
+      values.swap(sorted);
+    };
+    for (uint32_t &parent : parents) {
+      if (parent != kNoParent) {
+        parent = newIndex[parent];
+      }
+    }
+    permute(handles);
+    permute(parents);
+    permute(depths);
+    permute(translations);
+    permute(rotations);
+    permute(scales);
+    for (size_t i = 0; i < count; i++) {
+      indexOfHandle[handles[i]] = i;
+      dirty[i] = 1;
+      pendingUploads[i] = 0;
+    }
+    dirtyCount = count;
+    layoutDirty = false;
+  }
+
+  uint32_t ringSize;
+  // Storage index to handle and back.
+  std::vector<Handle> handles;
+  std::vector<uint32_t> indexOfHandle;
+  // Per node, in level order. parents holds storage indices.
+  std::vector<uint32_t> parents;
+  std::vector<uint32_t> depths;
+  std::vector<vec3> translations;
+  std::vector<quat> rotations;
+  std::vector<vec3> scales;
+  std::vector<mat4> locals;
+  std::vector<mat4> worlds;
+  // Bytes rather than vector<bool> so chunks on different threads never share
+  // a word.
+  std::vector<uint8_t> dirty;
+  std::vector<uint8_t> changed;
+  std::vector<uint32_t> pendingUploads;
+  // levelStart[d] is the index of the first node at depth d; one extra entry
+  // marks the end.
+  std::vector<size_t> levelStart;
+  size_t dirtyCount = 0;
+  // Updates that still have to copy recomputed matrices into ring slots.
+  uint32_t pendingFrames = 0;
+  bool layoutDirty = true;
+};
+
+}  // namespace vkt
@@ -0,0 +1,903 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+#include <array>
+
+/**
+ * Compile time descriptions of pipelines, render passes and samplers.
+ *
+ * A description is a small value type without pointers, built with chained
+ * constexpr with*() calls starting from defaults that match what the renderer
+ * used to fill in by hand:
+ *
+ *   constexpr GraphicsPipelineDesc kOpaque =
+ *       GraphicsPipelineDesc{}.withCullMode(VK_CULL_MODE_BACK_BIT,
+ *                                           VK_FRONT_FACE_CLOCKWISE);
+ *   static_assert(kOpaque.valid(), "kOpaque uses a disabled feature");
+ *
+ * valid() rejects combinations the device does not support with the features
+ * HelloVK enables (none), or that the spec forbids, so mistakes fail the
+ * build. hash() is constexpr as well: a description defined at namespace scope
+ * has its cache key computed by the compiler. The create*() functions turn a
+ * description into Vulkan objects at runtime; only the formats and layouts
+ * left to runtime (VK_FORMAT_UNDEFINED in a description) are filled in then.
+ */
+
+namespace vkt {
+
+// FNV-1a over 64-bit values, usable in constant expressions. Floats are
+// hashed quantised to 1/1024, which is far finer than any state value needs.
+class DescHasher {
+ public:
+  constexpr DescHasher &add(uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+      hash = (hash ^ ((value >> (i * 8)) & 0xff)) * 0x100000001b3ull;
+    }
+    return *this;
+  }
+  constexpr DescHasher &add(float value) {
+    return add(static_cast<uint64_t>(static_cast<int64_t>(value * 1024.f)));
+  }
+  constexpr uint64_t value() const { return hash; }
+
+ private:
+  uint64_t hash = 0xcbf29ce484222325ull;
+};
+
+constexpr bool isDepthFormat(VkFormat format) {
+  switch (format) {
+    case VK_FORMAT_D16_UNORM:
+    case VK_FORMAT_X8_D24_UNORM_PACK32:
+    case VK_FORMAT_D32_SFLOAT:
+    case VK_FORMAT_S8_UINT:
+    case VK_FORMAT_D16_UNORM_S8_UINT:
+    case VK_FORMAT_D24_UNORM_S8_UINT:
+    case VK_FORMAT_D32_SFLOAT_S8_UINT:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Bytes per pixel of the colour formats a swapchain offers, 0 for others.
+constexpr uint32_t colorFormatSize(VkFormat format) {
+  switch (format) {
+    case VK_FORMAT_R5G6B5_UNORM_PACK16:
+    case VK_FORMAT_B5G6R5_UNORM_PACK16:
+    case VK_FORMAT_R5G5B5A1_UNORM_PACK16:
+    case VK_FORMAT_A1R5G5B5_UNORM_PACK16:
+      return 2;
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_SRGB:
+    case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+      return 4;
+    case VK_FORMAT_R16G16B16A16_SFLOAT:
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+constexpr bool isValidSampleCount(VkSampleCountFlagBits samples) {
+  return samples != 0 && (samples & (samples - 1)) == 0 &&
+         samples <= VK_SAMPLE_COUNT_64_BIT;
+}
+
+constexpr bool isDualSourceFactor(VkBlendFactor factor) {
+  return factor == VK_BLEND_FACTOR_SRC1_COLOR ||
+         factor == VK_BLEND_FACTOR_ONE_MINUS_SRC1_COLOR ||
+         factor == VK_BLEND_FACTOR_SRC1_ALPHA ||
+         factor == VK_BLEND_FACTOR_ONE_MINUS_SRC1_ALPHA;
+}
+
+struct ColorBlendDesc {
+  bool enable = false;
+  VkBlendFactor srcColor = VK_BLEND_FACTOR_ONE;
+  VkBlendFactor dstColor = VK_BLEND_FACTOR_ZERO;
+  VkBlendOp colorOp = VK_BLEND_OP_ADD;
+  VkBlendFactor srcAlpha = VK_BLEND_FACTOR_ONE;
+  VkBlendFactor dstAlpha = VK_BLEND_FACTOR_ZERO;
+  VkBlendOp alphaOp = VK_BLEND_OP_ADD;
+  VkColorComponentFlags writeMask =
+      VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+      VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+  // Straight (non premultiplied) alpha blending.
+  static constexpr ColorBlendDesc alpha() {
+    ColorBlendDesc blend;
+    blend.enable = true;
+    blend.srcColor = VK_BLEND_FACTOR_SRC_ALPHA;
+    blend.dstColor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    blend.dstAlpha = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    return blend;
+  }
+  // Source colours already multiplied by their alpha.
+  static constexpr ColorBlendDesc premultipliedAlpha() {
+    ColorBlendDesc blend;
+    blend.enable = true;
+    blend.dstColor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    blend.dstAlpha = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    return blend;
+  }
+
+  constexpr VkPipelineColorBlendAttachmentState state() const {
+    return {enable ? VK_TRUE : VK_FALSE,
+            srcColor,
+            dstColor,
+            colorOp,
+            srcAlpha,
+            dstAlpha,
+            alphaOp,
+            writeMask};
+  }
+};
+
+/*
+ * Fixed function state of a graphics pipeline with one colour attachment.
+ * Viewport and scissor are always dynamic so pipelines survive rotation and
+ * resolution changes.
+ */
+struct GraphicsPipelineDesc {
+  VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  bool primitiveRestart = false;
+  VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;
+  VkCullModeFlags cullMode = VK_CULL_MODE_NONE;
+  VkFrontFace frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+  float lineWidth = 1.f;
+  VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+  bool depthTest = false;
+  bool depthWrite = false;
+  VkCompareOp depthCompare = VK_COMPARE_OP_LESS_OR_EQUAL;
+  ColorBlendDesc blend;
+
+  constexpr GraphicsPipelineDesc withTopology(VkPrimitiveTopology value,
+                                              bool restart = false) const {
+    GraphicsPipelineDesc desc = *this;
+    desc.topology = value;
+    desc.primitiveRestart = restart;
+    return desc;
+  }
+  constexpr GraphicsPipelineDesc withPolygonMode(VkPolygonMode mode,
+                                                 float width = 1.f) const {
+    GraphicsPipelineDesc desc = *this;
+    desc.polygonMode = mode;
+    desc.lineWidth = width;
+    return desc;
+  }
+  constexpr GraphicsPipelineDesc withCullMode(VkCullModeFlags mode,
+                                              VkFrontFace front) const {
+    GraphicsPipelineDesc desc = *this;
+    desc.cullMode = mode;
+    desc.frontFace = front;
+    return desc;
+  }
+  constexpr GraphicsPipelineDesc withSamples(
+      VkSampleCountFlagBits count) const {
+    GraphicsPipelineDesc desc = *this;
+    desc.samples = count;
+    return desc;
+  }
+  constexpr GraphicsPipelineDesc withDepth(
+      bool test, bool write,
+      VkCompareOp compare = VK_COMPARE_OP_LESS_OR_EQUAL) const {
+    GraphicsPipelineDesc desc = *this;
+    desc.depthTest = test;
+    desc.depthWrite = write;
+    desc.depthCompare = compare;
+    return desc;
+  }
+  constexpr GraphicsPipelineDesc withBlend(const ColorBlendDesc &value) const {
+    GraphicsPipelineDesc desc = *this;
+    desc.blend = value;
+    return desc;
+  }
+
+  constexpr bool valid() const {
+    bool listTopology = topology == VK_PRIMITIVE_TOPOLOGY_POINT_LIST ||
+                        topology == VK_PRIMITIVE_TOPOLOGY_LINE_LIST ||
+                        topology == VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    return
+        // Restart on lists needs VK_EXT_primitive_topology_list_restart.
+        !(primitiveRestart && listTopology) &&
+        // Needs the tessellationShader feature.
+        topology != VK_PRIMITIVE_TOPOLOGY_PATCH_LIST &&
+        // Needs the fillModeNonSolid and wideLines features.
+        polygonMode == VK_POLYGON_MODE_FILL && lineWidth == 1.f &&
+        isValidSampleCount(samples) &&
+        // Depth writes only happen when the depth test is enabled.
+        (depthTest || !depthWrite) &&
+        // Needs the dualSrcBlend feature.
+        !isDualSourceFactor(blend.srcColor) &&
+        !isDualSourceFactor(blend.dstColor) &&
+        !isDualSourceFactor(blend.srcAlpha) &&
+        !isDualSourceFactor(blend.dstAlpha) &&
+        // A pipeline that writes nothing is a bug.
+        (blend.writeMask != 0 || depthWrite);
+  }
+
+  constexpr uint64_t hash() const {
+    return DescHasher()
+        .add(uint64_t(topology))
+        .add(uint64_t(primitiveRestart))
+        .add(uint64_t(polygonMode))
+        .add(uint64_t(cullMode))
+        .add(uint64_t(frontFace))
+        .add(lineWidth)
+        .add(uint64_t(samples))
+        .add(uint64_t(depthTest))
+        .add(uint64_t(depthWrite))
+        .add(uint64_t(depthCompare))
+        .add(uint64_t(blend.enable))
+        .add(uint64_t(blend.srcColor))
+        .add(uint64_t(blend.dstColor))
+        .add(uint64_t(blend.colorOp))
+        .add(uint64_t(blend.srcAlpha))
+        .add(uint64_t(blend.dstAlpha))
+        .add(uint64_t(blend.alphaOp))
+        .add(uint64_t(blend.writeMask))
+        .value();
+  }
+};
+
+struct AttachmentDesc {
+  // VK_FORMAT_UNDEFINED is filled in at runtime, see withFormat().
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+  VkAttachmentLoadOp load = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  VkAttachmentStoreOp store = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+  constexpr bool valid(bool depth) const {
+    return isValidSampleCount(samples) &&
+           finalLayout != VK_IMAGE_LAYOUT_UNDEFINED &&
+           finalLayout != VK_IMAGE_LAYOUT_PREINITIALIZED &&
+           // Loading from an undefined layout reads garbage, clear or don't
+           // care instead.
+           !(load == VK_ATTACHMENT_LOAD_OP_LOAD &&
+             initialLayout == VK_IMAGE_LAYOUT_UNDEFINED) &&
+           (format == VK_FORMAT_UNDEFINED || isDepthFormat(format) == depth);
+  }
+
+  constexpr void hash(DescHasher &hasher) const {
+    hasher.add(uint64_t(format))
+        .add(uint64_t(samples))
+        .add(uint64_t(load))
+        .add(uint64_t(store))
+        .add(uint64_t(initialLayout))
+        .add(uint64_t(finalLayout));
+  }
+
+  constexpr bool operator==(const AttachmentDesc &other) const {
+    return format == other.format && samples == other.samples &&
+           load == other.load && store == other.store &&
+           initialLayout == other.initialLayout &&
+           finalLayout == other.finalLayout;
+  }
+  constexpr bool operator!=(const AttachmentDesc &other) const {
+    return !(*this == other);
+  }
+};
+
+/*
+ * A render pass with a single graphics subpass writing every colour
+ * attachment and the optional depth attachment.
+ */
+struct RenderPassDesc {
+  static constexpr uint32_t kMaxColorAttachments = 4;
+  std::array<AttachmentDesc, kMaxColorAttachments> colors{};
+  uint32_t colorCount = 0;
+  AttachmentDesc depth{};
+  bool hasDepth = false;
+  // Non-zero for multiview: every draw is broadcast to the framebuffer layers
+  // set here, and shaders see the layer as gl_ViewIndex. Needs the multiview
+  // device feature.
+  uint32_t viewMask = 0;
+  // Set when more than kMaxColorAttachments were added.
+  bool overflow = false;
+
+  constexpr RenderPassDesc addColor(VkFormat format, VkAttachmentLoadOp load,
+                                    VkAttachmentStoreOp store,
+                                    VkImageLayout initialLayout,
+                                    VkImageLayout finalLayout) const {
+    RenderPassDesc desc = *this;
+    if (desc.colorCount == kMaxColorAttachments) {
+      desc.overflow = true;
+      return desc;
+    }
+    AttachmentDesc &color = desc.colors[desc.colorCount++];
+    color.format = format;
+    color.samples = samples();
+    color.load = load;
+    color.store = store;
+    color.initialLayout = initialLayout;
+    color.finalLayout = finalLayout;
+    return desc;
+  }
+  constexpr RenderPassDesc withDepth(VkFormat format, VkAttachmentLoadOp load,
+                                     VkAttachmentStoreOp store) const {
+    RenderPassDesc desc = *this;
+    desc.hasDepth = true;
+    desc.depth.format = format;
+    desc.depth.samples = samples();
+    desc.depth.load = load;
+    desc.depth.store = store;
+    desc.depth.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    return desc;
+  }
+  constexpr RenderPassDesc withSamples(VkSampleCountFlagBits count) const {
+    RenderPassDesc desc = *this;
+    for (AttachmentDesc &color : desc.colors) {
+      color.samples = count;
+    }
+    desc.depth.samples = count;
+    return desc;
+  }
+  // Runtime fill-ins for attachments whose format or layout depends on the
+  // device or surface.
+  constexpr RenderPassDesc withFormat(uint32_t index, VkFormat format) const {
+    RenderPassDesc desc = *this;
+    desc.colors[index].format = format;
+    return desc;
+  }
+  constexpr RenderPassDesc withFinalLayout(uint32_t index,
+                                           VkImageLayout layout) const {
+    RenderPassDesc desc = *this;
+    desc.colors[index].finalLayout = layout;
+    return desc;
+  }
+  constexpr RenderPassDesc withViewMask(uint32_t mask) const {
+    RenderPassDesc desc = *this;
+    desc.viewMask = mask;
+    return desc;
+  }
+
+  constexpr VkSampleCountFlagBits samples() const {
+    return colorCount > 0 ? colors[0].samples : depth.samples;
+  }
+
+  constexpr bool valid() const {
+    if (overflow || (colorCount == 0 && !hasDepth)) {
+      return false;
+    }
+    for (uint32_t i = 0; i < colorCount; i++) {
+      if (!colors[i].valid(false) || colors[i].samples != samples()) {
+        return false;
+      }
+    }
+    return !hasDepth || (depth.valid(true) && depth.samples == samples());
+  }
+
+  // Every format is known, the description can be turned into a render pass.
+  constexpr bool complete() const {
+    for (uint32_t i = 0; i < colorCount; i++) {
+      if (colors[i].format == VK_FORMAT_UNDEFINED) {
+        return false;
+      }
+    }
+    return !hasDepth || depth.format != VK_FORMAT_UNDEFINED;
+  }
+
+  constexpr uint64_t hash() const {
+    DescHasher hasher;
+    hasher.add(uint64_t(colorCount))
+        .add(uint64_t(hasDepth))
+        .add(uint64_t(viewMask));
+    for (uint32_t i = 0; i < colorCount; i++) {
+      colors[i].hash(hasher);
+    }
+    if (hasDepth) {
+      depth.hash(hasher);
+    }
+    return hasher.value();
+  }
+
+  /*
+   * Equal for render passes that are compatible: same attachment formats and
+   * sample counts and the same view mask, whatever the load and store ops
+   * and layouts. A framebuffer created for one can be used with the other.
+   */
+  constexpr uint64_t compatibilityHash() const {
+    DescHasher hasher;
+    hasher.add(uint64_t(colorCount))
+        .add(uint64_t(hasDepth))
+        .add(uint64_t(viewMask));
+    for (uint32_t i = 0; i < colorCount; i++) {
+      hasher.add(uint64_t(colors[i].format))
+          .add(uint64_t(colors[i].samples));
+    }
+    if (hasDepth) {
+      hasher.add(uint64_t(depth.format)).add(uint64_t(depth.samples));
+    }
+    return hasher.value();
+  }
+
+  // What hash() and compatibilityHash() stand for; the caches compare these
+  // so a hash collision cannot hand out the wrong object.
+  constexpr bool operator==(const RenderPassDesc &other) const {
+    if (!compatibleWith(other)) {
+      return false;
+    }
+    for (uint32_t i = 0; i < colorCount; i++) {
+      if (colors[i] != other.colors[i]) {
+        return false;
+      }
+    }
+    return !hasDepth || depth == other.depth;
+  }
+  constexpr bool compatibleWith(const RenderPassDesc &other) const {
+    if (colorCount != other.colorCount || hasDepth != other.hasDepth ||
+        viewMask != other.viewMask || overflow != other.overflow) {
+      return false;
+    }
+    for (uint32_t i = 0; i < colorCount; i++) {
+      if (colors[i].format != other.colors[i].format ||
+          colors[i].samples != other.colors[i].samples) {
+        return false;
+      }
+    }
+    return !hasDepth || (depth.format == other.depth.format &&
+                         depth.samples == other.depth.samples);
+  }
+};
+
+struct SamplerDesc {
+  VkFilter magFilter = VK_FILTER_LINEAR;
+  VkFilter minFilter = VK_FILTER_LINEAR;
+  VkSamplerMipmapMode mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+  VkSamplerAddressMode addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  VkSamplerAddressMode addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  VkSamplerAddressMode addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  float mipLodBias = 0.f;
+  float maxAnisotropy = 1.f;
+  bool compareEnable = false;
+  VkCompareOp compareOp = VK_COMPARE_OP_ALWAYS;
+  float minLod = 0.f;
+  float maxLod = VK_LOD_CLAMP_NONE;
+  VkBorderColor borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
+  bool unnormalizedCoordinates = false;
+
+  constexpr SamplerDesc withFilter(VkFilter filter,
+                                   VkSamplerMipmapMode mipmap) const {
+    SamplerDesc desc = *this;
+    desc.magFilter = filter;
+    desc.minFilter = filter;
+    desc.mipmapMode = mipmap;
+    return desc;
+  }
+  constexpr SamplerDesc withAddressMode(VkSamplerAddressMode mode) const {
+    SamplerDesc desc = *this;
+    desc.addressModeU = mode;
+    desc.addressModeV = mode;
+    desc.addressModeW = mode;
+    return desc;
+  }
+  constexpr SamplerDesc withLod(float min, float max, float bias = 0.f) const {
+    SamplerDesc desc = *this;
+    desc.minLod = min;
+    desc.maxLod = max;
+    desc.mipLodBias = bias;
+    return desc;
+  }
+  constexpr SamplerDesc withCompare(VkCompareOp op) const {
+    SamplerDesc desc = *this;
+    desc.compareEnable = true;
+    desc.compareOp = op;
+    return desc;
+  }
+  constexpr SamplerDesc withUnnormalizedCoordinates() const {
+    SamplerDesc desc = *this;
+    desc.unnormalizedCoordinates = true;
+    desc.minFilter = desc.magFilter;
+    desc.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    desc.minLod = 0.f;
+    desc.maxLod = 0.f;
+    return desc;
+  }
+
+  constexpr bool valid() const {
+    bool clamped = addressModeU == VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE ||
+                   addressModeU == VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+    clamped &= addressModeV == VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE ||
+               addressModeV == VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+    return minLod <= maxLod &&
+           // Needs the samplerAnisotropy feature.
+           maxAnisotropy == 1.f &&
+           // Needs VK_KHR_sampler_mirror_clamp_to_edge.
+           addressModeU != VK_SAMPLER_ADDRESS_MODE_MIRROR_CLAMP_TO_EDGE &&
+           addressModeV != VK_SAMPLER_ADDRESS_MODE_MIRROR_CLAMP_TO_EDGE &&
+           addressModeW != VK_SAMPLER_ADDRESS_MODE_MIRROR_CLAMP_TO_EDGE &&
+           // Restrictions of VkSamplerCreateInfo::unnormalizedCoordinates.
+           (!unnormalizedCoordinates ||
+            (minFilter == magFilter &&
+             mipmapMode == VK_SAMPLER_MIPMAP_MODE_NEAREST && minLod == 0.f &&
+             maxLod == 0.f && clamped && !compareEnable));
+  }
+
+  // Samplers have no pointers, so the whole create info is a constant.
+  constexpr VkSamplerCreateInfo createInfo() const {
+    return {VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+            nullptr,
+            0,
+            magFilter,
+            minFilter,
+            mipmapMode,
+            addressModeU,
+            addressModeV,
+            addressModeW,
+            mipLodBias,
+            maxAnisotropy > 1.f ? VK_TRUE : VK_FALSE,
+            maxAnisotropy,
+            compareEnable ? VK_TRUE : VK_FALSE,
+            compareOp,
+            minLod,
+            maxLod,
+            borderColor,
+            unnormalizedCoordinates ? VK_TRUE : VK_FALSE};
+  }
+
+  constexpr uint64_t hash() const {
+    return DescHasher()
+        .add(uint64_t(magFilter))
+        .add(uint64_t(minFilter))
+        .add(uint64_t(mipmapMode))
+        .add(uint64_t(addressModeU))
+        .add(uint64_t(addressModeV))
+        .add(uint64_t(addressModeW))
+        .add(mipLodBias)
+        .add(maxAnisotropy)
+        .add(uint64_t(compareEnable))
+        .add(uint64_t(compareOp))
+        .add(minLod)
+        .add(maxLod)
+        .add(uint64_t(borderColor))
+        .add(uint64_t(unnormalizedCoordinates))
+        .value();
+  }
+
+  constexpr bool operator==(const SamplerDesc &other) const {
+    return magFilter == other.magFilter && minFilter == other.minFilter &&
+           mipmapMode == other.mipmapMode &&
+           addressModeU == other.addressModeU &&
+           addressModeV == other.addressModeV &&
+           addressModeW == other.addressModeW &&
+           mipLodBias == other.mipLodBias &&
+           maxAnisotropy == other.maxAnisotropy &&
+           compareEnable == other.compareEnable &&
+           compareOp == other.compareOp && minLod == other.minLod &&
+           maxLod == other.maxLod && borderColor == other.borderColor &&
+           unnormalizedCoordinates == other.unnormalizedCoordinates;
+  }
+};
+
+/*
+ * An image view less its image, which only exists at runtime. Components are
+ * always the identity swizzle. A format left VK_FORMAT_UNDEFINED is filled in
+ * with withFormat() once the image format is known.
+ */
+struct ImageViewDesc {
+  VkImageViewType viewType = VK_IMAGE_VIEW_TYPE_2D;
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  VkImageAspectFlags aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  uint32_t baseMipLevel = 0;
+  uint32_t levelCount = 1;
+  uint32_t baseArrayLayer = 0;
+  uint32_t layerCount = 1;
+
+  constexpr ImageViewDesc withFormat(VkFormat viewFormat) const {
+    ImageViewDesc desc = *this;
+    desc.format = viewFormat;
+    return desc;
+  }
+  constexpr ImageViewDesc withLayers(VkImageViewType type, uint32_t base,
+                                     uint32_t count) const {
+    ImageViewDesc desc = *this;
+    desc.viewType = type;
+    desc.baseArrayLayer = base;
+    desc.layerCount = count;
+    return desc;
+  }
+  constexpr ImageViewDesc withMipLevels(uint32_t base, uint32_t count) const {
+    ImageViewDesc desc = *this;
+    desc.baseMipLevel = base;
+    desc.levelCount = count;
+    return desc;
+  }
+
+  constexpr bool valid() const {
+    bool layersMatchType = true;
+    switch (viewType) {
+      case VK_IMAGE_VIEW_TYPE_1D:
+      case VK_IMAGE_VIEW_TYPE_2D:
+      case VK_IMAGE_VIEW_TYPE_3D:
+        layersMatchType = layerCount == 1;
+        break;
+      case VK_IMAGE_VIEW_TYPE_CUBE:
+        layersMatchType = layerCount == 6;
+        break;
+      case VK_IMAGE_VIEW_TYPE_CUBE_ARRAY:
+        // Needs the imageCubeArray feature.
+        layersMatchType = false;
+        break;
+      default:
+        break;
+    }
+    return layersMatchType && layerCount >= 1 && levelCount >= 1 &&
+           aspectMask != 0 &&
+           (format == VK_FORMAT_UNDEFINED ||
+            isDepthFormat(format) ==
+                ((aspectMask & VK_IMAGE_ASPECT_COLOR_BIT) == 0));
+  }
+
+  constexpr VkImageViewCreateInfo createInfo(VkImage image) const {
+    return {VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            nullptr,
+            0,
+            image,
+            viewType,
+            format,
+            {VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY,
+             VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY},
+            {aspectMask, baseMipLevel, levelCount, baseArrayLayer,
+             layerCount}};
+  }
+
+  constexpr uint64_t hash() const {
+    return DescHasher()
+        .add(uint64_t(viewType))
+        .add(uint64_t(format))
+        .add(uint64_t(aspectMask))
+        .add(uint64_t(baseMipLevel))
+        .add(uint64_t(levelCount))
+        .add(uint64_t(baseArrayLayer))
+        .add(uint64_t(layerCount))
+        .value();
+  }
+
+  constexpr bool operator==(const ImageViewDesc &other) const {
+    return viewType == other.viewType && format == other.format &&
+           aspectMask == other.aspectMask &&
+           baseMipLevel == other.baseMipLevel &&
+           levelCount == other.levelCount &&
+           baseArrayLayer == other.baseArrayLayer &&
+           layerCount == other.layerCount;
+  }
+};
+
+/*
+ * A fixed set of descriptions with their hashes, all computed at compile time.
+ * Declare tables constexpr and static_assert(table.unique()) so two entries
+ * never share a cache slot.
+ */
+template <typename Desc, size_t N>
+struct DescTable {
+  std::array<Desc, N> descs;
+  std::array<uint64_t, N> hashes;
+
+  constexpr bool valid() const {
+    for (const Desc &desc : descs) {
+      if (!desc.valid()) {
+        return false;
+      }
+    }
+    return true;
+  }
+  constexpr bool unique() const {
+    for (size_t i = 0; i < N; i++) {
+      for (size_t j = i + 1; j < N; j++) {
+        if (hashes[i] == hashes[j]) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+  // Index of the entry with hash, N if there is none.
+  constexpr size_t find(uint64_t hash) const {
+    for (size_t i = 0; i < N; i++) {
+      if (hashes[i] == hash) {
+        return i;
+      }
+    }
+    return N;
+  }
+};
+
+template <typename Desc, typename... Rest>
+constexpr DescTable<Desc, 1 + sizeof...(Rest)> makeDescTable(
+    const Desc &first, const Rest &...rest) {
+  return {{{first, rest...}}, {{first.hash(), rest.hash()...}}};
+}
+
+/*
+ * Runtime side: the pointer-carrying Vulkan structs are assembled on the stack
+ * from a description and handed straight to the driver.
+ */
+inline VkResult createRenderPass(VkDevice device, const RenderPassDesc &desc,
+                                 VkRenderPass *renderPass) {
+  std::array<VkAttachmentDescription, RenderPassDesc::kMaxColorAttachments + 1>
+      attachments{};
+  std::array<VkAttachmentReference, RenderPassDesc::kMaxColorAttachments>
+      colorRefs{};
+  auto describe = [](const AttachmentDesc &attachment) {
+    VkAttachmentDescription description{};
+    description.format = attachment.format;
+    description.samples = attachment.samples;
+    description.loadOp = attachment.load;
+    description.storeOp = attachment.store;
+    description.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    description.initialLayout = attachment.initialLayout;
+    description.finalLayout = attachment.finalLayout;
+    return description;
+  };
+  for (uint32_t i = 0; i < desc.colorCount; i++) {
+    attachments[i] = describe(desc.colors[i]);
+    colorRefs[i] = {i, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+  }
+  VkAttachmentReference depthRef = {
+      desc.colorCount, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+  if (desc.hasDepth) {
+    attachments[desc.colorCount] = describe(desc.depth);
+  }
+
+  VkSubpassDescription subpass{};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = desc.colorCount;
+  subpass.pColorAttachments = colorRefs.data();
+  subpass.pDepthStencilAttachment = desc.hasDepth ? &depthRef : nullptr;
+
+  VkSubpassDependency dependency{};
+  dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependency.dstSubpass = 0;
+  dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependency.srcAccessMask = 0;
+  dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  if (desc.hasDepth) {
+    dependency.srcStageMask |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependency.dstStageMask |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependency.dstAccessMask |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  }
+
+  // An attachment left in SHADER_READ_ONLY_OPTIMAL is sampled by a later
+  // pass: make its writes visible to fragment shaders without a separate
+  // barrier.
+  std::array<VkSubpassDependency, 2> dependencies = {dependency};
+  uint32_t dependencyCount = 1;
+  for (uint32_t i = 0; i < desc.colorCount; i++) {
+    if (desc.colors[i].finalLayout ==
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+      VkSubpassDependency &sampled = dependencies[dependencyCount++];
+      sampled.srcSubpass = 0;
+      sampled.dstSubpass = VK_SUBPASS_EXTERNAL;
+      sampled.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+      sampled.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+      sampled.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+      sampled.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+      break;
+    }
+  }
+
+  VkRenderPassCreateInfo renderPassInfo{};
+  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  renderPassInfo.attachmentCount = desc.colorCount + (desc.hasDepth ? 1 : 0);
+  renderPassInfo.pAttachments = attachments.data();
+  renderPassInfo.subpassCount = 1;
+  renderPassInfo.pSubpasses = &subpass;
+  renderPassInfo.dependencyCount = dependencyCount;
+  renderPassInfo.pDependencies = dependencies.data();
+
+  // The views render the same scene from nearby eyes, so the correlation mask
+  // lets the driver share work between them.
+  VkRenderPassMultiviewCreateInfo multiview{};
+  multiview.sType = VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO;
+  multiview.subpassCount = 1;
+  multiview.pViewMasks = &desc.viewMask;
+  multiview.correlationMaskCount = 1;
+  multiview.pCorrelationMasks = &desc.viewMask;
+  if (desc.viewMask != 0) {
+    renderPassInfo.pNext = &multiview;
+  }
+  return vkCreateRenderPass(device, &renderPassInfo, nullptr, renderPass);
+}
+
+inline VkResult createGraphicsPipeline(
+    VkDevice device, const GraphicsPipelineDesc &desc,
+    const VkPipelineShaderStageCreateInfo *stages, uint32_t stageCount,
+    VkPipelineLayout layout, VkRenderPass renderPass, VkPipeline *pipeline,
+    VkPipelineCache cache = VK_NULL_HANDLE) {
+  VkPipelineVertexInputStateCreateInfo vertexInput{};
+  vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+  VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+  inputAssembly.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+  inputAssembly.topology = desc.topology;
+  inputAssembly.primitiveRestartEnable =
+      desc.primitiveRestart ? VK_TRUE : VK_FALSE;
+
+  VkPipelineViewportStateCreateInfo viewportState{};
+  viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  viewportState.viewportCount = 1;
+  viewportState.scissorCount = 1;
+
+  VkPipelineRasterizationStateCreateInfo rasterizer{};
+  rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+  rasterizer.polygonMode = desc.polygonMode;
+  rasterizer.cullMode = desc.cullMode;
+  rasterizer.frontFace = desc.frontFace;
+  rasterizer.lineWidth = desc.lineWidth;
+
+  VkPipelineMultisampleStateCreateInfo multisampling{};
+  multisampling.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+  multisampling.rasterizationSamples = desc.samples;
+  multisampling.minSampleShading = 1.0f;
+
+  VkPipelineDepthStencilStateCreateInfo depthStencil{};
+  depthStencil.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+  depthStencil.depthTestEnable = desc.depthTest ? VK_TRUE : VK_FALSE;
+  depthStencil.depthWriteEnable = desc.depthWrite ? VK_TRUE : VK_FALSE;
+  depthStencil.depthCompareOp = desc.depthCompare;
+  depthStencil.maxDepthBounds = 1.0f;
+
+  VkPipelineColorBlendAttachmentState blendAttachment = desc.blend.state();
+  VkPipelineColorBlendStateCreateInfo colorBlending{};
+  colorBlending.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+  colorBlending.logicOp = VK_LOGIC_OP_COPY;
+  colorBlending.attachmentCount = 1;
+  colorBlending.pAttachments = &blendAttachment;
+
+  const VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT,
+                                          VK_DYNAMIC_STATE_SCISSOR};
+  VkPipelineDynamicStateCreateInfo dynamicState{};
+  dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+  dynamicState.dynamicStateCount = 2;
+  dynamicState.pDynamicStates = dynamicStates;
+
+  VkGraphicsPipelineCreateInfo pipelineInfo{};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipelineInfo.stageCount = stageCount;
+  pipelineInfo.pStages = stages;
+  pipelineInfo.pVertexInputState = &vertexInput;
+  pipelineInfo.pInputAssemblyState = &inputAssembly;
+  pipelineInfo.pViewportState = &viewportState;
+  pipelineInfo.pRasterizationState = &rasterizer;
+  pipelineInfo.pMultisampleState = &multisampling;
+  pipelineInfo.pDepthStencilState =
+      desc.depthTest || desc.depthWrite ? &depthStencil : nullptr;
+  pipelineInfo.pColorBlendState = &colorBlending;
+  pipelineInfo.pDynamicState = &dynamicState;
+  pipelineInfo.layout = layout;
+  pipelineInfo.renderPass = renderPass;
+  pipelineInfo.subpass = 0;
+  pipelineInfo.basePipelineIndex = -1;
+  return vkCreateGraphicsPipelines(device, cache, 1, &pipelineInfo, nullptr,
+                                   pipeline);
+}
+
+}  // namespace vkt
@@ -23,7 +23,12 @@
 
 #include <iostream>
 
+#include "app_config.h"
+#include "governor.h"
 #include "hellovk.h"
+#include "input.h"
+#include "render_server.h"
+#include "thread_affinity.h"
 
 /*
  * Shared state for the app. This will be accessed within lifecycle callbacks
@@ -38,24 +43,186 @@
  * bool canRender - a flag which signals that we are ready to call the vulkan
  * rendering logic
  *
+ * vkt::InputQueue input - timestamped key and touch events drained from
+ * GameActivity once per frame
+ *
+ * float rotation - rotation of the triangle in radians, driven by horizontal
+ * drags
+ *
+ * vkt::PerformanceGovernor governor - adjusts frame rate cap, resolution scale
+ * and frames in flight based on thermal headroom
+ *
+ * vkt::ThreadPlacement threadPlacement - core affinity and priority of the
+ * render thread (android_main's thread) and worker threads
+ *
+ * bool finishing - set for an offscreen batch run or render server session, no
+ * window is set up anymore
+ *
+ * std::vector<vkt::HelloVK::TargetId> extraTargets - offscreen targets
+ * rendered alongside the window, see AddRenderTargetsIfRequested()
+ *
+ * std::string powerProfile - value of debug.hellovk.power last applied, see
+ * UpdatePowerProfile()
+ *
+ * std::vector<vkt::HelloVK::LayerId> staticLayers - cached layers under the
+ * triangle, see AddStaticLayersIfRequested()
+ *
  */
 struct VulkanEngine {
   struct android_app *app;
   vkt::HelloVK *app_backend;
   bool canRender = false;
+  vkt::InputQueue input;
+  float rotation = 0.f;
+  float lastTouchX = 0.f;
+  std::unique_ptr<vkt::PerformanceGovernor> governor;
+  vkt::GovernorSettings appliedSettings{};
+  std::unique_ptr<vkt::ThreadPlacement> threadPlacement;
+  // Set once the app runs headless and the window is ignored.
+  bool finishing = false;
+  std::vector<vkt::HelloVK::TargetId> extraTargets;
+  std::string powerProfile = "standard";
+  std::vector<vkt::HelloVK::LayerId> staticLayers;
+  std::chrono::steady_clock::time_point nextPowerPoll;
+  std::chrono::steady_clock::time_point nextCommandLog;
 };
 
+static void LogThreadMigrations(VulkanEngine *engine) {
+  for (const auto &report : engine->threadPlacement->migrationReport()) {
+    LOGI("Thread %s (%d): %lld kernel migrations, %llu sampled",
+         report.name.c_str(), (int)report.tid, report.kernelMigrations,
+         report.sampledMigrations);
+  }
+}
+
+/*
+ * Frame capture for automated visual QA, enabled with
+ *   adb shell setprop debug.hellovk.capture png     (or raw)
+ *   adb shell setprop debug.hellovk.capture_every 10
+ * Frames are written to the app's external files directory so they can be
+ * pulled without root.
+ */
+static void StartCaptureIfRequested(VulkanEngine *engine) {
+  std::string encoding = vkt::getConfigString("debug.hellovk.capture");
+  if (encoding.empty() || encoding == "off") {
+    return;
+  }
+  GameActivity *activity = engine->app->activity;
+  vkt::FrameCaptureConfig config;
+  config.directory = activity->externalDataPath != nullptr
+                         ? activity->externalDataPath
+                         : activity->internalDataPath;
+  config.encoding =
+      encoding == "raw" ? vkt::CaptureEncoding::Raw : vkt::CaptureEncoding::Png;
+  config.everyNthFrame = vkt::getConfigInt("debug.hellovk.capture_every", 1);
+  config.workerThreadInit = [engine] {
+    engine->threadPlacement->placeCurrentThread(vkt::ThreadRole::Worker,
+                                                "frame-writer");
+  };
+  engine->app_backend->startCapture(config);
+}
+
+/*
+ * Command stream capture for deterministic benchmarking, enabled with
+ *   adb shell setprop debug.hellovk.record commands.hvks
+ * Relative paths are resolved against the app's external files directory.
+ * The capture is closed when the window goes away; replay it with
+ * debug.hellovk.replay.
+ */
+static std::string ResolveDataPath(VulkanEngine *engine,
+                                   const std::string &path) {
+  if (path.empty() || path[0] == '/') {
+    return path;
+  }
+  GameActivity *activity = engine->app->activity;
+  return std::string(activity->externalDataPath != nullptr
+                         ? activity->externalDataPath
+                         : activity->internalDataPath) +
+         "/" + path;
+}
+
+static void StartCommandCaptureIfRequested(VulkanEngine *engine) {
+  std::string path = vkt::getConfigString("debug.hellovk.record");
+  if (!path.empty()) {
+    engine->app_backend->startCommandCapture(ResolveDataPath(engine, path));
+  }
+}
+
+/*
+ * Offscreen targets rendered next to the window on their own schedule, to
+ * exercise multi-target rendering on the shared device:
+ *   adb shell setprop debug.hellovk.extra_targets 2
+ *   adb shell setprop debug.hellovk.extra_target_fps 30
+ * Their frame counts are logged when the window goes away.
+ */
+static void AddRenderTargetsIfRequested(VulkanEngine *engine) {
+  long count = vkt::getConfigInt("debug.hellovk.extra_targets", 0);
+  long framesPerSecond =
+      std::max(0L, vkt::getConfigInt("debug.hellovk.extra_target_fps", 30));
+  while ((long)engine->extraTargets.size() < count) {
+    engine->extraTargets.push_back(
+        engine->app_backend->addOffscreenTarget({640, 360}, framesPerSecond));
+  }
+}
+
+static void LogRenderTargets(VulkanEngine *engine) {
+  for (vkt::HelloVK::TargetId id : engine->extraTargets) {
+    LOGI("Render target %u: %llu frames", id,
+         (unsigned long long)engine->app_backend->targetFrameCount(id));
+  }
+}
+
+/*
+ * Static layers composited under the triangle, each a smaller copy of it in
+ * its own spot, to exercise the layer cache:
+ *   adb shell setprop debug.hellovk.static_layers 4
+ * Their cache hit rates are logged when the window goes away.
+ */
+static void AddStaticLayersIfRequested(VulkanEngine *engine) {
+  long count = vkt::getConfigInt("debug.hellovk.static_layers", 0);
+  while ((long)engine->staticLayers.size() < count) {
+    size_t i = engine->staticLayers.size();
+    float x = i % 2 == 0 ? -0.75f : 0.75f;
+    float y = (i / 2) % 2 == 0 ? -0.75f : 0.75f;
+    float size = 0.25f / (1 + i / 4);
+    engine->staticLayers.push_back(engine->app_backend->addStaticLayer(
+        {{3, 1, 0, 0}}, vkt::mat4::translation({x, y, 0.f}) *
+                            vkt::mat4::scale({size, size, 1.f})));
+  }
+}
+
+static void LogStaticLayers(VulkanEngine *engine) {
+  for (vkt::HelloVK::LayerId id : engine->staticLayers) {
+    vkt::LayerCacheStats stats = engine->app_backend->staticLayerStats(id);
+    LOGI("Static layer %u: %.1f%% cache hits, %llu renders", id,
+         stats.hitRate() * 100., (unsigned long long)stats.renders);
+  }
+}
+
 /**
  * Called by the Android runtime whenever events happen so the
  * app can react to it.
  */
 static void HandleCmd(struct android_app *app, int32_t cmd) {
   auto *engine = (VulkanEngine *)app->userData;
+  if (engine->finishing) {
+    // The window is no longer set up, but its loss must still stop rendering.
+    if (cmd == APP_CMD_TERM_WINDOW) {
+      engine->canRender = false;
+    }
+    if (cmd != APP_CMD_DESTROY) {
+      return;
+    }
+  }
   switch (cmd) {
     case APP_CMD_START:
       if (engine->app->window != nullptr) {
         engine->app_backend->reset(app->window, app->activity->assetManager);
         engine->app_backend->initVulkan();
+        StartCaptureIfRequested(engine);
+        StartCommandCaptureIfRequested(engine);
+        AddRenderTargetsIfRequested(engine);
+        AddStaticLayersIfRequested(engine);
         engine->canRender = true;
       }
     case APP_CMD_INIT_WINDOW:
@@ -67,6 +234,10 @@ static void HandleCmd(struct android_app *app, int32_t cmd) {
         if (!engine->app_backend->initialized) {
           LOGI("Starting application");
           engine->app_backend->initVulkan();
+          StartCaptureIfRequested(engine);
+          StartCommandCaptureIfRequested(engine);
+          AddRenderTargetsIfRequested(engine);
+          AddStaticLayersIfRequested(engine);
         }
         engine->canRender = true;
       }
@@ -74,10 +245,16 @@ static void HandleCmd(struct android_app *app, int32_t cmd) {
     case APP_CMD_TERM_WINDOW:
       // The window is being hidden or closed, clean it up.
       engine->canRender = false;
+      engine->app_backend->stopCommandCapture();
+      LogThreadMigrations(engine);
+      LogRenderTargets(engine);
+      LogStaticLayers(engine);
+      engine->app_backend->logPowerUsage();
       break;
     case APP_CMD_DESTROY:
       // The window is being hidden or closed, clean it up.
       LOGI("Destroying");
+      engine->canRender = false;
       engine->app_backend->cleanup();
     default:
       break;
@@ -85,35 +262,357 @@ static void HandleCmd(struct android_app *app, int32_t cmd) {
 }
 
 /*
- * Key events filter to GameActivity's android_native_app_glue. This sample does
- * not use/process any input events, return false for all input events so system
- * can still process them.
+ * Key events filter to GameActivity's android_native_app_glue. A key that
+ * returns true is buffered and reported handled, so it never reaches the
+ * system. No key drives the scene, so all of them - back (handled on the
+ * Kotlin side), volume, keyboards and gamepads - are left to the system.
  */
 extern "C" bool VulkanKeyEventFilter(const GameActivityKeyEvent *event) {
+  (void)event;
   return false;
 }
+
+// Only touch screen events drive the scene.
 extern "C" bool VulkanMotionEventFilter(const GameActivityMotionEvent *event) {
-  return false;
+  return (event->source & AINPUT_SOURCE_TOUCHSCREEN) ==
+         AINPUT_SOURCE_TOUCHSCREEN;
+}
+
+/*
+ * Horizontal drags of the first pointer rotate the triangle, a full screen
+ * width being one full turn. Pointer 0 can also go down after another finger
+ * is already on the screen (ACTION_POINTER_DOWN), which must restart the drag
+ * just like ACTION_DOWN does.
+ */
+static void ApplyTouch(VulkanEngine *engine, const vkt::InputEvent &event) {
+  if (event.id != 0) {
+    return;
+  }
+  if (event.action == AMOTION_EVENT_ACTION_DOWN ||
+      event.action == AMOTION_EVENT_ACTION_POINTER_DOWN) {
+    engine->lastTouchX = event.x;
+    return;
+  }
+  if (event.action != AMOTION_EVENT_ACTION_MOVE) {
+    return;
+  }
+
+  int32_t width = ANativeWindow_getWidth(engine->app->window);
+  if (width <= 0) {
+    return;
+  }
+  engine->rotation += (event.x - engine->lastTouchX) / width * 2.f * M_PI;
+  engine->lastTouchX = event.x;
+
+  engine->app_backend->setViewTransform(
+      vkt::mat4::rotationZ(engine->rotation));
+  engine->app_backend->onInputApplied(event.firstTimestampNs);
 }
 
 /*
- * Process user touch and key events. GameActivity double buffers those events,
+ * Process user touch events. GameActivity double buffers those events,
  * applications can process at any time. All of the buffered events have been
  * reported "handled" to OS. For details, refer to:
  * d.android.com/games/agdk/game-activity/get-started#handle-events
+ *
+ * The buffers are drained into the engine's input queue, which also resets
+ * the event counters inside the android_input_buffer to keep app glue code in
+ * a working state, and the queued events are then applied to the scene.
  */
 static void HandleInputEvents(struct android_app *app) {
+  auto *engine = (VulkanEngine *)app->userData;
   auto inputBuf = android_app_swap_input_buffers(app);
-  if (inputBuf == nullptr) {
+  if (inputBuf != nullptr) {
+    engine->input.drain(inputBuf);
+  }
+
+  // Events that arrive while there is nothing to render are discarded rather
+  // than replayed later.
+  vkt::InputEvent event;
+  while (engine->input.pop(event)) {
+    if (engine->canRender && event.type == vkt::InputEventType::Touch) {
+      ApplyTouch(engine, event);
+    }
+  }
+}
+
+/*
+ * Feeds the governor's current decision to the renderer, only touching the
+ * renderer when the decision changes.
+ */
+static void UpdateGovernor(VulkanEngine *engine) {
+  double now = std::chrono::duration<double>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+                   .count();
+  const vkt::GovernorSettings &settings = engine->governor->update(now);
+  if (settings == engine->appliedSettings) {
     return;
   }
+  LOGI("Governor level %zu (headroom %.2f from %s): %u fps cap, %.2f scale, "
+       "%u frames in flight",
+       engine->governor->currentLevel(), engine->governor->headroom(),
+       engine->governor->sourceName(), settings.frameRateCap,
+       settings.resolutionScale, settings.framesInFlight);
+  engine->app_backend->setFrameRateCap(settings.frameRateCap);
+  engine->app_backend->setResolutionScale(settings.resolutionScale);
+  engine->app_backend->setFramesInFlight(settings.framesInFlight);
+  engine->appliedSettings = settings;
+}
+
+/*
+ * State commands of the main window's latest frame, recorded and filtered by
+ * the command encoder, logged every five seconds while rendering. The
+ * averages over the whole run are logged by cleanup().
+ */
+static void LogFrameCommands(VulkanEngine *engine) {
+  auto now = std::chrono::steady_clock::now();
+  if (now < engine->nextCommandLog) {
+    return;
+  }
+  engine->nextCommandLog = now + std::chrono::seconds(5);
+  const vkt::CommandStats &stats = engine->app_backend->frameCommandStats();
+  std::string filtered;
+  for (size_t i = 0; i < vkt::kStateCommandCount; i++) {
+    char entry[64];
+    snprintf(entry, sizeof(entry), "%s%s %llu", i > 0 ? ", " : "",
+             vkt::stateCommandName(vkt::StateCommand(i)),
+             (unsigned long long)stats.filtered[i]);
+    filtered += entry;
+  }
+  LOGI("Frame commands: %llu recorded, %llu filtered (%s), %llu draws",
+       (unsigned long long)stats.totalRecorded(),
+       (unsigned long long)stats.totalFiltered(), filtered.c_str(),
+       (unsigned long long)stats.draws);
+}
+
+/*
+ * Power profile, switched at runtime with
+ *   adb shell setprop debug.hellovk.power low        (or standard)
+ * The property is read about once a second and the profile only changes when
+ * its value does. Switching logs the bandwidth and CPU time saved.
+ */
+static void UpdatePowerProfile(VulkanEngine *engine) {
+  auto now = std::chrono::steady_clock::now();
+  if (now < engine->nextPowerPoll) {
+    return;
+  }
+  engine->nextPowerPoll = now + std::chrono::seconds(1);
+  std::string name = vkt::getConfigString("debug.hellovk.power", "standard");
+  if (name == engine->powerProfile) {
+    return;
+  }
+  if (name == "low") {
+    engine->app_backend->setPowerProfile(vkt::PowerProfile::lowPower());
+  } else if (name == "standard") {
+    engine->app_backend->setPowerProfile(vkt::PowerProfile::standard());
+  } else {
+    LOGE("Unknown power profile %s", name.c_str());
+  }
+  engine->powerProfile = name;
+}
+
+/*
+ * Offscreen batch mode: renders a fixed number of frames without a window and
+ * streams them as raw RGBA8 to a file, then finishes the activity.
+ *   adb shell setprop debug.hellovk.batch_frames 600
+ *   adb shell setprop debug.hellovk.batch_output /data/local/tmp/frames.rgba
+ * The output defaults to frames.rgba, and relative paths are resolved as for
+ * debug.hellovk.record; stdout would go nowhere on Android. Optional:
+ * batch_width, batch_height, batch_depth (frames in flight), batch_fps
+ * (0 = unthrottled) and batch_memory_mb.
+ */
+static void RunBatch(VulkanEngine *engine, long frames) {
+  vkt::BatchConfig config;
+  config.frameCount = frames;
+  config.extent.width = vkt::getConfigInt("debug.hellovk.batch_width", 1280);
+  config.extent.height = vkt::getConfigInt("debug.hellovk.batch_height", 720);
+  config.pipelineDepth = vkt::getConfigInt("debug.hellovk.batch_depth", 3);
+  config.maxFramesPerSecond = vkt::getConfigInt("debug.hellovk.batch_fps", 0);
+  config.memoryBudgetBytes =
+      vkt::getConfigInt("debug.hellovk.batch_memory_mb", 256) << 20;
+  config.workerThreadInit = [engine] {
+    engine->threadPlacement->placeCurrentThread(vkt::ThreadRole::Worker,
+                                                "batch-writer");
+  };
+
+  std::string path = ResolveDataPath(
+      engine,
+      vkt::getConfigString("debug.hellovk.batch_output", "frames.rgba"));
+  config.output = fopen(path.c_str(), "wb");
+  if (config.output == nullptr) {
+    LOGE("Cannot open batch output %s: %s", path.c_str(), strerror(errno));
+    return;
+  }
+
+  engine->app_backend->initVulkanHeadless(engine->app->activity->assetManager);
+  vkt::BatchReport report = engine->app_backend->renderOffscreenBatch(config);
+  engine->app_backend->cleanup();
+  fclose(config.output);
+  if (report.frames == 0) {
+    // Refused, see the error logged before; leave no empty output behind.
+    LOGE("Batch rendered nothing, removing %s", path.c_str());
+    remove(path.c_str());
+  } else {
+    LOGI("Batch written to %s", path.c_str());
+  }
+
+  engine->finishing = true;
+  GameActivity_finish(engine->app->activity);
+}
+
+/*
+ * Swapchain churn soak test, enabled with
+ *   adb shell setprop debug.hellovk.soak_cycles 5000
+ *   adb shell setprop debug.hellovk.soak_frames 2   (frames after each step)
+ * Runs unattended once the window is up, logs recreation latencies, live
+ * object counts and memory growth, then finishes the activity.
+ */
+static void RunSoak(VulkanEngine *engine, long cycles) {
+  vkt::SoakConfig config;
+  config.cycles = cycles;
+  config.framesPerStep =
+      std::max(0L, vkt::getConfigInt("debug.hellovk.soak_frames", 2));
+  LOGI("Soak: %u cycles of resize, rotate and surface loss", config.cycles);
+  vkt::SoakReport report = engine->app_backend->runSwapchainSoak(config);
+
+  std::pair<const char *, vkt::LatencyRecorder *> steps[] = {
+      {"resize", &report.resize},
+      {"rotate", &report.rotate},
+      {"surface loss", &report.surfaceLoss}};
+  for (auto &[name, latency] : steps) {
+    LOGI("Soak %s: p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms", name,
+         latency->percentile(50), latency->percentile(90),
+         latency->percentile(99), latency->percentile(100));
+  }
+
+  const vkt::VulkanObjectCounts &before = report.objectsBefore;
+  const vkt::VulkanObjectCounts &after = report.objectsAfter;
+  LOGI("Soak live objects: surfaces %lld -> %lld, swapchains %lld -> %lld, "
+       "image views %lld -> %lld, framebuffers %lld -> %lld",
+       (long long)before.surfaces, (long long)after.surfaces,
+       (long long)before.swapchains, (long long)after.swapchains,
+       (long long)before.imageViews, (long long)after.imageViews,
+       (long long)before.framebuffers, (long long)after.framebuffers);
+  if (before != after) {
+    LOGE("Soak: live Vulkan objects changed over the run");
+  }
+  std::pair<const char *, vkt::ObjectCacheStats> caches[] = {
+      {"image views", engine->app_backend->imageViewCacheStats()},
+      {"framebuffers", engine->app_backend->framebufferCacheStats()}};
+  for (const auto &[name, cache] : caches) {
+    LOGI("Soak %s: %llu requested, %llu created, %.0f%% reused", name,
+         (unsigned long long)cache.requests, (unsigned long long)cache.created,
+         cache.reuseRate() * 100.);
+  }
+  auto mib = [](int64_t bytes) { return bytes / double(1 << 20); };
+  int64_t residentGrowth =
+      report.memoryAfter.residentBytes - report.memoryBefore.residentBytes;
+  for (const vkt::HostMemorySample &sample : report.memoryTrend) {
+    LOGI("Soak cycle %u: resident %.1f MiB, heap %.1f MiB", sample.cycle,
+         mib(sample.residentBytes), mib(sample.heapBytes));
+  }
+  LOGI("Soak host memory: resident %+.2f MiB, heap %+.2f MiB "
+       "(%+.1f KiB resident per 1000 cycles)",
+       mib(residentGrowth),
+       mib(report.memoryAfter.heapBytes - report.memoryBefore.heapBytes),
+       residentGrowth / 1024. * 1000. / std::max(1u, report.cycles));
 
-  // For the minimum, apps need to process the exit event (for example,
-  // listening to AKEYCODE_BACK). This sample has done that in the Kotlin side
-  // and not processing other input events, we just reset the event counter
-  // inside the android_input_buffer to keep app glue code in a working state.
-  android_app_clear_motion_events(inputBuf);
-  android_app_clear_motion_events(inputBuf);
+  // The window stays up until the activity is gone; stop drawing into it.
+  engine->canRender = false;
+  engine->finishing = true;
+  GameActivity_finish(engine->app->activity);
+}
+
+/*
+ * Headless replay of a command capture, enabled with
+ *   adb shell setprop debug.hellovk.replay commands.hvks
+ *   adb shell setprop debug.hellovk.replay_loops 10
+ * Every run of the same capture renders the exact same frames, which makes
+ * the reported frame rate comparable across builds and drivers.
+ */
+static void RunReplay(VulkanEngine *engine, const std::string &name) {
+  engine->finishing = true;
+  std::string path = ResolveDataPath(engine, name);
+  vkt::CommandStream stream;
+  if (!vkt::loadCommandStream(path, stream) || stream.frames.empty()) {
+    LOGE("Cannot load command capture %s", path.c_str());
+  } else {
+    uint32_t loops =
+        std::max(1L, vkt::getConfigInt("debug.hellovk.replay_loops", 1));
+    engine->app_backend->initVulkanHeadless(
+        engine->app->activity->assetManager);
+    engine->app_backend->replayCommandStream(stream, loops);
+    engine->app_backend->cleanup();
+  }
+  GameActivity_finish(engine->app->activity);
+}
+
+/*
+ * Forwards render server scene updates to HelloVK.
+ */
+class HelloVkServerHandler : public vkt::RenderServerHandler {
+ public:
+  explicit HelloVkServerHandler(vkt::HelloVK *backend) : backend(backend) {}
+
+  void setTransform(const std::array<float, 16> &mvp) override {
+    backend->setViewTransform(vkt::mat4::fromArray(mvp));
+  }
+  void setClearColor(const std::array<float, 4> &rgba) override {
+    backend->setClearColor(rgba);
+  }
+  void setDrawList(std::vector<vkt::DrawCommand> draws) override {
+    backend->setDrawList(std::move(draws));
+  }
+  void renderFrame() override { backend->renderOffscreenFrame(); }
+
+ private:
+  vkt::HelloVK *backend;
+};
+
+/*
+ * Render server mode, enabled with
+ *   adb shell setprop debug.hellovk.server <socket name>
+ *   adb shell setprop debug.hellovk.server_width 1280    (and server_height)
+ * A local client (see render_client.cpp) then drives rendering over the
+ * socket. Lifecycle events keep being processed so the activity can still be
+ * destroyed; the session ends when the client sends Shutdown.
+ */
+static void RunServer(VulkanEngine *engine, const std::string &name) {
+  // No window: HandleCmd must not set up the swapchain path.
+  engine->finishing = true;
+  VkExtent2D extent;
+  extent.width = vkt::getConfigInt("debug.hellovk.server_width", 1280);
+  extent.height = vkt::getConfigInt("debug.hellovk.server_height", 720);
+
+  engine->app_backend->initVulkanHeadless(engine->app->activity->assetManager);
+  engine->app_backend->startOffscreenRendering(extent);
+  StartCommandCaptureIfRequested(engine);
+  HelloVkServerHandler handler(engine->app_backend);
+  vkt::RenderServer server(name, extent.width, extent.height, handler);
+  if (!server.listen()) {
+    LOGE("Cannot listen on %s: %s", name.c_str(), strerror(errno));
+  } else {
+    LOGI("Render server listening on @%s, %ux%u", name.c_str(), extent.width,
+         extent.height);
+    while (!engine->app->destroyRequested && server.poll(16)) {
+      int events;
+      android_poll_source *source;
+      while (ALooper_pollAll(0, nullptr, &events, (void **)&source) >= 0) {
+        if (source != nullptr) {
+          source->process(engine->app, source);
+        }
+      }
+    }
+    const vkt::RenderServerStats &stats = server.stats();
+    LOGI("Render server: %llu clients, %llu updates, %llu frames, "
+         "%llu rejected messages",
+         (unsigned long long)stats.clients, (unsigned long long)stats.updates,
+         (unsigned long long)stats.frames,
+         (unsigned long long)stats.rejectedMessages);
+  }
+  engine->app_backend->stopOffscreenRendering();
+  engine->app_backend->cleanup();
+  GameActivity_finish(engine->app->activity);
 }
 
 /*
@@ -127,25 +626,93 @@ void android_main(struct android_app *state) {
 
   engine.app = state;
   engine.app_backend = &vulkanBackend;
+  engine.governor = std::make_unique<vkt::PerformanceGovernor>(
+      std::make_unique<vkt::AndroidThermalSource>());
+  engine.threadPlacement =
+      std::make_unique<vkt::ThreadPlacement>(vkt::discoverCpuTopology());
+  if (int error = engine.threadPlacement->placeCurrentThread(
+          vkt::ThreadRole::Render, "render")) {
+    LOGI("Render thread placement partially refused: %s", strerror(error));
+  }
   state->userData = &engine;
   state->onAppCmd = HandleCmd;
 
   android_app_set_key_event_filter(state, VulkanKeyEventFilter);
   android_app_set_motion_event_filter(state, VulkanMotionEventFilter);
 
+  // Full precision scene shaders even where float16 is supported:
+  //   adb shell setprop debug.hellovk.fp16 0
+  vulkanBackend.setHalfPrecision(
+      vkt::getConfigInt("debug.hellovk.fp16", 1) != 0);
+  // One framebuffer per swapchain image instead of imageless framebuffers:
+  //   adb shell setprop debug.hellovk.imageless 0
+  vulkanBackend.setImagelessFramebuffers(
+      vkt::getConfigInt("debug.hellovk.imageless", 1) != 0);
+  // Dirty rectangle rendering. The cycling background changes every pixel,
+  // so a fixed clear colour is set with it and only touch input redraws:
+  //   adb shell setprop debug.hellovk.dirty_rects 1
+  if (vkt::getConfigInt("debug.hellovk.dirty_rects", 0) != 0) {
+    vulkanBackend.setDirtyRegions(true);
+    vulkanBackend.setClearColor({0.1f, 0.1f, 0.1f, 1.f});
+  }
+  // Side by side eye views, the eyes 6.4 cm apart in view space units:
+  //   adb shell setprop debug.hellovk.stereo 1
+  if (vkt::getConfigInt("debug.hellovk.stereo", 0) != 0) {
+    vulkanBackend.setStereo(true);
+    vulkanBackend.setEyeTransforms(vkt::mat4::translation({0.032f, 0.f, 0.f}),
+                                   vkt::mat4::translation({-0.032f, 0.f, 0.f}));
+  }
+
+  // Before the window arrives, so the first swapchain has the profile's format.
+  UpdatePowerProfile(&engine);
+
+  long batchFrames = vkt::getConfigInt("debug.hellovk.batch_frames", 0);
+  if (batchFrames > 0) {
+    RunBatch(&engine, batchFrames);
+  }
+  std::string replayPath = vkt::getConfigString("debug.hellovk.replay");
+  if (!replayPath.empty() && !engine.finishing) {
+    RunReplay(&engine, replayPath);
+  }
+  std::string serverName = vkt::getConfigString("debug.hellovk.server");
+  if (!serverName.empty() && !engine.finishing) {
+    RunServer(&engine, serverName);
+  }
+
+  long soakCycles = vkt::getConfigInt("debug.hellovk.soak_cycles", 0);
   while (true) {
     int ident;
     int events;
     android_poll_source *source;
-    while ((ident = ALooper_pollAll(engine.canRender ? 0 : -1, nullptr, &events,
-                                    (void **)&source)) >= 0) {
+    // Blocks for the next event while there is nothing to render, but not
+    // once APP_CMD_DESTROY arrived: no further event would wake it up.
+    while ((ident = ALooper_pollAll(
+                engine.canRender || state->destroyRequested ? 0 : -1, nullptr,
+                &events, (void **)&source)) >= 0) {
       if (source != nullptr) {
         source->process(state, source);
       }
+      if (state->destroyRequested) {
+        break;
+      }
+    }
+    // cleanup() has run, nothing may touch the device anymore.
+    if (state->destroyRequested) {
+      return;
     }
 
     HandleInputEvents(state);
 
-    engine.app_backend->render();
+    if (engine.canRender && soakCycles > 0) {
+      RunSoak(&engine, soakCycles);
+      soakCycles = 0;
+    }
+    if (engine.canRender) {
+      UpdateGovernor(&engine);
+      UpdatePowerProfile(&engine);
+      engine.threadPlacement->sampleCurrentThread();
+      engine.app_backend->render();
+      LogFrameCommands(&engine);
+    }
   }
 }
\ No newline at end of file
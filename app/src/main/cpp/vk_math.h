@@ -0,0 +1,514 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <array>
+
+#if !defined(VKT_MATH_SCALAR) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define VKT_MATH_NEON 1
+#include <arm_neon.h>
+#elif !defined(VKT_MATH_SCALAR) && (defined(__SSE__) || defined(_M_X64))
+#define VKT_MATH_SSE 1
+#include <xmmintrin.h>
+#endif
+
+/**
+ * Small vector math for transforms: vec3, vec4, quat and a column major mat4
+ * laid out exactly like a GLSL mat4 in a uniform block, so a mat4 can be
+ * memcpy'd into a uniform buffer.
+ *
+ * Single matrix operations and the batch routines at the bottom use NEON on
+ * ARM and SSE on x86 (every Android ABI has one or the other). Defining
+ * VKT_MATH_SCALAR forces the portable code, which is also always available in
+ * namespace vkt::scalar as the reference for math_bench.cpp.
+ *
+ * Projections follow Vulkan conventions: right handed view space looking down
+ * -Z, clip space Y pointing down and depth in [0, 1].
+ */
+
+namespace vkt {
+
+struct vec3 {
+  float x = 0.f;
+  float y = 0.f;
+  float z = 0.f;
+
+  vec3 operator+(const vec3 &o) const { return {x + o.x, y + o.y, z + o.z}; }
+  vec3 operator-(const vec3 &o) const { return {x - o.x, y - o.y, z - o.z}; }
+  vec3 operator*(float s) const { return {x * s, y * s, z * s}; }
+  vec3 operator-() const { return {-x, -y, -z}; }
+};
+
+inline float dot(const vec3 &a, const vec3 &b) {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline vec3 cross(const vec3 &a, const vec3 &b) {
+  return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z,
+          a.x * b.y - a.y * b.x};
+}
+
+inline float length(const vec3 &v) { return sqrtf(dot(v, v)); }
+
+inline vec3 normalize(const vec3 &v) { return v * (1.f / length(v)); }
+
+struct alignas(16) vec4 {
+  float x = 0.f;
+  float y = 0.f;
+  float z = 0.f;
+  float w = 0.f;
+
+  vec4 operator+(const vec4 &o) const {
+    return {x + o.x, y + o.y, z + o.z, w + o.w};
+  }
+  vec4 operator-(const vec4 &o) const {
+    return {x - o.x, y - o.y, z - o.z, w - o.w};
+  }
+  vec4 operator*(float s) const { return {x * s, y * s, z * s, w * s}; }
+  bool operator==(const vec4 &o) const {
+    return x == o.x && y == o.y && z == o.z && w == o.w;
+  }
+};
+
+inline float dot(const vec4 &a, const vec4 &b) {
+  return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+}
+
+// Unit quaternion rotation, (x, y, z) vector part and w scalar part.
+struct alignas(16) quat {
+  float x = 0.f;
+  float y = 0.f;
+  float z = 0.f;
+  float w = 1.f;
+
+  // angle in radians, axis must be normalised.
+  static quat fromAxisAngle(const vec3 &axis, float angle) {
+    float s = sinf(angle * 0.5f);
+    return {axis.x * s, axis.y * s, axis.z * s, cosf(angle * 0.5f)};
+  }
+
+  // Applies o first, then this.
+  quat operator*(const quat &o) const {
+    return {w * o.x + x * o.w + y * o.z - z * o.y,
+            w * o.y - x * o.z + y * o.w + z * o.x,
+            w * o.z + x * o.y - y * o.x + z * o.w,
+            w * o.w - x * o.x - y * o.y - z * o.z};
+  }
+
+  vec3 rotate(const vec3 &v) const {
+    vec3 u{x, y, z};
+    vec3 t = cross(u, v) * 2.f;
+    return v + t * w + cross(u, t);
+  }
+};
+
+inline quat normalize(const quat &q) {
+  float inv = 1.f / sqrtf(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+  return {q.x * inv, q.y * inv, q.z * inv, q.w * inv};
+}
+
+// Shortest path spherical interpolation, t in [0, 1].
+inline quat slerp(const quat &a, quat b, float t) {
+  float cosTheta = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+  if (cosTheta < 0.f) {
+    b = {-b.x, -b.y, -b.z, -b.w};
+    cosTheta = -cosTheta;
+  }
+  float wa = 1.f - t;
+  float wb = t;
+  // Nearly parallel: fall back to normalised lerp to avoid dividing by ~0.
+  if (cosTheta < 0.9995f) {
+    float theta = acosf(cosTheta);
+    float inv = 1.f / sinf(theta);
+    wa = sinf(wa * theta) * inv;
+    wb = sinf(wb * theta) * inv;
+  }
+  return normalize(quat{a.x * wa + b.x * wb, a.y * wa + b.y * wb,
+                        a.z * wa + b.z * wb, a.w * wa + b.w * wb});
+}
+
+struct alignas(16) mat4 {
+  vec4 col[4] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}};
+
+  static mat4 identity() { return {}; }
+
+  static mat4 fromArray(const std::array<float, 16> &values) {
+    mat4 m;
+    memcpy(&m.col[0].x, values.data(), sizeof(m.col));
+    return m;
+  }
+  std::array<float, 16> toArray() const {
+    std::array<float, 16> values;
+    memcpy(values.data(), &col[0].x, sizeof(col));
+    return values;
+  }
+
+  static mat4 translation(const vec3 &t) {
+    mat4 m;
+    m.col[3] = {t.x, t.y, t.z, 1.f};
+    return m;
+  }
+  static mat4 scale(const vec3 &s) {
+    mat4 m;
+    m.col[0].x = s.x;
+    m.col[1].y = s.y;
+    m.col[2].z = s.z;
+    return m;
+  }
+  // Counter clockwise rotation around +Z, angle in radians.
+  static mat4 rotationZ(float angle) {
+    float c = cosf(angle);
+    float s = sinf(angle);
+    mat4 m;
+    m.col[0] = {c, s, 0.f, 0.f};
+    m.col[1] = {-s, c, 0.f, 0.f};
+    return m;
+  }
+  static mat4 rotation(const quat &q) {
+    float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+    float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+    float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+    mat4 m;
+    m.col[0] = {1.f - 2.f * (yy + zz), 2.f * (xy + wz), 2.f * (xz - wy), 0.f};
+    m.col[1] = {2.f * (xy - wz), 1.f - 2.f * (xx + zz), 2.f * (yz + wx), 0.f};
+    m.col[2] = {2.f * (xz + wy), 2.f * (yz - wx), 1.f - 2.f * (xx + yy), 0.f};
+    return m;
+  }
+  // translation * rotation * scale, without the two matrix products.
+  static mat4 compose(const vec3 &t, const quat &r, const vec3 &s) {
+    mat4 m = rotation(r);
+    m.col[0] = m.col[0] * s.x;
+    m.col[1] = m.col[1] * s.y;
+    m.col[2] = m.col[2] * s.z;
+    m.col[3] = {t.x, t.y, t.z, 1.f};
+    return m;
+  }
+
+  // fovY in radians.
+  static mat4 perspective(float fovY, float aspect, float zNear, float zFar) {
+    float f = 1.f / tanf(fovY * 0.5f);
+    mat4 m;
+    m.col[0] = {f / aspect, 0.f, 0.f, 0.f};
+    m.col[1] = {0.f, -f, 0.f, 0.f};
+    m.col[2] = {0.f, 0.f, zFar / (zNear - zFar), -1.f};
+    m.col[3] = {0.f, 0.f, zNear * zFar / (zNear - zFar), 0.f};
+    return m;
+  }
+  static mat4 orthographic(float left, float right, float bottom, float top,
+                           float zNear, float zFar) {
+    mat4 m;
+    m.col[0] = {2.f / (right - left), 0.f, 0.f, 0.f};
+    m.col[1] = {0.f, -2.f / (top - bottom), 0.f, 0.f};
+    m.col[2] = {0.f, 0.f, 1.f / (zNear - zFar), 0.f};
+    m.col[3] = {-(right + left) / (right - left),
+                (top + bottom) / (top - bottom), zNear / (zNear - zFar), 1.f};
+    return m;
+  }
+  static mat4 lookAt(const vec3 &eye, const vec3 &center, const vec3 &up) {
+    vec3 f = normalize(center - eye);
+    vec3 s = normalize(cross(f, up));
+    vec3 u = cross(s, f);
+    mat4 m;
+    m.col[0] = {s.x, u.x, -f.x, 0.f};
+    m.col[1] = {s.y, u.y, -f.y, 0.f};
+    m.col[2] = {s.z, u.z, -f.z, 0.f};
+    m.col[3] = {-dot(s, eye), -dot(u, eye), dot(f, eye), 1.f};
+    return m;
+  }
+
+  mat4 transposed() const {
+    mat4 m;
+    const float *src = &col[0].x;
+    float *dst = &m.col[0].x;
+    for (int c = 0; c < 4; c++) {
+      for (int r = 0; r < 4; r++) {
+        dst[r * 4 + c] = src[c * 4 + r];
+      }
+    }
+    return m;
+  }
+
+  inline mat4 operator*(const mat4 &o) const;
+  inline vec4 operator*(const vec4 &v) const;
+  vec3 transformPoint(const vec3 &p) const {
+    vec4 r = *this * vec4{p.x, p.y, p.z, 1.f};
+    return {r.x, r.y, r.z};
+  }
+};
+
+static_assert(sizeof(mat4) == 64, "mat4 must match a GLSL mat4");
+
+/*
+ * Portable implementations. The SIMD paths must produce the same results up
+ * to float rounding; math_bench.cpp checks that.
+ */
+namespace scalar {
+
+inline vec4 multiply(const mat4 &m, const vec4 &v) {
+  return m.col[0] * v.x + m.col[1] * v.y + m.col[2] * v.z + m.col[3] * v.w;
+}
+
+inline void multiply(const mat4 &a, const mat4 &b, mat4 &out) {
+  mat4 result;
+  for (int i = 0; i < 4; i++) {
+    result.col[i] = multiply(a, b.col[i]);
+  }
+  out = result;
+}
+
+inline void transformVec4(const mat4 &m, const vec4 *in, vec4 *out,
+                          size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    out[i] = multiply(m, in[i]);
+  }
+}
+
+inline void transformPoints(const mat4 &m, const vec3 *in, vec3 *out,
+                            size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    vec4 r = multiply(m, vec4{in[i].x, in[i].y, in[i].z, 1.f});
+    out[i] = {r.x, r.y, r.z};
+  }
+}
+
+inline void multiplyMat4(const mat4 &parent, const mat4 *in, mat4 *out,
+                         size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    multiply(parent, in[i], out[i]);
+  }
+}
+
+inline void composeTransforms(const vec3 *translations, const quat *rotations,
+                              const vec3 *scales, mat4 *out, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    out[i] = mat4::compose(translations[i], rotations[i], scales[i]);
+  }
+}
+
+}  // namespace scalar
+
+#if defined(VKT_MATH_NEON) || defined(VKT_MATH_SSE)
+namespace simd {
+
+#if defined(VKT_MATH_NEON)
+using f4 = float32x4_t;
+inline f4 load(const float *p) { return vld1q_f32(p); }
+inline void store(float *p, f4 v) { vst1q_f32(p, v); }
+inline f4 splat(float s) { return vdupq_n_f32(s); }
+inline f4 set(float a, float b, float c, float d) {
+  float values[4] = {a, b, c, d};
+  return vld1q_f32(values);
+}
+template <int N>
+inline f4 lane(f4 v) {
+  return vdupq_n_f32(vgetq_lane_f32(v, N));
+}
+inline f4 add(f4 a, f4 b) { return vaddq_f32(a, b); }
+inline f4 sub(f4 a, f4 b) { return vsubq_f32(a, b); }
+inline f4 mul(f4 a, f4 b) { return vmulq_f32(a, b); }
+inline f4 madd(f4 a, f4 b, f4 c) { return vmlaq_f32(c, a, b); }
+inline void transpose(f4 &a, f4 &b, f4 &c, f4 &d) {
+  float32x4x2_t ab = vtrnq_f32(a, b);
+  float32x4x2_t cd = vtrnq_f32(c, d);
+  a = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+  b = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+  c = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+  d = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+}
+#else
+using f4 = __m128;
+inline f4 load(const float *p) { return _mm_loadu_ps(p); }
+inline void store(float *p, f4 v) { _mm_storeu_ps(p, v); }
+inline f4 splat(float s) { return _mm_set1_ps(s); }
+inline f4 set(float a, float b, float c, float d) {
+  return _mm_setr_ps(a, b, c, d);
+}
+template <int N>
+inline f4 lane(f4 v) {
+  return _mm_shuffle_ps(v, v, _MM_SHUFFLE(N, N, N, N));
+}
+inline f4 add(f4 a, f4 b) { return _mm_add_ps(a, b); }
+inline f4 sub(f4 a, f4 b) { return _mm_sub_ps(a, b); }
+inline f4 mul(f4 a, f4 b) { return _mm_mul_ps(a, b); }
+inline f4 madd(f4 a, f4 b, f4 c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+inline void transpose(f4 &a, f4 &b, f4 &c, f4 &d) {
+  _MM_TRANSPOSE4_PS(a, b, c, d);
+}
+#endif
+
+// A matrix held in four registers, loaded once per batch.
+struct Columns {
+  explicit Columns(const mat4 &m)
+      : c0(load(&m.col[0].x)),
+        c1(load(&m.col[1].x)),
+        c2(load(&m.col[2].x)),
+        c3(load(&m.col[3].x)) {}
+
+  f4 apply(f4 v) const {
+    f4 r = mul(c0, lane<0>(v));
+    r = madd(c1, lane<1>(v), r);
+    r = madd(c2, lane<2>(v), r);
+    return madd(c3, lane<3>(v), r);
+  }
+  f4 applyPoint(float x, float y, float z) const {
+    return madd(c2, splat(z), madd(c1, splat(y), madd(c0, splat(x), c3)));
+  }
+
+  f4 c0, c1, c2, c3;
+};
+
+inline void multiply(const Columns &a, const mat4 &b, mat4 &out) {
+  f4 r0 = a.apply(load(&b.col[0].x));
+  f4 r1 = a.apply(load(&b.col[1].x));
+  f4 r2 = a.apply(load(&b.col[2].x));
+  f4 r3 = a.apply(load(&b.col[3].x));
+  store(&out.col[0].x, r0);
+  store(&out.col[1].x, r1);
+  store(&out.col[2].x, r2);
+  store(&out.col[3].x, r3);
+}
+
+/*
+ * mat4::compose() for four transforms at once: the quaternions are transposed
+ * so each register holds one component of all four, the rotation terms are
+ * computed lane-wise and the resulting columns transposed back.
+ */
+inline void compose4(const vec3 *t, const quat *r, const vec3 *s, mat4 *out) {
+  f4 x = load(&r[0].x), y = load(&r[1].x), z = load(&r[2].x),
+     w = load(&r[3].x);
+  transpose(x, y, z, w);
+  f4 sx = set(s[0].x, s[1].x, s[2].x, s[3].x);
+  f4 sy = set(s[0].y, s[1].y, s[2].y, s[3].y);
+  f4 sz = set(s[0].z, s[1].z, s[2].z, s[3].z);
+
+  f4 one = splat(1.f);
+  f4 two = splat(2.f);
+  f4 xx = mul(x, x), yy = mul(y, y), zz = mul(z, z);
+  f4 xy = mul(x, y), xz = mul(x, z), yz = mul(y, z);
+  f4 wx = mul(w, x), wy = mul(w, y), wz = mul(w, z);
+
+  f4 zero = splat(0.f);
+  f4 c0x = mul(sub(one, mul(two, add(yy, zz))), sx);
+  f4 c0y = mul(mul(two, add(xy, wz)), sx);
+  f4 c0z = mul(mul(two, sub(xz, wy)), sx);
+  f4 c0w = zero;
+  f4 c1x = mul(mul(two, sub(xy, wz)), sy);
+  f4 c1y = mul(sub(one, mul(two, add(xx, zz))), sy);
+  f4 c1z = mul(mul(two, add(yz, wx)), sy);
+  f4 c1w = zero;
+  f4 c2x = mul(mul(two, add(xz, wy)), sz);
+  f4 c2y = mul(mul(two, sub(yz, wx)), sz);
+  f4 c2z = mul(sub(one, mul(two, add(xx, yy))), sz);
+  f4 c2w = zero;
+  transpose(c0x, c0y, c0z, c0w);
+  transpose(c1x, c1y, c1z, c1w);
+  transpose(c2x, c2y, c2z, c2w);
+
+  f4 col0[4] = {c0x, c0y, c0z, c0w};
+  f4 col1[4] = {c1x, c1y, c1z, c1w};
+  f4 col2[4] = {c2x, c2y, c2z, c2w};
+  for (int i = 0; i < 4; i++) {
+    store(&out[i].col[0].x, col0[i]);
+    store(&out[i].col[1].x, col1[i]);
+    store(&out[i].col[2].x, col2[i]);
+    store(&out[i].col[3].x, set(t[i].x, t[i].y, t[i].z, 1.f));
+  }
+}
+
+}  // namespace simd
+
+inline mat4 mat4::operator*(const mat4 &o) const {
+  mat4 result;
+  simd::multiply(simd::Columns(*this), o, result);
+  return result;
+}
+
+inline vec4 mat4::operator*(const vec4 &v) const {
+  vec4 result;
+  simd::store(&result.x, simd::Columns(*this).apply(simd::load(&v.x)));
+  return result;
+}
+
+inline void transformVec4(const mat4 &m, const vec4 *in, vec4 *out,
+                          size_t count) {
+  simd::Columns columns(m);
+  for (size_t i = 0; i < count; i++) {
+    simd::store(&out[i].x, columns.apply(simd::load(&in[i].x)));
+  }
+}
+
+inline void transformPoints(const mat4 &m, const vec3 *in, vec3 *out,
+                            size_t count) {
+  simd::Columns columns(m);
+  alignas(16) float result[4];
+  for (size_t i = 0; i < count; i++) {
+    simd::store(result, columns.applyPoint(in[i].x, in[i].y, in[i].z));
+    out[i] = {result[0], result[1], result[2]};
+  }
+}
+
+inline void multiplyMat4(const mat4 &parent, const mat4 *in, mat4 *out,
+                         size_t count) {
+  simd::Columns columns(parent);
+  for (size_t i = 0; i < count; i++) {
+    simd::multiply(columns, in[i], out[i]);
+  }
+}
+
+inline void composeTransforms(const vec3 *translations, const quat *rotations,
+                              const vec3 *scales, mat4 *out, size_t count) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    simd::compose4(translations + i, rotations + i, scales + i, out + i);
+  }
+  for (; i < count; i++) {
+    out[i] = mat4::compose(translations[i], rotations[i], scales[i]);
+  }
+}
+#else
+inline mat4 mat4::operator*(const mat4 &o) const {
+  mat4 result;
+  scalar::multiply(*this, o, result);
+  return result;
+}
+
+inline vec4 mat4::operator*(const vec4 &v) const {
+  return scalar::multiply(*this, v);
+}
+
+using scalar::composeTransforms;
+using scalar::multiplyMat4;
+using scalar::transformPoints;
+using scalar::transformVec4;
+#endif
+
+// Name of the code path in use, for logs and benchmarks.
+inline const char *mathBackendName() {
+#if defined(VKT_MATH_NEON)
+  return "neon";
+#elif defined(VKT_MATH_SSE)
+  return "sse";
+#else
+  return "scalar";
+#endif
+}
+
+}  // namespace vkt
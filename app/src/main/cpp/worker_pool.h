@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vkt {
+
+/**
+ * Persistent worker threads for data parallel loops on the render thread's
+ * critical path, where spawning threads per frame would cost more than the
+ * work. parallelFor() hands out fixed size chunks through an atomic counter,
+ * runs chunks on the calling thread too and returns when all are done.
+ */
+class WorkerPool {
+ public:
+  /*
+   * threadInit runs on every worker before anything else, for example to
+   * apply a ThreadPlacement. workers == 0 runs everything on the caller.
+   */
+  explicit WorkerPool(unsigned workers, std::function<void()> threadInit = {}) {
+    for (unsigned i = 0; i < workers; i++) {
+      threads.emplace_back([this, threadInit] {
+        if (threadInit) {
+          threadInit();
+        }
+        run();
+      });
+    }
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+  }
+
+  // Threads taking part in parallelFor(), including the caller.
+  unsigned concurrency() const { return threads.size() + 1; }
+
+  /*
+   * Calls body(begin, end) for consecutive ranges of at most grain items
+   * covering [0, count). Ranges may run concurrently in any order. Not
+   * reentrant: body must not call parallelFor() on the same pool.
+   */
+  void parallelFor(size_t count, size_t grain,
+                   const std::function<void(size_t, size_t)> &body) {
+    grain = std::max<size_t>(grain, 1);
+    if (threads.empty() || count <= grain) {
+      if (count > 0) {
+        body(0, count);
+      }
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      job = &body;
+      jobCount = count;
+      jobGrain = grain;
+      next = 0;
+      active = threads.size();
+      generation++;
+    }
+    wake.notify_all();
+    runChunks(body, count, grain);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return active == 0; });
+    job = nullptr;
+  }
+
+ private:
+  void run() {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      wake.wait(lock, [&] { return stopping || generation != seen; });
+      if (stopping) {
+        return;
+      }
+      seen = generation;
+      const std::function<void(size_t, size_t)> &body = *job;
+      size_t count = jobCount;
+      size_t grain = jobGrain;
+      lock.unlock();
+
+      runChunks(body, count, grain);
+
+      lock.lock();
+      if (--active == 0) {
+        done.notify_one();
+      }
+    }
+  }
+
+  void runChunks(const std::function<void(size_t, size_t)> &body, size_t count,
+                 size_t grain) {
+    size_t begin;
+    while ((begin = next.fetch_add(grain)) < count) {
+      body(begin, std::min(begin + grain, count));
+    }
+  }
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  const std::function<void(size_t, size_t)> *job = nullptr;
+  size_t jobCount = 0;
+  size_t jobGrain = 1;
+  std::atomic<size_t> next{0};
+  size_t active = 0;
+  uint64_t generation = 0;
+  bool stopping = false;
+  std::vector<std::thread> threads;
+};
+
+}  // namespace vkt
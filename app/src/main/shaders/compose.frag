@@ -0,0 +1,14 @@
+#version 450
+
+layout(location = 0) in vec2 uv;
+
+layout(location = 0) out vec4 outColor;
+
+// Layer 0 is the left eye, layer 1 the right eye.
+layout(binding = 0) uniform sampler2DArray eyes;
+
+// Left eye on the left half of the screen, right eye on the right half.
+void main() {
+    float eye = uv.x < 0.5 ? 0.0 : 1.0;
+    outColor = texture(eyes, vec3(uv.x * 2.0 - eye, uv.y, eye));
+}
@@ -0,0 +1,14 @@
+#version 450
+
+// Full screen triangle for composing the eye layers into the swapchain.
+layout(location = 0) out vec2 uv;
+
+// Pre-rotation of the swapchain, the eye images are rendered upright.
+layout(push_constant) uniform Compose {
+    mat4 prerotation;
+} compose;
+
+void main() {
+    uv = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+    gl_Position = compose.prerotation * vec4(uv * 2.0 - 1.0, 0.0, 1.0);
+}
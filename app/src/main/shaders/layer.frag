@@ -0,0 +1,12 @@
+#version 450
+
+layout(location = 0) in vec2 uv;
+
+layout(location = 0) out vec4 outColor;
+
+// Premultiplied alpha: transparent wherever the layer has nothing drawn.
+layout(binding = 0) uniform sampler2D layer;
+
+void main() {
+    outColor = texture(layer, uv);
+}
@@ -0,0 +1,10 @@
+#version 450
+
+// Full screen triangle for compositing a cached static layer. The layer was
+// rendered pre-rotated at the swapchain size, so it maps 1:1.
+layout(location = 0) out vec2 uv;
+
+void main() {
+    uv = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+    gl_Position = vec4(uv * 2.0 - 1.0, 0.0, 1.0);
+}
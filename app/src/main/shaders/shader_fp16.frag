@@ -0,0 +1,11 @@
+#version 450
+#extension GL_EXT_shader_explicit_arithmetic_types_float16 : require
+
+// Half precision variant of shader.frag.
+layout(location = 0) in mediump vec3 fragColor;
+
+layout(location = 0) out mediump vec4 outColor;
+
+void main() {
+    outColor = f16vec4(f16vec3(fragColor), 1.0hf);
+}
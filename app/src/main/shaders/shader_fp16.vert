@@ -0,0 +1,28 @@
+#version 450
+#extension GL_EXT_shader_explicit_arithmetic_types_float16 : require
+
+// Half precision variant of shader.vert, used when the device supports
+// shaderFloat16. Positions stay full precision; colours are float16 and
+// interpolated at mediump, which needs no 16-bit input/output storage.
+layout(location = 0) out mediump vec3 fragColor;
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 MVP;
+} ubo;
+
+vec2 positions[3] = vec2[](
+    vec2(0.0, -0.5),
+    vec2(0.5, 0.5),
+    vec2(-0.5, 0.5)
+);
+
+f16vec3 colors[3] = f16vec3[](
+    f16vec3(0.67hf, 0.1hf, 0.2hf),
+    f16vec3(0.67hf, 0.1hf, 0.2hf),
+    f16vec3(0.67hf, 0.1hf, 0.2hf)
+);
+
+void main() {
+    gl_Position = ubo.MVP * vec4(positions[gl_VertexIndex], 0.0, 1.0);
+    fragColor = colors[gl_VertexIndex];
+}
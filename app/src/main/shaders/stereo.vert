@@ -0,0 +1,29 @@
+#version 450
+#extension GL_EXT_multiview : require
+
+// Multiview variant of shader.vert. One draw renders both eyes, each into its
+// own layer of the eye target.
+layout(location = 0) out vec3 fragColor;
+
+// One MVP per eye, indexed by the view being rendered.
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 MVP[2];
+} ubo;
+
+vec2 positions[3] = vec2[](
+    vec2(0.0, -0.5),
+    vec2(0.5, 0.5),
+    vec2(-0.5, 0.5)
+);
+
+vec3 colors[3] = vec3[](
+    vec3(0.67, 0.1, 0.2),
+    vec3(0.67, 0.1, 0.2),
+    vec3(0.67, 0.1, 0.2)
+);
+
+void main() {
+    gl_Position = ubo.MVP[gl_ViewIndex] *
+                  vec4(positions[gl_VertexIndex], 0.0, 1.0);
+    fragColor = colors[gl_VertexIndex];
+}